@@ -0,0 +1,72 @@
+/*
+    Bit-bang throughput benchmark.  Clocks a buffer out over BitBangSPI, write
+    only and (if a MISO line is given) full duplex, and reports the bit rate
+    achieved along with the cost per clock edge.
+
+    Usage: bitbang_bench <chip> <sck> <mosi> [miso] [bytes] [passes]
+*/
+
+#include <iostream>
+using std::cout;
+using std::endl;
+
+#include <vector>
+using std::vector;
+
+#include <stdlib.h>
+
+#include "BitBang.hpp"
+
+static void report(const char *what, BitBangSPI &spi, vector<uint8_t> &tx, uint8_t *rx, int passes)
+{
+    double total = 0.0;
+
+    for (int i = 0; i < passes; i++)
+    {
+        spi.transfer(tx.data(), rx, tx.size());
+        total += spi.get_bit_rate();
+    }
+
+    double rate = total / passes;
+    cout << what << " : " << (rate / 1000.0) << " kbit/s, "
+         << ((rate > 0.0) ? (1000000000.0 / (rate * 2.0)) : 0.0) << " ns/edge" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 4)
+    {
+        cout << "Usage: " << argv[0] << " <chip> <sck> <mosi> [miso] [bytes] [passes]" << endl;
+        return 1;
+    }
+
+    unsigned int miso = (argc > 4) ? atoi(argv[4]) : BitBang::NO_LINE;
+    int bytes = (argc > 5) ? atoi(argv[5]) : 1024;
+    int passes = (argc > 6) ? atoi(argv[6]) : 10;
+    if ((bytes <= 0) || (passes <= 0))
+    {
+        cout << "Bytes and passes must be positive numbers" << endl;
+        return 1;
+    }
+
+    BitBangSPI spi(argv[1], atoi(argv[2]), atoi(argv[3]), miso);
+    if (!spi.is_open())
+    {
+        cout << "Unable to open SPI lines" << endl;
+        return 1;
+    }
+
+    vector<uint8_t> tx(bytes), rx(bytes);
+    for (int i = 0; i < bytes; i++)
+    {
+        tx[i] = i & 0xFF;
+    }
+
+    report("SPI write only ", spi, tx, nullptr, passes);
+    if (miso != BitBang::NO_LINE)
+    {
+        report("SPI full duplex", spi, tx, rx.data(), passes);
+    }
+
+    return 0;
+}
@@ -0,0 +1,185 @@
+/*
+    GPIO engine benchmark.  Runs against a SimGPIOChip so the numbers are the
+    library's own overhead, with no kernel or hardware in them:
+
+        - set/get cost on an output line
+        - edge to callback latency on an input line (p50/p99/max)
+        - how many edge events per second KernelGPIO's event loop can take
+          before the event buffer starts dropping them
+
+    Given a real chip and line, the set/get pass is run against that as well.
+
+    Usage: gpio_bench [iterations] [chip line]
+*/
+
+#include <iostream>
+using std::cout;
+using std::endl;
+
+#include <atomic>
+using std::atomic;
+
+#include <stdlib.h>
+#include <sched.h>
+
+#include "GPIOMetrics.hpp"
+#include "KernelGPIO.hpp"
+#include "SimGPIOChip.hpp"
+
+static const char *SIM_CHIP = "sim:gpio_bench";
+static const unsigned int SIM_OUTPUT = 0;
+static const unsigned int SIM_INPUT = 1;
+
+// How long to wait on the event thread before giving up on it.
+static const uint64_t TIMEOUT_NS = 1000000000ULL;
+
+// The callback only gets the value, so what it measures against is out here.
+static atomic<uint64_t> g_injected_ns(0);
+static atomic<uint64_t> g_callbacks(0);
+static GPIOHistogram g_latency;
+
+static void latency_callback(bool)
+{
+    g_latency.record(GPIOMetrics::now_ns() - g_injected_ns.load());
+    g_callbacks++;
+}
+
+static void count_callback(bool)
+{
+    g_callbacks++;
+}
+
+static bool wait_for_callbacks(uint64_t count)
+{
+    uint64_t start = GPIOMetrics::now_ns();
+
+    while ((g_callbacks.load() < count) && ((GPIOMetrics::now_ns() - start) < TIMEOUT_NS))
+    {
+        sched_yield();
+    }
+
+    return g_callbacks.load() >= count;
+}
+
+static void report(const char *what, const gpio_histogram_t &histogram)
+{
+    cout << what << " : mean " << gpio_histogram_mean(histogram) << " ns, p50 "
+         << gpio_histogram_percentile(histogram, 0.50) << " ns, p99 "
+         << gpio_histogram_percentile(histogram, 0.99) << " ns, max " << histogram.max << " ns" << endl;
+}
+
+static void bench_set_get(const char *what, KernelGPIO &gpio, int iterations)
+{
+    gpio.reset_metrics();
+    for (int i = 0; i < iterations; i++)
+    {
+        gpio.set_value(i & 1);
+        gpio.get_value();
+    }
+
+    gpio_line_metrics_t metrics = gpio.get_metrics();
+    cout << what << " (" << metrics.name << ")" << endl;
+    report("    set", metrics.set_ns);
+    report("    get", metrics.get_ns);
+    if ((metrics.set_errors > 0) || (metrics.get_errors > 0))
+    {
+        cout << "    errors: " << metrics.set_errors << " set, " << metrics.get_errors << " get" << endl;
+    }
+}
+
+static void bench_latency(SimGPIOChip &sim, KernelGPIO &input, int iterations)
+{
+    input.set_callback(latency_callback);
+    g_callbacks = 0;
+    g_latency.reset();
+
+    bool level = false;
+    for (int i = 0; i < iterations; i++)
+    {
+        level = !level;
+        g_injected_ns = GPIOMetrics::now_ns();
+        sim.set_input(SIM_INPUT, level);
+        if (!wait_for_callbacks(i + 1))
+        {
+            cout << "Timed out waiting for edge " << i << endl;
+            break;
+        }
+    }
+
+    gpio_histogram_t histogram;
+    g_latency.snapshot(histogram);
+    report("Edge to callback", histogram);
+}
+
+static void bench_saturation(SimGPIOChip &sim, KernelGPIO &input, int iterations)
+{
+    // Bursts the size of the default event buffer, back to back.
+    const size_t burst = 16;
+    uint64_t injected = 0;
+
+    input.set_callback(count_callback);
+    input.reset_metrics();
+    g_callbacks = 0;
+
+    uint64_t start = GPIOMetrics::now_ns();
+    for (int i = 0; i < iterations; i++)
+    {
+        injected += sim.inject_burst(SIM_INPUT, burst, 1000);
+    }
+
+    // Let the event thread drain whatever's left.  Dropped events never
+    // show up, so stop once callbacks plus losses account for everything.
+    while ((GPIOMetrics::now_ns() - start) < (10 * TIMEOUT_NS))
+    {
+        gpio_line_metrics_t metrics = input.get_metrics();
+        if ((metrics.events + metrics.lost) >= injected)
+        {
+            break;
+        }
+        sched_yield();
+    }
+    double seconds = (GPIOMetrics::now_ns() - start) / 1e9;
+
+    gpio_line_metrics_t metrics = input.get_metrics();
+    cout << "Saturation : " << injected << " injected, " << metrics.events << " delivered, "
+         << metrics.lost << " lost, " << (metrics.events / seconds) << " events/s, "
+         << gpio_histogram_mean(metrics.events_per_wakeup) << " events/wakeup" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = (argc > 1) ? atoi(argv[1]) : 10000;
+    if (iterations <= 0)
+    {
+        cout << "Iterations must be a positive number" << endl;
+        return 1;
+    }
+
+    GPIOMetrics::set_timing(true);
+
+    shared_ptr<SimGPIOChip> sim = SimGPIOChip::create(SIM_CHIP, 2);
+    KernelGPIO output(SIM_CHIP, SIM_OUTPUT);
+    KernelGPIO input(SIM_CHIP, SIM_INPUT);
+    if ((sim == nullptr) || !output.configure(KernelGPIO::OUTPUT) || !input.configure(KernelGPIO::INPUT, false, KernelGPIO::BOTH))
+    {
+        cout << "Unable to set up the simulated chip" << endl;
+        return 1;
+    }
+
+    bench_set_get("Simulated set/get", output, iterations);
+    bench_latency(*sim, input, iterations);
+    bench_saturation(*sim, input, iterations);
+
+    if (argc > 3)
+    {
+        KernelGPIO real(argv[2], atoi(argv[3]));
+        if (!real.configure(KernelGPIO::OUTPUT))
+        {
+            cout << "Unable to open " << argv[2] << " line " << argv[3] << endl;
+            return 1;
+        }
+        bench_set_get("Real set/get", real, iterations);
+    }
+
+    return 0;
+}
@@ -0,0 +1,106 @@
+/*
+    SysFS GPIO get/set benchmark.  Toggles and reads a sysfs GPIO the way
+    SysFSGPIO used to (a stream opened on the value file per call) and the way
+    it does now (one value fd, opened at export, and a pread()/pwrite() per
+    call), and reports the cost per call of each.
+
+    The GPIO is exported as an output for the run, so pick one that's safe to
+    wiggle.
+
+    Usage: sysfs_bench <gpio> [iterations]
+*/
+
+#include <iostream>
+using std::cout;
+using std::endl;
+
+#include <fstream>
+
+#include <string>
+using std::string;
+using std::to_string;
+
+#include <stdexcept>
+
+#include <stdlib.h>
+
+#include "GPIOMetrics.hpp"
+#include "SysFSGPIO.hpp"
+
+// The old way- everything per call.
+static void legacy_set(const string &path, bool value)
+{
+    std::ofstream sysfs_value(path, std::ofstream::app);
+    sysfs_value << (value ? "1" : "0");
+    sysfs_value.close();
+}
+
+static char legacy_get(const string &path)
+{
+    std::ifstream sysfs_value(path);
+    return sysfs_value.get();
+}
+
+static void report(const char *what, uint64_t elapsed_ns, int iterations)
+{
+    cout << what << " : " << (elapsed_ns / iterations) << " ns/call" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        cout << "Usage: " << argv[0] << " <gpio> [iterations]" << endl;
+        return 1;
+    }
+
+    uint16_t id = atoi(argv[1]);
+    int iterations = (argc > 2) ? atoi(argv[2]) : 10000;
+    if (iterations <= 0)
+    {
+        cout << "Iterations must be a positive number" << endl;
+        return 1;
+    }
+    const string path = "/sys/class/gpio/gpio" + to_string(id) + "/value";
+
+    try
+    {
+        SysFSGPIO gpio(id, Direction::OUT);
+        uint64_t start;
+
+        start = GPIOMetrics::now_ns();
+        for (int i = 0; i < iterations; i++)
+        {
+            legacy_set(path, i & 0x01);
+        }
+        report("set, stream per call ", GPIOMetrics::now_ns() - start, iterations);
+
+        start = GPIOMetrics::now_ns();
+        for (int i = 0; i < iterations; i++)
+        {
+            gpio.setValue((i & 0x01) ? Value::HIGH : Value::LOW);
+        }
+        report("set, persistent fd   ", GPIOMetrics::now_ns() - start, iterations);
+
+        start = GPIOMetrics::now_ns();
+        for (int i = 0; i < iterations; i++)
+        {
+            legacy_get(path);
+        }
+        report("get, stream per call ", GPIOMetrics::now_ns() - start, iterations);
+
+        start = GPIOMetrics::now_ns();
+        for (int i = 0; i < iterations; i++)
+        {
+            gpio.getValue();
+        }
+        report("get, persistent fd   ", GPIOMetrics::now_ns() - start, iterations);
+    }
+    catch (std::exception &e)
+    {
+        cout << "Unable to run against GPIO " << id << ": " << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <memory>
+using std::unique_ptr;
+
+#include <stdint.h>
+
+#include "GPIOLineRequest.hpp"
+
+/*
+    Bit-banged serial transports for peripherals that ended up on pins with no
+    hardware controller behind them.  Each transport holds all of its lines in
+    one multi-line request and drives them with bulk writes- the clock and data
+    lines change together in a single ioctl per clock edge, out of bit patterns
+    precomputed at construction.  There's no per-bit checking or logging on
+    the way to the kernel, so you get about as many edges a second as the
+    kernel will give you.
+
+    By default everything runs as fast as the lines go.  set_half_period_ns()
+    slows the clock down to a (busy-waited, absolute deadline) target rate for
+    parts that can't keep up.
+*/
+class BitBang
+{
+    public:
+        // Use for optional lines (MISO, CS, ...) you don't have wired.
+        static const unsigned int NO_LINE = ~0U;
+
+        virtual ~BitBang() {}
+
+        BitBang(const BitBang &) = delete;
+        BitBang &operator=(const BitBang &) = delete;
+
+        bool is_open() { return (m_request != nullptr) && m_request->is_requested(); }
+
+        // Minimum time between clock edges.  0 is as fast as possible.
+        void set_half_period_ns(uint64_t half_period_ns) { m_half_period_ns = half_period_ns; }
+
+        // Achieved bit rate (bits/sec) of the last transfer.
+        double get_bit_rate();
+
+    protected:
+        BitBang(const string &chipname, const vector<unsigned int> &offsets, const string &consumer);
+
+        unique_ptr<GPIOLineRequest>     m_request;
+        uint64_t                        m_half_period_ns;
+        uint64_t                        m_deadline_ns;
+        uint64_t                        m_last_bits;
+        uint64_t                        m_last_ns;
+        uint64_t                        m_start_ns;
+
+        // Timing helpers...
+        static void spin_until(uint64_t deadline_ns);
+        void begin_transfer();
+        void end_transfer(uint64_t bits);
+
+        // Drive the lines in mask to values, after waiting out the half period.
+        bool drive(uint64_t mask, uint64_t values)
+        {
+            if (m_half_period_ns > 0)
+            {
+                m_deadline_ns += m_half_period_ns;
+                spin_until(m_deadline_ns);
+            }
+            return m_request->set_values(mask, values);
+        }
+};
+
+/*
+    SPI master, modes 0-3, MSB first.  MISO and CS are optional.  CS is driven
+    active low.  Write-only transfers cost two ioctls per bit- full duplex adds
+    one more per bit to sample MISO.
+*/
+class BitBangSPI : public BitBang
+{
+    public:
+        BitBangSPI(const string &chipname, unsigned int sck, unsigned int mosi,
+                   unsigned int miso = NO_LINE, unsigned int cs = NO_LINE, int mode = 0);
+
+        // Clock len bytes out of tx (zeros if nullptr) and, if rx isn't
+        // nullptr and we have a MISO line, into rx.
+        bool transfer(const uint8_t *tx, uint8_t *rx, size_t len);
+
+    private:
+        unsigned int        m_miso;
+        uint64_t            m_sck_mask;
+        uint64_t            m_mosi_mask;
+        uint64_t            m_cs_mask;
+        uint64_t            m_bus_mask;
+        bool                m_cpol;
+        bool                m_cpha;
+
+        // Two frames (SCK+MOSI values) per bit, 16 per byte, for every byte.
+        vector<uint64_t>    m_frames;
+};
+
+/*
+    I2C master.  Both lines are requested open-drain, so a logical 1 releases
+    the line to the pull-up.  Clock stretching support costs an extra read per
+    bit, so it's off unless you ask for it.
+*/
+class BitBangI2C : public BitBang
+{
+    public:
+        BitBangI2C(const string &chipname, unsigned int scl, unsigned int sda);
+
+        void set_clock_stretching(bool enable) { m_stretch = enable; }
+
+        // Each returns false if the target didn't ACK something it should have.
+        bool write(uint8_t address, const uint8_t *data, size_t len, bool send_stop = true);
+        bool read(uint8_t address, uint8_t *data, size_t len);
+        bool write_read(uint8_t address, const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len);
+
+    private:
+        unsigned int        m_scl;
+        unsigned int        m_sda;
+        uint64_t            m_scl_mask;
+        uint64_t            m_sda_mask;
+        uint64_t            m_bus_mask;
+        bool                m_stretch;
+        bool                m_active;           // Between a start and a stop?
+
+        // Two frames (SCL low, SCL high with SDA set) per bit, 16 per byte.
+        vector<uint64_t>    m_frames;
+
+        void start_condition();
+        void stop_condition();
+        bool clock_high(uint64_t sda);
+        bool write_byte(uint8_t byte);
+        uint8_t read_byte(bool ack);
+};
+
+/*
+    1-Wire master on one open-drain line.  1-Wire's timing is set by the slot
+    lengths, not by us, so this is all absolute deadline busy waits- the bit
+    rate's around 15kbit/s no matter how fast the lines are.
+*/
+class BitBangOneWire : public BitBang
+{
+    public:
+        BitBangOneWire(const string &chipname, unsigned int line);
+
+        // Reset pulse.  Returns true if something answered with a presence pulse.
+        bool reset();
+
+        void write_byte(uint8_t byte);
+        uint8_t read_byte();
+        void write(const uint8_t *data, size_t len);
+        void read(uint8_t *data, size_t len);
+
+        // Dallas/Maxim CRC-8 for checking ROM codes and scratchpads.
+        static uint8_t crc8(const uint8_t *data, size_t len);
+
+    private:
+        unsigned int        m_line;
+        uint64_t            m_mask;
+
+        void write_bit(bool bit);
+        bool read_bit();
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <memory>
+using std::unique_ptr;
+
+#include <atomic>
+using std::atomic;
+
+#include <stdint.h>
+
+#include "GPIOLineRequest.hpp"
+#include "LoopThread.hpp"
+
+// What's at the front of a capture file.  Everything after it is records of
+// one byte (line index << 1 | rising) followed by a varint (7 bits a byte,
+// low bits first, high bit set on all but the last) of the ns since the
+// previous record- or since start_ns for the first one.
+typedef struct capture_header_t
+{
+    char            magic[8];           // "PHACAP1"
+    uint32_t        version;
+    uint32_t        num_lines;
+    uint64_t        start_ns;           // CLOCK_MONOTONIC time the capture began
+    uint64_t        initial_levels;     // Bitmask by index
+    uint64_t        data_bytes;         // Size of the records that follow
+    uint64_t        events;
+    uint64_t        lost;               // Events the kernel dropped on us
+    char            chip[64];
+    uint32_t        offsets[64];
+    char            names[64][32];
+} capture_header_t;
+
+/*
+    Logic analyzer style capture.  Every edge on a set of lines goes into a
+    compact, delta encoded log that's written straight into an mmap'd,
+    preallocated file- two or three bytes an edge for typical signals.  Events
+    are drained from the kernel in batches and encoded in place, so nothing is
+    allocated per event, and the file's only grown (by doubling) when it fills.
+
+    convert_to_vcd() turns a capture into a VCD you can look at in GTKWave or
+    similar.
+*/
+class EdgeCapture : public LoopThread
+{
+    public:
+        // max_bytes caps the file size.  0 lets it grow as long as you capture.
+        EdgeCapture(const string &chipname, const vector<unsigned int> &offsets,
+                    const string &path, uint64_t max_bytes = 0);
+        ~EdgeCapture();
+
+        EdgeCapture(const EdgeCapture &) = delete;
+        EdgeCapture &operator=(const EdgeCapture &) = delete;
+
+        bool is_open() { return m_data != nullptr; }
+
+        // Stop capturing and close the file out.  Called for you on destruction.
+        bool finish();
+
+        // Progress...
+        uint64_t get_events() { return m_events; }
+        uint64_t get_lost() { return m_lost; }
+        uint64_t get_bytes() { return m_used; }
+        bool is_full() { return m_full; }
+
+        // Turn a capture file into a VCD.
+        static bool convert_to_vcd(const string &capture_path, const string &vcd_path);
+
+    protected:
+        void run();
+
+    private:
+        unique_ptr<GPIOLineRequest>     m_request;
+        string                          m_path;
+        int                             m_fd;
+        uint8_t                         *m_data;            // mmap'd file, header first
+        uint64_t                        m_capacity;
+        uint64_t                        m_max_bytes;
+        atomic<uint64_t>                m_used;             // Record bytes used
+        atomic<uint64_t>                m_events;
+        atomic<uint64_t>                m_lost;
+        atomic<bool>                    m_full;
+        uint64_t                        m_last_ns;
+        unsigned long                   m_last_seqno;
+
+        capture_header_t *header() { return (capture_header_t *) m_data; }
+        bool open_file(const string &chipname);
+        bool grow();
+        void record(const gpio_edge_event_t &event);
+};
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <memory>
+using std::unique_ptr;
+
+#include <functional>
+using std::function;
+
+#include <mutex>
+using std::mutex;
+using std::lock_guard;
+
+#include <stdint.h>
+
+#include "GPIOLineRequest.hpp"
+#include "LoopThread.hpp"
+
+// One interval's worth of measurements for a line.
+typedef struct frequency_reading_t
+{
+    unsigned int    offset;
+    uint64_t        timestamp_ns;       // End of the interval (CLOCK_MONOTONIC)
+    uint64_t        interval_ns;
+    uint64_t        edges;              // Rising edges seen in the interval
+    double          frequency_hz;
+    double          rpm;                // frequency / pulses per revolution * 60
+    double          period_ns;          // Mean rising to rising
+    uint64_t        min_period_ns;
+    uint64_t        max_period_ns;
+    double          pulse_width_ns;     // Mean rising to falling
+    double          duty;               // pulse width / period
+    uint64_t        lost;               // Events the kernel dropped on us
+} frequency_reading_t;
+
+typedef function<void(const frequency_reading_t &reading)> frequency_callback_t;
+
+/*
+    Frequency counter/tachometer for input lines.  Instead of waking up for
+    every edge, we let the kernel queue them (with their timestamps) and drain
+    them in batches, working out rate, period and pulse width from the kernel's
+    timestamps- so the numbers don't depend on how promptly we got scheduled.
+    Readings come out once per interval per line, via the callback and/or
+    get_reading().
+
+    We normally wake once per interval, but if the lines are busy enough that
+    the kernel's buffer would overflow before then, we drain more often.
+*/
+class FrequencyCounter : public LoopThread
+{
+    public:
+        FrequencyCounter(const string &chipname, const vector<unsigned int> &offsets,
+                         uint64_t interval_ns, frequency_callback_t callback = nullptr);
+        ~FrequencyCounter();
+
+        FrequencyCounter(const FrequencyCounter &) = delete;
+        FrequencyCounter &operator=(const FrequencyCounter &) = delete;
+
+        bool is_open() { return (m_request != nullptr) && m_request->is_requested(); }
+
+        // Tachometer mode- pulses per revolution for the rpm figure.  Default 1.
+        bool set_pulses_per_rev(unsigned int offset, unsigned int pulses);
+
+        // Latest completed reading for the line.  false if there isn't one yet.
+        bool get_reading(unsigned int offset, frequency_reading_t &reading);
+
+    protected:
+        void run();
+
+    private:
+        typedef struct line_state_t
+        {
+            uint64_t        edges;
+            uint64_t        period_sum;
+            uint64_t        period_count;
+            uint64_t        min_period;
+            uint64_t        max_period;
+            uint64_t        high_sum;
+            uint64_t        high_count;
+            uint64_t        last_rise_ns;
+            bool            have_rise;
+            unsigned long   last_seqno;
+            uint64_t        lost;
+            unsigned int    pulses_per_rev;
+        } line_state_t;
+
+        unique_ptr<GPIOLineRequest>     m_request;
+        uint64_t                        m_interval_ns;
+        frequency_callback_t            m_callback;
+        vector<line_state_t>            m_state;
+        mutex                           m_lock;             // Guards the readings and pulses_per_rev
+        vector<frequency_reading_t>     m_readings;
+        vector<bool>                    m_have_reading;
+
+        void process(const gpio_edge_event_t &event);
+        void publish(uint64_t timestamp_ns);
+};
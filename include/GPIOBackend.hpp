@@ -0,0 +1,129 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <memory>
+using std::unique_ptr;
+
+#include <stdint.h>
+
+// The settings enums are libgpiod's- they're what every backend has to be
+// able to express anyway, so there's no point in a second set of names.
+#include <gpiod.h>
+
+#include "GPIODiag.hpp"
+
+// Settings for one line in a request.  Plain data so we can cache it, compare
+// it, and only push it to the kernel when it actually changes.
+typedef struct gpio_line_settings_t
+{
+    enum gpiod_line_direction   direction = GPIOD_LINE_DIRECTION_INPUT;
+    enum gpiod_line_edge        edge = GPIOD_LINE_EDGE_NONE;
+    enum gpiod_line_bias        bias = GPIOD_LINE_BIAS_AS_IS;
+    enum gpiod_line_drive       drive = GPIOD_LINE_DRIVE_PUSH_PULL;
+    bool                        active_low = false;
+    bool                        value = false;          // Output value, ignored for inputs
+    unsigned long               debounce_us = 0;
+} gpio_line_settings_t;
+
+// One edge event, pulled out of the backend's buffer.  The index is the line's
+// position within the request, which is what the bitmasks are built on.
+typedef struct gpio_edge_event_t
+{
+    uint64_t                    timestamp_ns;
+    unsigned int                offset;
+    unsigned int                index;
+    bool                        rising;
+    unsigned long               global_seqno;
+    unsigned long               line_seqno;
+} gpio_edge_event_t;
+
+// What the chip says about one line.
+typedef struct gpio_line_info_t
+{
+    unsigned int                offset = 0;
+    string                      name;
+    string                      consumer;
+    bool                        used = false;
+    enum gpiod_line_direction   direction = GPIOD_LINE_DIRECTION_INPUT;
+    enum gpiod_line_edge        edge = GPIOD_LINE_EDGE_NONE;
+    enum gpiod_line_bias        bias = GPIOD_LINE_BIAS_AS_IS;
+    bool                        active_low = false;
+} gpio_line_info_t;
+
+// A change to a watched line's info, and the info as of the change.
+typedef struct gpio_info_event_t
+{
+    enum gpiod_info_event_type  type;
+    uint64_t                    timestamp_ns;
+    gpio_line_info_t            info;
+} gpio_info_event_t;
+
+/*
+    The one-request half of a GPIO backend.  GPIOLineRequest keeps the
+    settings cache, the offset/index bookkeeping and the error reporting, and
+    hands the actual line work to one of these.  Values and masks are logical
+    (active/inactive) and the masks are by index within the request.
+*/
+class GPIORequestBackend
+{
+    public:
+        virtual ~GPIORequestBackend() {}
+
+        // Change the settings on the held lines in place, by index.
+        virtual bool reconfigure(const vector<gpio_line_settings_t> &settings) = 0;
+
+        virtual GPIOStatus read_value(unsigned int offset, bool &value) = 0;
+        virtual GPIOStatus set_value(unsigned int offset, bool value) = 0;
+        virtual GPIOStatus get_values(uint64_t &values) = 0;
+        virtual GPIOStatus set_values(uint64_t mask, uint64_t values) = 0;
+
+        // Edge events.  get_fd() is pollable (POLLIN) whenever events are
+        // pending.  read_edge_events() fills in everything but the index and
+        // blocks if there's nothing pending.
+        virtual int get_fd() = 0;
+        virtual int wait_edge_events(int64_t timeout_ns) = 0;
+        virtual int read_edge_events(gpio_edge_event_t *events, size_t max_events) = 0;
+};
+
+/*
+    The chip half of a GPIO backend.  GPIOChip wraps one of these, so a chip
+    can be a real one through libgpiod or something else entirely (such as
+    SimGPIOChip) registered for a path prefix with GPIOChip::register_backend().
+*/
+class GPIOChipBackend
+{
+    public:
+        virtual ~GPIOChipBackend() {}
+
+        virtual string get_name() = 0;
+        virtual string get_label() = 0;
+        virtual size_t get_num_lines() = 0;
+
+        // The line's name, empty if it doesn't have one.
+        virtual string get_line_name(unsigned int offset) = 0;
+
+        // Take the lines with these settings (by index).  nullptr, with errno
+        // set, on failure.
+        virtual unique_ptr<GPIORequestBackend> request_lines(const vector<unsigned int> &offsets,
+                                                             const vector<gpio_line_settings_t> &settings,
+                                                             const string &consumer, size_t event_buffer_size) = 0;
+
+        // Line info.  get_line_info() asks the chip.  watch_line_info() does
+        // the same and has changes to the line queued as info events from
+        // then on.  get_info_fd() is pollable (POLLIN) while events are
+        // pending, and read_info_event() blocks if there are none.
+        virtual bool get_line_info(unsigned int offset, gpio_line_info_t &info) = 0;
+        virtual bool watch_line_info(unsigned int offset, gpio_line_info_t &info) = 0;
+        virtual bool unwatch_line_info(unsigned int offset) = 0;
+        virtual int get_info_fd() = 0;
+        virtual bool read_info_event(gpio_info_event_t &event) = 0;
+
+        // The raw libgpiod chip, for the few things only libgpiod can do.
+        // nullptr for anything that isn't libgpiod.
+        virtual struct gpiod_chip *get_gpiod_chip() { return nullptr; }
+};
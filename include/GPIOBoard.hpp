@@ -0,0 +1,131 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <map>
+using std::map;
+
+#include <memory>
+using std::shared_ptr;
+using std::unique_ptr;
+
+#include <istream>
+using std::istream;
+
+#include <stdint.h>
+
+#include "GPIOBackend.hpp"
+#include "GPIOChip.hpp"
+#include "GPIODiag.hpp"
+#include "GPIOLineRequest.hpp"
+
+// One line of a board description.  Either the chip and offset are given, or
+// they're left empty and the line is found by its name through GPIOChip's
+// line name index.
+typedef struct gpio_board_line_t
+{
+    string                  name;                   // What the application calls it
+    string                  line_name;              // What the kernel calls it, if we look it up
+    string                  chip;
+    unsigned int            offset = 0;
+    bool                    has_offset = false;
+    gpio_line_settings_t    settings;
+} gpio_board_line_t;
+
+// Where the time went bringing the board up.
+typedef struct gpio_board_timing_t
+{
+    uint64_t                parse_ns = 0;
+    uint64_t                resolve_ns = 0;         // Name lookups and chip opens
+    uint64_t                request_ns = 0;
+    size_t                  lines = 0;
+    size_t                  chips = 0;
+    size_t                  requests = 0;
+} gpio_board_timing_t;
+
+/*
+    A whole board's worth of lines, described up front and requested in one go.
+    Standing up dozens of KernelGPIOs one at a time costs a request (and a
+    configure) per line.  Here the lines are grouped by chip and each chip gets
+    one multi-line request with every line's settings in it, so bring-up is a
+    request per chip no matter how many lines are on it.
+
+    The description is INI- one section per line, named for the line:
+
+        ; Comments start with ';' or '#'
+        [RELAY_1]
+        chip = /dev/gpiochip0
+        line = 17
+        direction = output
+        active_low = true
+        value = 0
+
+        [BUTTON]
+        name = USER_BUTTON          ; Kernel line name, defaults to the section's
+        direction = input
+        bias = pull-up
+        edge = both
+        debounce_us = 1000
+
+    Keys are chip, line, name, direction (input/output), edge (none/rising/
+    falling/both), bias (as-is/disabled/pull-up/pull-down), drive (push-pull/
+    open-drain/open-source), active_low, value and debounce_us.  Lines
+    without a chip and line are looked up by name.
+
+    Line access goes through the requests, so a name is a map lookup- callers
+    on a hot path should get_line() once and hang on to the request and offset.
+*/
+class GPIOBoard
+{
+    public:
+        // Load and request a board description.  nullptr (and logged) if the
+        // file doesn't parse, a line can't be found or a request fails- it's
+        // all of the board or none of it.
+        static unique_ptr<GPIOBoard> load(const string &path, const string &consumer = "GPIOBoard");
+        static unique_ptr<GPIOBoard> load(istream &in, const string &consumer = "GPIOBoard");
+
+        // Same, from lines built in code.
+        static unique_ptr<GPIOBoard> create(const vector<gpio_board_line_t> &lines, const string &consumer = "GPIOBoard");
+
+        // Just the parse.  false (and logged) on a bad description.
+        static bool parse(istream &in, vector<gpio_board_line_t> &lines);
+
+        ~GPIOBoard() {}
+
+        GPIOBoard(const GPIOBoard &) = delete;
+        GPIOBoard &operator=(const GPIOBoard &) = delete;
+
+        // Where a line ended up.  false if there's no such line on the board.
+        bool get_line(const string &name, GPIOLineRequest *&request, unsigned int &offset);
+        bool has_line(const string &name) { return m_lines.find(name) != m_lines.end(); }
+        vector<string> get_line_names();
+
+        // Line I/O by name.
+        GPIOStatus read_value(const string &name, bool &value);
+        GPIOStatus set_value(const string &name, bool value);
+
+        // The requests, one per chip (more if a chip has over MAX_LINES on the
+        // board), for the engines that work on requests in bulk.
+        const vector<unique_ptr<GPIOLineRequest>> &get_requests() { return m_requests; }
+
+        const gpio_board_timing_t &get_timing() { return m_timing; }
+
+    private:
+        typedef struct board_entry_t
+        {
+            GPIOLineRequest         *request;
+            unsigned int            offset;
+        } board_entry_t;
+
+        GPIOBoard() {}
+
+        vector<unique_ptr<GPIOLineRequest>>     m_requests;
+        map<string, board_entry_t>              m_lines;
+        gpio_board_timing_t                     m_timing;
+
+        bool bring_up(const vector<gpio_board_line_t> &lines, const string &consumer);
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <map>
+using std::map;
+
+#include <deque>
+using std::deque;
+
+#include <memory>
+using std::unique_ptr;
+
+#include <atomic>
+using std::atomic;
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "GPIOBoard.hpp"
+#include "GPIOBrokerProtocol.hpp"
+#include "GPIODiag.hpp"
+#include "LoopThread.hpp"
+
+typedef struct gpio_broker_stats_t
+{
+    uint64_t        clients;                // Connected right now
+    uint64_t        messages;               // Requests handled
+    uint64_t        sets;                   // SET requests
+    uint64_t        bulk_writes;            // set_values calls they were folded into
+    uint64_t        edges_sent;
+    uint64_t        edges_dropped;          // A subscriber's socket was full
+    uint64_t        disconnects;            // Clients dropped for not reading their replies
+} gpio_broker_stats_t;
+
+/*
+    Owns a board's worth of lines and shares them out to other processes over
+    a Unix domain socket (GPIOBrokerClient is the other end).  The kernel only
+    lets one process hold a line, so this is that process.
+
+    Everything runs on one epoll thread.  Each pass reads every message that's
+    waiting from every client, then does all the SETs with one bulk write per
+    line request- so a dozen clients flipping lines on the same chip costs one
+    ioctl, not a dozen.  Writes to the same line in the same pass land in the
+    order they were read, last one wins.  GETs are answered after the writes.
+
+    Lines with edge detection on stream EDGE messages to the clients that
+    subscribed to them.  A subscriber that can't keep up loses edges rather
+    than holding up the broker.  Replies aren't lost that way- one that
+    doesn't fit is held until the client's socket has room, and edges for
+    that client are dropped until it's gone out.
+
+    The socket gets the mode it's given, not whatever the umask leaves, and
+    each connection's credentials are checked against it- root and our own
+    user always get in, our group only if the mode lets the group in, and
+    anybody else only if it's open to everybody.
+*/
+class GPIOBroker : public LoopThread
+{
+    public:
+        // Takes the board over.  The first 64 of its lines (by name) are
+        // served.  An existing socket at the path is replaced.
+        GPIOBroker(const string &socket_path, unique_ptr<GPIOBoard> board, mode_t mode = 0660);
+        ~GPIOBroker();
+
+        GPIOBroker(const GPIOBroker &) = delete;
+        GPIOBroker &operator=(const GPIOBroker &) = delete;
+
+        bool is_open() { return m_listen_fd >= 0; }
+
+        // The broker index clients address a line by, -1 if it isn't served.
+        int get_line(const string &name);
+
+        gpio_broker_stats_t get_stats();
+
+    protected:
+        void run();
+
+    private:
+        typedef struct broker_line_t
+        {
+            string              name;
+            size_t              request;            // Index into the board's requests
+            uint64_t            request_mask;       // The line's bit within that request
+            int                 request_index;
+        } broker_line_t;
+
+        typedef struct client_t
+        {
+            uint64_t                    subscribed;
+            bool                        closing;
+            deque<gpio_broker_msg_t>    replies;            // Waiting on room in the socket
+        } client_t;
+
+        string                          m_socket_path;
+        mode_t                          m_mode;
+        unique_ptr<GPIOBoard>           m_board;
+        vector<broker_line_t>           m_lines;
+        vector<uint64_t>                m_request_lines;    // Broker lines on each request
+        uint64_t                        m_output_lines;     // Broker lines configured as outputs
+        map<int, client_t>              m_clients;          // By fd, only touched by the thread
+        int                             m_listen_fd;
+        int                             m_epoll_fd;
+
+        atomic<uint64_t>                m_client_count;
+        atomic<uint64_t>                m_messages;
+        atomic<uint64_t>                m_sets;
+        atomic<uint64_t>                m_bulk_writes;
+        atomic<uint64_t>                m_edges_sent;
+        atomic<uint64_t>                m_edges_dropped;
+        atomic<uint64_t>                m_disconnects;
+
+        void number_lines();
+        void listen_on();
+        void accept_clients();
+        bool allowed(int fd);
+        void read_edges(size_t request);
+        bool send_msg(int fd, const gpio_broker_msg_t &msg);
+        void flush_replies(int fd);
+        void close_client(int fd);
+};
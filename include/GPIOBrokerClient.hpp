@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <deque>
+using std::deque;
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "GPIOBrokerProtocol.hpp"
+#include "GPIODiag.hpp"
+
+// One edge streamed from the broker.
+typedef struct gpio_broker_edge_t
+{
+    unsigned int    line;                   // Broker index
+    bool            rising;
+    uint64_t        timestamp_ns;
+} gpio_broker_edge_t;
+
+/*
+    A process's connection to a GPIOBroker.  Lines are addressed by broker
+    index (find() them by name once) and the bulk calls take a mask of them,
+    so setting or reading a whole group is one round trip.
+
+    Calls block until the broker answers, or fail with GPIO_ERR_IO/ETIMEDOUT
+    if it hasn't inside REPLY_TIMEOUT_MS.  Edges that show up while we're
+    waiting on an answer are held for read_edges().  One thread per client.
+*/
+class GPIOBrokerClient
+{
+    public:
+        // Edges held for read_edges() before the oldest are dropped.
+        static const size_t MAX_HELD_EDGES = 1024;
+
+        // How long a call waits on the broker's answer.
+        static const int REPLY_TIMEOUT_MS = 2000;
+
+        GPIOBrokerClient(const string &socket_path);
+        ~GPIOBrokerClient();
+
+        GPIOBrokerClient(const GPIOBrokerClient &) = delete;
+        GPIOBrokerClient &operator=(const GPIOBrokerClient &) = delete;
+
+        bool is_open() { return m_fd >= 0; }
+
+        // The broker index of a line, -1 if the broker doesn't serve it.
+        int find(const string &name);
+
+        // Line I/O, by mask of broker indexes or one line at a time.
+        GPIOStatus set_values(uint64_t mask, uint64_t values);
+        GPIOStatus get_values(uint64_t mask, uint64_t &values);
+        GPIOStatus set_value(unsigned int line, bool value);
+        GPIOStatus read_value(unsigned int line, bool &value);
+
+        // Edge streams for the lines in mask.
+        GPIOStatus subscribe(uint64_t mask);
+        GPIOStatus unsubscribe(uint64_t mask);
+
+        // Up to max edges, waiting up to timeout_ms (-1 forever) if there
+        // aren't any yet.  Returns how many, -1 on a broken connection.
+        int read_edges(gpio_broker_edge_t *edges, size_t max, int timeout_ms);
+
+        // For poll()ing alongside other things- readable means edges (call
+        // read_edges() with a zero timeout).
+        int get_fd() { return m_fd; }
+
+        // Edges dropped because nobody read them in time.
+        uint64_t get_dropped_edges() { return m_dropped; }
+
+    private:
+        int                             m_fd;
+        uint32_t                        m_next_id;
+        deque<gpio_broker_edge_t>       m_edges;
+        uint64_t                        m_dropped;
+
+        GPIOStatus transact(gpio_broker_msg_t &msg);
+        void hold_edge(const gpio_broker_msg_t &msg);
+};
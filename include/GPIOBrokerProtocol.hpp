@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Wire format between GPIOBroker and GPIOBrokerClient.  The socket is
+    SOCK_SEQPACKET, so every send is exactly one message and there's no
+    framing to get wrong.  It's a local socket, so everything is in host
+    byte order.
+
+    Lines are addressed by their broker index (0-63, see LOOKUP), and every
+    request that touches lines carries a mask of them, so one message can
+    set or get any number of lines.
+*/
+
+typedef enum gpio_broker_msg_type_t
+{
+    GPIO_BROKER_LOOKUP = 1,         // name -> line.  Reply has the line, or a status
+    GPIO_BROKER_SET,                // Drive the lines in mask to values (outputs only)
+    GPIO_BROKER_GET,                // Read the lines in mask, reply has values
+    GPIO_BROKER_SUBSCRIBE,          // Send EDGEs for the lines in mask
+    GPIO_BROKER_UNSUBSCRIBE,        // Stop sending EDGEs for the lines in mask
+    GPIO_BROKER_REPLY,              // Broker -> client, id is the request's
+    GPIO_BROKER_EDGE                // Broker -> client, unsolicited
+} gpio_broker_msg_type_t;
+
+static const size_t GPIO_BROKER_NAME_SIZE = 32;
+static const unsigned int GPIO_BROKER_MAX_LINES = 64;
+
+typedef struct gpio_broker_msg_t
+{
+    uint32_t        type;                   // gpio_broker_msg_type_t
+    uint32_t        id;                     // Picked by the client, echoed in the reply
+    int32_t         status;                 // gpio_error_t, replies only
+    uint32_t        line;                   // LOOKUP reply and EDGE
+    uint64_t        mask;
+    uint64_t        values;                 // EDGE: bit 0 is the level after the edge
+    uint64_t        timestamp_ns;           // EDGE: kernel timestamp
+    char            name[GPIO_BROKER_NAME_SIZE];
+} gpio_broker_msg_t;
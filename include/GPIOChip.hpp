@@ -0,0 +1,125 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <map>
+using std::map;
+
+#include <vector>
+using std::vector;
+
+#include <memory>
+using std::shared_ptr;
+using std::weak_ptr;
+
+#include <mutex>
+using std::mutex;
+using std::lock_guard;
+
+#include <functional>
+using std::function;
+
+#include <time.h>
+
+#include <gpiod.h>
+
+#include "GPIOBackend.hpp"
+
+// Opens a chip for a backend registered with GPIOChip::register_backend().
+// Handed the full path (prefix and all), returns nullptr on failure.
+typedef function<shared_ptr<GPIOChipBackend>(const string &path)> gpio_backend_factory_t;
+
+/*
+    Process-wide, reference counted handle onto a GPIO chip.  Every KernelGPIO
+    used to open its own chip, which meant one open()/fd per line.  Now all the
+    users of a given chip share one gpiod_chip handle that is closed when the last
+    user lets go of it.  We also cache the (static) chip info on open so nobody
+    has to go back to the kernel to ask how many lines it has.
+
+    The chip itself is a GPIOChipBackend.  Paths go to libgpiod unless they
+    start with a prefix some other backend has been registered for (e.g.
+    "sim:" for SimGPIOChip).
+*/
+class GPIOChip
+{
+    public:
+        // Get a shared handle on the chip at the path provided.  Returns the
+        // already open chip if somebody else has it, nullptr on failure.
+        static shared_ptr<GPIOChip> open(const string &path);
+
+        // Send every path starting with the prefix to this factory instead of
+        // libgpiod.  Registering a prefix again replaces the factory.
+        static void register_backend(const string &prefix, gpio_backend_factory_t factory);
+
+        // How many chips we currently have open across the process.
+        static size_t open_count();
+
+        // Find a line by name across all of the chips in the system.  This is
+        // served out of an index of all the chips' line names that's only
+        // rebuilt when a chip shows up or goes away.  Returns false if the
+        // line's not known to the system.
+        static bool find_line(const string &name, string &chip_path, unsigned int &offset);
+
+        // Force a rebuild of the line name index on the next lookup.
+        static void invalidate_line_index();
+
+        ~GPIOChip();
+
+        // No copying- there's exactly one of these per open chip.
+        GPIOChip(const GPIOChip &) = delete;
+        GPIOChip &operator=(const GPIOChip &) = delete;
+
+        // Cached info about the chip.
+        const string &get_path() { return m_path; }
+        const string &get_name() { return m_name; }
+        const string &get_label() { return m_label; }
+        size_t get_num_lines() { return m_num_lines; }
+
+        // The line's name, empty if it doesn't have one.  Goes to the backend
+        // every time.
+        string get_line_name(unsigned int offset) { return m_backend->get_line_name(offset); }
+
+        // The backend, for the folks that need to make requests on it.
+        shared_ptr<GPIOChipBackend> get_backend() { return m_backend; }
+
+        // Raw libgpiod handle, nullptr if the chip isn't a libgpiod one.
+        struct gpiod_chip *get_chip() { return m_backend->get_gpiod_chip(); }
+
+    private:
+        GPIOChip(const string &key, const string &path, shared_ptr<GPIOChipBackend> backend);
+
+        string                      m_key;
+        string                      m_path;
+        string                      m_name;
+        string                      m_label;
+        size_t                      m_num_lines;
+        shared_ptr<GPIOChipBackend> m_backend;
+
+        // Line name index helpers...
+        static vector<string> list_chips();
+        static void update_line_index();
+
+        // The registry proper.  Keyed by canonical path, holds weak references
+        // so the last shared_ptr going away is what closes the chip.
+        static mutex                                    s_lock;
+        static map<string, weak_ptr<GPIOChip>>          s_registry;
+
+        // Non-libgpiod backends by path prefix.  Guarded by s_lock.
+        static map<string, gpio_backend_factory_t>      s_backends;
+
+        // The line name index.  Keyed by line name, holds the chip path and
+        // offset.  We keep the chip list it was built from and the last /dev
+        // change time we saw so we know when it needs a rebuild.
+        typedef struct line_location_t
+        {
+            string          chip_path;
+            unsigned int    offset;
+        } line_location_t;
+
+        static mutex                                    s_index_lock;
+        static map<string, line_location_t>             s_line_index;
+        static vector<string>                           s_index_chips;
+        static struct timespec                          s_dev_mtime;
+        static bool                                     s_index_valid;
+};
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <functional>
+using std::function;
+
+#include <atomic>
+using std::atomic;
+
+#include <stdint.h>
+#include <time.h>
+
+// What went wrong, for the calls that hand back a GPIOStatus.
+typedef enum gpio_error_t
+{
+    GPIO_OK = 0,
+    GPIO_ERR_NO_CHIP,           // Chip isn't (or couldn't be) opened
+    GPIO_ERR_NO_LINE,           // No such line, or it's not part of the request
+    GPIO_ERR_NOT_REQUESTED,     // We don't hold the line(s)
+    GPIO_ERR_BUSY,              // Already requested/in use
+    GPIO_ERR_DIRECTION,         // Wrong direction for the operation
+    GPIO_ERR_INVALID,           // Bad argument or bad data
+    GPIO_ERR_NO_MEMORY,
+    GPIO_ERR_NO_SPACE,
+    GPIO_ERR_IO                 // The kernel call itself failed- see the errno
+} gpio_error_t;
+
+typedef enum gpio_log_level_t
+{
+    GPIO_LOG_DEBUG = 0,
+    GPIO_LOG_INFO,
+    GPIO_LOG_WARNING,
+    GPIO_LOG_ERROR
+} gpio_log_level_t;
+
+const char *gpio_error_string(gpio_error_t code);
+
+/*
+    Result of an operation- an error code plus the errno, if the kernel had
+    anything to say.  Converts to true on success so existing "if (set_value())"
+    style code keeps on working.
+*/
+class GPIOStatus
+{
+    public:
+        GPIOStatus(gpio_error_t code = GPIO_OK, int sys_errno = 0) : m_code(code), m_errno(sys_errno) {}
+
+        bool ok() const { return m_code == GPIO_OK; }
+        operator bool() const { return ok(); }
+
+        gpio_error_t get_code() const { return m_code; }
+        int get_errno() const { return m_errno; }
+        const char *what() const { return gpio_error_string(m_code); }
+
+    private:
+        gpio_error_t    m_code;
+        int             m_errno;
+};
+
+// One diagnostic message, as handed to the sink.
+typedef struct gpio_diag_record_t
+{
+    uint64_t            timestamp_ns;       // CLOCK_MONOTONIC
+    gpio_log_level_t    level;
+    gpio_error_t        code;
+    int                 sys_errno;
+    const char          *source;            // Always a string literal
+    uint32_t            suppressed;         // Messages this site dropped since the last one that got out
+    char                message[108];
+} gpio_diag_record_t;
+
+typedef function<void(const gpio_diag_record_t &record)> gpio_diag_sink_t;
+
+/*
+    Diagnostics for the library.  Nothing in here writes to the console from
+    the caller's thread- messages are formatted into a fixed size record and
+    pushed onto a lock-free queue, and a logging thread hands them to the sink
+    (stdout by default).  If the queue's full the message is dropped and
+    counted rather than making anyone wait.
+
+    Use it through GPIO_DIAG(), which also rate limits each call site, so a
+    line that's failing in a tight loop costs a clock read and a compare per
+    hit instead of a flood of output.
+*/
+class GPIODiag
+{
+    public:
+        // Where messages go.  nullptr puts back the default (stdout).
+        static void set_sink(gpio_diag_sink_t sink);
+
+        // Messages below this level are skipped outright.  Default is WARNING.
+        static void set_level(gpio_log_level_t level) { s_level = level; }
+        static bool enabled(gpio_log_level_t level) { return level >= s_level; }
+
+        // Messages per second, per call site.  Default is 10.
+        static void set_rate_limit(uint32_t per_second) { s_rate_limit = per_second; }
+        static uint32_t get_rate_limit() { return s_rate_limit; }
+
+        // Async (the default) queues messages for the logging thread; sync
+        // calls the sink right there, which is handy in short lived tools.
+        static void set_async(bool async) { s_async = async; }
+
+        // Wait for everything queued so far to reach the sink.
+        static void flush();
+
+        // Messages dropped because the queue was full.
+        static uint64_t get_dropped();
+
+        // What GPIO_DIAG() calls once the site's rate limit says go.
+        static void post(gpio_log_level_t level, const char *source, gpio_error_t code, int sys_errno,
+                         uint32_t suppressed, const char *format, ...) __attribute__((format(printf, 6, 7)));
+
+    private:
+        static atomic<gpio_log_level_t>     s_level;
+        static atomic<uint32_t>             s_rate_limit;
+        static atomic<bool>                 s_async;
+};
+
+/*
+    Per call site rate limiter.  Everything is relaxed atomics and a coarse
+    clock read- it's fine for the count to be off by one under contention,
+    the point is just to keep a misbehaving line from drowning everything else.
+*/
+class GPIODiagLimiter
+{
+    public:
+        constexpr GPIODiagLimiter() : m_window(0), m_count(0), m_suppressed(0) {}
+
+        bool allow(uint32_t &suppressed)
+        {
+            bool retVal = false;
+            struct timespec ts;
+
+            clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+            uint64_t window = (uint64_t) ts.tv_sec;
+            if (m_window.load(std::memory_order_relaxed) != window)
+            {
+                m_window.store(window, std::memory_order_relaxed);
+                m_count.store(0, std::memory_order_relaxed);
+            }
+
+            if (m_count.fetch_add(1, std::memory_order_relaxed) < GPIODiag::get_rate_limit())
+            {
+                suppressed = m_suppressed.exchange(0, std::memory_order_relaxed);
+                retVal = true;
+            }
+            else
+            {
+                m_suppressed.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            return retVal;
+        }
+
+    private:
+        atomic<uint64_t>    m_window;
+        atomic<uint32_t>    m_count;
+        atomic<uint32_t>    m_suppressed;
+};
+
+// Post a printf style diagnostic, rate limited per call site.  sys_errno is
+// picked up before anything else has a chance to stomp on it.
+#define GPIO_DIAG(level, source, code, sys_errno, ...)                                          \
+    do                                                                                          \
+    {                                                                                           \
+        static GPIODiagLimiter gpio_diag_limiter;                                               \
+        int gpio_diag_errno = (sys_errno);                                                      \
+        uint32_t gpio_diag_suppressed = 0;                                                      \
+        if (GPIODiag::enabled(level) && gpio_diag_limiter.allow(gpio_diag_suppressed))          \
+        {                                                                                       \
+            GPIODiag::post(level, source, code, gpio_diag_errno, gpio_diag_suppressed,          \
+                           __VA_ARGS__);                                                        \
+        }                                                                                       \
+    } while (0)
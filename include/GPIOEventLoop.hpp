@@ -0,0 +1,196 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <map>
+using std::map;
+
+#include <queue>
+using std::priority_queue;
+
+#include <memory>
+using std::unique_ptr;
+
+#include <mutex>
+using std::mutex;
+using std::lock_guard;
+
+#include <stdint.h>
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
+
+#include <gpiod.h>
+
+#include "GPIODiag.hpp"
+#include "GPIOLineRequest.hpp"
+#include "LoopThread.hpp"
+
+// How a wait ended.  A timeout is a success with timed_out set- the status
+// is only bad if the line went away (or was never there).
+typedef struct gpio_async_result_t
+{
+    GPIOStatus          status;
+    bool                timed_out = false;
+    bool                rising = false;
+    uint64_t            timestamp_ns = 0;       // Kernel timestamp of the edge
+    unsigned long       line_seqno = 0;
+} gpio_async_result_t;
+
+// One pending wait.  The storage is the waiter's (for a coroutine it's part
+// of the coroutine frame) and has to stay put until resume is called- which
+// happens exactly once, on the event loop's thread, outside of any lock.
+typedef struct gpio_async_waiter_t
+{
+    enum gpiod_line_edge    edge = GPIOD_LINE_EDGE_BOTH;    // Which edges end the wait
+    int64_t                 timeout_ns = -1;                // Negative waits forever
+    void                    (*resume)(struct gpio_async_waiter_t *waiter) = nullptr;
+    void                    *context = nullptr;
+    gpio_async_result_t     result;
+
+    // The loop's bookkeeping.
+    uint64_t                id = 0;
+} gpio_async_waiter_t;
+
+class GPIOAsyncLine;
+
+/*
+    One epoll thread for any number of lines and any number of waiters on
+    them.  A waiter is a few dozen bytes sitting in a map until its edge (or
+    its timeout) comes along, so thousands of them suspended at once costs
+    no threads at all.  Timeouts all run off of one timerfd armed for the
+    earliest of them.
+
+    With C++20 coroutines, lines hand out awaitables:
+
+        gpio_async_result_t edge = co_await line->next_edge();
+        gpio_async_result_t press = co_await line->edge(GPIOD_LINE_EDGE_FALLING, 50000000);
+
+    and the coroutine picks up on the loop's thread with the event's
+    timestamp.  Without them it's the same thing with a callback in the
+    waiter.
+*/
+class GPIOEventLoop : public LoopThread
+{
+    public:
+        GPIOEventLoop();
+        ~GPIOEventLoop();
+
+        GPIOEventLoop(const GPIOEventLoop &) = delete;
+        GPIOEventLoop &operator=(const GPIOEventLoop &) = delete;
+
+        bool is_open() { return isRunning(); }
+
+        // Request a line, both edges detected, and hang it off of the loop.
+        // nullptr if it couldn't be had.  Lines have to go before the loop does.
+        unique_ptr<GPIOAsyncLine> open_line(const string &chipname, unsigned int offset,
+                                            enum gpiod_line_bias bias = GPIOD_LINE_BIAS_AS_IS,
+                                            unsigned long debounce_us = 0);
+
+        // Waits pending across every line.
+        size_t get_waiting();
+
+    protected:
+        void run();
+
+    private:
+        friend class GPIOAsyncLine;
+
+        typedef struct timeout_t
+        {
+            uint64_t            deadline_ns;
+            uint64_t            line_id;
+            uint64_t            waiter_id;
+        } timeout_t;
+
+        typedef struct timeout_later_t
+        {
+            bool operator()(const timeout_t &a, const timeout_t &b) const { return a.deadline_ns > b.deadline_ns; }
+        } timeout_later_t;
+
+        int                                 m_epoll_fd;
+        int                                 m_timer_fd;
+        mutex                               m_lock;         // Guards the lines, their waiters and the timeouts
+        map<uint64_t, GPIOAsyncLine *>      m_lines;
+        priority_queue<timeout_t, vector<timeout_t>, timeout_later_t> m_timeouts;
+        uint64_t                            m_armed_ns;     // What the timerfd's set for, 0 if nothing
+        uint64_t                            m_next_id;
+
+        // Called with m_lock held.
+        void add_timeout(uint64_t deadline_ns, uint64_t line_id, uint64_t waiter_id);
+        void arm_timer();
+        void expire_timeouts(vector<gpio_async_waiter_t *> &ready);
+};
+
+/*
+    A line being waited on through a GPIOEventLoop.
+*/
+class GPIOAsyncLine
+{
+    public:
+        ~GPIOAsyncLine();
+
+        GPIOAsyncLine(const GPIOAsyncLine &) = delete;
+        GPIOAsyncLine &operator=(const GPIOAsyncLine &) = delete;
+
+        unsigned int get_offset() { return m_offset; }
+        GPIOStatus read_value(bool &value) { return m_request->read_value(m_offset, value); }
+
+        // Start a wait.  The waiter's resume is called (on the loop's
+        // thread) when it ends.  false if the waiter's unusable.
+        bool wait(gpio_async_waiter_t *waiter);
+
+        // Call off a wait.  false if it's already ended (or is ending), in
+        // which case resume is (or will be) called as usual.
+        bool cancel(gpio_async_waiter_t *waiter);
+
+#if defined(__cpp_impl_coroutine)
+        // co_await-able wait for an edge.
+        class EdgeAwaitable
+        {
+            public:
+                EdgeAwaitable(GPIOAsyncLine *line, enum gpiod_line_edge edge, int64_t timeout_ns) : m_line(line)
+                {
+                    m_waiter.edge = edge;
+                    m_waiter.timeout_ns = timeout_ns;
+                    m_waiter.resume = resume;
+                }
+
+                bool await_ready() const noexcept { return false; }
+                bool await_suspend(std::coroutine_handle<> handle)
+                {
+                    m_waiter.context = handle.address();
+                    return m_line->wait(&m_waiter);
+                }
+                gpio_async_result_t await_resume() const noexcept { return m_waiter.result; }
+
+            private:
+                GPIOAsyncLine           *m_line;
+                gpio_async_waiter_t     m_waiter;
+
+                static void resume(gpio_async_waiter_t *waiter)
+                {
+                    std::coroutine_handle<>::from_address(waiter->context).resume();
+                }
+        };
+
+        EdgeAwaitable next_edge() { return EdgeAwaitable(this, GPIOD_LINE_EDGE_BOTH, -1); }
+        EdgeAwaitable edge(enum gpiod_line_edge edge, int64_t timeout_ns = -1) { return EdgeAwaitable(this, edge, timeout_ns); }
+#endif
+
+    private:
+        friend class GPIOEventLoop;
+
+        GPIOAsyncLine(GPIOEventLoop *loop, uint64_t id, unique_ptr<GPIOLineRequest> request, unsigned int offset);
+
+        GPIOEventLoop                               *m_loop;
+        uint64_t                                    m_id;
+        unique_ptr<GPIOLineRequest>                 m_request;
+        unsigned int                                m_offset;
+        map<uint64_t, gpio_async_waiter_t *>        m_waiters;      // By waiter id, guarded by the loop's lock
+};
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <memory>
+using std::shared_ptr;
+using std::unique_ptr;
+
+#include <stdint.h>
+
+#include <gpiod.h>
+
+#include "GPIOBackend.hpp"
+#include "GPIOChip.hpp"
+#include "GPIODiag.hpp"
+
+/*
+    A (possibly multi-line) request on one chip.  This keeps the settings
+    cached and changes the settings on a live request in place instead of
+    dropping the lines and asking for them all over again.  That's cheaper, and
+    nobody else gets a shot at the lines (or sees an output glitch) while we're
+    at it.  The line work itself is done by the chip's backend.
+
+    The bulk calls are bitmasks by index within the request- the kernel caps a
+    request at 64 lines so a uint64_t covers everything.
+*/
+class GPIOLineRequest
+{
+    public:
+        static const size_t MAX_LINES = 64;
+
+        GPIOLineRequest(shared_ptr<GPIOChip> chip, const vector<unsigned int> &offsets, const string &consumer = "KernelGPIO");
+        ~GPIOLineRequest();
+
+        GPIOLineRequest(const GPIOLineRequest &) = delete;
+        GPIOLineRequest &operator=(const GPIOLineRequest &) = delete;
+
+        // Settings for every line, or for just one of them by offset.  These
+        // are only cached here- call apply() to push them to the kernel.
+        void set_settings(const gpio_line_settings_t &settings);
+        bool set_settings(unsigned int offset, const gpio_line_settings_t &settings);
+        const gpio_line_settings_t &get_settings(size_t index) { return m_settings[index]; }
+
+        // Size of the kernel's event buffer for the request.  Only takes effect
+        // on a fresh request().  Zero leaves it to the kernel's default.
+        void set_event_buffer_size(size_t size) { m_event_buffer_size = size; }
+
+        // Push the cached settings out.  apply() reconfigures in place if we
+        // already hold the lines and falls back to a fresh request if that
+        // fails or we don't.  reconfigure() and request() are the two halves
+        // for callers that need to know which one happened.
+        bool apply();
+        bool reconfigure();
+        bool request();
+        void release();
+        bool is_requested() { return m_request != nullptr; }
+
+        // Line I/O.  Values are logical (active/inactive).  These are the hot
+        // path, so they don't log- failures come back in the GPIOStatus.
+        int get_value(unsigned int offset);
+        GPIOStatus read_value(unsigned int offset, bool &value);
+        GPIOStatus set_value(unsigned int offset, bool value);
+        GPIOStatus get_values(uint64_t &values);
+        GPIOStatus set_values(uint64_t mask, uint64_t values);
+
+        // Edge events.  Only one thread should be reading events at a time.
+        int get_fd();
+        int wait_edge_events(int64_t timeout_ns);
+        int read_edge_events(gpio_edge_event_t *events, size_t max_events);
+
+        // Info about the request.
+        shared_ptr<GPIOChip> get_chip() { return m_chip; }
+        const vector<unsigned int> &get_offsets() { return m_offsets; }
+        size_t get_num_lines() { return m_offsets.size(); }
+        int get_index(unsigned int offset) { return (offset < m_index.size()) ? m_index[offset] : -1; }
+        uint64_t get_mask(unsigned int offset) { int index = get_index(offset); return (index < 0) ? 0 : (1ULL << index); }
+        GPIORequestBackend *get_backend() { return m_request.get(); }
+
+    private:
+        shared_ptr<GPIOChip>            m_chip;
+        vector<unsigned int>            m_offsets;
+        vector<int>                     m_index;            // offset -> index, -1 if not ours
+        vector<gpio_line_settings_t>    m_settings;
+        string                          m_consumer;
+        size_t                          m_event_buffer_size;
+        bool                            m_dirty;
+        unique_ptr<GPIORequestBackend>  m_request;
+};
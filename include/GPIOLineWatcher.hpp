@@ -0,0 +1,83 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <utility>
+using std::pair;
+
+#include <memory>
+using std::shared_ptr;
+
+#include <functional>
+using std::function;
+
+#include <mutex>
+using std::mutex;
+using std::lock_guard;
+
+#include <atomic>
+using std::atomic;
+
+#include <stdint.h>
+
+#include "GPIOBackend.hpp"
+#include "GPIOChip.hpp"
+#include "LoopThread.hpp"
+
+typedef function<void(const gpio_info_event_t &event)> line_info_callback_t;
+
+/*
+    Keeps a chip's line info (direction, consumer, in use or not) in memory,
+    up to date off of the kernel's info change events.  "Is that line busy,
+    and who has it?" is then a memory read instead of an ioctl per line, and
+    subscribers hear about it when some other process grabs or lets go of a
+    line.
+
+    The kernel only allows one watch per line per chip fd, and the chip fd is
+    shared process wide through GPIOChip, so there should only be one of
+    these per chip.
+*/
+class GPIOLineWatcher : public LoopThread
+{
+    public:
+        // Watch every line on the chip, or just these.
+        GPIOLineWatcher(const string &chipname);
+        GPIOLineWatcher(const string &chipname, const vector<unsigned int> &offsets);
+        ~GPIOLineWatcher();
+
+        GPIOLineWatcher(const GPIOLineWatcher &) = delete;
+        GPIOLineWatcher &operator=(const GPIOLineWatcher &) = delete;
+
+        bool is_open() { return isRunning(); }
+
+        // Cached info.  false (or unused/empty) for lines we aren't watching.
+        bool get_info(unsigned int offset, gpio_line_info_t &info);
+        bool is_used(unsigned int offset);
+        string get_consumer(unsigned int offset);
+
+        // Called on the watcher's thread for every change.  Returns an id
+        // for unsubscribe().
+        int subscribe(line_info_callback_t callback);
+        bool unsubscribe(int id);
+
+        // Info events seen since we started.
+        uint64_t get_event_count() { return m_events; }
+
+    protected:
+        void run();
+
+    private:
+        shared_ptr<GPIOChip>                        m_chip;
+        mutex                                       m_lock;             // Guards the cache and the subscribers
+        vector<gpio_line_info_t>                    m_info;
+        vector<bool>                                m_watched;
+        vector<pair<int, line_info_callback_t>>     m_subscribers;
+        int                                         m_next_id;
+        atomic<uint64_t>                            m_events;
+
+        void watch(const string &chipname, const vector<unsigned int> &offsets);
+};
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <atomic>
+using std::atomic;
+
+#include <stdint.h>
+#include <time.h>
+
+// Snapshot of a log2 histogram.  Bucket 0 holds 0 and 1, bucket i (i > 0)
+// holds values in [2^i, 2^(i+1)).  For the timing histograms the values are
+// ns, so the last bucket starts a little past 1000 seconds.
+typedef struct gpio_histogram_t
+{
+    static const size_t BUCKETS = 40;
+
+    uint64_t        count;
+    uint64_t        sum;
+    uint64_t        max;
+    uint64_t        buckets[BUCKETS];
+} gpio_histogram_t;
+
+// Mean of a histogram snapshot, 0 if it's empty.
+double gpio_histogram_mean(const gpio_histogram_t &histogram);
+
+// Upper bound of the bucket the given percentile (0.0 - 1.0) falls in.
+uint64_t gpio_histogram_percentile(const gpio_histogram_t &histogram, double percentile);
+
+// Everything we know about one line, as of the snapshot.
+typedef struct gpio_line_metrics_t
+{
+    string              name;                   // "<chip>:<line>" or "sysfs:<gpio>"
+    uint64_t            events;                 // Edge events received
+    uint64_t            lost;                   // Edge events the kernel dropped (seqno gaps)
+    uint64_t            wakeups;                // Times the event loop woke up with events
+    uint64_t            gets;
+    uint64_t            get_errors;
+    uint64_t            sets;
+    uint64_t            set_errors;
+    gpio_histogram_t    events_per_wakeup;
+    gpio_histogram_t    callback_ns;
+    gpio_histogram_t    get_ns;
+    gpio_histogram_t    set_ns;
+} gpio_line_metrics_t;
+
+/*
+    Lock-free log2 histogram.  Recording is a handful of relaxed atomic adds-
+    no locks, no allocation- so it can sit right in the event loop.
+*/
+class GPIOHistogram
+{
+    public:
+        GPIOHistogram() { reset(); }
+
+        GPIOHistogram(const GPIOHistogram &) = delete;
+        GPIOHistogram &operator=(const GPIOHistogram &) = delete;
+
+        void record(uint64_t value)
+        {
+            size_t bucket = (value < 2) ? 0 : (63 - __builtin_clzll(value));
+            if (bucket >= gpio_histogram_t::BUCKETS)
+            {
+                bucket = gpio_histogram_t::BUCKETS - 1;
+            }
+            m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+            m_count.fetch_add(1, std::memory_order_relaxed);
+            m_sum.fetch_add(value, std::memory_order_relaxed);
+
+            uint64_t max = m_max.load(std::memory_order_relaxed);
+            while ((value > max) && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed))
+            {
+                // Someone else moved it, try again against theirs.
+            }
+        }
+
+        void snapshot(gpio_histogram_t &histogram) const;
+        void reset();
+
+    private:
+        atomic<uint64_t>    m_count;
+        atomic<uint64_t>    m_sum;
+        atomic<uint64_t>    m_max;
+        atomic<uint64_t>    m_buckets[gpio_histogram_t::BUCKETS];
+};
+
+/*
+    Runtime metrics for one line.  KernelGPIO and SysFSGPIO each carry one of
+    these and bump it as they go.  Every live one is in a registry, so a
+    monitoring thread can walk all of the lines in the process without knowing
+    who owns them.
+
+    Counting is always on.  Timing get/set calls costs a pair of clock reads
+    per call, so that can be switched off process wide if it matters.
+*/
+class GPIOMetrics
+{
+    public:
+        GPIOMetrics(const string &name = "");
+        ~GPIOMetrics();
+
+        GPIOMetrics(const GPIOMetrics &) = delete;
+        GPIOMetrics &operator=(const GPIOMetrics &) = delete;
+
+        void set_name(const string &name);
+        string get_name();
+
+        // Event loop side.
+        void record_wakeup(uint64_t events)
+        {
+            m_wakeups.fetch_add(1, std::memory_order_relaxed);
+            m_events.fetch_add(events, std::memory_order_relaxed);
+            m_events_per_wakeup.record(events);
+        }
+        void record_lost(uint64_t lost) { m_lost.fetch_add(lost, std::memory_order_relaxed); }
+        void record_callback(uint64_t ns) { m_callback_ns.record(ns); }
+
+        // get/set side.  start_timer() is 0 when timing's switched off, and
+        // the record calls skip the histogram for a 0 start.
+        static uint64_t start_timer() { return s_timing ? now_ns() : 0; }
+        void record_get(uint64_t start_ns, bool ok)
+        {
+            m_gets.fetch_add(1, std::memory_order_relaxed);
+            if (!ok)
+            {
+                m_get_errors.fetch_add(1, std::memory_order_relaxed);
+            }
+            if (start_ns != 0)
+            {
+                m_get_ns.record(now_ns() - start_ns);
+            }
+        }
+        void record_set(uint64_t start_ns, bool ok)
+        {
+            m_sets.fetch_add(1, std::memory_order_relaxed);
+            if (!ok)
+            {
+                m_set_errors.fetch_add(1, std::memory_order_relaxed);
+            }
+            if (start_ns != 0)
+            {
+                m_set_ns.record(now_ns() - start_ns);
+            }
+        }
+
+        // Copy out everything.  Counters are read individually, so a snapshot
+        // taken while the line is busy can be off by an event or two between
+        // fields- it never tears a single value.
+        void snapshot(gpio_line_metrics_t &metrics);
+        void reset();
+
+        // Every live line's metrics.
+        static vector<gpio_line_metrics_t> snapshot_all();
+
+        // Time get/set calls (on by default).
+        static void set_timing(bool enable) { s_timing = enable; }
+
+        // CLOCK_MONOTONIC in ns- the clock the kernel stamps edge events with,
+        // and the one everything in here times against.
+        static uint64_t now_ns()
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+        }
+
+    private:
+        static atomic<bool>     s_timing;
+
+        string                  m_name;
+        atomic<uint64_t>        m_events;
+        atomic<uint64_t>        m_lost;
+        atomic<uint64_t>        m_wakeups;
+        atomic<uint64_t>        m_gets;
+        atomic<uint64_t>        m_get_errors;
+        atomic<uint64_t>        m_sets;
+        atomic<uint64_t>        m_set_errors;
+        GPIOHistogram           m_events_per_wakeup;
+        GPIOHistogram           m_callback_ns;
+        GPIOHistogram           m_get_ns;
+        GPIOHistogram           m_set_ns;
+
+        void snapshot_counters(gpio_line_metrics_t &metrics);
+};
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <memory>
+using std::shared_ptr;
+using std::unique_ptr;
+
+#include <stdexcept>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <gpiod.h>
+
+#include "GPIOBackend.hpp"
+#include "GPIOChip.hpp"
+#include "GPIODiag.hpp"
+#include "GPIOLineRequest.hpp"
+
+/*
+    Compile-time typed pins.  KernelGPIO works out what a line is at run time,
+    so every set_value() checks the direction and the request before it gets
+    anywhere near the kernel.  When a pin's role is fixed at design time (and
+    it usually is) that's all wasted- so here the role is in the type:
+
+        OutputPin<ActiveLow>            relay
+        InputPin<Edge::BOTH>            button
+        InputPin<Edge::NONE, ActiveLow> fault
+
+    Setting an input or waiting on edges from a line with no edge detection
+    doesn't compile.  Pins only come out of open() fully set up (nullptr
+    otherwise), so there's nothing left to check per call- set() is a call
+    straight into the backend, which for libgpiod is the one ioctl.  The
+    polarity is handled by the kernel as part of the request, so values here
+    are logical and there's no flipping on the hot path either.
+*/
+
+// Polarity tags.
+struct ActiveHigh { static const bool active_low = false; };
+struct ActiveLow { static const bool active_low = true; };
+
+// Edge detection for InputPin.
+enum class Edge
+{
+    NONE = GPIOD_LINE_EDGE_NONE,
+    RISING = GPIOD_LINE_EDGE_RISING,
+    FALLING = GPIOD_LINE_EDGE_FALLING,
+    BOTH = GPIOD_LINE_EDGE_BOTH
+};
+
+// One entry of a board pin map.
+typedef struct gpio_pin_t
+{
+    const char      *name;
+    const char      *chip;
+    unsigned int    line;
+} gpio_pin_t;
+
+// Name compare that the compiler can do for us.
+constexpr bool gpio_pin_name_equal(const char *a, const char *b)
+{
+    return (*a == *b) && ((*a == '\0') || gpio_pin_name_equal(a + 1, b + 1));
+}
+
+// Look a pin up in a constexpr board map by name.  Used to initialize a
+// constexpr, the lookup happens entirely at compile time and a name that
+// isn't on the board is a compile error:
+//
+//     constexpr gpio_pin_t BOARD[] = { { "RELAY_1", "/dev/gpiochip0", 17 }, ... };
+//     constexpr gpio_pin_t RELAY_1 = gpio_board_pin(BOARD, "RELAY_1");
+template <size_t N>
+constexpr gpio_pin_t gpio_board_pin(const gpio_pin_t (&board)[N], const char *name, size_t index = 0)
+{
+    return (index >= N) ? throw std::invalid_argument("No such pin on the board") :
+           gpio_pin_name_equal(board[index].name, name) ? board[index] : gpio_board_pin(board, name, index + 1);
+}
+
+/*
+    What the typed pins have in common- the chip, the request and the line.
+    Not for use on its own.
+*/
+class GPIOPin
+{
+    public:
+        GPIOPin(const GPIOPin &) = delete;
+        GPIOPin &operator=(const GPIOPin &) = delete;
+
+        shared_ptr<GPIOChip> get_chip() { return m_chip; }
+        unsigned int get_line() { return m_line; }
+        GPIOLineRequest *get_line_request() { return m_request.get(); }
+
+    protected:
+        GPIOPin() : m_backend(nullptr), m_line(0) {}
+
+        // Take the line with the settings.  false (and logged) on failure.
+        bool open(const string &chipname, unsigned int line, const gpio_line_settings_t &settings, const char *consumer);
+
+        shared_ptr<GPIOChip>            m_chip;
+        unique_ptr<GPIOLineRequest>     m_request;
+        GPIORequestBackend              *m_backend;         // m_request's, cached so calls go straight to it
+        unsigned int                    m_line;
+};
+
+/*
+    A line that's only ever an output.
+*/
+template <typename Polarity = ActiveHigh>
+class OutputPin : public GPIOPin
+{
+    public:
+        // nullptr if the line couldn't be had.
+        static unique_ptr<OutputPin> open(const string &chipname, unsigned int line, bool value = false)
+        {
+            gpio_line_settings_t settings;
+            settings.direction = GPIOD_LINE_DIRECTION_OUTPUT;
+            settings.active_low = Polarity::active_low;
+            settings.value = value;
+
+            unique_ptr<OutputPin> retVal(new OutputPin());
+            if (!retVal->GPIOPin::open(chipname, line, settings, "OutputPin"))
+            {
+                retVal.reset();
+            }
+
+            return retVal;
+        }
+        static unique_ptr<OutputPin> open(const gpio_pin_t &pin, bool value = false) { return open(pin.chip, pin.line, value); }
+
+        GPIOStatus set(bool value) { return m_backend->set_value(m_line, value); }
+        GPIOStatus on() { return m_backend->set_value(m_line, true); }
+        GPIOStatus off() { return m_backend->set_value(m_line, false); }
+
+        // What the line's being driven to.
+        GPIOStatus read(bool &value) { return m_backend->read_value(m_line, value); }
+
+    private:
+        OutputPin() {}
+};
+
+/*
+    A line that's only ever an input, with (or without) edge detection.
+*/
+template <Edge EdgeMode = Edge::NONE, typename Polarity = ActiveHigh>
+class InputPin : public GPIOPin
+{
+    public:
+        // nullptr if the line couldn't be had.
+        static unique_ptr<InputPin> open(const string &chipname, unsigned int line,
+                                         enum gpiod_line_bias bias = GPIOD_LINE_BIAS_AS_IS, unsigned long debounce_us = 0)
+        {
+            gpio_line_settings_t settings;
+            settings.direction = GPIOD_LINE_DIRECTION_INPUT;
+            settings.edge = (enum gpiod_line_edge) EdgeMode;
+            settings.bias = bias;
+            settings.active_low = Polarity::active_low;
+            settings.debounce_us = debounce_us;
+
+            unique_ptr<InputPin> retVal(new InputPin());
+            if (!retVal->GPIOPin::open(chipname, line, settings, "InputPin"))
+            {
+                retVal.reset();
+            }
+
+            return retVal;
+        }
+        static unique_ptr<InputPin> open(const gpio_pin_t &pin, enum gpiod_line_bias bias = GPIOD_LINE_BIAS_AS_IS,
+                                         unsigned long debounce_us = 0)
+        {
+            return open(pin.chip, pin.line, bias, debounce_us);
+        }
+
+        GPIOStatus read(bool &value) { return m_backend->read_value(m_line, value); }
+
+        // Plain bool version- failures read as inactive.
+        bool get() { bool value = false; m_backend->read_value(m_line, value); return value; }
+
+        // Edge events.  Only there if the pin's watching for edges.
+        int get_fd()
+        {
+            static_assert(EdgeMode != Edge::NONE, "InputPin has no edge detection");
+            return m_backend->get_fd();
+        }
+        int wait_edge_events(int64_t timeout_ns)
+        {
+            static_assert(EdgeMode != Edge::NONE, "InputPin has no edge detection");
+            return m_backend->wait_edge_events(timeout_ns);
+        }
+        int read_edge_events(gpio_edge_event_t *events, size_t max_events)
+        {
+            static_assert(EdgeMode != Edge::NONE, "InputPin has no edge detection");
+            int retVal = m_backend->read_edge_events(events, max_events);
+            for (int i = 0; i < retVal; i++)
+            {
+                events[i].index = 0;
+            }
+            return retVal;
+        }
+
+    private:
+        InputPin() {}
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <memory>
+using std::unique_ptr;
+
+#include <atomic>
+using std::atomic;
+
+#include <stdint.h>
+
+#include "GPIOLineRequest.hpp"
+#include "SeqLock.hpp"
+#include "LoopThread.hpp"
+
+// One tick's worth of line levels.
+typedef struct gpio_sample_t
+{
+    uint64_t        sequence;           // Counts up from 1, one per tick
+    uint64_t        timestamp_ns;       // CLOCK_MONOTONIC
+    uint64_t        values;             // Bitmask by index within the group
+} gpio_sample_t;
+
+/*
+    Fixed rate sampler for groups of input lines that don't have usable edge
+    interrupts.  Every tick of a timerfd reads the whole group with one bulk
+    get_values call and publishes the snapshot to a "latest" slot and a ring of
+    recent history.  Both are seqlocked, so any number of readers can get at
+    current (or recent) state with no syscalls and no locks.
+*/
+class GPIOSampler : public LoopThread
+{
+    public:
+        // history is rounded up to a power of two.
+        GPIOSampler(const string &chipname, const vector<unsigned int> &offsets, uint64_t period_ns,
+                    size_t history = 1024, enum gpiod_line_bias bias = GPIOD_LINE_BIAS_AS_IS);
+        ~GPIOSampler();
+
+        GPIOSampler(const GPIOSampler &) = delete;
+        GPIOSampler &operator=(const GPIOSampler &) = delete;
+
+        bool is_open() { return (m_request != nullptr) && m_request->is_requested(); }
+
+        // The most recent snapshot.  Sequence 0 means we haven't ticked yet.
+        gpio_sample_t latest() const { return m_latest.load(); }
+
+        // One line's level out of the most recent snapshot.
+        bool get_value(unsigned int offset) const;
+
+        // Copy out up to max snapshots newer than sequence "after", oldest
+        // first.  Anything that's already fallen off the ring is skipped.
+        size_t read(uint64_t after, gpio_sample_t *samples, size_t max) const;
+
+        // Ticks we missed because we didn't get scheduled in time.
+        uint64_t get_overruns() const { return m_overruns; }
+
+    protected:
+        void run();
+
+    private:
+        unique_ptr<GPIOLineRequest>             m_request;
+        uint64_t                                m_period_ns;
+        int                                     m_timer_fd;
+        SeqLock<gpio_sample_t>                  m_latest;
+        unique_ptr<SeqLock<gpio_sample_t>[]>    m_ring;
+        size_t                                  m_ring_mask;
+        atomic<uint64_t>                        m_overruns;
+};
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <algorithm>
+
+#include <mutex>
+using std::mutex;
+using std::lock_guard;
+
+#include <atomic>
+using std::atomic;
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "SeqLock.hpp"
+
+// One line's published state.
+typedef struct gpio_line_state_t
+{
+    uint64_t        timestamp_ns;           // Kernel timestamp of the last edge, CLOCK_MONOTONIC
+    uint64_t        edges;                  // Edges seen since the line was published
+    uint64_t        lost;                   // Edges the kernel dropped on us
+    uint64_t        value;                  // Level (logical) after the last edge
+} gpio_line_state_t;
+
+/*
+    Layout of the shared segment.  The header and slot descriptions are
+    written once, before num_lines is bumped (release) to make the slot
+    visible- after that only the seqlocked state changes.  Every slot has its
+    own seqlock and its own single writer, the thread of whatever owns the line.
+*/
+static const uint32_t GPIO_STATE_MAGIC = 0x47504953;        // "GPIS"
+static const uint32_t GPIO_STATE_VERSION = 1;
+static const size_t GPIO_STATE_NAME_SIZE = 32;
+
+typedef struct gpio_state_slot_t
+{
+    char                            chip[GPIO_STATE_NAME_SIZE];
+    char                            name[GPIO_STATE_NAME_SIZE];
+    uint32_t                        offset;
+    SeqLock<gpio_line_state_t>      state;
+} gpio_state_slot_t;
+
+typedef struct gpio_state_header_t
+{
+    atomic<uint32_t>                magic;                  // Stored (release) last, once the rest is built
+    uint32_t                        version;
+    uint32_t                        capacity;
+    atomic<uint32_t>                num_lines;
+} gpio_state_header_t;
+
+/*
+    Publishes line state into a POSIX shared memory segment, so processes other
+    than the one that owns the lines can see them without asking over some
+    IPC or other.  Readers (GPIOStateReader) map the segment read-only and
+    get consistent snapshots with no syscalls and no locks.
+
+    The owner adds a slot per line and hands it to the line's dispatcher
+    (KernelGPIO::set_publisher()), which publishes from its event thread.
+    The segment goes away with the publisher.
+*/
+class GPIOStatePublisher
+{
+    public:
+        // name is a shm_open() name ("/something").  An existing segment by
+        // that name is replaced.
+        GPIOStatePublisher(const string &name, size_t capacity = 64);
+        ~GPIOStatePublisher();
+
+        GPIOStatePublisher(const GPIOStatePublisher &) = delete;
+        GPIOStatePublisher &operator=(const GPIOStatePublisher &) = delete;
+
+        bool is_open() { return m_header != nullptr; }
+        const string &get_name() { return m_name; }
+
+        // Add a line.  Names longer than the slot's are truncated.  Returns
+        // the slot, -1 if we're full (or not open).
+        int add_line(const string &chip, unsigned int offset, const string &name);
+
+        // Writer side- only ever one thread per slot.  Adds the edges and
+        // lost counts to the slot's running totals.
+        void publish(int slot, bool value, uint64_t timestamp_ns, uint64_t edges = 0, uint64_t lost = 0);
+
+    private:
+        string                  m_name;
+        size_t                  m_size;
+        gpio_state_header_t     *m_header;
+        gpio_state_slot_t       *m_slots;
+        gpio_line_state_t       *m_shadow;          // Writer's copy of each slot, so publishing never reads the segment
+        mutex                   m_lock;             // Guards adding slots
+};
+
+/*
+    The other end- maps a publisher's segment read-only.  Reads never block
+    the publisher and never make a syscall.
+*/
+class GPIOStateReader
+{
+    public:
+        GPIOStateReader(const string &name);
+        ~GPIOStateReader();
+
+        GPIOStateReader(const GPIOStateReader &) = delete;
+        GPIOStateReader &operator=(const GPIOStateReader &) = delete;
+
+        bool is_open() { return m_header != nullptr; }
+
+        // Slots published so far.  The count comes from the segment, so it's
+        // held to the capacity we checked the segment's size against.
+        size_t get_num_lines() { return (m_header != nullptr) ? std::min<size_t>(m_header->num_lines.load(std::memory_order_acquire), m_capacity) : 0; }
+
+        // Find a slot by line name, -1 if there isn't one.
+        int find(const string &name);
+
+        // A slot's description and current state.  false for a bad slot.
+        bool get_line(int slot, string &chip, unsigned int &offset, string &name);
+        bool read(int slot, gpio_line_state_t &state);
+
+        // Bumps on every publish to the slot, 0 if it's a bad slot.
+        uint32_t sequence(int slot);
+
+    private:
+        size_t                  m_size;
+        size_t                  m_capacity;
+        const gpio_state_header_t   *m_header;
+        const gpio_state_slot_t     *m_slots;
+
+        bool valid(int slot) { return (slot >= 0) && ((size_t) slot < get_num_lines()); }
+};
@@ -11,12 +11,18 @@ using std::flush;
 #include <mutex>
 using std::mutex;
 using std::lock_guard;
+using std::unique_lock;
+
+#include <condition_variable>
+using std::condition_variable;
 
 #include <atomic>
 using std::atomic;
 using std::memory_order;
 
-#include <Runable.hpp>
+#include <memory>
+using std::shared_ptr;
+using std::unique_ptr;
 
 // We're using the simpler (albeit only SLIGHTLY so..) C API for libgpiod
 // as the C++ wrapper, especially in the 2.x api where they radically cnaged
@@ -28,6 +34,13 @@ using std::memory_order;
 //really.  VERY disappointing.
 #include <gpiod.h>
 
+#include "GPIOChip.hpp"
+#include "GPIODiag.hpp"
+#include "GPIOLineRequest.hpp"
+#include "GPIOMetrics.hpp"
+#include "GPIOStatePublisher.hpp"
+#include "LoopThread.hpp"
+
 /*
     Provide for easy-ish use of libgpiod without having to deal with the C++ wrapper
     as it's kind of painful to use compared to the C API.  This works generically
@@ -35,7 +48,7 @@ using std::memory_order;
     and interface.  The main problem with the C++ wrapper is that it tries to handle
     each and every kind of situation with pins...this one just cares whether
 */
-class KernelGPIO : public Runable
+class KernelGPIO : public LoopThread
 {
     public:
         // Declare out a cleaner, simpler direction typedef
@@ -59,11 +72,33 @@ class KernelGPIO : public Runable
         // passed in as a nullptr, we don't handle callbacks.
         typedef void (*gpio_callback_t)(bool value);
 
+        // What happened on the line since the last notification.  With no
+        // rate limit that's always the one edge.
+        typedef struct gpio_edge_summary_t
+        {
+            uint64_t    edges;                  // Edges folded into this notification
+            uint64_t    first_ns;               // Timestamp of the first of them
+            uint64_t    last_ns;                // Timestamp of the last of them
+            bool        value;                  // Level after the last of them
+        } gpio_edge_summary_t;
+        typedef void (*gpio_summary_callback_t)(const gpio_edge_summary_t &summary);
+
         // We open to the chip and line number we're interested in, failure blocks other calls.
-        KernelGPIO(string chipname, size_t line);
+        // The chip itself is shared with every other KernelGPIO on it via GPIOChip.
+        KernelGPIO(const string &chipname, size_t line);
+
+        // Same, but we find the chip and line by the line's name (e.g. "RELAY_3").
+        // Resolution is done out of GPIOChip's cached line name index.
+        explicit KernelGPIO(const string &linename);
         ~KernelGPIO();
 
+        // Factory for by-name lines.  Returns nullptr if the name isn't known
+        // to the system or the line couldn't be opened, instead of handing you
+        // back an object that'll fail every call.
+        static unique_ptr<KernelGPIO> from_name(const string &linename);
+
         // This can (re-)configure the GPIO line to the right mode, behavior, etc.
+        // Reconfiguring a line we already hold is done in place, without letting go of it.
         // An error will leave the object in a non-configured state...
         bool configure(gpio_direction_t direction = INPUT, bool active_low = false, gpio_edge_t edge = NONE, bool value = false);
 
@@ -71,17 +106,48 @@ class KernelGPIO : public Runable
         // Ignored if we're not in edge detection mode, can be set to NULL to turn this off.
         void set_callback(gpio_callback_t callback) { m_callback = callback; }
 
-        // Line value getter/setter.
+        // Same, but with the summary of the edges behind the notification.
+        // Both callbacks are called if both are set.
+        void set_summary_callback(gpio_summary_callback_t callback) { m_summary_callback = callback; }
+
+        // Deliver at most max_notifications per window_ns, however fast the
+        // line toggles.  Edges past the limit are folded into one summary
+        // that's delivered when the window rolls over.  Zero turns it off
+        // (every edge is a notification, which is the default).
+        void set_rate_limit(unsigned int max_notifications, uint64_t window_ns);
+
+        // Publish the line's level, last edge time and edge/lost counts to a
+        // shared memory segment from the event thread, as name (chip:line if
+        // empty).  Only lines with edge detection on are published.  nullptr
+        // stops publishing.  Once this returns the event thread is done with
+        // the old publisher, so it can go- except when it's called from one
+        // of our own callbacks, where that's once the callback returns.
+        bool set_publisher(GPIOStatePublisher *publisher, const string &name = "");
+
+        // Line value getter/setter.  set_value() and read_value() are the hot
+        // path- they hand back a status instead of logging.  get_value() is the
+        // plain bool version, failures read as false and go to GPIODiag.
         bool get_value();
-        bool set_value(bool value);
+        GPIOStatus read_value(bool &value);
+        GPIOStatus set_value(bool value);
 
         // Info about the GPIO chip and line defined by this object and config.
+        bool is_open() { return m_chip != nullptr; }
         string get_chipname() { return chipname; }
         size_t get_line() { return m_line_num; }
         gpio_direction_t get_direction() { return m_direction; }
         gpio_edge_t get_edge() { return m_edge; }
         bool get_active_low() { return m_active_low; }
 
+        // The request behind this line, for the engines that drive or watch
+        // lines in bulk (WaveformEngine and friends).  nullptr if not open.
+        GPIOLineRequest *get_line_request() { return m_request.get(); }
+
+        // Event, callback and get/set metrics for this line.  Also reachable
+        // for every live line through GPIOMetrics::snapshot_all().
+        gpio_line_metrics_t get_metrics() { gpio_line_metrics_t retVal; m_metrics.snapshot(retVal); return retVal; }
+        void reset_metrics() { m_metrics.reset(); }
+
     protected:
         void run();
 
@@ -92,12 +158,26 @@ class KernelGPIO : public Runable
         atomic<gpio_edge_t>         m_edge;
         atomic<bool>                m_active_low;
         atomic<gpio_callback_t>     m_callback;
+        atomic<gpio_summary_callback_t> m_summary_callback;
+        atomic<unsigned int>        m_max_notifications;
+        atomic<uint64_t>            m_window_ns;
+        mutex                       m_publish_lock;     // Guards the publisher and slot, read by the event thread on wakeup
+        GPIOStatePublisher          *m_publisher;
+        int                         m_publish_slot;
+        atomic<uint64_t>            m_publish_generation;   // Bumped on every set_publisher()
+        uint64_t                    m_publish_seen;     // The generation the event thread has picked up
+        bool                        m_publish_running;  // The event thread's in run(), to pick it up
+        condition_variable          m_publish_cond;     // Signalled when the event thread picks one up (or goes)
         unsigned int                m_line_num;
-        struct gpiod_chip           *m_chip;
-        struct gpiod_line           *m_line;
-        struct gpiod_line_request   *m_request;
+        shared_ptr<GPIOChip>        m_chip;
+        unique_ptr<GPIOLineRequest> m_request;
+        GPIOMetrics                 m_metrics;
 
         // Helper functions
+        void open_line(size_t line);
+        void notify(const gpio_edge_summary_t &summary);
+        void refresh_publisher(GPIOStatePublisher *&publisher, int &slot);
+        void stop_events();
         void release_request();
         void close_chip();
 };
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <memory>
+using std::shared_ptr;
+using std::unique_ptr;
+
+#include <gpiod.h>
+
+#include "GPIOBackend.hpp"
+
+/*
+    The real thing- a GPIO chip character device through libgpiod.  This is
+    the default backend for any path GPIOChip doesn't have another backend
+    registered for.
+*/
+class LibgpiodChip : public GPIOChipBackend
+{
+    public:
+        // Opens the chip.  nullptr on failure.
+        static shared_ptr<LibgpiodChip> open(const string &path);
+        ~LibgpiodChip();
+
+        LibgpiodChip(const LibgpiodChip &) = delete;
+        LibgpiodChip &operator=(const LibgpiodChip &) = delete;
+
+        string get_name() { return m_name; }
+        string get_label() { return m_label; }
+        size_t get_num_lines() { return m_num_lines; }
+        string get_line_name(unsigned int offset);
+        unique_ptr<GPIORequestBackend> request_lines(const vector<unsigned int> &offsets,
+                                                     const vector<gpio_line_settings_t> &settings,
+                                                     const string &consumer, size_t event_buffer_size);
+        bool get_line_info(unsigned int offset, gpio_line_info_t &info);
+        bool watch_line_info(unsigned int offset, gpio_line_info_t &info);
+        bool unwatch_line_info(unsigned int offset);
+        int get_info_fd();
+        bool read_info_event(gpio_info_event_t &event);
+        struct gpiod_chip *get_gpiod_chip() { return m_chip; }
+
+    private:
+        LibgpiodChip(struct gpiod_chip *chip);
+
+        // Copy libgpiod's line info out and free it.  false for nullptr.
+        static bool take_line_info(struct gpiod_line_info *raw, gpio_line_info_t &info, bool free_it);
+
+        struct gpiod_chip           *m_chip;
+        string                      m_name;
+        string                      m_label;
+        size_t                      m_num_lines;
+};
+
+/*
+    A libgpiod line request.  The settings and config objects are kept around
+    for the life of the request instead of being built fresh every time, and
+    reconfigure() goes through gpiod_line_request_reconfigure_lines() so the
+    lines never leave our hands.
+*/
+class LibgpiodRequest : public GPIORequestBackend
+{
+    public:
+        LibgpiodRequest(const vector<unsigned int> &offsets);
+        ~LibgpiodRequest();
+
+        LibgpiodRequest(const LibgpiodRequest &) = delete;
+        LibgpiodRequest &operator=(const LibgpiodRequest &) = delete;
+
+        // Take the lines.  Only used by LibgpiodChip::request_lines().
+        bool request(struct gpiod_chip *chip, const vector<gpio_line_settings_t> &settings,
+                     const string &consumer, size_t event_buffer_size);
+
+        bool reconfigure(const vector<gpio_line_settings_t> &settings);
+        GPIOStatus read_value(unsigned int offset, bool &value);
+        GPIOStatus set_value(unsigned int offset, bool value);
+        GPIOStatus get_values(uint64_t &values);
+        GPIOStatus set_values(uint64_t mask, uint64_t values);
+        int get_fd();
+        int wait_edge_events(int64_t timeout_ns);
+        int read_edge_events(gpio_edge_event_t *events, size_t max_events);
+
+    private:
+        vector<unsigned int>            m_offsets;
+        struct gpiod_line_request       *m_request;
+        struct gpiod_line_settings      *m_line_settings;   // Scratch, reused for every line
+        struct gpiod_line_config        *m_line_config;     // Reused for every (re)configure
+        struct gpiod_edge_event_buffer  *m_event_buffer;
+
+        bool build_config(const vector<gpio_line_settings_t> &settings);
+};
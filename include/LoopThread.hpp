@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <Runable.hpp>
+
+#include "ThreadPolicy.hpp"
+#include "WakeupFD.hpp"
+
+/*
+    What every one of the loops in here is built on- a Runable thread with a
+    ThreadPolicy, and the wakeup fd it polls alongside whatever it's really
+    waiting on so it notices stop() (and configuration changes) promptly.
+
+    stop_loop() brings the thread down and waits for it.  Call it first thing
+    in the destructor- run() is working on the derived object's members, so
+    it has to be done before any of them go.
+*/
+class LoopThread : public Runable, public ThreadPolicy
+{
+    protected:
+        LoopThread(const string &thread_name) : ThreadPolicy(thread_name) {}
+        ~LoopThread() {}
+
+        void stop_loop()
+        {
+            if (isRunning())
+            {
+                stop();
+                m_wake.signal();
+                join();
+                if (NULL != _thread)
+                {
+                    delete _thread;
+                    _thread = NULL;
+                }
+            }
+        }
+
+        WakeupFD                        m_wake;
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <memory>
+using std::unique_ptr;
+
+#include <atomic>
+using std::atomic;
+
+#include <stdint.h>
+
+#include "GPIOLineRequest.hpp"
+#include "LoopThread.hpp"
+
+/*
+    Quadrature (rotary/linear) encoder decoder.  The A and B lines, and the
+    optional index line, are held in one request with both edges detected, so
+    the kernel hands us every edge on all of them in order with timestamps.  We
+    drain them in batches and run each through a table driven state machine,
+    which is about as cheap as decoding gets and keeps up with whatever rate
+    the kernel can deliver.
+
+    Position is an atomic counter- read it from anywhere, any time.  Edges
+    that don't make sense (a line "changing" to the level it's already at,
+    meaning we lost one) are counted as illegal transitions rather than being
+    folded into the position.
+*/
+class QuadratureEncoder : public LoopThread
+{
+    public:
+        static const unsigned int NO_INDEX = ~0U;
+
+        QuadratureEncoder(const string &chipname, unsigned int line_a, unsigned int line_b,
+                          unsigned int line_index = NO_INDEX, unsigned long debounce_us = 0,
+                          enum gpiod_line_bias bias = GPIOD_LINE_BIAS_AS_IS);
+        ~QuadratureEncoder();
+
+        QuadratureEncoder(const QuadratureEncoder &) = delete;
+        QuadratureEncoder &operator=(const QuadratureEncoder &) = delete;
+
+        bool is_open() { return (m_request != nullptr) && m_request->is_requested(); }
+
+        // Position in counts (four per cycle of A/B).
+        int64_t get_position() const { return m_position.load(std::memory_order_relaxed); }
+        void set_position(int64_t position) { m_position.store(position, std::memory_order_relaxed); }
+
+        // Counts per second, over the velocity window.  Windows under 1ms are
+        // taken as 1ms- the loop wakes up once a window.
+        double get_velocity() const { return m_velocity.load(std::memory_order_relaxed); }
+        void set_velocity_window_ns(uint64_t window_ns);
+
+        // Zero the position on every rising edge of the index line.
+        void set_index_reset(bool enable) { m_index_reset = enable; }
+        uint64_t get_index_count() const { return m_index_count; }
+
+        // Trouble counters...
+        uint64_t get_illegal() const { return m_illegal; }
+        uint64_t get_lost() const { return m_lost; }
+
+    protected:
+        void run();
+
+    private:
+        unique_ptr<GPIOLineRequest>     m_request;
+        uint64_t                        m_a_mask;
+        uint64_t                        m_b_mask;
+        uint64_t                        m_index_mask;
+        unsigned int                    m_state;            // (A << 1) | B
+        unsigned long                   m_last_seqno;
+        atomic<int64_t>                 m_position;
+        atomic<double>                  m_velocity;
+        atomic<uint64_t>                m_window_ns;
+        atomic<bool>                    m_index_reset;
+        atomic<uint64_t>                m_index_count;
+        atomic<uint64_t>                m_illegal;
+        atomic<uint64_t>                m_lost;
+};
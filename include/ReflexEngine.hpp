@@ -0,0 +1,130 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <queue>
+using std::priority_queue;
+
+#include <memory>
+using std::unique_ptr;
+
+#include <mutex>
+using std::mutex;
+using std::lock_guard;
+
+#include <stdint.h>
+
+#include "GPIOLineRequest.hpp"
+#include "GPIOMetrics.hpp"
+#include "LoopThread.hpp"
+
+// What a rule does to its output lines.
+typedef enum reflex_action_t
+{
+    REFLEX_SET,
+    REFLEX_CLEAR,
+    REFLEX_TOGGLE
+} reflex_action_t;
+
+// On this edge of the input, do this to the outputs in mask (by index in the
+// output request).  The delay is counted from the edge's kernel timestamp.
+// Once a rule fires, further triggers are ignored for holdoff_ns.
+typedef struct reflex_rule_t
+{
+    unsigned int            input;
+    enum gpiod_line_edge    edge = GPIOD_LINE_EDGE_RISING;
+    reflex_action_t         action = REFLEX_SET;
+    uint64_t                mask = 0;
+    uint64_t                delay_ns = 0;
+    uint64_t                holdoff_ns = 0;
+} reflex_rule_t;
+
+typedef struct reflex_stats_t
+{
+    uint64_t            triggers;           // Rule firings
+    uint64_t            held_off;           // Triggers ignored for hold-off
+    uint64_t            writes;
+    uint64_t            write_errors;
+    uint64_t            lost;               // Input events the kernel dropped
+    gpio_histogram_t    latency_ns;         // Edge timestamp to write done, undelayed rules
+    gpio_histogram_t    late_ns;            // Due time to write done, delayed rules
+} reflex_stats_t;
+
+/*
+    Reflexes- "when the limit switch trips, cut the relay"- run right in the
+    event thread instead of going out through a callback and back in through
+    another line's set_value().  Everything that fires off one batch of
+    events is folded into a single bulk write, so an interlock costs one event
+    read and one write.
+
+    The inputs are requested here (both edges, the rules pick which ones they
+    care about).  The output request belongs to the caller, has to outlive us
+    and needs its lines already configured as outputs.
+*/
+class ReflexEngine : public LoopThread
+{
+    public:
+        ReflexEngine(const string &chipname, const vector<unsigned int> &inputs, GPIOLineRequest *outputs);
+        ~ReflexEngine();
+
+        ReflexEngine(const ReflexEngine &) = delete;
+        ReflexEngine &operator=(const ReflexEngine &) = delete;
+
+        bool is_open() { return (m_request != nullptr) && m_request->is_requested(); }
+
+        // Returns a rule id, -1 if the input isn't ours or there's nothing to drive.
+        int add_rule(const reflex_rule_t &rule);
+        bool remove_rule(int id);
+
+        // Drop any delayed actions that haven't happened yet.
+        void cancel_pending();
+
+        reflex_stats_t get_stats();
+        void reset_stats();
+
+    protected:
+        void run();
+
+    private:
+        typedef struct rule_entry_t
+        {
+            int                 id;
+            reflex_rule_t       rule;
+            int                 input_index;
+            uint64_t            holdoff_until;
+        } rule_entry_t;
+
+        // An action waiting out its rule's delay.
+        typedef struct delayed_t
+        {
+            uint64_t            due_ns;
+            reflex_action_t     action;
+            uint64_t            mask;
+        } delayed_t;
+
+        typedef struct delayed_later_t
+        {
+            bool operator()(const delayed_t &a, const delayed_t &b) const { return a.due_ns > b.due_ns; }
+        } delayed_later_t;
+
+        unique_ptr<GPIOLineRequest>     m_request;
+        GPIOLineRequest                 *m_outputs;
+        mutex                           m_lock;             // Guards the rules, the delayed actions and the counters
+        vector<rule_entry_t>            m_rules;
+        priority_queue<delayed_t, vector<delayed_t>, delayed_later_t> m_delayed;
+        int                             m_next_id;
+
+        uint64_t                        m_triggers;
+        uint64_t                        m_held_off;
+        uint64_t                        m_writes;
+        uint64_t                        m_write_errors;
+        uint64_t                        m_lost;
+        GPIOHistogram                   m_latency;
+        GPIOHistogram                   m_late;
+
+        static void apply(reflex_action_t action, uint64_t mask, uint64_t &values);
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+using std::atomic;
+using std::memory_order_relaxed;
+using std::memory_order_acquire;
+using std::memory_order_release;
+using std::atomic_thread_fence;
+
+#include <type_traits>
+
+/*
+    Single writer, any number of readers sequence lock around a small, plain
+    data value.  The writer never waits on readers and readers never take a
+    lock or make a syscall- they just retry if they caught the writer mid
+    update.  The value is held as relaxed atomic words (rather than memcpy'd
+    about under the fences) so readers racing the writer is well defined.
+
+    Everything in here is plain atomics, so it works as-is in memory shared
+    between processes as long as 64 bit atomics are lock-free on the target.
+*/
+template <typename T>
+class SeqLock
+{
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLock needs a trivially copyable type");
+
+    public:
+        SeqLock() : m_seq(0)
+        {
+            for (auto &word : m_words)
+            {
+                word.store(0, memory_order_relaxed);
+            }
+        }
+
+        SeqLock(const SeqLock &) = delete;
+        SeqLock &operator=(const SeqLock &) = delete;
+
+        // Writer side.  Only ever one writer at a time.
+        void store(const T &value)
+        {
+            uint64_t words[WORDS] = {};
+            uint32_t seq = m_seq.load(memory_order_relaxed);
+
+            memcpy(words, &value, sizeof(T));
+
+            m_seq.store(seq + 1, memory_order_relaxed);
+            atomic_thread_fence(memory_order_release);
+            for (size_t i = 0; i < WORDS; i++)
+            {
+                m_words[i].store(words[i], memory_order_relaxed);
+            }
+            m_seq.store(seq + 2, memory_order_release);
+        }
+
+        // Reader side.  One attempt- false if we raced the writer.
+        bool try_load(T &value) const
+        {
+            uint64_t words[WORDS];
+            uint32_t before = m_seq.load(memory_order_acquire);
+
+            if (before & 0x01)
+            {
+                return false;
+            }
+
+            for (size_t i = 0; i < WORDS; i++)
+            {
+                words[i] = m_words[i].load(memory_order_relaxed);
+            }
+            atomic_thread_fence(memory_order_acquire);
+
+            if (m_seq.load(memory_order_relaxed) != before)
+            {
+                return false;
+            }
+
+            memcpy(&value, words, sizeof(T));
+            return true;
+        }
+
+        // Reader side.  Retries until it gets a consistent copy.
+        T load() const
+        {
+            T retVal;
+            while (!try_load(retVal))
+            {
+                // Writer's mid-update, go again.
+            }
+            return retVal;
+        }
+
+        // Bumps by two for every store.  Handy for "has anything changed?"
+        uint32_t sequence() const { return m_seq.load(memory_order_acquire); }
+
+    private:
+        static const size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+        atomic<uint32_t>    m_seq;
+        atomic<uint64_t>    m_words[WORDS];
+};
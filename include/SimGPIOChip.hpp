@@ -0,0 +1,165 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <deque>
+using std::deque;
+
+#include <map>
+using std::map;
+
+#include <memory>
+using std::shared_ptr;
+using std::unique_ptr;
+using std::enable_shared_from_this;
+
+#include <mutex>
+using std::mutex;
+using std::lock_guard;
+
+#include <stdint.h>
+
+#include "GPIOBackend.hpp"
+#include "WakeupFD.hpp"
+
+class SimGPIORequest;
+
+/*
+    An in-process GPIO chip.  No kernel, no hardware- lines are just levels
+    in memory, which makes it the thing to run the engines against in a test
+    or a benchmark.  Create one and open it through GPIOChip (or anything that
+    takes a chip name) by the same "sim:..." path:
+
+        SimGPIOChip::create("sim:bench", 8);
+        KernelGPIO pin("sim:bench", 3);
+
+    Requests behave like the kernel's as far as the engines can tell- a line
+    can only be held by one request, edge events carry timestamps and global
+    and per-line seqnos, the request's fd polls readable while events are
+    pending, and a full event buffer drops the oldest event (the seqnos still
+    count it, so lost events show up as gaps).  Watched lines get info events
+    when they're requested, reconfigured or released.
+*/
+class SimGPIOChip : public GPIOChipBackend, public enable_shared_from_this<SimGPIOChip>
+{
+    public:
+        static const char *PREFIX;
+
+        // Make a chip at the path (which has to start with PREFIX) and keep
+        // it until remove().  Returns the existing chip if there already is
+        // one at the path.
+        static shared_ptr<SimGPIOChip> create(const string &path, size_t num_lines, const string &label = "sim");
+        static shared_ptr<SimGPIOChip> find(const string &path);
+        static void remove(const string &path);
+
+        SimGPIOChip(const SimGPIOChip &) = delete;
+        SimGPIOChip &operator=(const SimGPIOChip &) = delete;
+
+        string get_name() { return m_name; }
+        string get_label() { return m_label; }
+        size_t get_num_lines() { return m_lines.size(); }
+        string get_line_name(unsigned int offset);
+        unique_ptr<GPIORequestBackend> request_lines(const vector<unsigned int> &offsets,
+                                                     const vector<gpio_line_settings_t> &settings,
+                                                     const string &consumer, size_t event_buffer_size);
+        bool get_line_info(unsigned int offset, gpio_line_info_t &info);
+        bool watch_line_info(unsigned int offset, gpio_line_info_t &info);
+        bool unwatch_line_info(unsigned int offset);
+        int get_info_fd() { return m_info_pending.get_fd(); }
+        bool read_info_event(gpio_info_event_t &event);
+
+        // The "outside world" side of the chip.  Levels here are physical.
+        void set_line_name(unsigned int offset, const string &name);
+
+        // Drive an input.  An edge is raised if the level changes and a
+        // request is watching for it.  False if the line's bad or is an
+        // output somebody holds.
+        bool set_input(unsigned int offset, bool level);
+
+        // Toggle an input edges times as fast as we can, with the event
+        // timestamps spaced period_ns apart.  Returns the number of edges
+        // injected.
+        size_t inject_burst(unsigned int offset, size_t edges, uint64_t period_ns);
+
+        // The level a line is at, 1 or 0, -1 if the line's bad.
+        int get_output(unsigned int offset);
+
+    private:
+        friend class SimGPIORequest;
+
+        typedef struct sim_line_t
+        {
+            string              name;
+            string              consumer;
+            bool                watched = false;
+            bool                level = false;
+            SimGPIORequest      *owner = nullptr;
+            unsigned int        index = 0;          // Index within the owner's request
+        } sim_line_t;
+
+        SimGPIOChip(const string &path, size_t num_lines, const string &label);
+
+        // Hand an edge on the line to whoever holds it.  Caller holds m_lock.
+        void deliver_edge(unsigned int offset, uint64_t timestamp_ns);
+
+        // Line info as of now, and queueing a change to it for the watchers.
+        // Caller holds m_lock.
+        void fill_line_info(unsigned int offset, gpio_line_info_t &info);
+        void info_event(unsigned int offset, enum gpiod_info_event_type type);
+
+        string                  m_name;
+        string                  m_label;
+        vector<sim_line_t>      m_lines;
+        deque<gpio_info_event_t> m_info_events;
+        WakeupFD                m_info_pending;     // Readable while info events are pending
+        mutex                   m_lock;             // Guards the lines, the info events and every request on the chip
+
+        static mutex                                    s_lock;
+        static map<string, shared_ptr<SimGPIOChip>>     s_chips;
+};
+
+/*
+    A request on a SimGPIOChip.  Everything is guarded by the chip's lock.
+*/
+class SimGPIORequest : public GPIORequestBackend
+{
+    public:
+        ~SimGPIORequest();
+
+        SimGPIORequest(const SimGPIORequest &) = delete;
+        SimGPIORequest &operator=(const SimGPIORequest &) = delete;
+
+        bool reconfigure(const vector<gpio_line_settings_t> &settings);
+        GPIOStatus read_value(unsigned int offset, bool &value);
+        GPIOStatus set_value(unsigned int offset, bool value);
+        GPIOStatus get_values(uint64_t &values);
+        GPIOStatus set_values(uint64_t mask, uint64_t values);
+        int get_fd() { return m_pending.get_fd(); }
+        int wait_edge_events(int64_t timeout_ns);
+        int read_edge_events(gpio_edge_event_t *events, size_t max_events);
+
+    private:
+        friend class SimGPIOChip;
+
+        SimGPIORequest(shared_ptr<SimGPIOChip> chip, const vector<unsigned int> &offsets,
+                       const vector<gpio_line_settings_t> &settings, size_t event_buffer_size);
+
+        // Apply the settings to the chip's lines.  Caller holds the chip lock.
+        void apply_settings(const vector<gpio_line_settings_t> &settings);
+
+        // The physical level on a held line moved.  Caller holds the chip lock.
+        void edge_event(unsigned int index, bool level, uint64_t timestamp_ns);
+
+        shared_ptr<SimGPIOChip>         m_chip;
+        vector<unsigned int>            m_offsets;
+        vector<gpio_line_settings_t>    m_settings;
+        deque<gpio_edge_event_t>        m_events;
+        size_t                          m_capacity;
+        unsigned long                   m_global_seqno;
+        vector<unsigned long>           m_line_seqno;
+        WakeupFD                        m_pending;          // Readable while events are pending
+};
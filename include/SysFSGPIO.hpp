@@ -49,16 +49,23 @@
 #if defined(__linux__)
 
 #include <NONCOPY.hpp>
-#include <Runable.hpp>
+#include <ThreadPolicy.hpp>
+#include <GPIOMetrics.hpp>
 #include <unistd.h>
 
 #include <functional>
 using std::function;
 
+#include <memory>
+using std::unique_ptr;
+
 #include <string>
 using std::string;
 using std::to_string;
 
+#include <vector>
+using std::vector;
+
 // Helpful typedefs...
 
 //  Direction, used to help indicate IN/OUT for code.
@@ -88,8 +95,35 @@ typedef enum
 
 typedef function<void(Value, void*)> CallbackFunction;
 
+// Same, but also handed the CLOCK_MONOTONIC time (ns) the edge was picked up at.
+typedef function<void(Value, uint64_t, void*)> TimestampedCallbackFunction;
+
+// The one poll loop every callback-enabled SysFSGPIO shares.
+class SysFSDispatcher;
 
-class SysFSGPIO: public Runable
+// One pin for SysFSGPIO::exportAll()...
+typedef struct
+{
+	uint16_t	id;
+	Direction	direction;
+	bool		activeLow;
+	Value		value;			// Initial value for an output, INVALID leaves it as it is
+} SysFSPinConfig;
+
+// ...and how its bring-up went.
+typedef struct
+{
+	uint64_t	totalNs;		// The whole thing
+	uint64_t	exportNs;		// Exporting (and checking for) the gpioN entries
+	uint64_t	configNs;		// direction, active_low and value
+	uint32_t	pins;
+	uint32_t	exported;		// Pins we exported- the rest already were
+	uint32_t	writes;			// Attribute writes made...
+	uint32_t	skipped;		// ...and skipped, since sysfs already had them that way
+} SysFSBringUpTiming;
+
+
+class SysFSGPIO
 {
 public:
 	// Having to make a default constructor- if you want to use SharedReference,
@@ -99,10 +133,13 @@ public:
 	// In/Out constructor without an event callback for input...
 	SysFSGPIO(uint16_t id, Direction direction, bool useActiveLow = false);
 
-	// In constructor with an event callback for input...  Destructor **MUST** unwind the
-	// callback thread when it's this case...
+	// In constructor with an event callback for input...  Destructor **MUST** take us back
+	// out of the shared poll loop when it's this case...
 	SysFSGPIO(uint16_t id, Edge edge, CallbackFunction callback, void *data = NULL, bool useActiveLow = false);
 
+	// Same, with the capture timestamp passed along to the callback...
+	SysFSGPIO(uint16_t id, Edge edge, TimestampedCallbackFunction callback, void *data = NULL, bool useActiveLow = false);
+
 	// Destructor...should correctly unwind unless something catastrophic happens...
 	virtual ~SysFSGPIO();
 
@@ -116,6 +153,24 @@ public:
 	// Get my ID...
 	uint16_t getID(void) { return _id; }
 
+	// Event, callback and get/set metrics.  SysFS doesn't give us sequence
+	// numbers, so "lost" always reads zero here.
+	gpio_line_metrics_t getMetrics(void) { gpio_line_metrics_t retVal; _metrics.snapshot(retVal); return retVal; }
+	void resetMetrics(void) { _metrics.reset(); }
+
+	// Export and configure a whole set of pins in one go- one export FD, no
+	// stream or string building per attribute, and no writes where sysfs already
+	// matches.  Throws like the constructors; pins already brought up are
+	// unwound with the vector.  Fills in timing if it's handed one.
+	static vector<unique_ptr<SysFSGPIO>> exportAll(const vector<SysFSPinConfig> &pins, SysFSBringUpTiming *timing = NULL);
+
+	// Edge callbacks all run on the one shared dispatcher thread, so that's
+	// where a scheduling policy goes (kept across the thread coming and going
+	// with the callback pins)...
+	static void setDispatcherPolicy(const thread_policy_t &policy);
+	static void clearDispatcherPolicy(void);
+	static thread_policy_status_t getDispatcherPolicyStatus(void);
+
 	// Check for seeing if a designated chip entry for our GPIOs is even THERE.
 	static bool checkForGPIOChip(uint16_t _id)
 	{
@@ -123,10 +178,9 @@ public:
 		return PathExists(gpiochipPath);
 	};
 
-protected:
-	virtual void run(void);
-
 private:
+	friend class SysFSDispatcher;
+
 	// The generic path into the sysfs GPIO class edge...
 	static const string  _sysfsPath;
 
@@ -136,17 +190,36 @@ private:
 	Direction   			_direction;		// What direction was set on init?
 	Edge					_edge;			// What (optional) edge was set on init?
 	CallbackFunction		_callback;		// Did we have a callback set on us?
+	TimestampedCallbackFunction	_timestampedCallback;	// ...or one that wants the timestamp?
+	bool					_dispatched;	// Are we in the shared poll loop?
 	int						_fd;			// Is there an FD opened against this GPIO?
+	int						_valueFd;		// The value file, opened once at export for get/set
 	void *					_data;			// Generic pointer to data that can be passed to the callback.
 	bool					_activeLow;		// Are we set active low?
 	bool                    _doTeardown;    // Was the GPIO config there before we came into existence?
+	GPIOMetrics				_metrics;		// Counters/histograms, also visible through GPIOMetrics::snapshot_all()
+
+	// For exportAll(), which has already done the exporting...
+	SysFSGPIO(uint16_t id, Direction direction, bool useActiveLow, bool doTeardown);
 
 	// Export out GPIO...
 	void exportGPIO(void);
 
+	// Set direction, active_low and (for outputs) the initial value, skipping what's already set...
+	void configure(Value initial, SysFSBringUpTiming &timing);
+
 	// Unexport the GPIO
 	void unexportGPIO(void);
 
+	// Open (once) the value file get/set go through...
+	void openValue(const char *path);
+
+	// Set up edge detection and hand ourselves to the dispatcher...
+	void setupCallback(void);
+
+	// Called by the dispatcher when our value file says there's been an edge...
+	void dispatch(uint64_t timestamp, const bool &removed);
+
 	// Quick, NASTY way to check if a path exists...
 	static bool PathExists( const std::string &Pathname ) { return access( Pathname.c_str(), 0 ) == 0;	};
 };
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <mutex>
+using std::mutex;
+using std::lock_guard;
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+
+// How a loop thread should be run.  The defaults leave the thread exactly the
+// way std::thread made it.
+typedef struct thread_policy_t
+{
+    int             policy = SCHED_OTHER;       // SCHED_OTHER, SCHED_FIFO or SCHED_RR
+    int             priority = 0;               // 1 - 99 for FIFO/RR, 0 otherwise
+    uint64_t        cpu_mask = 0;               // Bit per CPU to allow, 0 leaves affinity alone
+    bool            lock_memory = false;        // mlockall() the process (once, process wide)
+    size_t          prefault_stack = 0;         // Bytes of stack to touch up front
+    string          name;                       // Thread name, 15 chars max- empty uses the loop's own
+} thread_policy_t;
+
+// What actually took when the policy was last applied.  Privilege problems
+// (no CAP_SYS_NICE, RLIMIT_MEMLOCK too low...) show up here, not as failures
+// of the loop itself.
+typedef struct thread_policy_status_t
+{
+    bool            bound = false;              // A loop thread is running under this policy
+    bool            scheduling = false;
+    bool            affinity = false;
+    bool            memory_locked = false;
+    bool            stack_prefaulted = false;
+    bool            named = false;
+    int             error = 0;                  // First error we hit, 0 if none
+} thread_policy_status_t;
+
+/*
+    Mixin for the Runable based loops in here, so their threads can be given
+    real-time scheduling, pinned to CPUs, kept out of swap and named.  Set a
+    policy on the object, or a global default for every loop that hasn't been
+    given one of its own.
+
+    The policy is applied by the loop thread itself when start() launches it,
+    so it's in effect before the first event is handled.  Setting a policy on
+    an object whose loop is already running applies it to the running thread
+    (everything but stack prefaulting, which only the thread can do for itself).
+*/
+class ThreadPolicy
+{
+    public:
+        // Global default for loops without a policy of their own.  Only
+        // affects loops started after the call.
+        static void set_default_thread_policy(const thread_policy_t &policy);
+        static thread_policy_t get_default_thread_policy();
+
+        // This object's policy, and going back to the global default.
+        void set_thread_policy(const thread_policy_t &policy);
+        void clear_thread_policy();
+        thread_policy_t get_thread_policy();
+
+        thread_policy_status_t get_thread_policy_status();
+
+    protected:
+        ThreadPolicy(const string &thread_name);
+        ~ThreadPolicy() {}
+
+        // Put one of these at the top of run().  It applies the policy to the
+        // calling thread and keeps track of it until run() returns.
+        class Binding
+        {
+            public:
+                Binding(ThreadPolicy &owner);
+                ~Binding();
+
+                Binding(const Binding &) = delete;
+                Binding &operator=(const Binding &) = delete;
+
+            private:
+                ThreadPolicy    &m_owner;
+        };
+
+    private:
+        static mutex            s_lock;
+        static thread_policy_t  s_default;
+        static bool             s_memory_locked;
+
+        mutex                   m_lock;
+        string                  m_thread_name;
+        bool                    m_has_policy;
+        thread_policy_t         m_policy;
+        thread_policy_status_t  m_status;
+        pthread_t               m_thread;
+
+        thread_policy_t effective_policy();
+        void apply(const thread_policy_t &policy, bool self);
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+/*
+    Tiny eventfd wrapper so the poll()-driven loops in here have something
+    to kick when it's time for them to notice a stop() or a change in their
+    configuration.  Without it, a loop blocked waiting on a line that never
+    changes would never come back to check _run.
+*/
+class WakeupFD
+{
+    public:
+        WakeupFD() : m_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+        ~WakeupFD() { if (m_fd >= 0) close(m_fd); }
+
+        WakeupFD(const WakeupFD &) = delete;
+        WakeupFD &operator=(const WakeupFD &) = delete;
+
+        // The fd to add to your poll set (POLLIN).
+        int get_fd() const { return m_fd; }
+
+        // Kick whoever is waiting on us.
+        void signal()
+        {
+            uint64_t one = 1;
+            if (write(m_fd, &one, sizeof(one)) < 0)
+            {
+                // Counter's saturated or we're closed- either way they're awake.
+            }
+        }
+
+        // Soak up any pending kicks.
+        void clear()
+        {
+            uint64_t count;
+            if (read(m_fd, &count, sizeof(count)) < 0)
+            {
+                // EAGAIN- nothing pending.
+            }
+        }
+
+    private:
+        int     m_fd;
+};
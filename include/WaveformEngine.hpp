@@ -0,0 +1,191 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <queue>
+using std::priority_queue;
+
+#include <deque>
+using std::deque;
+
+#include <mutex>
+using std::mutex;
+using std::lock_guard;
+
+#include <stdint.h>
+
+#include "GPIOLineRequest.hpp"
+#include "KernelGPIO.hpp"
+#include "LoopThread.hpp"
+
+// One step in a waveform- drive the channel's lines to these values (bitmask by
+// index within the request) and hold them for this long before the next step.
+typedef struct waveform_step_t
+{
+    uint64_t        values;
+    uint64_t        duration_ns;
+} waveform_step_t;
+
+// How well we've been keeping time.  Lateness is how far past its deadline
+// each wakeup actually happened.
+typedef struct waveform_stats_t
+{
+    uint64_t        wakeups;
+    uint64_t        writes;
+    uint64_t        overruns;       // Times we fell a whole step behind and had to resync
+    int64_t         min_late_ns;
+    int64_t         max_late_ns;
+    double          mean_late_ns;
+    double          stddev_late_ns;
+} waveform_stats_t;
+
+// How a scheduled change actually went.  Error is actual - requested, where
+// actual is when the write completed.
+typedef struct schedule_result_t
+{
+    uint64_t        id;
+    uint64_t        requested_ns;
+    uint64_t        actual_ns;
+    int64_t         error_ns;
+    bool            ok;             // The write went through
+} schedule_result_t;
+
+/*
+    Software PWM and arbitrary waveform player.  One timing thread serves
+    every channel on the engine, no matter how many.  It sleeps to absolute
+    deadlines on a timerfd (so the timing doesn't drift with how long each pass
+    takes), and every channel due at the same time on the same request gets
+    its lines written with one bulk set.
+
+    It also applies one-shot changes at absolute CLOCK_MONOTONIC times
+    (schedule()).  Those sit in a heap ordered by time on the same thread, so
+    thousands of them cost memory, not threads, and changes due together go
+    out in the same bulk writes as the waveforms.
+
+    The requests handed in belong to the caller and have to outlive the
+    channels using them.  Lines need to already be configured as outputs.
+*/
+class WaveformEngine : public LoopThread
+{
+    public:
+        WaveformEngine();
+        ~WaveformEngine();
+
+        WaveformEngine(const WaveformEngine &) = delete;
+        WaveformEngine &operator=(const WaveformEngine &) = delete;
+
+        // PWM on a single line.  Duty is 0.0 - 1.0.  Returns a channel id
+        // or -1 on failure.
+        int add_pwm(GPIOLineRequest *request, unsigned int offset, uint64_t period_ns, double duty);
+        int add_pwm(KernelGPIO &gpio, uint64_t period_ns, double duty);
+
+        // Arbitrary sequence of steps over the lines in mask.  The sequence is
+        // played repeat times (0 is forever).  Returns a channel id or -1.
+        int add_waveform(GPIOLineRequest *request, uint64_t mask, const vector<waveform_step_t> &steps, size_t repeat = 0);
+
+        // Change a PWM channel on the fly.  Takes effect at the start of the
+        // next period so we never emit a runt pulse.
+        bool set_pwm(int channel, uint64_t period_ns, double duty);
+
+        // Stop playing a channel.  Its lines are left where they are.
+        bool remove_channel(int channel);
+
+        // Is the channel still playing?  (Finite waveforms finish on their own.)
+        bool is_active(int channel);
+
+        // Drive the lines in mask (by request index) to values at when_ns
+        // (CLOCK_MONOTONIC).  Changes due at the same time are applied in the
+        // order they were scheduled.  Returns an id for matching up results.
+        uint64_t schedule(GPIOLineRequest *request, uint64_t when_ns, uint64_t mask, uint64_t values);
+        uint64_t schedule(KernelGPIO &gpio, uint64_t when_ns, bool value);
+
+        // How many changes haven't happened yet, and drop all of them.
+        size_t scheduled_count();
+        void clear_schedule();
+
+        // Move the results of the changes applied since the last call into
+        // results.  Only the most recent MAX_SCHEDULE_RESULTS are kept.
+        size_t take_schedule_results(vector<schedule_result_t> &results);
+        static const size_t MAX_SCHEDULE_RESULTS = 4096;
+
+        // Shorthand for a SCHED_FIFO thread policy at this priority.  0 goes
+        // back to normal scheduling.  See ThreadPolicy for the rest.
+        void set_realtime(int priority);
+        bool is_realtime();
+
+        // Jitter statistics.
+        waveform_stats_t get_stats();
+        void reset_stats();
+
+    protected:
+        void run();
+
+    private:
+        typedef struct channel_t
+        {
+            int                         id;
+            GPIOLineRequest             *request;
+            uint64_t                    mask;
+            vector<waveform_step_t>     steps;
+            vector<waveform_step_t>     pending;        // New steps to switch to at the end of the sequence
+            bool                        has_pending;
+            size_t                      step;
+            size_t                      repeat;         // Remaining, 0 is forever
+            uint64_t                    deadline_ns;
+            bool                        active;
+        } channel_t;
+
+        // One change waiting in the schedule.
+        typedef struct scheduled_t
+        {
+            uint64_t                    id;
+            uint64_t                    when_ns;
+            GPIOLineRequest             *request;
+            uint64_t                    mask;
+            uint64_t                    values;
+        } scheduled_t;
+
+        // Orders the heap soonest first, ties by id (which is schedule order).
+        typedef struct scheduled_later_t
+        {
+            bool operator()(const scheduled_t &a, const scheduled_t &b) const
+            {
+                return (a.when_ns != b.when_ns) ? (a.when_ns > b.when_ns) : (a.id > b.id);
+            }
+        } scheduled_later_t;
+
+        // A bulk write we're gathering up for one request.
+        typedef struct write_t
+        {
+            GPIOLineRequest             *request;
+            uint64_t                    mask;
+            uint64_t                    values;
+            bool                        ok;
+            uint64_t                    done_ns;
+        } write_t;
+
+        mutex                   m_lock;
+        vector<channel_t>       m_channels;
+        vector<write_t>         m_writes;
+        priority_queue<scheduled_t, vector<scheduled_t>, scheduled_later_t> m_schedule;
+        vector<scheduled_t>     m_due;                  // Scratch for the changes due this pass
+        deque<schedule_result_t> m_results;
+        uint64_t                m_next_schedule_id;
+        int                     m_next_id;
+        int                     m_timer_fd;
+
+        // Jitter accumulators...
+        waveform_stats_t        m_stats;
+        double                  m_late_sum;
+        double                  m_late_sum_sq;
+
+        int add_channel(channel_t &channel);
+        channel_t *find_channel(int id);
+        write_t *find_write(GPIOLineRequest *request);
+        void record_lateness(int64_t late_ns);
+        static vector<waveform_step_t> pwm_steps(uint64_t mask, uint64_t period_ns, double duty);
+};
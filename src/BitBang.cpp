@@ -0,0 +1,639 @@
+
+#include <string>
+using std::string;
+
+#include <time.h>
+
+#include "BitBang.hpp"
+#include "GPIODiag.hpp"
+#include "GPIOMetrics.hpp"
+
+// How long we'll put up with a target stretching the I2C clock.
+static const uint64_t I2C_STRETCH_TIMEOUT_NS = 1000000;
+
+// 1-Wire standard speed slot timing, in ns.
+static const uint64_t OW_RESET_LOW_NS = 480000;
+static const uint64_t OW_PRESENCE_SAMPLE_NS = 70000;
+static const uint64_t OW_RESET_SLOT_NS = 960000;
+static const uint64_t OW_WRITE1_LOW_NS = 6000;
+static const uint64_t OW_WRITE0_LOW_NS = 60000;
+static const uint64_t OW_READ_LOW_NS = 6000;
+static const uint64_t OW_READ_SAMPLE_NS = 15000;
+static const uint64_t OW_SLOT_NS = 70000;
+
+/**
+ * @brief Build an offsets list, skipping the lines that aren't wired.
+ */
+static vector<unsigned int> wired_lines(const vector<unsigned int> &lines)
+{
+    vector<unsigned int> retVal;
+
+    for (auto line : lines)
+    {
+        if (line != BitBang::NO_LINE)
+        {
+            retVal.push_back(line);
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * Constructor for BitBang.  Gets our share of the chip and sets up (but
+ * doesn't request) the one request all of the transport's lines live in.
+ * The transports set up their line settings and request them.
+ */
+BitBang::BitBang(const string &chipname, const vector<unsigned int> &offsets, const string &consumer) :
+    m_half_period_ns(0), m_deadline_ns(0), m_last_bits(0), m_last_ns(0), m_start_ns(0)
+{
+    shared_ptr<GPIOChip> chip = GPIOChip::open(chipname);
+    if (chip == nullptr)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "BitBang", GPIO_ERR_NO_CHIP, 0, "Failed to open GPIO chip <%s>", chipname.c_str());
+    }
+    else
+    {
+        m_request.reset(new GPIOLineRequest(chip, offsets, consumer));
+    }
+}
+
+/**
+ * @brief Achieved bit rate of the last transfer, in bits/sec.
+ */
+double BitBang::get_bit_rate()
+{
+    return (m_last_ns > 0) ? ((double) m_last_bits * 1000000000.0 / m_last_ns) : 0.0;
+}
+
+/**
+ * @brief Busy wait until an absolute CLOCK_MONOTONIC deadline.
+ *
+ * At bit-bang timescales, sleeping would cost us far more than the
+ * time we're trying to wait out.
+ */
+void BitBang::spin_until(uint64_t deadline_ns)
+{
+    while (GPIOMetrics::now_ns() < deadline_ns)
+    {
+        // Spin...
+    }
+}
+
+/**
+ * @brief Start timing a transfer (for the clock and the bit rate).
+ */
+void BitBang::begin_transfer()
+{
+    m_start_ns = GPIOMetrics::now_ns();
+    m_deadline_ns = m_start_ns;
+}
+
+/**
+ * @brief Finish timing a transfer of so many bits.
+ */
+void BitBang::end_transfer(uint64_t bits)
+{
+    m_last_bits = bits;
+    m_last_ns = GPIOMetrics::now_ns() - m_start_ns;
+}
+
+/**
+ * Constructor for BitBangSPI.  Requests the lines and precomputes the
+ * SCK/MOSI frames for every byte value in the given mode.
+ *
+ * @param chipname The chip the lines are on.
+ * @param sck, mosi The clock and data out lines.
+ * @param miso The data in line, or NO_LINE for write-only.
+ * @param cs The chip select line (driven active low), or NO_LINE.
+ * @param mode SPI mode 0-3 (CPOL is bit 1, CPHA is bit 0).
+ */
+BitBangSPI::BitBangSPI(const string &chipname, unsigned int sck, unsigned int mosi,
+                       unsigned int miso, unsigned int cs, int mode) :
+    BitBang(chipname, wired_lines({ sck, mosi, miso, cs }), "BitBangSPI"),
+    m_miso(miso), m_sck_mask(0), m_mosi_mask(0), m_cs_mask(0), m_bus_mask(0),
+    m_cpol((mode & 0x02) != 0), m_cpha((mode & 0x01) != 0), m_frames(256 * 16)
+{
+    if (m_request != nullptr)
+    {
+        gpio_line_settings_t settings;
+
+        m_sck_mask = m_request->get_mask(sck);
+        m_mosi_mask = m_request->get_mask(mosi);
+        m_bus_mask = m_sck_mask | m_mosi_mask;
+
+        settings.direction = GPIOD_LINE_DIRECTION_OUTPUT;
+        settings.value = m_cpol;
+        m_request->set_settings(sck, settings);
+        settings.value = false;
+        m_request->set_settings(mosi, settings);
+
+        if (cs != NO_LINE)
+        {
+            m_cs_mask = m_request->get_mask(cs);
+            settings.active_low = true;
+            m_request->set_settings(cs, settings);
+        }
+
+        if (miso != NO_LINE)
+        {
+            settings = gpio_line_settings_t();
+            m_request->set_settings(miso, settings);
+        }
+
+        if (!m_request->request())
+        {
+            GPIO_DIAG(GPIO_LOG_ERROR, "BitBangSPI", GPIO_ERR_IO, 0, "Failed to request SPI lines");
+        }
+
+        // Precompute both frames of every bit of every byte.  Data goes out
+        // on the edge before the sampling edge- with CPHA 0 that's the idle
+        // level, with CPHA 1 it's the leading edge.
+        uint64_t idle = m_cpol ? m_sck_mask : 0;
+        uint64_t active = m_cpol ? 0 : m_sck_mask;
+        for (unsigned int byte = 0; byte < 256; byte++)
+        {
+            for (int bit = 0; bit < 8; bit++)
+            {
+                uint64_t data = (byte & (0x80 >> bit)) ? m_mosi_mask : 0;
+                m_frames[(byte * 16) + (bit * 2)] = (m_cpha ? active : idle) | data;
+                m_frames[(byte * 16) + (bit * 2) + 1] = (m_cpha ? idle : active) | data;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Clock bytes out (and optionally in).
+ *
+ * @param tx The bytes to send, or nullptr to send zeros.
+ * @param rx Where to put the bytes received, or nullptr to skip sampling
+ *           MISO entirely (the fast path).
+ * @param len How many bytes.
+ * @return true on success, false if the lines aren't held or a write failed.
+ */
+bool BitBangSPI::transfer(const uint8_t *tx, uint8_t *rx, size_t len)
+{
+    bool retVal = is_open();
+
+    if (!retVal)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "BitBangSPI", GPIO_ERR_NOT_REQUESTED, 0, "SPI lines not open");
+    }
+    else
+    {
+        bool sample = (rx != nullptr) && (m_miso != NO_LINE);
+
+        begin_transfer();
+
+        if (m_cs_mask != 0)
+        {
+            retVal = drive(m_cs_mask, m_cs_mask);
+        }
+
+        for (size_t i = 0; (i < len) && retVal; i++)
+        {
+            const uint64_t *frames = &m_frames[(tx != nullptr ? tx[i] : 0) * 16];
+            uint8_t in = 0;
+
+            for (int bit = 0; (bit < 8) && retVal; bit++)
+            {
+                retVal = drive(m_bus_mask, frames[bit * 2]) && drive(m_bus_mask, frames[(bit * 2) + 1]);
+                if (sample)
+                {
+                    in = (in << 1) | ((m_request->get_value(m_miso) > 0) ? 1 : 0);
+                }
+            }
+
+            if (rx != nullptr)
+            {
+                rx[i] = in;
+            }
+        }
+
+        // CPHA 0 leaves the clock at its active level after the last bit.
+        if (!m_cpha && retVal)
+        {
+            retVal = drive(m_sck_mask, m_cpol ? m_sck_mask : 0);
+        }
+
+        if (m_cs_mask != 0)
+        {
+            drive(m_cs_mask, 0);
+        }
+
+        end_transfer(len * 8);
+    }
+
+    return retVal;
+}
+
+/**
+ * Constructor for BitBangI2C.  Requests both lines open-drain and released
+ * (idle bus), and precomputes the frames for every byte value.
+ *
+ * @param chipname The chip the lines are on.
+ * @param scl, sda The clock and data lines.
+ */
+BitBangI2C::BitBangI2C(const string &chipname, unsigned int scl, unsigned int sda) :
+    BitBang(chipname, { scl, sda }, "BitBangI2C"),
+    m_scl(scl), m_sda(sda), m_scl_mask(0), m_sda_mask(0), m_bus_mask(0),
+    m_stretch(false), m_active(false), m_frames(256 * 16)
+{
+    if (m_request != nullptr)
+    {
+        gpio_line_settings_t settings;
+
+        m_scl_mask = m_request->get_mask(scl);
+        m_sda_mask = m_request->get_mask(sda);
+        m_bus_mask = m_scl_mask | m_sda_mask;
+
+        settings.direction = GPIOD_LINE_DIRECTION_OUTPUT;
+        settings.drive = GPIOD_LINE_DRIVE_OPEN_DRAIN;
+        settings.value = true;
+        m_request->set_settings(settings);
+
+        if (!m_request->request())
+        {
+            GPIO_DIAG(GPIO_LOG_ERROR, "BitBangI2C", GPIO_ERR_IO, 0, "Failed to request I2C lines");
+        }
+
+        // Data changes while SCL is low and is held while SCL is high.
+        for (unsigned int byte = 0; byte < 256; byte++)
+        {
+            for (int bit = 0; bit < 8; bit++)
+            {
+                uint64_t data = (byte & (0x80 >> bit)) ? m_sda_mask : 0;
+                m_frames[(byte * 16) + (bit * 2)] = data;
+                m_frames[(byte * 16) + (bit * 2) + 1] = m_scl_mask | data;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Write bytes to a target.
+ *
+ * @param address The 7 bit target address.
+ * @param data, len The bytes to write.
+ * @param send_stop Send a stop at the end.  Leave it off to follow up
+ *        with a repeated start (write_read() does this for you).
+ * @return false if the lines aren't held or the target NAKed.
+ */
+bool BitBangI2C::write(uint8_t address, const uint8_t *data, size_t len, bool send_stop)
+{
+    bool retVal = is_open();
+
+    if (!retVal)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "BitBangI2C", GPIO_ERR_NOT_REQUESTED, 0, "I2C lines not open");
+    }
+    else
+    {
+        begin_transfer();
+        start_condition();
+
+        retVal = write_byte(address << 1);
+        for (size_t i = 0; (i < len) && retVal; i++)
+        {
+            retVal = write_byte(data[i]);
+        }
+
+        if (send_stop || !retVal)
+        {
+            stop_condition();
+        }
+
+        end_transfer((len + 1) * 9);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Read bytes from a target.
+ *
+ * @param address The 7 bit target address.
+ * @param data, len Where to put the bytes read.
+ * @return false if the lines aren't held or the target NAKed its address.
+ */
+bool BitBangI2C::read(uint8_t address, uint8_t *data, size_t len)
+{
+    bool retVal = is_open();
+
+    if (!retVal)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "BitBangI2C", GPIO_ERR_NOT_REQUESTED, 0, "I2C lines not open");
+    }
+    else
+    {
+        begin_transfer();
+        start_condition();
+
+        retVal = write_byte((address << 1) | 0x01);
+        for (size_t i = 0; (i < len) && retVal; i++)
+        {
+            // ACK everything but the last byte.
+            data[i] = read_byte(i < (len - 1));
+        }
+
+        stop_condition();
+        end_transfer((len + 1) * 9);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Write then read with a repeated start in between (register reads).
+ */
+bool BitBangI2C::write_read(uint8_t address, const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len)
+{
+    return write(address, tx, tx_len, false) && read(address, rx, rx_len);
+}
+
+/**
+ * @brief Start (or repeated start) condition- SDA falls while SCL is high.
+ */
+void BitBangI2C::start_condition()
+{
+    if (m_active)
+    {
+        // Repeated start.  Get both lines back up without a stop first.
+        drive(m_bus_mask, m_sda_mask);
+        clock_high(m_sda_mask);
+    }
+
+    drive(m_bus_mask, m_scl_mask);
+    drive(m_bus_mask, 0);
+    m_active = true;
+}
+
+/**
+ * @brief Stop condition- SDA rises while SCL is high.
+ */
+void BitBangI2C::stop_condition()
+{
+    drive(m_bus_mask, 0);
+    clock_high(0);
+    drive(m_bus_mask, m_bus_mask);
+    m_active = false;
+}
+
+/**
+ * @brief Raise SCL with SDA as given, waiting out clock stretching if enabled.
+ *
+ * @return false if the write failed or the target held SCL down too long.
+ */
+bool BitBangI2C::clock_high(uint64_t sda)
+{
+    bool retVal = drive(m_bus_mask, m_scl_mask | (sda & m_sda_mask));
+
+    if (retVal && m_stretch)
+    {
+        uint64_t timeout = GPIOMetrics::now_ns() + I2C_STRETCH_TIMEOUT_NS;
+        while ((m_request->get_value(m_scl) == 0) && retVal)
+        {
+            retVal = (GPIOMetrics::now_ns() < timeout);
+        }
+
+        // The target let go late.  Restart the clock timing from here.
+        m_deadline_ns = GPIOMetrics::now_ns();
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Clock one byte out and read back the target's ACK.
+ *
+ * @return true if the target ACKed.
+ */
+bool BitBangI2C::write_byte(uint8_t byte)
+{
+    const uint64_t *frames = &m_frames[byte * 16];
+
+    for (int bit = 0; bit < 8; bit++)
+    {
+        drive(m_bus_mask, frames[bit * 2]);
+        clock_high(frames[(bit * 2) + 1]);
+    }
+
+    // Release SDA and clock in the ACK.
+    drive(m_bus_mask, m_sda_mask);
+    clock_high(m_sda_mask);
+    bool retVal = (m_request->get_value(m_sda) == 0);
+    drive(m_bus_mask, m_sda_mask);
+
+    return retVal;
+}
+
+/**
+ * @brief Clock one byte in and send ACK or NAK for it.
+ */
+uint8_t BitBangI2C::read_byte(bool ack)
+{
+    uint8_t retVal = 0;
+    uint64_t ack_sda = ack ? 0 : m_sda_mask;
+
+    for (int bit = 0; bit < 8; bit++)
+    {
+        drive(m_bus_mask, m_sda_mask);
+        clock_high(m_sda_mask);
+        retVal = (retVal << 1) | ((m_request->get_value(m_sda) > 0) ? 1 : 0);
+    }
+
+    drive(m_bus_mask, ack_sda);
+    clock_high(ack_sda);
+    drive(m_bus_mask, ack_sda);
+
+    return retVal;
+}
+
+/**
+ * Constructor for BitBangOneWire.  Requests the line open-drain, released.
+ *
+ * @param chipname The chip the line is on.
+ * @param line The 1-Wire data line.
+ */
+BitBangOneWire::BitBangOneWire(const string &chipname, unsigned int line) :
+    BitBang(chipname, { line }, "BitBangOneWire"), m_line(line), m_mask(0)
+{
+    if (m_request != nullptr)
+    {
+        gpio_line_settings_t settings;
+
+        m_mask = m_request->get_mask(line);
+
+        settings.direction = GPIOD_LINE_DIRECTION_OUTPUT;
+        settings.drive = GPIOD_LINE_DRIVE_OPEN_DRAIN;
+        settings.value = true;
+        m_request->set_settings(settings);
+
+        if (!m_request->request())
+        {
+            GPIO_DIAG(GPIO_LOG_ERROR, "BitBangOneWire", GPIO_ERR_IO, 0, "Failed to request 1-Wire line");
+        }
+    }
+}
+
+/**
+ * @brief Reset pulse and presence detect.
+ *
+ * @return true if at least one device answered with a presence pulse.
+ */
+bool BitBangOneWire::reset()
+{
+    bool retVal = false;
+
+    if (!is_open())
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "BitBangOneWire", GPIO_ERR_NOT_REQUESTED, 0, "1-Wire line not open");
+    }
+    else
+    {
+        uint64_t start = GPIOMetrics::now_ns();
+        m_request->set_values(m_mask, 0);
+        spin_until(start + OW_RESET_LOW_NS);
+        m_request->set_values(m_mask, m_mask);
+        spin_until(start + OW_RESET_LOW_NS + OW_PRESENCE_SAMPLE_NS);
+        retVal = (m_request->get_value(m_line) == 0);
+        spin_until(start + OW_RESET_SLOT_NS);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Write one byte, LSB first.
+ */
+void BitBangOneWire::write_byte(uint8_t byte)
+{
+    if (!is_open())
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "BitBangOneWire", GPIO_ERR_NOT_REQUESTED, 0, "1-Wire line not open");
+    }
+    else
+    {
+        begin_transfer();
+        for (int bit = 0; bit < 8; bit++)
+        {
+            write_bit((byte >> bit) & 0x01);
+        }
+        end_transfer(8);
+    }
+}
+
+/**
+ * @brief Read one byte, LSB first.
+ */
+uint8_t BitBangOneWire::read_byte()
+{
+    uint8_t retVal = 0;
+
+    if (!is_open())
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "BitBangOneWire", GPIO_ERR_NOT_REQUESTED, 0, "1-Wire line not open");
+    }
+    else
+    {
+        begin_transfer();
+        for (int bit = 0; bit < 8; bit++)
+        {
+            if (read_bit())
+            {
+                retVal |= (1 << bit);
+            }
+        }
+        end_transfer(8);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Write a run of bytes.
+ */
+void BitBangOneWire::write(const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        write_byte(data[i]);
+    }
+}
+
+/**
+ * @brief Read a run of bytes.
+ */
+void BitBangOneWire::read(uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        data[i] = read_byte();
+    }
+}
+
+/**
+ * @brief Dallas/Maxim CRC-8 (x^8 + x^5 + x^4 + 1).
+ *
+ * @return The CRC.  Running it over data that ends with its own CRC gives 0.
+ */
+uint8_t BitBangOneWire::crc8(const uint8_t *data, size_t len)
+{
+    uint8_t retVal = 0;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        uint8_t byte = data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            uint8_t mix = (retVal ^ byte) & 0x01;
+            retVal >>= 1;
+            if (mix)
+            {
+                retVal ^= 0x8C;
+            }
+            byte >>= 1;
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief One write slot.
+ */
+void BitBangOneWire::write_bit(bool bit)
+{
+    if (is_open())
+    {
+        uint64_t start = GPIOMetrics::now_ns();
+
+        m_request->set_values(m_mask, 0);
+        spin_until(start + (bit ? OW_WRITE1_LOW_NS : OW_WRITE0_LOW_NS));
+        m_request->set_values(m_mask, m_mask);
+        spin_until(start + OW_SLOT_NS);
+    }
+}
+
+/**
+ * @brief One read slot.
+ */
+bool BitBangOneWire::read_bit()
+{
+    bool retVal = false;
+
+    if (is_open())
+    {
+        uint64_t start = GPIOMetrics::now_ns();
+
+        m_request->set_values(m_mask, 0);
+        spin_until(start + OW_READ_LOW_NS);
+        m_request->set_values(m_mask, m_mask);
+        spin_until(start + OW_READ_SAMPLE_NS);
+        retVal = (m_request->get_value(m_line) > 0);
+        spin_until(start + OW_SLOT_NS);
+    }
+
+    return retVal;
+}
@@ -0,0 +1,441 @@
+
+#include <string>
+using std::string;
+
+#include <fstream>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "EdgeCapture.hpp"
+#include "GPIODiag.hpp"
+#include "GPIOMetrics.hpp"
+
+static const char CAPTURE_MAGIC[8] = "PHACAP1";
+static const uint32_t CAPTURE_VERSION = 1;
+
+// Where we start the file at, unless capped lower.
+static const uint64_t INITIAL_FILE_SIZE = 16 * 1024 * 1024;
+
+// Worst case size of a record- one byte of line/level and a 64 bit varint.
+static const size_t MAX_RECORD_SIZE = 1 + 10;
+
+// The kernel's ceiling on a request's event buffer, and our read batch size.
+static const size_t KERNEL_EVENT_BUFFER = 1024;
+static const size_t EVENT_BATCH_SIZE = 64;
+
+/**
+ * Constructor for EdgeCapture.  Requests the lines with both edges
+ * detected, sets up the capture file, records where every line stands and
+ * starts capturing.
+ *
+ * @param chipname The chip the lines are on.
+ * @param offsets The lines to capture.  At most 64.
+ * @param path The capture file to write.
+ * @param max_bytes Cap on the file's size, 0 for none.
+ */
+EdgeCapture::EdgeCapture(const string &chipname, const vector<unsigned int> &offsets,
+                         const string &path, uint64_t max_bytes) :
+    LoopThread("EdgeCapture"),
+    m_path(path), m_fd(-1), m_data(nullptr), m_capacity(0), m_max_bytes(max_bytes),
+    m_used(0), m_events(0), m_lost(0), m_full(false), m_last_ns(0), m_last_seqno(0)
+{
+    shared_ptr<GPIOChip> chip = GPIOChip::open(chipname);
+    if (chip == nullptr)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "EdgeCapture", GPIO_ERR_NO_CHIP, 0, "Failed to open GPIO chip <%s>", chipname.c_str());
+    }
+    else
+    {
+        gpio_line_settings_t settings;
+        settings.edge = GPIOD_LINE_EDGE_BOTH;
+
+        m_request.reset(new GPIOLineRequest(chip, offsets, "EdgeCapture"));
+        m_request->set_settings(settings);
+        m_request->set_event_buffer_size(KERNEL_EVENT_BUFFER);
+        if (!m_request->request())
+        {
+            GPIO_DIAG(GPIO_LOG_ERROR, "EdgeCapture", GPIO_ERR_IO, 0, "Failed to request lines");
+        }
+        else if (open_file(chip->get_path()))
+        {
+            uint64_t levels = 0;
+
+            header()->start_ns = GPIOMetrics::now_ns();
+            m_last_ns = header()->start_ns;
+            if (m_request->get_values(levels))
+            {
+                header()->initial_levels = levels;
+            }
+
+            start();
+        }
+    }
+}
+
+/**
+ * Destructor for EdgeCapture.  Closes out the capture if finish() wasn't called.
+ */
+EdgeCapture::~EdgeCapture()
+{
+    finish();
+}
+
+/**
+ * @brief Stop capturing and close the file out.
+ *
+ * Fills in the final counts in the header and trims the file to what was
+ * actually used.  Safe to call more than once.
+ *
+ * @return true if there was a capture to close out and it went cleanly.
+ */
+bool EdgeCapture::finish()
+{
+    bool retVal = false;
+
+    stop_loop();
+
+    if (m_request != nullptr)
+    {
+        m_request->release();
+    }
+
+    if (m_data != nullptr)
+    {
+        uint64_t used = m_used;
+
+        header()->data_bytes = used;
+        header()->events = m_events;
+        header()->lost = m_lost;
+
+        retVal = (msync(m_data, m_capacity, MS_SYNC) == 0);
+        munmap(m_data, m_capacity);
+        m_data = nullptr;
+
+        if (ftruncate(m_fd, sizeof(capture_header_t) + used) < 0)
+        {
+            GPIO_DIAG(GPIO_LOG_ERROR, "EdgeCapture", GPIO_ERR_IO, errno, "Failed to trim capture file");
+            retVal = false;
+        }
+    }
+
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Turn a capture file into a VCD.
+ *
+ * @param capture_path The capture to read.
+ * @param vcd_path The VCD to write.
+ * @return true on success, false if the capture couldn't be read or the
+ *         VCD couldn't be written.
+ */
+bool EdgeCapture::convert_to_vcd(const string &capture_path, const string &vcd_path)
+{
+    bool retVal = false;
+    struct stat st;
+
+    int fd = open(capture_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "EdgeCapture", GPIO_ERR_IO, 0, "Unable to open capture <%s>", capture_path.c_str());
+    }
+    else
+    {
+        void *map = MAP_FAILED;
+
+        if ((fstat(fd, &st) == 0) && ((size_t) st.st_size >= sizeof(capture_header_t)))
+        {
+            map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+
+        const capture_header_t *hdr = (const capture_header_t *) map;
+        if ((map == MAP_FAILED) || (memcmp(hdr->magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0) ||
+            (hdr->version != CAPTURE_VERSION) || (hdr->num_lines > 64) ||
+            ((sizeof(capture_header_t) + hdr->data_bytes) > (size_t) st.st_size))
+        {
+            GPIO_DIAG(GPIO_LOG_ERROR, "EdgeCapture", GPIO_ERR_INVALID, 0, "<%s> is not a valid capture", capture_path.c_str());
+        }
+        else
+        {
+            std::ofstream vcd(vcd_path);
+            if (!vcd.is_open())
+            {
+                GPIO_DIAG(GPIO_LOG_ERROR, "EdgeCapture", GPIO_ERR_IO, 0, "Unable to write VCD <%s>", vcd_path.c_str());
+            }
+            else
+            {
+                // VCD identifiers are printable characters- one per line is plenty for 64.
+                vcd << "$comment Captured from " << hdr->chip << " $end\n";
+                vcd << "$timescale 1ns $end\n";
+                vcd << "$scope module gpio $end\n";
+                for (uint32_t i = 0; i < hdr->num_lines; i++)
+                {
+                    string name = (hdr->names[i][0] != '\0') ? string(hdr->names[i], strnlen(hdr->names[i], 32)) :
+                                                              ("line" + std::to_string(hdr->offsets[i]));
+                    vcd << "$var wire 1 " << (char) ('!' + i) << " " << name << " $end\n";
+                }
+                vcd << "$upscope $end\n";
+                vcd << "$enddefinitions $end\n";
+
+                vcd << "#0\n$dumpvars\n";
+                for (uint32_t i = 0; i < hdr->num_lines; i++)
+                {
+                    vcd << ((hdr->initial_levels >> i) & 0x01) << (char) ('!' + i) << "\n";
+                }
+                vcd << "$end\n";
+
+                // Walk the records...
+                const uint8_t *p = (const uint8_t *) map + sizeof(capture_header_t);
+                const uint8_t *end = p + hdr->data_bytes;
+                uint64_t t = 0;
+                uint64_t last_t = 0;
+                bool ok = true;
+                while ((p < end) && ok)
+                {
+                    uint8_t line = *p++;
+                    uint64_t delta = 0;
+                    int shift = 0;
+                    ok = false;
+                    while ((p < end) && (shift < 64))
+                    {
+                        uint8_t b = *p++;
+                        delta |= (uint64_t) (b & 0x7F) << shift;
+                        shift += 7;
+                        if ((b & 0x80) == 0)
+                        {
+                            ok = true;
+                            break;
+                        }
+                    }
+
+                    if (ok)
+                    {
+                        t += delta;
+                        if (t != last_t)
+                        {
+                            vcd << "#" << t << "\n";
+                            last_t = t;
+                        }
+                        vcd << (line & 0x01) << (char) ('!' + (line >> 1)) << "\n";
+                    }
+                }
+
+                if (!ok)
+                {
+                    GPIO_DIAG(GPIO_LOG_ERROR, "EdgeCapture", GPIO_ERR_INVALID, 0, "<%s> is truncated", capture_path.c_str());
+                }
+
+                vcd.close();
+                retVal = ok && !vcd.fail();
+            }
+        }
+
+        // Clean up after yourself
+        if (map != MAP_FAILED)
+        {
+            munmap(map, st.st_size);
+        }
+        close(fd);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief The capture loop.
+ *
+ * Waits for events (or a wakeup), then drains everything queued in batches
+ * and encodes it straight into the mapped file.
+ */
+void EdgeCapture::run()
+{
+    ThreadPolicy::Binding policy(*this);
+    gpio_edge_event_t events[EVENT_BATCH_SIZE];
+    struct pollfd fds[2];
+
+    fds[0].fd = m_request->get_fd();
+    fds[0].events = POLLIN;
+    fds[1].fd = m_wake.get_fd();
+    fds[1].events = POLLIN;
+
+    while (_run)
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno != EINTR)
+            {
+                GPIO_DIAG(GPIO_LOG_ERROR, "EdgeCapture", GPIO_ERR_IO, errno, "Failed to wait for events");
+            }
+            continue;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            m_wake.clear();
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            while (m_request->wait_edge_events(0) > 0)
+            {
+                int count = m_request->read_edge_events(events, EVENT_BATCH_SIZE);
+                if (count <= 0)
+                {
+                    break;
+                }
+                for (int i = 0; i < count; i++)
+                {
+                    record(events[i]);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Create, preallocate and map the capture file, and fill in the header.
+ */
+bool EdgeCapture::open_file(const string &chipname)
+{
+    bool retVal = false;
+
+    m_capacity = sizeof(capture_header_t) + INITIAL_FILE_SIZE;
+    if ((m_max_bytes > 0) && (m_capacity > (sizeof(capture_header_t) + m_max_bytes)))
+    {
+        m_capacity = sizeof(capture_header_t) + m_max_bytes;
+    }
+
+    m_fd = open(m_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_fd < 0)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "EdgeCapture", GPIO_ERR_IO, 0, "Unable to create capture <%s>", m_path.c_str());
+    }
+    else if (posix_fallocate(m_fd, 0, m_capacity) != 0)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "EdgeCapture", GPIO_ERR_NO_MEMORY, 0, "Unable to preallocate capture <%s>", m_path.c_str());
+    }
+    else
+    {
+        void *map = mmap(NULL, m_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        if (map == MAP_FAILED)
+        {
+            GPIO_DIAG(GPIO_LOG_ERROR, "EdgeCapture", GPIO_ERR_IO, errno, "Unable to map capture <%s>", m_path.c_str());
+        }
+        else
+        {
+            m_data = (uint8_t *) map;
+
+            capture_header_t *hdr = header();
+            memset(hdr, 0, sizeof(capture_header_t));
+            memcpy(hdr->magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+            hdr->version = CAPTURE_VERSION;
+            hdr->num_lines = m_request->get_num_lines();
+            strncpy(hdr->chip, chipname.c_str(), sizeof(hdr->chip) - 1);
+
+            // Line names cost an ioctl apiece- once, here, is fine.
+            for (uint32_t i = 0; i < hdr->num_lines; i++)
+            {
+                hdr->offsets[i] = m_request->get_offsets()[i];
+
+                string name = m_request->get_chip()->get_line_name(hdr->offsets[i]);
+                strncpy(hdr->names[i], name.c_str(), sizeof(hdr->names[i]) - 1);
+            }
+
+            retVal = true;
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Double the capture file (up to the cap).
+ *
+ * @return false if we're at the cap or the file couldn't be grown.
+ */
+bool EdgeCapture::grow()
+{
+    bool retVal = false;
+    uint64_t capacity = m_capacity * 2;
+
+    if ((m_max_bytes > 0) && (capacity > (sizeof(capture_header_t) + m_max_bytes)))
+    {
+        capacity = sizeof(capture_header_t) + m_max_bytes;
+    }
+
+    if ((capacity > m_capacity) && (posix_fallocate(m_fd, 0, capacity) == 0))
+    {
+        void *map = mremap(m_data, m_capacity, capacity, MREMAP_MAYMOVE);
+        if (map == MAP_FAILED)
+        {
+            GPIO_DIAG(GPIO_LOG_ERROR, "EdgeCapture", GPIO_ERR_IO, errno, "Unable to remap capture");
+        }
+        else
+        {
+            m_data = (uint8_t *) map;
+            m_capacity = capacity;
+            retVal = true;
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Encode one event into the file.
+ */
+void EdgeCapture::record(const gpio_edge_event_t &event)
+{
+    uint64_t used = m_used;
+
+    // The kernel numbers every event on the request- gaps are drops.
+    if ((m_last_seqno != 0) && (event.global_seqno > (m_last_seqno + 1)))
+    {
+        m_lost += event.global_seqno - m_last_seqno - 1;
+    }
+    m_last_seqno = event.global_seqno;
+
+    if ((sizeof(capture_header_t) + used + MAX_RECORD_SIZE) > m_capacity)
+    {
+        if (m_full || !grow())
+        {
+            if (!m_full)
+            {
+                GPIO_DIAG(GPIO_LOG_WARNING, "EdgeCapture", GPIO_ERR_NO_SPACE, 0, "Capture file is full");
+                m_full = true;
+            }
+            m_lost++;
+            return;
+        }
+    }
+
+    // An edge that beat our start time (or out of order across lines) is
+    // recorded as simultaneous rather than going backwards.
+    uint64_t delta = (event.timestamp_ns > m_last_ns) ? (event.timestamp_ns - m_last_ns) : 0;
+    m_last_ns += delta;
+
+    uint8_t *p = m_data + sizeof(capture_header_t) + used;
+    *p++ = (event.index << 1) | (event.rising ? 0x01 : 0x00);
+    while (delta >= 0x80)
+    {
+        *p++ = (delta & 0x7F) | 0x80;
+        delta >>= 7;
+    }
+    *p++ = delta;
+
+    m_used = p - (m_data + sizeof(capture_header_t));
+    m_events++;
+}
@@ -0,0 +1,311 @@
+
+#include <string>
+using std::string;
+
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+#include "FrequencyCounter.hpp"
+#include "GPIODiag.hpp"
+#include "GPIOMetrics.hpp"
+
+// The kernel's ceiling on a request's event buffer.
+static const size_t KERNEL_EVENT_BUFFER = 1024;
+
+// How many events we pull per read.
+static const size_t EVENT_BATCH_SIZE = 64;
+
+// Floor on how often we'll drain when the lines are busy.
+static const uint64_t MIN_DRAIN_NS = 1000000;
+
+/**
+ * Constructor for FrequencyCounter.  Requests the lines as inputs with
+ * both edges detected and the biggest event buffer the kernel will give
+ * us, then starts counting.
+ *
+ * @param chipname The chip the lines are on.
+ * @param offsets The lines to measure.
+ * @param interval_ns How often to produce a reading for each line.
+ * @param callback Called with each line's reading every interval, may be nullptr.
+ */
+FrequencyCounter::FrequencyCounter(const string &chipname, const vector<unsigned int> &offsets,
+                                   uint64_t interval_ns, frequency_callback_t callback) :
+    LoopThread("FreqCounter"),
+    m_interval_ns(interval_ns), m_callback(callback), m_state(offsets.size()),
+    m_readings(offsets.size()), m_have_reading(offsets.size(), false)
+{
+    for (auto &state : m_state)
+    {
+        state = line_state_t();
+        state.pulses_per_rev = 1;
+    }
+
+    shared_ptr<GPIOChip> chip = GPIOChip::open(chipname);
+    if (chip == nullptr)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "FrequencyCounter", GPIO_ERR_NO_CHIP, 0, "Failed to open GPIO chip <%s>", chipname.c_str());
+    }
+    else if (m_interval_ns == 0)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "FrequencyCounter", GPIO_ERR_INVALID, 0, "Interval can't be zero");
+    }
+    else
+    {
+        gpio_line_settings_t settings;
+        settings.edge = GPIOD_LINE_EDGE_BOTH;
+
+        m_request.reset(new GPIOLineRequest(chip, offsets, "FrequencyCounter"));
+        m_request->set_settings(settings);
+        m_request->set_event_buffer_size(KERNEL_EVENT_BUFFER);
+        if (!m_request->request())
+        {
+            GPIO_DIAG(GPIO_LOG_ERROR, "FrequencyCounter", GPIO_ERR_IO, 0, "Failed to request lines");
+        }
+        else
+        {
+            start();
+        }
+    }
+}
+
+/**
+ * Destructor for FrequencyCounter.  Stops counting and releases the lines.
+ */
+FrequencyCounter::~FrequencyCounter()
+{
+    stop_loop();
+}
+
+/**
+ * @brief Set the pulses per revolution used for the rpm figure.
+ *
+ * @return false if the line isn't one of ours or pulses is zero.
+ */
+bool FrequencyCounter::set_pulses_per_rev(unsigned int offset, unsigned int pulses)
+{
+    bool retVal = false;
+    int index = (m_request != nullptr) ? m_request->get_index(offset) : -1;
+
+    if ((index >= 0) && (pulses > 0))
+    {
+        lock_guard<mutex> lock(m_lock);
+        m_state[index].pulses_per_rev = pulses;
+        retVal = true;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Get the latest completed reading for a line.
+ *
+ * @return false if the line isn't one of ours or no interval has completed yet.
+ */
+bool FrequencyCounter::get_reading(unsigned int offset, frequency_reading_t &reading)
+{
+    bool retVal = false;
+    int index = (m_request != nullptr) ? m_request->get_index(offset) : -1;
+
+    if (index >= 0)
+    {
+        lock_guard<mutex> lock(m_lock);
+        if (m_have_reading[index])
+        {
+            reading = m_readings[index];
+            retVal = true;
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief The counting loop.
+ *
+ * Sleeps until the next drain or the end of the interval, whichever comes
+ * first, then pulls everything the kernel has queued up in batches.  If a
+ * drain pulls more than half of the kernel's buffer, we drain twice as often
+ * next time so nothing overflows, backing off again once things quiet down.
+ */
+void FrequencyCounter::run()
+{
+    ThreadPolicy::Binding policy(*this);
+    gpio_edge_event_t events[EVENT_BATCH_SIZE];
+    struct pollfd fds[1];
+    uint64_t drain_ns = m_interval_ns;
+    uint64_t deadline = GPIOMetrics::now_ns() + m_interval_ns;
+    uint64_t next_drain = GPIOMetrics::now_ns() + drain_ns;
+
+    fds[0].fd = m_wake.get_fd();
+    fds[0].events = POLLIN;
+
+    while (_run)
+    {
+        uint64_t now = GPIOMetrics::now_ns();
+        uint64_t wake_at = (next_drain < deadline) ? next_drain : deadline;
+
+        if (wake_at > now)
+        {
+            struct timespec timeout;
+            timeout.tv_sec = (wake_at - now) / 1000000000ULL;
+            timeout.tv_nsec = (wake_at - now) % 1000000000ULL;
+            if (ppoll(fds, 1, &timeout, NULL) > 0)
+            {
+                m_wake.clear();
+                continue;
+            }
+        }
+
+        // Drain everything that's queued up...
+        size_t drained = 0;
+        while (m_request->wait_edge_events(0) > 0)
+        {
+            int count = m_request->read_edge_events(events, EVENT_BATCH_SIZE);
+            if (count <= 0)
+            {
+                break;
+            }
+            for (int i = 0; i < count; i++)
+            {
+                process(events[i]);
+            }
+            drained += count;
+        }
+
+        // ...and adjust how often we do that to how busy things are.
+        if ((drained > (KERNEL_EVENT_BUFFER / 2)) && (drain_ns > MIN_DRAIN_NS))
+        {
+            drain_ns /= 2;
+        }
+        else if ((drained < (KERNEL_EVENT_BUFFER / 8)) && (drain_ns < m_interval_ns))
+        {
+            drain_ns *= 2;
+            if (drain_ns > m_interval_ns)
+            {
+                drain_ns = m_interval_ns;
+            }
+        }
+
+        now = GPIOMetrics::now_ns();
+        next_drain = now + drain_ns;
+
+        if (now >= deadline)
+        {
+            publish(now);
+            deadline += m_interval_ns;
+            if (deadline <= now)
+            {
+                // We were held off for more than a whole interval.  Resync.
+                deadline = now + m_interval_ns;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Fold one edge into its line's accumulators.
+ */
+void FrequencyCounter::process(const gpio_edge_event_t &event)
+{
+    line_state_t &state = m_state[event.index];
+
+    // Gaps in the line's sequence numbers are events the kernel dropped.
+    if ((state.last_seqno != 0) && (event.line_seqno > (state.last_seqno + 1)))
+    {
+        state.lost += event.line_seqno - state.last_seqno - 1;
+    }
+    state.last_seqno = event.line_seqno;
+
+    if (event.rising)
+    {
+        state.edges++;
+        if (state.have_rise)
+        {
+            uint64_t period = event.timestamp_ns - state.last_rise_ns;
+            state.period_sum += period;
+            state.period_count++;
+            if ((state.min_period == 0) || (period < state.min_period))
+            {
+                state.min_period = period;
+            }
+            if (period > state.max_period)
+            {
+                state.max_period = period;
+            }
+        }
+        state.last_rise_ns = event.timestamp_ns;
+        state.have_rise = true;
+    }
+    else if (state.have_rise)
+    {
+        state.high_sum += event.timestamp_ns - state.last_rise_ns;
+        state.high_count++;
+    }
+}
+
+/**
+ * @brief Turn the interval's accumulators into readings and hand them out.
+ *
+ * The accumulators are cleared, but the last rising edge is kept so the
+ * first period of the next interval is measured across the boundary.
+ */
+void FrequencyCounter::publish(uint64_t timestamp_ns)
+{
+    for (size_t i = 0; i < m_state.size(); i++)
+    {
+        line_state_t &state = m_state[i];
+        frequency_reading_t reading = frequency_reading_t();
+
+        reading.offset = m_request->get_offsets()[i];
+        reading.timestamp_ns = timestamp_ns;
+        reading.interval_ns = m_interval_ns;
+        reading.edges = state.edges;
+        reading.min_period_ns = state.min_period;
+        reading.max_period_ns = state.max_period;
+        reading.lost = state.lost;
+
+        if (state.period_count > 0)
+        {
+            // Timestamped periods are the accurate answer...
+            reading.period_ns = (double) state.period_sum / state.period_count;
+            reading.frequency_hz = 1000000000.0 / reading.period_ns;
+        }
+        else
+        {
+            // ...but at very low rates, counting is all we've got.
+            reading.frequency_hz = (double) state.edges * 1000000000.0 / m_interval_ns;
+        }
+
+        if (state.high_count > 0)
+        {
+            reading.pulse_width_ns = (double) state.high_sum / state.high_count;
+            if (reading.period_ns > 0.0)
+            {
+                reading.duty = reading.pulse_width_ns / reading.period_ns;
+            }
+        }
+
+        {
+            lock_guard<mutex> lock(m_lock);
+            reading.rpm = reading.frequency_hz * 60.0 / state.pulses_per_rev;
+            m_readings[i] = reading;
+            m_have_reading[i] = true;
+        }
+
+        if (m_callback)
+        {
+            m_callback(reading);
+        }
+
+        // Clear for the next interval, keeping the edge timing continuity.
+        state.edges = 0;
+        state.period_sum = 0;
+        state.period_count = 0;
+        state.min_period = 0;
+        state.max_period = 0;
+        state.high_sum = 0;
+        state.high_count = 0;
+        state.lost = 0;
+    }
+}
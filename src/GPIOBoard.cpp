@@ -0,0 +1,568 @@
+
+#include <string>
+using std::string;
+
+#include <fstream>
+using std::ifstream;
+
+#include <set>
+using std::set;
+
+#include <utility>
+using std::pair;
+
+#include <algorithm>
+using std::min;
+
+#include <errno.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "GPIOBoard.hpp"
+#include "GPIODiag.hpp"
+#include "GPIOMetrics.hpp"
+
+/**
+ * @brief Strip the leading and trailing whitespace off of a string.
+ */
+static string trim(const string &value)
+{
+    size_t start = 0;
+    size_t end = value.size();
+
+    while ((start < end) && isspace((unsigned char) value[start]))
+    {
+        start++;
+    }
+    while ((end > start) && isspace((unsigned char) value[end - 1]))
+    {
+        end--;
+    }
+
+    return value.substr(start, end - start);
+}
+
+/**
+ * @brief Lower case copy of a string.
+ */
+static string lower(const string &value)
+{
+    string retVal = value;
+
+    for (auto &c : retVal)
+    {
+        c = tolower((unsigned char) c);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Parse a true/false, yes/no, on/off or 1/0.
+ */
+static bool parse_bool(const string &value, bool &result)
+{
+    bool retVal = true;
+    string text = lower(value);
+
+    if ((text == "true") || (text == "yes") || (text == "on") || (text == "1"))
+    {
+        result = true;
+    }
+    else if ((text == "false") || (text == "no") || (text == "off") || (text == "0"))
+    {
+        result = false;
+    }
+    else
+    {
+        retVal = false;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Parse an unsigned number, decimal or 0x hex.
+ */
+static bool parse_number(const string &value, unsigned long &result)
+{
+    char *end = nullptr;
+
+    errno = 0;
+    result = strtoul(value.c_str(), &end, 0);
+
+    return !value.empty() && (value[0] != '-') && (errno == 0) && (*end == '\0');
+}
+
+/**
+ * @brief Apply one key = value to a line.
+ *
+ * @return false if the key or the value is bad.
+ */
+static bool parse_key(const string &key, const string &value, gpio_board_line_t &line)
+{
+    bool retVal = true;
+    string text = lower(value);
+    unsigned long number = 0;
+
+    if (key == "chip")
+    {
+        line.chip = value;
+    }
+    else if (key == "line")
+    {
+        retVal = parse_number(value, number);
+        line.offset = number;
+        line.has_offset = retVal;
+    }
+    else if (key == "name")
+    {
+        line.line_name = value;
+    }
+    else if (key == "direction")
+    {
+        if (text == "input")
+        {
+            line.settings.direction = GPIOD_LINE_DIRECTION_INPUT;
+        }
+        else if (text == "output")
+        {
+            line.settings.direction = GPIOD_LINE_DIRECTION_OUTPUT;
+        }
+        else
+        {
+            retVal = false;
+        }
+    }
+    else if (key == "edge")
+    {
+        if (text == "none")
+        {
+            line.settings.edge = GPIOD_LINE_EDGE_NONE;
+        }
+        else if (text == "rising")
+        {
+            line.settings.edge = GPIOD_LINE_EDGE_RISING;
+        }
+        else if (text == "falling")
+        {
+            line.settings.edge = GPIOD_LINE_EDGE_FALLING;
+        }
+        else if (text == "both")
+        {
+            line.settings.edge = GPIOD_LINE_EDGE_BOTH;
+        }
+        else
+        {
+            retVal = false;
+        }
+    }
+    else if (key == "bias")
+    {
+        if (text == "as-is")
+        {
+            line.settings.bias = GPIOD_LINE_BIAS_AS_IS;
+        }
+        else if (text == "disabled")
+        {
+            line.settings.bias = GPIOD_LINE_BIAS_DISABLED;
+        }
+        else if (text == "pull-up")
+        {
+            line.settings.bias = GPIOD_LINE_BIAS_PULL_UP;
+        }
+        else if (text == "pull-down")
+        {
+            line.settings.bias = GPIOD_LINE_BIAS_PULL_DOWN;
+        }
+        else
+        {
+            retVal = false;
+        }
+    }
+    else if (key == "drive")
+    {
+        if (text == "push-pull")
+        {
+            line.settings.drive = GPIOD_LINE_DRIVE_PUSH_PULL;
+        }
+        else if (text == "open-drain")
+        {
+            line.settings.drive = GPIOD_LINE_DRIVE_OPEN_DRAIN;
+        }
+        else if (text == "open-source")
+        {
+            line.settings.drive = GPIOD_LINE_DRIVE_OPEN_SOURCE;
+        }
+        else
+        {
+            retVal = false;
+        }
+    }
+    else if (key == "active_low")
+    {
+        retVal = parse_bool(value, line.settings.active_low);
+    }
+    else if (key == "value")
+    {
+        retVal = parse_bool(value, line.settings.value);
+    }
+    else if (key == "debounce_us")
+    {
+        retVal = parse_number(value, number);
+        line.settings.debounce_us = number;
+    }
+    else
+    {
+        retVal = false;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Load a board description from a file and bring it up.
+ *
+ * @param path The INI file.
+ * @param consumer The consumer name the kernel will report for the lines.
+ * @return The board, nullptr on any failure.
+ */
+unique_ptr<GPIOBoard> GPIOBoard::load(const string &path, const string &consumer)
+{
+    unique_ptr<GPIOBoard> retVal;
+    ifstream in(path);
+
+    if (!in.is_open())
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOBoard", GPIO_ERR_IO, errno, "Failed to open board description <%s>", path.c_str());
+    }
+    else
+    {
+        retVal = load(in, consumer);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Load a board description from a stream and bring it up.
+ */
+unique_ptr<GPIOBoard> GPIOBoard::load(istream &in, const string &consumer)
+{
+    unique_ptr<GPIOBoard> retVal;
+    vector<gpio_board_line_t> lines;
+    uint64_t start = GPIOMetrics::now_ns();
+
+    if (parse(in, lines))
+    {
+        uint64_t parse_ns = GPIOMetrics::now_ns() - start;
+
+        retVal = create(lines, consumer);
+        if (retVal != nullptr)
+        {
+            retVal->m_timing.parse_ns = parse_ns;
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Bring up a board from lines built in code.
+ */
+unique_ptr<GPIOBoard> GPIOBoard::create(const vector<gpio_board_line_t> &lines, const string &consumer)
+{
+    unique_ptr<GPIOBoard> retVal(new GPIOBoard());
+
+    if (!retVal->bring_up(lines, consumer))
+    {
+        retVal.reset();
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Parse an INI board description.
+ *
+ * Each section is a line.  Sections and keys can come in any order, but a
+ * key outside of a section, an unknown key or a value that doesn't parse
+ * fails the whole thing- a typo in a pin map is better found at startup.
+ *
+ * @param in The description.
+ * @param lines Filled with the lines, in the order they're described.
+ * @return false on a bad description.
+ */
+bool GPIOBoard::parse(istream &in, vector<gpio_board_line_t> &lines)
+{
+    bool retVal = true;
+    string text;
+    size_t number = 0;
+
+    lines.clear();
+
+    while (retVal && std::getline(in, text))
+    {
+        number++;
+
+        // Comments run to the end of the line...
+        size_t comment = text.find_first_of(";#");
+        if (comment != string::npos)
+        {
+            text.erase(comment);
+        }
+        text = trim(text);
+
+        if (text.empty())
+        {
+            continue;
+        }
+
+        if (text[0] == '[')
+        {
+            if ((text.back() != ']') || (text.size() < 3))
+            {
+                GPIO_DIAG(GPIO_LOG_ERROR, "GPIOBoard", GPIO_ERR_INVALID, 0, "Bad section header at line %zu", number);
+                retVal = false;
+            }
+            else
+            {
+                gpio_board_line_t line;
+                line.name = trim(text.substr(1, text.size() - 2));
+                lines.push_back(line);
+            }
+        }
+        else
+        {
+            size_t equals = text.find('=');
+
+            if (lines.empty())
+            {
+                GPIO_DIAG(GPIO_LOG_ERROR, "GPIOBoard", GPIO_ERR_INVALID, 0, "Key outside of a section at line %zu", number);
+                retVal = false;
+            }
+            else if (equals == string::npos)
+            {
+                GPIO_DIAG(GPIO_LOG_ERROR, "GPIOBoard", GPIO_ERR_INVALID, 0, "Expected key = value at line %zu", number);
+                retVal = false;
+            }
+            else if (!parse_key(lower(trim(text.substr(0, equals))), trim(text.substr(equals + 1)), lines.back()))
+            {
+                GPIO_DIAG(GPIO_LOG_ERROR, "GPIOBoard", GPIO_ERR_INVALID, 0, "Bad key or value at line %zu", number);
+                retVal = false;
+            }
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Get the request and offset a line ended up in.
+ *
+ * @return false if there's no such line on the board.
+ */
+bool GPIOBoard::get_line(const string &name, GPIOLineRequest *&request, unsigned int &offset)
+{
+    bool retVal = false;
+
+    auto it = m_lines.find(name);
+    if (it != m_lines.end())
+    {
+        request = it->second.request;
+        offset = it->second.offset;
+        retVal = true;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Get the names of all the lines on the board.
+ */
+vector<string> GPIOBoard::get_line_names()
+{
+    vector<string> retVal;
+
+    for (auto &entry : m_lines)
+    {
+        retVal.push_back(entry.first);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Read a line's (logical) value by name.
+ */
+GPIOStatus GPIOBoard::read_value(const string &name, bool &value)
+{
+    GPIOStatus retVal(GPIO_ERR_NO_LINE);
+
+    auto it = m_lines.find(name);
+    if (it != m_lines.end())
+    {
+        retVal = it->second.request->read_value(it->second.offset, value);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Set a line's (logical) value by name.
+ */
+GPIOStatus GPIOBoard::set_value(const string &name, bool value)
+{
+    GPIOStatus retVal(GPIO_ERR_NO_LINE);
+
+    auto it = m_lines.find(name);
+    if (it != m_lines.end())
+    {
+        retVal = it->second.request->set_value(it->second.offset, value);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Resolve the lines, group them by chip and request them.
+ *
+ * Every chip is opened once, and lines are grouped by the chip handle rather
+ * than the path so two spellings of the same chip still end up in the one
+ * request.  Anything failing releases whatever was already requested.
+ *
+ * @return false (and logged) on any failure.
+ */
+bool GPIOBoard::bring_up(const vector<gpio_board_line_t> &lines, const string &consumer)
+{
+    bool retVal = true;
+    vector<pair<shared_ptr<GPIOChip>, vector<size_t>>> groups;     // Chip, and the lines (by index) on it
+    map<string, shared_ptr<GPIOChip>> chips;
+    vector<unsigned int> offsets(lines.size(), 0);
+    uint64_t start = GPIOMetrics::now_ns();
+
+    m_timing.lines = lines.size();
+
+    // Find every line and sort them out by chip...
+    for (size_t i = 0; retVal && (i < lines.size()); i++)
+    {
+        const gpio_board_line_t &line = lines[i];
+        string chip_path = line.chip;
+
+        offsets[i] = line.offset;
+        if (line.name.empty() || (m_lines.find(line.name) != m_lines.end()))
+        {
+            GPIO_DIAG(GPIO_LOG_ERROR, "GPIOBoard", GPIO_ERR_INVALID, 0, "Missing or duplicate line name <%s>", line.name.c_str());
+            retVal = false;
+            break;
+        }
+
+        m_lines[line.name] = { nullptr, 0 };
+        if (chip_path.empty() != !line.has_offset)
+        {
+            GPIO_DIAG(GPIO_LOG_ERROR, "GPIOBoard", GPIO_ERR_INVALID, 0, "Line <%s> needs both a chip and a line, or neither", line.name.c_str());
+            retVal = false;
+        }
+        else if (chip_path.empty())
+        {
+            const string &line_name = line.line_name.empty() ? line.name : line.line_name;
+
+            if (!GPIOChip::find_line(line_name, chip_path, offsets[i]))
+            {
+                GPIO_DIAG(GPIO_LOG_ERROR, "GPIOBoard", GPIO_ERR_NO_LINE, 0, "No line named <%s> on the system", line_name.c_str());
+                retVal = false;
+            }
+        }
+
+        if (retVal && (chips.find(chip_path) == chips.end()))
+        {
+            chips[chip_path] = GPIOChip::open(chip_path);
+            if (chips[chip_path] == nullptr)
+            {
+                GPIO_DIAG(GPIO_LOG_ERROR, "GPIOBoard", GPIO_ERR_NO_CHIP, 0, "Failed to open GPIO chip <%s>", chip_path.c_str());
+                retVal = false;
+            }
+        }
+
+        if (retVal)
+        {
+            shared_ptr<GPIOChip> chip = chips[chip_path];
+            size_t group = 0;
+
+            if (offsets[i] >= chip->get_num_lines())
+            {
+                GPIO_DIAG(GPIO_LOG_ERROR, "GPIOBoard", GPIO_ERR_NO_LINE, 0, "Invalid line number %u for <%s>", offsets[i], line.name.c_str());
+                retVal = false;
+            }
+
+            while ((group < groups.size()) && (groups[group].first != chip))
+            {
+                group++;
+            }
+            if (group == groups.size())
+            {
+                groups.push_back({ chip, vector<size_t>() });
+            }
+            groups[group].second.push_back(i);
+        }
+    }
+
+    m_timing.chips = groups.size();
+    m_timing.resolve_ns = GPIOMetrics::now_ns() - start;
+    start = GPIOMetrics::now_ns();
+
+    // ...and then one request per chip, with all of its lines' settings in it.
+    for (size_t group = 0; retVal && (group < groups.size()); group++)
+    {
+        const vector<size_t> &members = groups[group].second;
+        set<unsigned int> seen;
+
+        for (size_t first = 0; retVal && (first < members.size()); first += GPIOLineRequest::MAX_LINES)
+        {
+            size_t last = min(first + GPIOLineRequest::MAX_LINES, members.size());
+            vector<unsigned int> request_offsets;
+
+            for (size_t member = first; member < last; member++)
+            {
+                if (!seen.insert(offsets[members[member]]).second)
+                {
+                    GPIO_DIAG(GPIO_LOG_ERROR, "GPIOBoard", GPIO_ERR_BUSY, 0, "Line <%s> is already on the board",
+                              lines[members[member]].name.c_str());
+                    retVal = false;
+                }
+                request_offsets.push_back(offsets[members[member]]);
+            }
+
+            if (retVal)
+            {
+                unique_ptr<GPIOLineRequest> request(new GPIOLineRequest(groups[group].first, request_offsets, consumer));
+
+                for (size_t member = first; member < last; member++)
+                {
+                    request->set_settings(offsets[members[member]], lines[members[member]].settings);
+                    m_lines[lines[members[member]].name] = { request.get(), offsets[members[member]] };
+                }
+
+                if (!request->request())
+                {
+                    GPIO_DIAG(GPIO_LOG_ERROR, "GPIOBoard", GPIO_ERR_IO, 0, "Failed to request %zu lines on <%s>",
+                              request_offsets.size(), groups[group].first->get_path().c_str());
+                    retVal = false;
+                }
+                m_requests.push_back(std::move(request));
+            }
+        }
+    }
+
+    m_timing.requests = m_requests.size();
+    m_timing.request_ns = GPIOMetrics::now_ns() - start;
+
+    if (!retVal)
+    {
+        m_requests.clear();
+        m_lines.clear();
+    }
+
+    return retVal;
+}
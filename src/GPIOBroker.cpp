@@ -0,0 +1,701 @@
+
+#include <string>
+using std::string;
+
+#include <utility>
+using std::pair;
+
+#include <algorithm>
+using std::fill;
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "GPIOBroker.hpp"
+#include "GPIODiag.hpp"
+
+// What an epoll event is for.  The low 32 bits are the fd (or request index).
+static const uint64_t TAG_CLIENT = 0;
+static const uint64_t TAG_LISTEN = 1ULL << 32;
+static const uint64_t TAG_WAKE = 2ULL << 32;
+static const uint64_t TAG_REQUEST = 3ULL << 32;
+static const uint64_t TAG_MASK = 0xffffffff00000000ULL;
+
+// Most epoll events and edge events we take per pass.
+static const int EPOLL_BATCH_SIZE = 32;
+static const size_t EVENT_BATCH_SIZE = 64;
+
+// Replies we'll hold for a client whose socket is full before giving up on it.
+static const size_t MAX_HELD_REPLIES = 64;
+
+/**
+ * Constructor for GPIOBroker.  Maps the board's lines to broker indexes,
+ * opens the socket and starts the broker thread.
+ *
+ * @param socket_path Where to put the Unix domain socket.
+ * @param board The lines to serve, already brought up.
+ * @param mode Permissions for the socket, which also decide who's let in.
+ */
+GPIOBroker::GPIOBroker(const string &socket_path, unique_ptr<GPIOBoard> board, mode_t mode) :
+    LoopThread("GPIOBroker"),
+    m_socket_path(socket_path), m_mode(mode & 0777), m_board(std::move(board)), m_output_lines(0), m_listen_fd(-1), m_epoll_fd(-1),
+    m_client_count(0), m_messages(0), m_sets(0), m_bulk_writes(0), m_edges_sent(0), m_edges_dropped(0),
+    m_disconnects(0)
+{
+    struct sockaddr_un addr;
+
+    if (m_board == nullptr)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOBroker", GPIO_ERR_INVALID, 0, "No board to serve");
+    }
+    else if (m_socket_path.size() >= sizeof(addr.sun_path))
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOBroker", GPIO_ERR_INVALID, 0, "Socket path <%s> is too long", m_socket_path.c_str());
+    }
+    else
+    {
+        number_lines();
+        listen_on();
+    }
+}
+
+/**
+ * Destructor for GPIOBroker.  Stops the thread, hangs up on the clients and
+ * removes the socket.  The board's lines are released with it.
+ */
+GPIOBroker::~GPIOBroker()
+{
+    stop_loop();
+
+    for (auto &client : m_clients)
+    {
+        close(client.first);
+    }
+    m_clients.clear();
+
+    if (m_listen_fd >= 0)
+    {
+        close(m_listen_fd);
+        unlink(m_socket_path.c_str());
+    }
+    if (m_epoll_fd >= 0)
+    {
+        close(m_epoll_fd);
+    }
+}
+
+/**
+ * @brief Get the broker index of a line.
+ *
+ * @return The index, -1 if the line isn't served.
+ */
+int GPIOBroker::get_line(const string &name)
+{
+    int retVal = -1;
+
+    for (size_t i = 0; i < m_lines.size(); i++)
+    {
+        if (m_lines[i].name == name)
+        {
+            retVal = i;
+            break;
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Get the broker's counters.
+ */
+gpio_broker_stats_t GPIOBroker::get_stats()
+{
+    gpio_broker_stats_t retVal;
+
+    retVal.clients = m_client_count;
+    retVal.messages = m_messages;
+    retVal.sets = m_sets;
+    retVal.bulk_writes = m_bulk_writes;
+    retVal.edges_sent = m_edges_sent;
+    retVal.edges_dropped = m_edges_dropped;
+    retVal.disconnects = m_disconnects;
+
+    return retVal;
+}
+
+/**
+ * @brief The broker loop.
+ *
+ * Every pass drains all of the ready clients first, folding their SETs into
+ * one pending mask/values per line request, then writes each request once,
+ * then answers everybody.  A SET's reply carries the status of the writes
+ * it was folded into.
+ */
+void GPIOBroker::run()
+{
+    ThreadPolicy::Binding policy(*this);
+    const vector<unique_ptr<GPIOLineRequest>> &requests = m_board->get_requests();
+    struct epoll_event events[EPOLL_BATCH_SIZE];
+    vector<uint64_t> pending_mask(requests.size());
+    vector<uint64_t> pending_values(requests.size());
+    vector<GPIOStatus> write_status(requests.size());
+    vector<pair<int, gpio_broker_msg_t>> sets;
+    vector<pair<int, gpio_broker_msg_t>> gets;
+
+    while (_run)
+    {
+        int count = epoll_wait(m_epoll_fd, events, EPOLL_BATCH_SIZE, -1);
+        if (count < 0)
+        {
+            if (errno != EINTR)
+            {
+                GPIO_DIAG(GPIO_LOG_ERROR, "GPIOBroker", GPIO_ERR_IO, errno, "Failed to wait for events");
+            }
+            continue;
+        }
+
+        sets.clear();
+        gets.clear();
+        fill(pending_mask.begin(), pending_mask.end(), 0);
+
+        for (int i = 0; i < count; i++)
+        {
+            uint64_t tag = events[i].data.u64 & TAG_MASK;
+            int fd = (int) (events[i].data.u64 & ~TAG_MASK);
+
+            if (tag == TAG_WAKE)
+            {
+                m_wake.clear();
+            }
+            else if (tag == TAG_LISTEN)
+            {
+                accept_clients();
+            }
+            else if (tag == TAG_REQUEST)
+            {
+                read_edges(fd);
+            }
+            else if (events[i].events & (EPOLLHUP | EPOLLERR))
+            {
+                m_clients[fd].closing = true;
+            }
+            else
+            {
+                gpio_broker_msg_t msg;
+                ssize_t len;
+
+                if (events[i].events & EPOLLOUT)
+                {
+                    flush_replies(fd);
+                }
+
+                // Everything they've sent us, so it all goes out in this pass's writes.
+                while ((len = recv(fd, &msg, sizeof(msg), MSG_DONTWAIT)) > 0)
+                {
+                    gpio_broker_msg_t reply;
+
+                    m_messages++;
+                    memset(&reply, 0, sizeof(reply));
+                    reply.type = GPIO_BROKER_REPLY;
+                    reply.id = msg.id;
+                    reply.status = GPIO_OK;
+
+                    if ((size_t) len != sizeof(msg))
+                    {
+                        reply.status = GPIO_ERR_INVALID;
+                        send_msg(fd, reply);
+                        continue;
+                    }
+
+                    // Lines we don't serve in a mask are an error, not silently skipped.
+                    uint64_t valid = (m_lines.size() >= 64) ? ~0ULL : ((1ULL << m_lines.size()) - 1);
+                    if ((msg.type != GPIO_BROKER_LOOKUP) && ((msg.mask & ~valid) != 0))
+                    {
+                        reply.status = GPIO_ERR_NO_LINE;
+                        send_msg(fd, reply);
+                        continue;
+                    }
+
+                    switch (msg.type)
+                    {
+                        case GPIO_BROKER_LOOKUP:
+                            msg.name[GPIO_BROKER_NAME_SIZE - 1] = '\0';
+                            reply.status = GPIO_ERR_NO_LINE;
+                            for (size_t line = 0; line < m_lines.size(); line++)
+                            {
+                                if (m_lines[line].name == msg.name)
+                                {
+                                    reply.status = GPIO_OK;
+                                    reply.line = line;
+                                    reply.mask = 1ULL << line;
+                                    break;
+                                }
+                            }
+                            send_msg(fd, reply);
+                            break;
+
+                        case GPIO_BROKER_SET:
+                            m_sets++;
+
+                            // The write's all-or-nothing per request- an input in one
+                            // client's mask would fail everybody's SETs with it.
+                            if ((msg.mask & ~m_output_lines) != 0)
+                            {
+                                reply.status = GPIO_ERR_DIRECTION;
+                                send_msg(fd, reply);
+                                break;
+                            }
+
+                            for (size_t line = 0; line < m_lines.size(); line++)
+                            {
+                                if (msg.mask & (1ULL << line))
+                                {
+                                    const broker_line_t &entry = m_lines[line];
+
+                                    pending_mask[entry.request] |= entry.request_mask;
+                                    if (msg.values & (1ULL << line))
+                                    {
+                                        pending_values[entry.request] |= entry.request_mask;
+                                    }
+                                    else
+                                    {
+                                        pending_values[entry.request] &= ~entry.request_mask;
+                                    }
+                                }
+                            }
+                            sets.push_back({ fd, msg });
+                            break;
+
+                        case GPIO_BROKER_GET:
+                            gets.push_back({ fd, msg });
+                            break;
+
+                        case GPIO_BROKER_SUBSCRIBE:
+                            m_clients[fd].subscribed |= msg.mask;
+                            send_msg(fd, reply);
+                            break;
+
+                        case GPIO_BROKER_UNSUBSCRIBE:
+                            m_clients[fd].subscribed &= ~msg.mask;
+                            send_msg(fd, reply);
+                            break;
+
+                        default:
+                            reply.status = GPIO_ERR_INVALID;
+                            send_msg(fd, reply);
+                            break;
+                    }
+                }
+
+                if ((len == 0) || ((len < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK)))
+                {
+                    m_clients[fd].closing = true;
+                }
+            }
+        }
+
+        // One write per request for everybody's SETs...
+        for (size_t request = 0; request < requests.size(); request++)
+        {
+            if (pending_mask[request] != 0)
+            {
+                write_status[request] = requests[request]->set_values(pending_mask[request], pending_values[request]);
+                m_bulk_writes++;
+            }
+        }
+
+        for (auto &set : sets)
+        {
+            gpio_broker_msg_t reply;
+
+            memset(&reply, 0, sizeof(reply));
+            reply.type = GPIO_BROKER_REPLY;
+            reply.id = set.second.id;
+            reply.status = GPIO_OK;
+            for (size_t request = 0; request < requests.size(); request++)
+            {
+                if ((set.second.mask & m_request_lines[request]) && !write_status[request])
+                {
+                    reply.status = write_status[request].get_code();
+                    break;
+                }
+            }
+            send_msg(set.first, reply);
+        }
+
+        // ...then the reads, one per request no matter how many asked.
+        if (!gets.empty())
+        {
+            uint64_t asked = 0;
+            uint64_t values = 0;
+            uint64_t failed = 0;
+
+            for (auto &get : gets)
+            {
+                asked |= get.second.mask;
+            }
+
+            for (size_t request = 0; request < requests.size(); request++)
+            {
+                if (asked & m_request_lines[request])
+                {
+                    uint64_t request_values = 0;
+
+                    if (!requests[request]->get_values(request_values))
+                    {
+                        failed |= m_request_lines[request];
+                        continue;
+                    }
+
+                    for (size_t line = 0; line < m_lines.size(); line++)
+                    {
+                        if ((m_lines[line].request == request) && (request_values & m_lines[line].request_mask))
+                        {
+                            values |= 1ULL << line;
+                        }
+                    }
+                }
+            }
+
+            for (auto &get : gets)
+            {
+                gpio_broker_msg_t reply;
+
+                memset(&reply, 0, sizeof(reply));
+                reply.type = GPIO_BROKER_REPLY;
+                reply.id = get.second.id;
+                reply.status = (get.second.mask & failed) ? GPIO_ERR_IO : GPIO_OK;
+                reply.mask = get.second.mask;
+                reply.values = values & get.second.mask;
+                send_msg(get.first, reply);
+            }
+        }
+
+        // Hang up on whoever left (or stopped listening) this pass.
+        for (auto it = m_clients.begin(); it != m_clients.end();)
+        {
+            int fd = it->first;
+            it++;
+            if (m_clients[fd].closing)
+            {
+                close_client(fd);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Give the board's lines their broker indexes, in name order.
+ */
+void GPIOBroker::number_lines()
+{
+    const vector<unique_ptr<GPIOLineRequest>> &requests = m_board->get_requests();
+
+    m_request_lines.resize(requests.size(), 0);
+    for (auto &name : m_board->get_line_names())
+    {
+        GPIOLineRequest *request = nullptr;
+        unsigned int offset = 0;
+
+        if (m_lines.size() >= GPIO_BROKER_MAX_LINES)
+        {
+            GPIO_DIAG(GPIO_LOG_WARNING, "GPIOBroker", GPIO_ERR_NO_SPACE, 0, "Only serving the first %u lines", GPIO_BROKER_MAX_LINES);
+            break;
+        }
+
+        m_board->get_line(name, request, offset);
+        for (size_t i = 0; i < requests.size(); i++)
+        {
+            if (requests[i].get() == request)
+            {
+                m_request_lines[i] |= 1ULL << m_lines.size();
+                if (request->get_settings(request->get_index(offset)).direction == GPIOD_LINE_DIRECTION_OUTPUT)
+                {
+                    m_output_lines |= 1ULL << m_lines.size();
+                }
+                m_lines.push_back({ name, i, request->get_mask(offset), request->get_index(offset) });
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Open the socket, set up the epoll set and start the thread.
+ */
+void GPIOBroker::listen_on()
+{
+    const vector<unique_ptr<GPIOLineRequest>> &requests = m_board->get_requests();
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, m_socket_path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(m_socket_path.c_str());
+
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    m_listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    // Nobody can connect until we listen, so the mode's in place before anyone can.
+    if ((m_epoll_fd < 0) || (m_listen_fd < 0) ||
+        (bind(m_listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) ||
+        (chmod(m_socket_path.c_str(), m_mode) < 0) ||
+        (listen(m_listen_fd, SOMAXCONN) < 0))
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOBroker", GPIO_ERR_IO, errno, "Failed to listen on <%s>", m_socket_path.c_str());
+        if (m_listen_fd >= 0)
+        {
+            close(m_listen_fd);
+            m_listen_fd = -1;
+        }
+    }
+    else
+    {
+        struct epoll_event ev;
+
+        ev.events = EPOLLIN;
+        ev.data.u64 = TAG_LISTEN;
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_listen_fd, &ev);
+        ev.data.u64 = TAG_WAKE;
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_wake.get_fd(), &ev);
+
+        // Only requests with edge detection on somewhere have anything to say.
+        for (size_t i = 0; i < requests.size(); i++)
+        {
+            bool edges = false;
+
+            for (size_t index = 0; index < requests[i]->get_num_lines(); index++)
+            {
+                edges |= (requests[i]->get_settings(index).edge != GPIOD_LINE_EDGE_NONE);
+            }
+
+            if (edges)
+            {
+                ev.data.u64 = TAG_REQUEST | i;
+                epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, requests[i]->get_fd(), &ev);
+            }
+        }
+
+        start();
+    }
+}
+
+/**
+ * @brief Take every connection that's waiting.
+ */
+void GPIOBroker::accept_clients()
+{
+    int fd;
+
+    while ((fd = accept4(m_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        struct epoll_event ev;
+
+        ev.events = EPOLLIN;
+        ev.data.u64 = TAG_CLIENT | (uint32_t) fd;
+        if (!allowed(fd))
+        {
+            close(fd);
+        }
+        else if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        {
+            GPIO_DIAG(GPIO_LOG_ERROR, "GPIOBroker", GPIO_ERR_IO, errno, "Failed to add client");
+            close(fd);
+        }
+        else
+        {
+            m_clients[fd] = { 0, false, {} };
+            m_client_count = m_clients.size();
+        }
+    }
+}
+
+/**
+ * @brief Check a new connection's credentials against the socket's mode.
+ *
+ * The mode already keeps out whoever it should when the path's reachable,
+ * this is for when it isn't the only thing standing in the way (a
+ * directory somebody else can write to, an fd handed across, and so on).
+ *
+ * @return true if they're let in.
+ */
+bool GPIOBroker::allowed(int fd)
+{
+    bool retVal = false;
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOBroker", GPIO_ERR_IO, errno, "Failed to get client credentials");
+    }
+    else
+    {
+        retVal = (cred.uid == 0) || (cred.uid == geteuid()) ||
+                 ((m_mode & 0070) && (cred.gid == getegid())) ||
+                 (m_mode & 0007);
+        if (!retVal)
+        {
+            GPIO_DIAG(GPIO_LOG_WARNING, "GPIOBroker", GPIO_ERR_INVALID, 0, "Refused client pid %d uid %u gid %u",
+                      (int) cred.pid, (unsigned int) cred.uid, (unsigned int) cred.gid);
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Hand a request's edge events out to the subscribers.
+ */
+void GPIOBroker::read_edges(size_t request)
+{
+    gpio_edge_event_t events[EVENT_BATCH_SIZE];
+    GPIOLineRequest *lines = m_board->get_requests()[request].get();
+
+    int count = lines->read_edge_events(events, EVENT_BATCH_SIZE);
+    for (int i = 0; i < count; i++)
+    {
+        gpio_broker_msg_t msg;
+        size_t line = 0;
+
+        while ((line < m_lines.size()) &&
+               ((m_lines[line].request != request) || (m_lines[line].request_index != (int) events[i].index)))
+        {
+            line++;
+        }
+        if (line == m_lines.size())
+        {
+            continue;
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        msg.type = GPIO_BROKER_EDGE;
+        msg.status = GPIO_OK;
+        msg.line = line;
+        msg.mask = 1ULL << line;
+        msg.values = events[i].rising ? 1 : 0;
+        msg.timestamp_ns = events[i].timestamp_ns;
+
+        for (auto &client : m_clients)
+        {
+            if (!client.second.closing && (client.second.subscribed & msg.mask))
+            {
+                // Held replies get the room first- edges are what gives.
+                if (client.second.replies.empty() &&
+                    (send(client.first, &msg, sizeof(msg), MSG_DONTWAIT | MSG_NOSIGNAL) == sizeof(msg)))
+                {
+                    m_edges_sent++;
+                }
+                else
+                {
+                    m_edges_dropped++;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Send a reply.
+ *
+ * A full socket is usually just edges the client hasn't got to yet, so the
+ * reply's held and goes out when there's room.  Only a client that's let
+ * MAX_HELD_REPLIES pile up (it isn't reading at all) gets hung up on.
+ *
+ * @return false if the client's been marked for closing.
+ */
+bool GPIOBroker::send_msg(int fd, const gpio_broker_msg_t &msg)
+{
+    bool retVal = true;
+    client_t &client = m_clients[fd];
+
+    if (client.closing)
+    {
+        retVal = false;
+    }
+    else if (!client.replies.empty())
+    {
+        // Behind the ones already waiting, so they stay in order.
+        if (client.replies.size() >= MAX_HELD_REPLIES)
+        {
+            GPIO_DIAG(GPIO_LOG_WARNING, "GPIOBroker", GPIO_ERR_NO_SPACE, 0, "Client isn't reading its replies, dropping it");
+            m_disconnects++;
+            client.closing = true;
+            retVal = false;
+        }
+        else
+        {
+            client.replies.push_back(msg);
+        }
+    }
+    else if (send(fd, &msg, sizeof(msg), MSG_DONTWAIT | MSG_NOSIGNAL) != sizeof(msg))
+    {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        {
+            struct epoll_event ev;
+
+            // Let us know when there's room.
+            ev.events = EPOLLIN | EPOLLOUT;
+            ev.data.u64 = TAG_CLIENT | (uint32_t) fd;
+            epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+            client.replies.push_back(msg);
+        }
+        else
+        {
+            client.closing = true;
+            retVal = false;
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Send whatever replies a client's socket has room for now.
+ *
+ * Once they're all out we stop asking to hear about room.
+ */
+void GPIOBroker::flush_replies(int fd)
+{
+    client_t &client = m_clients[fd];
+
+    while (!client.closing && !client.replies.empty())
+    {
+        if (send(fd, &client.replies.front(), sizeof(gpio_broker_msg_t), MSG_DONTWAIT | MSG_NOSIGNAL) == sizeof(gpio_broker_msg_t))
+        {
+            client.replies.pop_front();
+        }
+        else
+        {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+            {
+                client.closing = true;
+            }
+            break;
+        }
+    }
+
+    if (!client.closing && client.replies.empty())
+    {
+        struct epoll_event ev;
+
+        ev.events = EPOLLIN;
+        ev.data.u64 = TAG_CLIENT | (uint32_t) fd;
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+    }
+}
+
+/**
+ * @brief Drop a client.
+ */
+void GPIOBroker::close_client(int fd)
+{
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    m_clients.erase(fd);
+    m_client_count = m_clients.size();
+}
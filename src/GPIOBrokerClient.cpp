@@ -0,0 +1,327 @@
+
+#include <string>
+using std::string;
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "GPIOBrokerClient.hpp"
+#include "GPIODiag.hpp"
+#include "GPIOMetrics.hpp"
+
+/**
+ * Constructor for GPIOBrokerClient.  Connects to the broker.  On failure
+ * the client is left closed and every call fails.
+ *
+ * @param socket_path The broker's socket.
+ */
+GPIOBrokerClient::GPIOBrokerClient(const string &socket_path) :
+    m_fd(-1), m_next_id(1), m_dropped(0)
+{
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+
+    m_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if ((m_fd < 0) || (connect(m_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0))
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOBrokerClient", GPIO_ERR_IO, errno, "Failed to connect to <%s>", socket_path.c_str());
+        if (m_fd >= 0)
+        {
+            close(m_fd);
+            m_fd = -1;
+        }
+    }
+}
+
+/**
+ * Destructor for GPIOBrokerClient.  Hangs up- the broker drops our
+ * subscriptions with the connection.
+ */
+GPIOBrokerClient::~GPIOBrokerClient()
+{
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+/**
+ * @brief Look a line up by name.
+ *
+ * @return The line's broker index, -1 if it isn't served (or we're not connected).
+ */
+int GPIOBrokerClient::find(const string &name)
+{
+    int retVal = -1;
+    gpio_broker_msg_t msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = GPIO_BROKER_LOOKUP;
+    strncpy(msg.name, name.c_str(), GPIO_BROKER_NAME_SIZE - 1);
+
+    if (transact(msg))
+    {
+        retVal = msg.line;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Drive the lines in the mask.
+ *
+ * Returns once the broker's done the write (folded in with whatever else it
+ * was writing at the time).
+ */
+GPIOStatus GPIOBrokerClient::set_values(uint64_t mask, uint64_t values)
+{
+    gpio_broker_msg_t msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = GPIO_BROKER_SET;
+    msg.mask = mask;
+    msg.values = values;
+
+    return transact(msg);
+}
+
+/**
+ * @brief Read the lines in the mask.
+ */
+GPIOStatus GPIOBrokerClient::get_values(uint64_t mask, uint64_t &values)
+{
+    gpio_broker_msg_t msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = GPIO_BROKER_GET;
+    msg.mask = mask;
+
+    GPIOStatus retVal = transact(msg);
+    if (retVal)
+    {
+        values = msg.values;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Drive one line.
+ *
+ * @return GPIO_ERR_NO_LINE for an index past what a mask can hold.
+ */
+GPIOStatus GPIOBrokerClient::set_value(unsigned int line, bool value)
+{
+    GPIOStatus retVal(GPIO_ERR_NO_LINE);
+
+    if (line < GPIO_BROKER_MAX_LINES)
+    {
+        retVal = set_values(1ULL << line, value ? (1ULL << line) : 0);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Read one line.
+ *
+ * @return GPIO_ERR_NO_LINE for an index past what a mask can hold.
+ */
+GPIOStatus GPIOBrokerClient::read_value(unsigned int line, bool &value)
+{
+    GPIOStatus retVal(GPIO_ERR_NO_LINE);
+    uint64_t values = 0;
+
+    if (line < GPIO_BROKER_MAX_LINES)
+    {
+        retVal = get_values(1ULL << line, values);
+        if (retVal)
+        {
+            value = (values != 0);
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Start streaming edges for the lines in the mask.
+ */
+GPIOStatus GPIOBrokerClient::subscribe(uint64_t mask)
+{
+    gpio_broker_msg_t msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = GPIO_BROKER_SUBSCRIBE;
+    msg.mask = mask;
+
+    return transact(msg);
+}
+
+/**
+ * @brief Stop streaming edges for the lines in the mask.
+ */
+GPIOStatus GPIOBrokerClient::unsubscribe(uint64_t mask)
+{
+    gpio_broker_msg_t msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = GPIO_BROKER_UNSUBSCRIBE;
+    msg.mask = mask;
+
+    return transact(msg);
+}
+
+/**
+ * @brief Get streamed edges.
+ *
+ * Edges held while waiting on replies come out first.  Only if there aren't
+ * any do we wait on the socket.
+ *
+ * @return How many edges, -1 if the connection's gone.
+ */
+int GPIOBrokerClient::read_edges(gpio_broker_edge_t *edges, size_t max, int timeout_ms)
+{
+    int retVal = 0;
+    gpio_broker_msg_t msg;
+
+    if (m_fd < 0)
+    {
+        retVal = -1;
+    }
+    else if (m_edges.empty())
+    {
+        struct pollfd fds[1];
+
+        fds[0].fd = m_fd;
+        fds[0].events = POLLIN;
+        if (poll(fds, 1, timeout_ms) > 0)
+        {
+            ssize_t len;
+
+            while ((len = recv(m_fd, &msg, sizeof(msg), MSG_DONTWAIT)) == sizeof(msg))
+            {
+                if (msg.type == GPIO_BROKER_EDGE)
+                {
+                    hold_edge(msg);
+                }
+            }
+
+            if ((len == 0) || ((len < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK)))
+            {
+                retVal = -1;
+            }
+        }
+    }
+
+    while ((retVal >= 0) && ((size_t) retVal < max) && !m_edges.empty())
+    {
+        edges[retVal++] = m_edges.front();
+        m_edges.pop_front();
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Send a request and wait for its reply.
+ *
+ * The reply comes back in msg.  Edges that arrive first are held.  A reply
+ * that turns up after we've given up on it is skipped by the next call.
+ *
+ * @return GPIO_ERR_IO with ETIMEDOUT if there's no reply in REPLY_TIMEOUT_MS.
+ */
+GPIOStatus GPIOBrokerClient::transact(gpio_broker_msg_t &msg)
+{
+    GPIOStatus retVal(GPIO_ERR_NOT_REQUESTED);
+
+    if (m_fd >= 0)
+    {
+        uint32_t id = m_next_id++;
+
+        msg.id = id;
+        if (send(m_fd, &msg, sizeof(msg), MSG_NOSIGNAL) != sizeof(msg))
+        {
+            retVal = GPIOStatus(GPIO_ERR_IO, errno);
+        }
+        else
+        {
+            // One deadline for the lot- edges can keep arriving while we wait.
+            uint64_t deadline = GPIOMetrics::now_ns() + ((uint64_t) REPLY_TIMEOUT_MS * 1000000ULL);
+            int error = 0;
+
+            while (error == 0)
+            {
+                uint64_t now = GPIOMetrics::now_ns();
+                struct pollfd fds[1];
+                int ready = 0;
+                ssize_t len;
+
+                fds[0].fd = m_fd;
+                fds[0].events = POLLIN;
+                if (now < deadline)
+                {
+                    ready = poll(fds, 1, (int) ((deadline - now + 999999) / 1000000));
+                }
+
+                if (ready == 0)
+                {
+                    error = ETIMEDOUT;
+                }
+                else if (ready < 0)
+                {
+                    if (errno != EINTR)
+                    {
+                        error = errno;
+                    }
+                }
+                else if ((len = recv(m_fd, &msg, sizeof(msg), 0)) != sizeof(msg))
+                {
+                    error = (len < 0) ? errno : EPIPE;
+                }
+                else if (msg.type == GPIO_BROKER_EDGE)
+                {
+                    hold_edge(msg);
+                }
+                else if ((msg.type == GPIO_BROKER_REPLY) && (msg.id == id))
+                {
+                    break;
+                }
+            }
+
+            if (error != 0)
+            {
+                retVal = GPIOStatus(GPIO_ERR_IO, error);
+            }
+            else
+            {
+                retVal = GPIOStatus((gpio_error_t) msg.status);
+            }
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Hold on to an edge for read_edges(), dropping the oldest if
+ *        nobody's been reading them.
+ */
+void GPIOBrokerClient::hold_edge(const gpio_broker_msg_t &msg)
+{
+    if (m_edges.size() >= MAX_HELD_EDGES)
+    {
+        m_edges.pop_front();
+        m_dropped++;
+    }
+
+    m_edges.push_back({ msg.line, (msg.values & 0x01) != 0, msg.timestamp_ns });
+}
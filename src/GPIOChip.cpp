@@ -0,0 +1,284 @@
+
+#include <string>
+using std::string;
+
+#include <algorithm>
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "GPIOChip.hpp"
+#include "GPIODiag.hpp"
+#include "LibgpiodBackend.hpp"
+
+mutex GPIOChip::s_lock;
+map<string, weak_ptr<GPIOChip>> GPIOChip::s_registry;
+map<string, gpio_backend_factory_t> GPIOChip::s_backends;
+
+mutex GPIOChip::s_index_lock;
+map<string, GPIOChip::line_location_t> GPIOChip::s_line_index;
+vector<string> GPIOChip::s_index_chips;
+struct timespec GPIOChip::s_dev_mtime = { 0, 0 };
+bool GPIOChip::s_index_valid = false;
+
+// Where the chip character devices live...
+static const char *GPIO_DEV_DIR = "/dev";
+
+/**
+ * @brief Get a shared handle on a GPIO chip.
+ *
+ * Looks the chip up in the process-wide registry first and hands back the
+ * existing handle if someone already has it open.  Otherwise, the chip is
+ * opened, its info is cached, and it's entered into the registry.  Paths are
+ * canonicalized so that "/dev/gpiochip0" and a symlink to it share a handle.
+ * Paths with a registered backend prefix aren't files, so they're used as is.
+ *
+ * @param path Path to the chip's character device.
+ * @return Shared handle on the chip or nullptr if it couldn't be opened.
+ */
+shared_ptr<GPIOChip> GPIOChip::open(const string &path)
+{
+    shared_ptr<GPIOChip> retVal;
+    gpio_backend_factory_t factory;
+    char resolved[PATH_MAX];
+    string key = path;
+
+    lock_guard<mutex> lock(s_lock);
+
+    for (auto &backend : s_backends)
+    {
+        if (path.compare(0, backend.first.size(), backend.first) == 0)
+        {
+            factory = backend.second;
+            break;
+        }
+    }
+
+    // Canonicalize if we can, otherwise just use what we were handed.
+    if (!factory && (realpath(path.c_str(), resolved) != nullptr))
+    {
+        key = resolved;
+    }
+
+    auto it = s_registry.find(key);
+    if (it != s_registry.end())
+    {
+        retVal = it->second.lock();
+    }
+
+    if (!retVal)
+    {
+        shared_ptr<GPIOChipBackend> backend = factory ? factory(path) : LibgpiodChip::open(path);
+        if (backend == nullptr)
+        {
+            GPIO_DIAG(GPIO_LOG_ERROR, "GPIOChip", GPIO_ERR_NO_CHIP, errno, "Failed to open GPIO chip <%s>", path.c_str());
+        }
+        else
+        {
+            retVal = shared_ptr<GPIOChip>(new GPIOChip(key, path, backend));
+            s_registry[key] = retVal;
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Register a backend for a path prefix.
+ *
+ * Chips already open stay with whatever backend opened them.
+ *
+ * @param prefix Paths starting with this go to the factory (e.g. "sim:").
+ * @param factory Opens a chip given its full path.
+ */
+void GPIOChip::register_backend(const string &prefix, gpio_backend_factory_t factory)
+{
+    lock_guard<mutex> lock(s_lock);
+    s_backends[prefix] = factory;
+}
+
+/**
+ * @brief Number of chips currently held open by the registry.
+ */
+size_t GPIOChip::open_count()
+{
+    size_t retVal = 0;
+
+    lock_guard<mutex> lock(s_lock);
+    for (auto &entry : s_registry)
+    {
+        if (!entry.second.expired())
+        {
+            retVal++;
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Find a line by name across all the GPIO chips in the system.
+ *
+ * Resolving a name with libgpiod proper means pulling line info for every
+ * line on every chip- one ioctl per line per chip.  We do that exactly once
+ * and keep the results in an index.  The index is only rebuilt when a chip
+ * appears or disappears, so resolving lots of names at startup costs a stat()
+ * of /dev and a map lookup each.  As with libgpiod, the first line found with
+ * a given name wins if there are duplicates.
+ *
+ * @param name Name of the line to find (e.g. "RELAY_3").
+ * @param chip_path Filled in with the path of the chip the line is on.
+ * @param offset Filled in with the line's offset on that chip.
+ * @return true if the line was found, false otherwise.
+ */
+bool GPIOChip::find_line(const string &name, string &chip_path, unsigned int &offset)
+{
+    bool retVal = false;
+
+    lock_guard<mutex> lock(s_index_lock);
+
+    update_line_index();
+
+    auto it = s_line_index.find(name);
+    if (it != s_line_index.end())
+    {
+        chip_path = it->second.chip_path;
+        offset = it->second.offset;
+        retVal = true;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Force the line name index to be rebuilt on the next lookup.
+ *
+ * Only needed if you know something changed that we can't see from /dev,
+ * such as a chip being swapped out from under the same device node.
+ */
+void GPIOChip::invalidate_line_index()
+{
+    lock_guard<mutex> lock(s_index_lock);
+    s_index_valid = false;
+}
+
+/**
+ * @brief Get a sorted list of the GPIO chip devices currently in /dev.
+ */
+vector<string> GPIOChip::list_chips()
+{
+    vector<string> retVal;
+
+    DIR *dir = opendir(GPIO_DEV_DIR);
+    if (dir == nullptr)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOChip", GPIO_ERR_IO, 0, "Unable to scan %s for GPIO chips", GPIO_DEV_DIR);
+    }
+    else
+    {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != nullptr)
+        {
+            if (strncmp(entry->d_name, "gpiochip", 8) == 0)
+            {
+                string path = string(GPIO_DEV_DIR) + "/" + entry->d_name;
+                if (gpiod_is_gpiochip_device(path.c_str()))
+                {
+                    retVal.push_back(path);
+                }
+            }
+        }
+
+        // Clean up after yourself
+        closedir(dir);
+    }
+
+    // Keep this stable so we can compare chip lists and so lookups of
+    // duplicate names prefer the lowest numbered chip.
+    std::sort(retVal.begin(), retVal.end());
+
+    return retVal;
+}
+
+/**
+ * @brief Bring the line name index up to date.  Caller holds s_index_lock.
+ *
+ * The cheap check is the modification time of /dev- it changes whenever a
+ * device node comes or goes.  Only when that moves do we rescan for chips,
+ * and only when the set of chips actually differs do we pay for pulling the
+ * line info off of every chip.
+ */
+void GPIOChip::update_line_index()
+{
+    struct stat st;
+    bool rescan = !s_index_valid;
+
+    if (stat(GPIO_DEV_DIR, &st) == 0)
+    {
+        if ((st.st_mtim.tv_sec != s_dev_mtime.tv_sec) || (st.st_mtim.tv_nsec != s_dev_mtime.tv_nsec))
+        {
+            s_dev_mtime = st.st_mtim;
+            rescan = true;
+        }
+    }
+
+    if (rescan)
+    {
+        vector<string> chips = list_chips();
+        if (!s_index_valid || (chips != s_index_chips))
+        {
+            s_line_index.clear();
+            for (auto &path : chips)
+            {
+                shared_ptr<GPIOChip> chip = GPIOChip::open(path);
+                if (chip != nullptr)
+                {
+                    for (unsigned int offset = 0; offset < chip->get_num_lines(); offset++)
+                    {
+                        string name = chip->get_line_name(offset);
+                        if (!name.empty() && (s_line_index.count(name) == 0))
+                        {
+                            s_line_index[name] = { path, offset };
+                        }
+                    }
+                }
+            }
+
+            s_index_chips = chips;
+        }
+
+        s_index_valid = true;
+    }
+}
+
+/**
+ * Constructor for GPIOChip.  Only reachable through open(), which has
+ * already opened the chip for us.  We pull the chip info once here and
+ * keep it so nobody needs to ask the backend for it again.
+ */
+GPIOChip::GPIOChip(const string &key, const string &path, shared_ptr<GPIOChipBackend> backend) :
+    m_key(key), m_path(path), m_name(backend->get_name()), m_label(backend->get_label()),
+    m_num_lines(backend->get_num_lines()), m_backend(backend)
+{
+}
+
+/**
+ * Destructor for GPIOChip.  Called when the last user of the chip lets go
+ * of it.  Closes the chip and drops the (now dead) registry entry unless
+ * somebody has already re-opened the chip under the same key.
+ */
+GPIOChip::~GPIOChip()
+{
+    m_backend.reset();
+
+    lock_guard<mutex> lock(s_lock);
+    auto it = s_registry.find(m_key);
+    if ((it != s_registry.end()) && it->second.expired())
+    {
+        s_registry.erase(it);
+    }
+}
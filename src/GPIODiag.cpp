@@ -0,0 +1,318 @@
+
+#include <string>
+using std::string;
+
+#include <iostream>
+using std::cout;
+using std::endl;
+using std::flush;
+
+#include <mutex>
+using std::mutex;
+using std::lock_guard;
+using std::unique_lock;
+
+#include <condition_variable>
+using std::condition_variable;
+
+#include <chrono>
+
+#include <errno.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <Runable.hpp>
+
+#include "GPIODiag.hpp"
+#include "WakeupFD.hpp"
+
+// Queue depth.  Has to be a power of two.
+static const size_t QUEUE_SIZE = 256;
+
+atomic<gpio_log_level_t> GPIODiag::s_level(GPIO_LOG_WARNING);
+atomic<uint32_t> GPIODiag::s_rate_limit(10);
+atomic<bool> GPIODiag::s_async(true);
+
+/**
+ * @brief Human readable name for an error code.
+ */
+const char *gpio_error_string(gpio_error_t code)
+{
+    const char *retVal = "Unknown error";
+
+    switch (code)
+    {
+        case GPIO_OK:                   retVal = "OK"; break;
+        case GPIO_ERR_NO_CHIP:          retVal = "No chip open"; break;
+        case GPIO_ERR_NO_LINE:          retVal = "No such line"; break;
+        case GPIO_ERR_NOT_REQUESTED:    retVal = "Line not requested"; break;
+        case GPIO_ERR_BUSY:             retVal = "Busy"; break;
+        case GPIO_ERR_DIRECTION:        retVal = "Wrong direction"; break;
+        case GPIO_ERR_INVALID:          retVal = "Invalid argument"; break;
+        case GPIO_ERR_NO_MEMORY:        retVal = "Out of memory"; break;
+        case GPIO_ERR_NO_SPACE:         retVal = "Out of space"; break;
+        case GPIO_ERR_IO:               retVal = "I/O error"; break;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief The sink we use when nobody's given us one- the same one line
+ * format everything in here has always printed.
+ */
+static void default_sink(const gpio_diag_record_t &record)
+{
+    cout << " " << record.source << " : " << record.message;
+    if (record.sys_errno != 0)
+    {
+        cout << " - errno = " << record.sys_errno << " (" << strerror(record.sys_errno) << ")";
+    }
+    if (record.suppressed > 0)
+    {
+        cout << " [" << record.suppressed << " similar suppressed]";
+    }
+    cout << endl << flush;
+}
+
+/*
+    Bounded multi-producer, single-consumer queue of records and the thread
+    that drains it.  Producers claim a slot with a CAS on the enqueue position
+    and publish it by bumping the slot's sequence- no locks, no syscalls other
+    than the eventfd kick.  Only the logging thread ever dequeues.
+*/
+class DiagLogger : public Runable
+{
+    public:
+        DiagLogger() : m_enqueue(0), m_dequeue(0), m_dropped(0), m_sink(default_sink)
+        {
+            for (size_t i = 0; i < QUEUE_SIZE; i++)
+            {
+                m_slots[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        ~DiagLogger()
+        {
+            if (isRunning())
+            {
+                stop();
+                m_wake.signal();
+                join();
+                if (NULL != _thread)
+                {
+                    delete _thread;
+                    _thread = NULL;
+                }
+            }
+        }
+
+        bool push(const gpio_diag_record_t &record)
+        {
+            bool retVal = false;
+            size_t pos = m_enqueue.load(std::memory_order_relaxed);
+            slot_t *slot = nullptr;
+
+            while (slot == nullptr)
+            {
+                slot_t *candidate = &m_slots[pos & (QUEUE_SIZE - 1)];
+                size_t seq = candidate->sequence.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+                if (diff == 0)
+                {
+                    if (m_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        slot = candidate;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    // Full.  Drop it rather than wait.
+                    m_dropped.fetch_add(1, std::memory_order_relaxed);
+                    break;
+                }
+                else
+                {
+                    pos = m_enqueue.load(std::memory_order_relaxed);
+                }
+            }
+
+            if (slot != nullptr)
+            {
+                slot->record = record;
+                slot->sequence.store(pos + 1, std::memory_order_release);
+                retVal = true;
+
+                // The thread only gets started once, on the first message.
+                if (!isRunning())
+                {
+                    lock_guard<mutex> lock(m_start_lock);
+                    if (!isRunning())
+                    {
+                        start();
+                    }
+                }
+                m_wake.signal();
+            }
+
+            return retVal;
+        }
+
+        void set_sink(gpio_diag_sink_t sink)
+        {
+            lock_guard<mutex> lock(m_sink_lock);
+            m_sink = (sink != nullptr) ? sink : gpio_diag_sink_t(default_sink);
+        }
+
+        void deliver(const gpio_diag_record_t &record)
+        {
+            lock_guard<mutex> lock(m_sink_lock);
+            m_sink(record);
+        }
+
+        void flush()
+        {
+            size_t target = m_enqueue.load(std::memory_order_acquire);
+            unique_lock<mutex> lock(m_flush_lock);
+
+            while (isRunning() && (m_dequeue.load(std::memory_order_acquire) < target))
+            {
+                m_wake.signal();
+                m_flushed.wait_for(lock, std::chrono::milliseconds(10));
+            }
+        }
+
+        uint64_t get_dropped() { return m_dropped.load(std::memory_order_relaxed); }
+
+    protected:
+        void run()
+        {
+            struct pollfd fds[1];
+
+            fds[0].fd = m_wake.get_fd();
+            fds[0].events = POLLIN;
+
+            while (_run)
+            {
+                if (poll(fds, 1, -1) > 0)
+                {
+                    m_wake.clear();
+                }
+                drain();
+            }
+
+            // Don't lose whatever was queued on the way out.
+            drain();
+        }
+
+    private:
+        typedef struct slot_t
+        {
+            atomic<size_t>          sequence;
+            gpio_diag_record_t      record;
+        } slot_t;
+
+        slot_t                  m_slots[QUEUE_SIZE];
+        atomic<size_t>          m_enqueue;
+        atomic<size_t>          m_dequeue;
+        atomic<uint64_t>        m_dropped;
+        WakeupFD                m_wake;
+        mutex                   m_start_lock;
+        mutex                   m_sink_lock;
+        gpio_diag_sink_t        m_sink;
+        mutex                   m_flush_lock;
+        condition_variable      m_flushed;
+
+        void drain()
+        {
+            size_t pos = m_dequeue.load(std::memory_order_relaxed);
+
+            while (true)
+            {
+                slot_t &slot = m_slots[pos & (QUEUE_SIZE - 1)];
+                if (slot.sequence.load(std::memory_order_acquire) != (pos + 1))
+                {
+                    // Empty, or the producer hasn't finished with it yet.
+                    break;
+                }
+
+                gpio_diag_record_t record = slot.record;
+                slot.sequence.store(pos + QUEUE_SIZE, std::memory_order_release);
+                pos++;
+                m_dequeue.store(pos, std::memory_order_release);
+                deliver(record);
+            }
+
+            lock_guard<mutex> lock(m_flush_lock);
+            m_flushed.notify_all();
+        }
+};
+
+/**
+ * @brief The one logger for the process.
+ */
+static DiagLogger &logger()
+{
+    static DiagLogger s_logger;
+    return s_logger;
+}
+
+/**
+ * @brief Set where messages go.  nullptr puts back the default.
+ */
+void GPIODiag::set_sink(gpio_diag_sink_t sink)
+{
+    logger().set_sink(sink);
+}
+
+/**
+ * @brief Wait until everything queued so far has been handed to the sink.
+ */
+void GPIODiag::flush()
+{
+    logger().flush();
+}
+
+/**
+ * @brief How many messages we've dropped on a full queue.
+ */
+uint64_t GPIODiag::get_dropped()
+{
+    return logger().get_dropped();
+}
+
+/**
+ * @brief Format a message and queue it (or hand it straight to the sink in
+ * sync mode).  Call through GPIO_DIAG() so it's rate limited.
+ */
+void GPIODiag::post(gpio_log_level_t level, const char *source, gpio_error_t code, int sys_errno,
+                    uint32_t suppressed, const char *format, ...)
+{
+    gpio_diag_record_t record;
+    struct timespec ts;
+    va_list args;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    record.timestamp_ns = ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+    record.level = level;
+    record.code = code;
+    record.sys_errno = sys_errno;
+    record.source = source;
+    record.suppressed = suppressed;
+
+    va_start(args, format);
+    vsnprintf(record.message, sizeof(record.message), format, args);
+    va_end(args);
+
+    if (s_async)
+    {
+        logger().push(record);
+    }
+    else
+    {
+        logger().deliver(record);
+    }
+}
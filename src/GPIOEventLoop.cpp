@@ -0,0 +1,402 @@
+
+#include <string>
+using std::string;
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "GPIOEventLoop.hpp"
+#include "GPIOChip.hpp"
+#include "GPIODiag.hpp"
+#include "GPIOMetrics.hpp"
+
+// What an epoll event is for.  Everything else is a line id.
+static const uint64_t TAG_WAKE = 0;
+static const uint64_t TAG_TIMER = 1;
+
+// Most epoll events and edge events we take per pass.
+static const int EPOLL_BATCH_SIZE = 32;
+static const size_t EVENT_BATCH_SIZE = 64;
+
+/**
+ * Constructor for GPIOEventLoop.  Sets up the epoll set and the timeout
+ * timer and starts the loop thread.
+ */
+GPIOEventLoop::GPIOEventLoop() :
+    LoopThread("GPIOEventLoop"),
+    m_epoll_fd(epoll_create1(EPOLL_CLOEXEC)), m_timer_fd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)),
+    m_armed_ns(0), m_next_id(TAG_TIMER + 1)
+{
+    if ((m_epoll_fd < 0) || (m_timer_fd < 0))
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOEventLoop", GPIO_ERR_IO, errno, "Failed to set up the event loop");
+    }
+    else
+    {
+        struct epoll_event ev;
+
+        ev.events = EPOLLIN;
+        ev.data.u64 = TAG_WAKE;
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_wake.get_fd(), &ev);
+        ev.data.u64 = TAG_TIMER;
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_timer_fd, &ev);
+
+        start();
+    }
+}
+
+/**
+ * Destructor for GPIOEventLoop.  Stops the loop thread.  Any lines still
+ * open are orphaned- close them first.
+ */
+GPIOEventLoop::~GPIOEventLoop()
+{
+    stop_loop();
+
+    {
+        lock_guard<mutex> lock(m_lock);
+        for (auto &line : m_lines)
+        {
+            line.second->m_loop = nullptr;
+        }
+        m_lines.clear();
+    }
+
+    if (m_timer_fd >= 0)
+    {
+        close(m_timer_fd);
+    }
+    if (m_epoll_fd >= 0)
+    {
+        close(m_epoll_fd);
+    }
+}
+
+/**
+ * @brief Request a line and add it to the loop.
+ *
+ * Both edges are always detected- waiters pick which ones they want.
+ *
+ * @return The line, nullptr if it couldn't be requested.
+ */
+unique_ptr<GPIOAsyncLine> GPIOEventLoop::open_line(const string &chipname, unsigned int offset,
+                                                   enum gpiod_line_bias bias, unsigned long debounce_us)
+{
+    unique_ptr<GPIOAsyncLine> retVal;
+    shared_ptr<GPIOChip> chip = GPIOChip::open(chipname);
+
+    if (!isRunning())
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOEventLoop", GPIO_ERR_NOT_REQUESTED, 0, "Event loop isn't running");
+    }
+    else if (chip == nullptr)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOEventLoop", GPIO_ERR_NO_CHIP, 0, "Failed to open GPIO chip <%s>", chipname.c_str());
+    }
+    else
+    {
+        gpio_line_settings_t settings;
+        settings.edge = GPIOD_LINE_EDGE_BOTH;
+        settings.bias = bias;
+        settings.debounce_us = debounce_us;
+
+        unique_ptr<GPIOLineRequest> request(new GPIOLineRequest(chip, { offset }, "GPIOEventLoop"));
+        request->set_settings(settings);
+        if (!request->request())
+        {
+            GPIO_DIAG(GPIO_LOG_ERROR, "GPIOEventLoop", GPIO_ERR_IO, 0, "Failed to request line %u", offset);
+        }
+        else
+        {
+            lock_guard<mutex> lock(m_lock);
+            struct epoll_event ev;
+            int fd = request->get_fd();
+
+            retVal.reset(new GPIOAsyncLine(this, m_next_id++, std::move(request), offset));
+            ev.events = EPOLLIN;
+            ev.data.u64 = retVal->m_id;
+            if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+            {
+                GPIO_DIAG(GPIO_LOG_ERROR, "GPIOEventLoop", GPIO_ERR_IO, errno, "Failed to watch line %u", offset);
+                retVal->m_loop = nullptr;
+                retVal.reset();
+            }
+            else
+            {
+                m_lines[retVal->m_id] = retVal.get();
+            }
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief How many waits are pending across all the lines.
+ */
+size_t GPIOEventLoop::get_waiting()
+{
+    size_t retVal = 0;
+    lock_guard<mutex> lock(m_lock);
+
+    for (auto &line : m_lines)
+    {
+        retVal += line.second->m_waiters.size();
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief The loop.
+ *
+ * Events are handed to whichever waiters on the line want that edge, and
+ * timeouts are handed out off of the timerfd.  Ended waits are collected
+ * under the lock and resumed after it's dropped, so a resumed coroutine can
+ * go straight back to waiting (or close its line).
+ */
+void GPIOEventLoop::run()
+{
+    ThreadPolicy::Binding policy(*this);
+    struct epoll_event events[EPOLL_BATCH_SIZE];
+    gpio_edge_event_t edges[EVENT_BATCH_SIZE];
+    vector<gpio_async_waiter_t *> ready;
+
+    while (_run)
+    {
+        int count = epoll_wait(m_epoll_fd, events, EPOLL_BATCH_SIZE, -1);
+        if (count < 0)
+        {
+            if (errno != EINTR)
+            {
+                GPIO_DIAG(GPIO_LOG_ERROR, "GPIOEventLoop", GPIO_ERR_IO, errno, "Failed to wait for events");
+            }
+            continue;
+        }
+
+        ready.clear();
+        {
+            lock_guard<mutex> lock(m_lock);
+
+            for (int i = 0; i < count; i++)
+            {
+                if (events[i].data.u64 == TAG_WAKE)
+                {
+                    m_wake.clear();
+                }
+                else if (events[i].data.u64 == TAG_TIMER)
+                {
+                    uint64_t expirations;
+                    if (read(m_timer_fd, &expirations, sizeof(expirations)) < 0)
+                    {
+                        // EAGAIN- somebody re-armed it under us.
+                    }
+                    m_armed_ns = 0;
+                }
+                else
+                {
+                    auto it = m_lines.find(events[i].data.u64);
+                    if (it == m_lines.end())
+                    {
+                        continue;
+                    }
+
+                    GPIOAsyncLine *line = it->second;
+                    int found = line->m_request->read_edge_events(edges, EVENT_BATCH_SIZE);
+                    for (int event = 0; event < found; event++)
+                    {
+                        for (auto waiter = line->m_waiters.begin(); waiter != line->m_waiters.end();)
+                        {
+                            gpio_async_waiter_t *entry = waiter->second;
+
+                            if ((entry->edge == GPIOD_LINE_EDGE_BOTH) ||
+                                ((entry->edge == GPIOD_LINE_EDGE_RISING) && edges[event].rising) ||
+                                ((entry->edge == GPIOD_LINE_EDGE_FALLING) && !edges[event].rising))
+                            {
+                                entry->result.status = GPIOStatus();
+                                entry->result.rising = edges[event].rising;
+                                entry->result.timestamp_ns = edges[event].timestamp_ns;
+                                entry->result.line_seqno = edges[event].line_seqno;
+                                ready.push_back(entry);
+                                waiter = line->m_waiters.erase(waiter);
+                            }
+                            else
+                            {
+                                waiter++;
+                            }
+                        }
+                    }
+                }
+            }
+
+            expire_timeouts(ready);
+        }
+
+        for (auto waiter : ready)
+        {
+            waiter->resume(waiter);
+        }
+    }
+}
+
+/**
+ * @brief Queue up a timeout and make sure the timer goes off for it.
+ */
+void GPIOEventLoop::add_timeout(uint64_t deadline_ns, uint64_t line_id, uint64_t waiter_id)
+{
+    m_timeouts.push({ deadline_ns, line_id, waiter_id });
+    if ((m_armed_ns == 0) || (deadline_ns < m_armed_ns))
+    {
+        arm_timer();
+    }
+}
+
+/**
+ * @brief Arm the timer for the earliest timeout, or disarm it if there
+ *        aren't any.
+ */
+void GPIOEventLoop::arm_timer()
+{
+    struct itimerspec spec;
+
+    memset(&spec, 0, sizeof(spec));
+    m_armed_ns = m_timeouts.empty() ? 0 : m_timeouts.top().deadline_ns;
+    spec.it_value.tv_sec = m_armed_ns / 1000000000ULL;
+    spec.it_value.tv_nsec = m_armed_ns % 1000000000ULL;
+    if (timerfd_settime(m_timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOEventLoop", GPIO_ERR_IO, errno, "Failed to arm the timeout timer");
+    }
+}
+
+/**
+ * @brief End every wait that's run out of time.
+ *
+ * Timeouts for waits that already ended are just dropped as they come up.
+ */
+void GPIOEventLoop::expire_timeouts(vector<gpio_async_waiter_t *> &ready)
+{
+    uint64_t now = GPIOMetrics::now_ns();
+
+    while (!m_timeouts.empty() && (m_timeouts.top().deadline_ns <= now))
+    {
+        const timeout_t &timeout = m_timeouts.top();
+
+        auto line = m_lines.find(timeout.line_id);
+        if (line != m_lines.end())
+        {
+            auto waiter = line->second->m_waiters.find(timeout.waiter_id);
+            if (waiter != line->second->m_waiters.end())
+            {
+                waiter->second->result.status = GPIOStatus();
+                waiter->second->result.timed_out = true;
+                ready.push_back(waiter->second);
+                line->second->m_waiters.erase(waiter);
+            }
+        }
+        m_timeouts.pop();
+    }
+
+    if (!m_timeouts.empty() && (m_armed_ns != m_timeouts.top().deadline_ns))
+    {
+        arm_timer();
+    }
+}
+
+/**
+ * Constructor for GPIOAsyncLine.  Only the loop makes these.
+ */
+GPIOAsyncLine::GPIOAsyncLine(GPIOEventLoop *loop, uint64_t id, unique_ptr<GPIOLineRequest> request, unsigned int offset) :
+    m_loop(loop), m_id(id), m_request(std::move(request)), m_offset(offset)
+{
+}
+
+/**
+ * Destructor for GPIOAsyncLine.  Takes the line off of the loop and releases
+ * it.  Anything still waiting is resumed, right here, with GPIO_ERR_NOT_REQUESTED.
+ */
+GPIOAsyncLine::~GPIOAsyncLine()
+{
+    vector<gpio_async_waiter_t *> orphans;
+
+    if (m_loop != nullptr)
+    {
+        lock_guard<mutex> lock(m_loop->m_lock);
+
+        epoll_ctl(m_loop->m_epoll_fd, EPOLL_CTL_DEL, m_request->get_fd(), NULL);
+        m_loop->m_lines.erase(m_id);
+        for (auto &waiter : m_waiters)
+        {
+            waiter.second->result.status = GPIOStatus(GPIO_ERR_NOT_REQUESTED);
+            orphans.push_back(waiter.second);
+        }
+        m_waiters.clear();
+    }
+
+    for (auto waiter : orphans)
+    {
+        waiter->resume(waiter);
+    }
+}
+
+/**
+ * @brief Start waiting for an edge.
+ *
+ * Once this returns true the waiter belongs to the loop until its resume is
+ * called, which may be before this even returns.
+ *
+ * @return false (with the reason in the waiter's result) if the wait
+ *         couldn't be started- resume won't be called.
+ */
+bool GPIOAsyncLine::wait(gpio_async_waiter_t *waiter)
+{
+    bool retVal = false;
+
+    waiter->result = gpio_async_result_t();
+    if (waiter->resume == nullptr)
+    {
+        waiter->result.status = GPIOStatus(GPIO_ERR_INVALID);
+    }
+    else if (m_loop == nullptr)
+    {
+        waiter->result.status = GPIOStatus(GPIO_ERR_NOT_REQUESTED);
+    }
+    else
+    {
+        lock_guard<mutex> lock(m_loop->m_lock);
+
+        waiter->id = m_loop->m_next_id++;
+        m_waiters[waiter->id] = waiter;
+        if (waiter->timeout_ns >= 0)
+        {
+            m_loop->add_timeout(GPIOMetrics::now_ns() + waiter->timeout_ns, m_id, waiter->id);
+        }
+        retVal = true;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Call off a wait.
+ *
+ * Its timeout (if any) is left in the queue and dropped when it comes up.
+ *
+ * @return false if the wait's already ended.
+ */
+bool GPIOAsyncLine::cancel(gpio_async_waiter_t *waiter)
+{
+    bool retVal = false;
+
+    if (m_loop != nullptr)
+    {
+        lock_guard<mutex> lock(m_loop->m_lock);
+        retVal = (m_waiters.erase(waiter->id) > 0);
+    }
+
+    return retVal;
+}
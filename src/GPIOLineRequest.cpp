@@ -0,0 +1,369 @@
+
+#include <string>
+using std::string;
+
+#include <errno.h>
+
+#include "GPIOLineRequest.hpp"
+#include "GPIODiag.hpp"
+
+/**
+ * @brief Compare two sets of line settings.
+ */
+static bool same_settings(const gpio_line_settings_t &a, const gpio_line_settings_t &b)
+{
+    return (a.direction == b.direction) && (a.edge == b.edge) && (a.bias == b.bias) &&
+           (a.drive == b.drive) && (a.active_low == b.active_low) && (a.value == b.value) &&
+           (a.debounce_us == b.debounce_us);
+}
+
+/**
+ * Constructor for GPIOLineRequest.  Sets up the cached settings.  Nothing
+ * is requested until apply() or request() is called.
+ *
+ * @param chip The (shared) chip the lines are on.
+ * @param offsets The offsets of the lines on the chip.  At most MAX_LINES.
+ * @param consumer The consumer name the kernel will report for the lines.
+ */
+GPIOLineRequest::GPIOLineRequest(shared_ptr<GPIOChip> chip, const vector<unsigned int> &offsets, const string &consumer) :
+    m_chip(chip), m_offsets(offsets), m_settings(offsets.size()), m_consumer(consumer),
+    m_event_buffer_size(0), m_dirty(true)
+{
+    if (m_offsets.size() > MAX_LINES)
+    {
+        GPIO_DIAG(GPIO_LOG_WARNING, "GPIOLineRequest", GPIO_ERR_INVALID, 0, "Too many lines requested, truncating to %zu", MAX_LINES);
+        m_offsets.resize(MAX_LINES);
+        m_settings.resize(MAX_LINES);
+    }
+
+    // Build the offset to index map...
+    for (size_t i = 0; i < m_offsets.size(); i++)
+    {
+        if (m_offsets[i] >= m_index.size())
+        {
+            m_index.resize(m_offsets[i] + 1, -1);
+        }
+        m_index[m_offsets[i]] = i;
+    }
+}
+
+/**
+ * Destructor for GPIOLineRequest.  Releases the lines if we hold them.
+ */
+GPIOLineRequest::~GPIOLineRequest()
+{
+    release();
+}
+
+/**
+ * @brief Set the cached settings for every line in the request.
+ */
+void GPIOLineRequest::set_settings(const gpio_line_settings_t &settings)
+{
+    for (auto &current : m_settings)
+    {
+        if (!same_settings(current, settings))
+        {
+            current = settings;
+            m_dirty = true;
+        }
+    }
+}
+
+/**
+ * @brief Set the cached settings for one line in the request.
+ *
+ * @param offset The offset of the line on the chip.
+ * @param settings The settings for the line.
+ * @return false if the line isn't part of this request.
+ */
+bool GPIOLineRequest::set_settings(unsigned int offset, const gpio_line_settings_t &settings)
+{
+    bool retVal = false;
+    int index = get_index(offset);
+
+    if (index < 0)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOLineRequest", GPIO_ERR_NO_LINE, 0, "Line %u is not part of this request", offset);
+    }
+    else
+    {
+        if (!same_settings(m_settings[index], settings))
+        {
+            m_settings[index] = settings;
+            m_dirty = true;
+        }
+        retVal = true;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Push the cached settings to the kernel.
+ *
+ * If we already hold the lines, this changes their settings in place.  If
+ * that fails (or we don't hold them), the lines are requested fresh.  If
+ * nothing has changed since the last time, this is a no-op.
+ *
+ * @return true if the lines are held with the cached settings applied.
+ */
+bool GPIOLineRequest::apply()
+{
+    bool retVal = false;
+
+    if (is_requested())
+    {
+        retVal = reconfigure();
+        if (!retVal)
+        {
+            // In place didn't work out.  Do it the hard way.
+            release();
+        }
+    }
+
+    if (!retVal)
+    {
+        retVal = request();
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Change the settings on the lines we already hold, in place.
+ *
+ * @return true on success (or if there was nothing to change), false if we
+ *         don't hold the lines or the kernel refused the new settings.
+ */
+bool GPIOLineRequest::reconfigure()
+{
+    bool retVal = false;
+
+    if (!is_requested())
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOLineRequest", GPIO_ERR_NOT_REQUESTED, 0, "No request to reconfigure");
+    }
+    else if (!m_dirty)
+    {
+        // Nothing to do.
+        retVal = true;
+    }
+    else if (!m_request->reconfigure(m_settings))
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOLineRequest", GPIO_ERR_IO, errno, "Failed to reconfigure lines");
+    }
+    else
+    {
+        m_dirty = false;
+        retVal = true;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Request the lines from the kernel with the cached settings.
+ *
+ * @return true on success, false on failure.  Requesting when we already
+ *         hold the lines is a failure- use apply() or reconfigure().
+ */
+bool GPIOLineRequest::request()
+{
+    bool retVal = false;
+
+    if (is_requested())
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOLineRequest", GPIO_ERR_BUSY, 0, "Lines are already requested");
+    }
+    else if (m_chip == nullptr)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOLineRequest", GPIO_ERR_NO_CHIP, 0, "No chip open");
+    }
+    else
+    {
+        m_request = m_chip->get_backend()->request_lines(m_offsets, m_settings, m_consumer, m_event_buffer_size);
+        if (m_request == nullptr)
+        {
+            GPIO_DIAG(GPIO_LOG_ERROR, "GPIOLineRequest", (errno == EBUSY) ? GPIO_ERR_BUSY : GPIO_ERR_IO, errno, "Failed to request GPIO lines");
+        }
+        else
+        {
+            m_dirty = false;
+            retVal = true;
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Release the lines if we hold them.  No-op otherwise.
+ */
+void GPIOLineRequest::release()
+{
+    if (m_request != nullptr)
+    {
+        // We use nullptr as a barrier for not requested...
+        m_request.reset();
+        m_dirty = true;
+    }
+}
+
+/**
+ * @brief Get the logical value of one line.
+ *
+ * @return 1 for active, 0 for inactive, -1 on failure.
+ */
+int GPIOLineRequest::get_value(unsigned int offset)
+{
+    bool value = false;
+
+    return read_value(offset, value) ? (value ? 1 : 0) : -1;
+}
+
+/**
+ * @brief Get the logical value of one line.
+ *
+ * @param value Filled in with the line's value on success.
+ * @return GPIO_OK, GPIO_ERR_NOT_REQUESTED or GPIO_ERR_IO.
+ */
+GPIOStatus GPIOLineRequest::read_value(unsigned int offset, bool &value)
+{
+    GPIOStatus retVal;
+
+    if (m_request == nullptr)
+    {
+        retVal = GPIOStatus(GPIO_ERR_NOT_REQUESTED);
+    }
+    else
+    {
+        retVal = m_request->read_value(offset, value);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Set the logical value of one line.
+ *
+ * @return GPIO_OK, GPIO_ERR_NOT_REQUESTED or GPIO_ERR_IO.
+ */
+GPIOStatus GPIOLineRequest::set_value(unsigned int offset, bool value)
+{
+    GPIOStatus retVal;
+
+    if (m_request == nullptr)
+    {
+        retVal = GPIOStatus(GPIO_ERR_NOT_REQUESTED);
+    }
+    else
+    {
+        retVal = m_request->set_value(offset, value);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Read every line in the request with one call.
+ *
+ * @param values Filled in with a bitmask of the values by index.
+ * @return GPIO_OK, GPIO_ERR_NOT_REQUESTED or GPIO_ERR_IO.
+ */
+GPIOStatus GPIOLineRequest::get_values(uint64_t &values)
+{
+    GPIOStatus retVal;
+
+    if (m_request == nullptr)
+    {
+        retVal = GPIOStatus(GPIO_ERR_NOT_REQUESTED);
+    }
+    else
+    {
+        retVal = m_request->get_values(values);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Set any subset of the lines in the request with one call.
+ *
+ * @param mask Bitmask by index of the lines to set.
+ * @param values Bitmask by index of the values to set them to.
+ * @return GPIO_OK, GPIO_ERR_NOT_REQUESTED or GPIO_ERR_IO.
+ */
+GPIOStatus GPIOLineRequest::set_values(uint64_t mask, uint64_t values)
+{
+    GPIOStatus retVal;
+
+    if (m_request == nullptr)
+    {
+        retVal = GPIOStatus(GPIO_ERR_NOT_REQUESTED);
+    }
+    else
+    {
+        retVal = m_request->set_values(mask, values);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Get the request's fd for use with poll()/epoll.
+ *
+ * @return The fd, or -1 if we don't hold the lines.
+ */
+int GPIOLineRequest::get_fd()
+{
+    return (m_request != nullptr) ? m_request->get_fd() : -1;
+}
+
+/**
+ * @brief Wait for edge events on the request.
+ *
+ * @param timeout_ns How long to wait, negative waits forever.
+ * @return 1 if events are pending, 0 on timeout, -1 on error.
+ */
+int GPIOLineRequest::wait_edge_events(int64_t timeout_ns)
+{
+    int retVal = -1;
+
+    if (m_request != nullptr)
+    {
+        retVal = m_request->wait_edge_events(timeout_ns);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Read a batch of pending edge events.
+ *
+ * This blocks if there's nothing pending, so use get_fd() or
+ * wait_edge_events() first if that matters to you.
+ *
+ * @param events Where to put the events.
+ * @param max_events How many will fit there.
+ * @return The number of events read, -1 on error.
+ */
+int GPIOLineRequest::read_edge_events(gpio_edge_event_t *events, size_t max_events)
+{
+    int retVal = -1;
+
+    if (m_request == nullptr)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOLineRequest", GPIO_ERR_NOT_REQUESTED, 0, "No request open");
+    }
+    else
+    {
+        retVal = m_request->read_edge_events(events, max_events);
+        for (int i = 0; i < retVal; i++)
+        {
+            events[i].index = get_index(events[i].offset);
+        }
+    }
+
+    return retVal;
+}
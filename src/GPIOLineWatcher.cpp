@@ -0,0 +1,257 @@
+
+#include <string>
+using std::string;
+
+#include <errno.h>
+#include <poll.h>
+
+#include "GPIOLineWatcher.hpp"
+#include "GPIODiag.hpp"
+
+/**
+ * Constructor for GPIOLineWatcher.  Watches every line on the chip.
+ *
+ * @param chipname The chip to watch.
+ */
+GPIOLineWatcher::GPIOLineWatcher(const string &chipname) :
+    LoopThread("LineWatcher"),
+    m_next_id(0), m_events(0)
+{
+    watch(chipname, vector<unsigned int>());
+}
+
+/**
+ * Constructor for GPIOLineWatcher.  Watches just the lines given.
+ *
+ * @param chipname The chip to watch.
+ * @param offsets The lines to watch.
+ */
+GPIOLineWatcher::GPIOLineWatcher(const string &chipname, const vector<unsigned int> &offsets) :
+    LoopThread("LineWatcher"),
+    m_next_id(0), m_events(0)
+{
+    watch(chipname, offsets);
+}
+
+/**
+ * Destructor for GPIOLineWatcher.  Stops the thread and drops the watches.
+ */
+GPIOLineWatcher::~GPIOLineWatcher()
+{
+    stop_loop();
+
+    if (m_chip != nullptr)
+    {
+        for (size_t offset = 0; offset < m_watched.size(); offset++)
+        {
+            if (m_watched[offset])
+            {
+                m_chip->get_backend()->unwatch_line_info(offset);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Get a line's cached info.
+ *
+ * @return false if we aren't watching the line.
+ */
+bool GPIOLineWatcher::get_info(unsigned int offset, gpio_line_info_t &info)
+{
+    bool retVal = false;
+    lock_guard<mutex> lock(m_lock);
+
+    if ((offset < m_watched.size()) && m_watched[offset])
+    {
+        info = m_info[offset];
+        retVal = true;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Is somebody (us included) holding the line?
+ */
+bool GPIOLineWatcher::is_used(unsigned int offset)
+{
+    lock_guard<mutex> lock(m_lock);
+
+    return (offset < m_watched.size()) && m_watched[offset] && m_info[offset].used;
+}
+
+/**
+ * @brief Who's holding the line.  Empty if nobody is (or we aren't watching it).
+ */
+string GPIOLineWatcher::get_consumer(unsigned int offset)
+{
+    string retVal;
+    lock_guard<mutex> lock(m_lock);
+
+    if ((offset < m_watched.size()) && m_watched[offset])
+    {
+        retVal = m_info[offset].consumer;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Be told about every line info change.
+ *
+ * The callback runs on the watcher's thread after the cache is updated.
+ *
+ * @return An id for unsubscribe().
+ */
+int GPIOLineWatcher::subscribe(line_info_callback_t callback)
+{
+    lock_guard<mutex> lock(m_lock);
+
+    int retVal = m_next_id++;
+    m_subscribers.push_back({ retVal, callback });
+
+    return retVal;
+}
+
+/**
+ * @brief Stop being told about changes.
+ *
+ * @return false if there's no such subscriber.
+ */
+bool GPIOLineWatcher::unsubscribe(int id)
+{
+    bool retVal = false;
+    lock_guard<mutex> lock(m_lock);
+
+    for (auto it = m_subscribers.begin(); it != m_subscribers.end(); it++)
+    {
+        if (it->first == id)
+        {
+            m_subscribers.erase(it);
+            retVal = true;
+            break;
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Watch loop.
+ *
+ * Info events are rare (somebody requested, reconfigured or released a
+ * line), so they're read one at a time.  Subscribers are called with a copy
+ * of the list, outside of the lock, so they can (un)subscribe and query the
+ * cache from inside a callback.
+ */
+void GPIOLineWatcher::run()
+{
+    ThreadPolicy::Binding policy(*this);
+    shared_ptr<GPIOChipBackend> backend = m_chip->get_backend();
+    struct pollfd fds[2];
+
+    fds[0].fd = backend->get_info_fd();
+    fds[0].events = POLLIN;
+    fds[1].fd = m_wake.get_fd();
+    fds[1].events = POLLIN;
+
+    while (_run)
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno != EINTR)
+            {
+                GPIO_DIAG(GPIO_LOG_ERROR, "GPIOLineWatcher", GPIO_ERR_IO, errno, "Failed to wait for info events");
+            }
+            continue;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            m_wake.clear();
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            gpio_info_event_t event;
+            vector<pair<int, line_info_callback_t>> subscribers;
+
+            if (!backend->read_info_event(event))
+            {
+                GPIO_DIAG(GPIO_LOG_ERROR, "GPIOLineWatcher", GPIO_ERR_IO, errno, "Failed to read info event");
+                continue;
+            }
+            m_events++;
+
+            {
+                lock_guard<mutex> lock(m_lock);
+                if (event.info.offset < m_info.size())
+                {
+                    m_info[event.info.offset] = event.info;
+                }
+                subscribers = m_subscribers;
+            }
+
+            for (auto &subscriber : subscribers)
+            {
+                subscriber.second(event);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Open the chip, watch the lines and start the thread.
+ *
+ * The watches hand back each line's info as of now, which seeds the cache-
+ * from then on it's kept up by the events.
+ *
+ * @param offsets The lines to watch, empty for all of them.
+ */
+void GPIOLineWatcher::watch(const string &chipname, const vector<unsigned int> &offsets)
+{
+    m_chip = GPIOChip::open(chipname);
+    if (m_chip == nullptr)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOLineWatcher", GPIO_ERR_NO_CHIP, 0, "Failed to open GPIO chip <%s>", chipname.c_str());
+    }
+    else
+    {
+        size_t watched = 0;
+        vector<unsigned int> lines = offsets;
+
+        if (lines.empty())
+        {
+            for (unsigned int offset = 0; offset < m_chip->get_num_lines(); offset++)
+            {
+                lines.push_back(offset);
+            }
+        }
+
+        m_info.resize(m_chip->get_num_lines());
+        m_watched.resize(m_chip->get_num_lines(), false);
+        for (auto offset : lines)
+        {
+            if (offset >= m_chip->get_num_lines())
+            {
+                GPIO_DIAG(GPIO_LOG_ERROR, "GPIOLineWatcher", GPIO_ERR_NO_LINE, 0, "Invalid line number %u", offset);
+            }
+            else if (!m_chip->get_backend()->watch_line_info(offset, m_info[offset]))
+            {
+                GPIO_DIAG(GPIO_LOG_ERROR, "GPIOLineWatcher", (errno == EBUSY) ? GPIO_ERR_BUSY : GPIO_ERR_IO, errno,
+                          "Failed to watch line %u", offset);
+            }
+            else
+            {
+                m_watched[offset] = true;
+                watched++;
+            }
+        }
+
+        if (watched > 0)
+        {
+            start();
+        }
+    }
+}
@@ -0,0 +1,208 @@
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <set>
+using std::set;
+
+#include <mutex>
+using std::mutex;
+using std::lock_guard;
+
+#include "GPIOMetrics.hpp"
+
+atomic<bool> GPIOMetrics::s_timing(true);
+
+// Registry of live metrics.  Only touched on construction, destruction,
+// renames and snapshot_all()- never from the hot paths.  Function statics so
+// lines declared at namespace scope elsewhere can't beat them into existence.
+static mutex &registry_lock()
+{
+    static mutex s_lock;
+    return s_lock;
+}
+
+static set<GPIOMetrics *> &registry()
+{
+    static set<GPIOMetrics *> s_registry;
+    return s_registry;
+}
+
+/**
+ * @brief Mean of a histogram snapshot.
+ */
+double gpio_histogram_mean(const gpio_histogram_t &histogram)
+{
+    return (histogram.count > 0) ? ((double) histogram.sum / histogram.count) : 0.0;
+}
+
+/**
+ * @brief Upper bound of the bucket a percentile falls in.
+ *
+ * @param percentile 0.0 - 1.0.
+ * @return The bucket's upper bound (capped at the max seen), 0 if empty.
+ */
+uint64_t gpio_histogram_percentile(const gpio_histogram_t &histogram, double percentile)
+{
+    uint64_t retVal = 0;
+    uint64_t target = (uint64_t) (percentile * histogram.count);
+    uint64_t seen = 0;
+
+    if (histogram.count > 0)
+    {
+        for (size_t i = 0; i < gpio_histogram_t::BUCKETS; i++)
+        {
+            seen += histogram.buckets[i];
+            if (seen > target || (i == gpio_histogram_t::BUCKETS - 1))
+            {
+                retVal = (i == 0) ? 1 : ((2ULL << i) - 1);
+                break;
+            }
+        }
+
+        if (retVal > histogram.max)
+        {
+            retVal = histogram.max;
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Copy the histogram out.
+ */
+void GPIOHistogram::snapshot(gpio_histogram_t &histogram) const
+{
+    histogram.count = m_count.load(std::memory_order_relaxed);
+    histogram.sum = m_sum.load(std::memory_order_relaxed);
+    histogram.max = m_max.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < gpio_histogram_t::BUCKETS; i++)
+    {
+        histogram.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Zero the histogram.
+ */
+void GPIOHistogram::reset()
+{
+    m_count.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+    for (auto &bucket : m_buckets)
+    {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * Constructor for GPIOMetrics.  Zeroes everything and adds us to the registry.
+ *
+ * @param name What to call the line in snapshots.
+ */
+GPIOMetrics::GPIOMetrics(const string &name) :
+    m_name(name)
+{
+    reset();
+
+    lock_guard<mutex> lock(registry_lock());
+    registry().insert(this);
+}
+
+/**
+ * Destructor for GPIOMetrics.  Takes us back out of the registry.
+ */
+GPIOMetrics::~GPIOMetrics()
+{
+    lock_guard<mutex> lock(registry_lock());
+    registry().erase(this);
+}
+
+/**
+ * @brief Rename the line (e.g. once we know which chip/line it ended up on).
+ */
+void GPIOMetrics::set_name(const string &name)
+{
+    lock_guard<mutex> lock(registry_lock());
+    m_name = name;
+}
+
+/**
+ * @brief The line's name.
+ */
+string GPIOMetrics::get_name()
+{
+    lock_guard<mutex> lock(registry_lock());
+    return m_name;
+}
+
+/**
+ * @brief Copy out all of the counters and histograms.
+ */
+void GPIOMetrics::snapshot(gpio_line_metrics_t &metrics)
+{
+    metrics.name = get_name();
+    snapshot_counters(metrics);
+}
+
+/**
+ * @brief Copy out everything but the name.
+ */
+void GPIOMetrics::snapshot_counters(gpio_line_metrics_t &metrics)
+{
+    metrics.events = m_events.load(std::memory_order_relaxed);
+    metrics.lost = m_lost.load(std::memory_order_relaxed);
+    metrics.wakeups = m_wakeups.load(std::memory_order_relaxed);
+    metrics.gets = m_gets.load(std::memory_order_relaxed);
+    metrics.get_errors = m_get_errors.load(std::memory_order_relaxed);
+    metrics.sets = m_sets.load(std::memory_order_relaxed);
+    metrics.set_errors = m_set_errors.load(std::memory_order_relaxed);
+    m_events_per_wakeup.snapshot(metrics.events_per_wakeup);
+    m_callback_ns.snapshot(metrics.callback_ns);
+    m_get_ns.snapshot(metrics.get_ns);
+    m_set_ns.snapshot(metrics.set_ns);
+}
+
+/**
+ * @brief Zero all of the counters and histograms.
+ */
+void GPIOMetrics::reset()
+{
+    m_events.store(0, std::memory_order_relaxed);
+    m_lost.store(0, std::memory_order_relaxed);
+    m_wakeups.store(0, std::memory_order_relaxed);
+    m_gets.store(0, std::memory_order_relaxed);
+    m_get_errors.store(0, std::memory_order_relaxed);
+    m_sets.store(0, std::memory_order_relaxed);
+    m_set_errors.store(0, std::memory_order_relaxed);
+    m_events_per_wakeup.reset();
+    m_callback_ns.reset();
+    m_get_ns.reset();
+    m_set_ns.reset();
+}
+
+/**
+ * @brief Snapshot every live line in the process.
+ */
+vector<gpio_line_metrics_t> GPIOMetrics::snapshot_all()
+{
+    vector<gpio_line_metrics_t> retVal;
+    lock_guard<mutex> lock(registry_lock());
+
+    retVal.resize(registry().size());
+    size_t i = 0;
+    for (auto metrics : registry())
+    {
+        // We already hold the registry lock, so the name's read directly.
+        retVal[i].name = metrics->m_name;
+        metrics->snapshot_counters(retVal[i]);
+        i++;
+    }
+
+    return retVal;
+}
@@ -0,0 +1,46 @@
+
+#include <string>
+using std::string;
+
+#include "GPIOPin.hpp"
+#include "GPIODiag.hpp"
+
+/**
+ * @brief Take the line for a typed pin.
+ *
+ * Everything that can go wrong with a pin goes wrong here, once, so the
+ * typed pins' calls don't have to check anything.
+ *
+ * @param chipname The chip the line is on.
+ * @param line The line's offset on the chip.
+ * @param settings What the line's to be.
+ * @param consumer The consumer name the kernel will report for the line.
+ * @return true if the line is ours, false (and logged) otherwise.
+ */
+bool GPIOPin::open(const string &chipname, unsigned int line, const gpio_line_settings_t &settings, const char *consumer)
+{
+    bool retVal = false;
+
+    m_chip = GPIOChip::open(chipname);
+    if (m_chip == nullptr)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOPin", GPIO_ERR_NO_CHIP, 0, "Failed to open GPIO chip <%s>", chipname.c_str());
+    }
+    else if (line >= m_chip->get_num_lines())
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOPin", GPIO_ERR_NO_LINE, 0, "Invalid line number specified.  Must be < %zu", m_chip->get_num_lines());
+    }
+    else
+    {
+        m_line = line;
+        m_request.reset(new GPIOLineRequest(m_chip, { line }, consumer));
+        m_request->set_settings(settings);
+        if (m_request->request())
+        {
+            m_backend = m_request->get_backend();
+            retVal = true;
+        }
+    }
+
+    return retVal;
+}
@@ -0,0 +1,199 @@
+
+#include <string>
+using std::string;
+
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "GPIOSampler.hpp"
+#include "GPIODiag.hpp"
+#include "GPIOMetrics.hpp"
+
+/**
+ * Constructor for GPIOSampler.  Requests the lines as inputs and starts
+ * sampling them.
+ *
+ * @param chipname The chip the lines are on.
+ * @param offsets The lines to sample.  At most 64.
+ * @param period_ns Time between samples.
+ * @param history How many snapshots to keep in the ring (rounded up to a
+ *        power of two).
+ * @param bias Pull-up/down to apply to the lines.
+ */
+GPIOSampler::GPIOSampler(const string &chipname, const vector<unsigned int> &offsets, uint64_t period_ns,
+                         size_t history, enum gpiod_line_bias bias) :
+    LoopThread("GPIOSampler"),
+    m_period_ns(period_ns), m_timer_fd(-1), m_ring_mask(0), m_overruns(0)
+{
+    size_t size = 1;
+    while (size < history)
+    {
+        size <<= 1;
+    }
+    m_ring.reset(new SeqLock<gpio_sample_t>[size]);
+    m_ring_mask = size - 1;
+
+    shared_ptr<GPIOChip> chip = GPIOChip::open(chipname);
+    if (chip == nullptr)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOSampler", GPIO_ERR_NO_CHIP, 0, "Failed to open GPIO chip <%s>", chipname.c_str());
+    }
+    else if (m_period_ns == 0)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOSampler", GPIO_ERR_INVALID, 0, "Period can't be zero");
+    }
+    else
+    {
+        gpio_line_settings_t settings;
+        settings.bias = bias;
+
+        m_request.reset(new GPIOLineRequest(chip, offsets, "GPIOSampler"));
+        m_request->set_settings(settings);
+        if (!m_request->request())
+        {
+            GPIO_DIAG(GPIO_LOG_ERROR, "GPIOSampler", GPIO_ERR_IO, 0, "Failed to request lines");
+        }
+        else
+        {
+            m_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+            if (m_timer_fd < 0)
+            {
+                GPIO_DIAG(GPIO_LOG_ERROR, "GPIOSampler", GPIO_ERR_IO, errno, "Failed to create timer");
+            }
+            else
+            {
+                start();
+            }
+        }
+    }
+}
+
+/**
+ * Destructor for GPIOSampler.  Stops sampling and releases the lines.
+ */
+GPIOSampler::~GPIOSampler()
+{
+    stop_loop();
+
+    if (m_timer_fd >= 0)
+    {
+        close(m_timer_fd);
+    }
+}
+
+/**
+ * @brief One line's level out of the latest snapshot.  No syscalls.
+ *
+ * @return The level, or false if the line isn't one of ours.
+ */
+bool GPIOSampler::get_value(unsigned int offset) const
+{
+    uint64_t mask = (m_request != nullptr) ? m_request->get_mask(offset) : 0;
+    return (latest().values & mask) != 0;
+}
+
+/**
+ * @brief Copy out the snapshots newer than a given sequence.  No syscalls.
+ *
+ * @param after Sequence of the last snapshot you've seen (0 for everything
+ *        still in the ring).
+ * @param samples Where to put them.
+ * @param max How many will fit.
+ * @return How many were copied out.
+ */
+size_t GPIOSampler::read(uint64_t after, gpio_sample_t *samples, size_t max) const
+{
+    size_t retVal = 0;
+    uint64_t newest = latest().sequence;
+    uint64_t next = after + 1;
+
+    // Skip what's already been overwritten.
+    if ((newest > m_ring_mask) && (next < (newest - m_ring_mask)))
+    {
+        next = newest - m_ring_mask;
+    }
+
+    while ((next <= newest) && (retVal < max))
+    {
+        gpio_sample_t sample = m_ring[next & m_ring_mask].load();
+
+        // The writer may have lapped us while we were copying.
+        if (sample.sequence == next)
+        {
+            samples[retVal++] = sample;
+        }
+        next++;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief The sampling loop.
+ *
+ * A periodic timerfd drives us- the kernel keeps the ticks evenly spaced,
+ * and tells us how many we missed if we got held off.
+ */
+void GPIOSampler::run()
+{
+    ThreadPolicy::Binding policy(*this);
+    struct pollfd fds[2];
+    struct itimerspec its;
+    uint64_t sequence = 0;
+
+    its.it_interval.tv_sec = m_period_ns / 1000000000ULL;
+    its.it_interval.tv_nsec = m_period_ns % 1000000000ULL;
+    its.it_value = its.it_interval;
+    if (timerfd_settime(m_timer_fd, 0, &its, NULL) < 0)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOSampler", GPIO_ERR_IO, errno, "Failed to start timer");
+        return;
+    }
+
+    fds[0].fd = m_timer_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = m_wake.get_fd();
+    fds[1].events = POLLIN;
+
+    while (_run)
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno != EINTR)
+            {
+                GPIO_DIAG(GPIO_LOG_ERROR, "GPIOSampler", GPIO_ERR_IO, errno, "Failed to wait on timer");
+            }
+            continue;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            m_wake.clear();
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            uint64_t expirations = 0;
+            if ((::read(m_timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) && (expirations > 1))
+            {
+                m_overruns += expirations - 1;
+            }
+
+            gpio_sample_t sample;
+            if (m_request->get_values(sample.values))
+            {
+                sample.sequence = ++sequence;
+                sample.timestamp_ns = GPIOMetrics::now_ns();
+                m_ring[sequence & m_ring_mask].store(sample);
+                m_latest.store(sample);
+            }
+        }
+    }
+
+    // Disarm.
+    its = {};
+    timerfd_settime(m_timer_fd, 0, &its, NULL);
+}
@@ -0,0 +1,275 @@
+
+#include <string>
+using std::string;
+
+#include <new>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "GPIOStatePublisher.hpp"
+#include "GPIODiag.hpp"
+
+/**
+ * @brief Copy a string into a fixed size, always terminated, name field.
+ */
+static void copy_name(char *dest, const string &src)
+{
+    strncpy(dest, src.c_str(), GPIO_STATE_NAME_SIZE - 1);
+    dest[GPIO_STATE_NAME_SIZE - 1] = '\0';
+}
+
+/**
+ * Constructor for GPIOStatePublisher.  Creates and maps the segment.  On
+ * failure the publisher is left closed and every add_line() fails.
+ *
+ * @param name The shm_open() name of the segment.
+ * @param capacity The most lines we'll ever publish.
+ */
+GPIOStatePublisher::GPIOStatePublisher(const string &name, size_t capacity) :
+    m_name(name), m_size(sizeof(gpio_state_header_t) + (capacity * sizeof(gpio_state_slot_t))),
+    m_header(nullptr), m_slots(nullptr), m_shadow(nullptr)
+{
+    shm_unlink(m_name.c_str());
+
+    int fd = shm_open(m_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOStatePublisher", GPIO_ERR_IO, errno, "Failed to create segment <%s>", m_name.c_str());
+    }
+    else
+    {
+        void *base = MAP_FAILED;
+
+        if (ftruncate(fd, m_size) < 0)
+        {
+            GPIO_DIAG(GPIO_LOG_ERROR, "GPIOStatePublisher", GPIO_ERR_IO, errno, "Failed to size segment <%s>", m_name.c_str());
+        }
+        else if ((base = mmap(NULL, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+        {
+            GPIO_DIAG(GPIO_LOG_ERROR, "GPIOStatePublisher", GPIO_ERR_IO, errno, "Failed to map segment <%s>", m_name.c_str());
+        }
+        else
+        {
+            // Fresh from ftruncate() the segment is all zeros- build the
+            // slots in place, then the header last so a reader that gets in
+            // early sees no magic rather than a half built segment.
+            m_slots = reinterpret_cast<gpio_state_slot_t *>(static_cast<char *>(base) + sizeof(gpio_state_header_t));
+            for (size_t i = 0; i < capacity; i++)
+            {
+                new (&m_slots[i].state) SeqLock<gpio_line_state_t>();
+            }
+            m_shadow = new gpio_line_state_t[capacity]();
+
+            m_header = new (base) gpio_state_header_t;
+            m_header->version = GPIO_STATE_VERSION;
+            m_header->capacity = capacity;
+            m_header->num_lines.store(0, std::memory_order_relaxed);
+            m_header->magic.store(GPIO_STATE_MAGIC, std::memory_order_release);
+        }
+        close(fd);
+
+        if (m_header == nullptr)
+        {
+            shm_unlink(m_name.c_str());
+        }
+    }
+}
+
+/**
+ * Destructor for GPIOStatePublisher.  Unmaps and removes the segment.
+ * Readers that already have it mapped keep their (now frozen) copy.
+ */
+GPIOStatePublisher::~GPIOStatePublisher()
+{
+    if (m_header != nullptr)
+    {
+        munmap(m_header, m_size);
+        shm_unlink(m_name.c_str());
+        m_header = nullptr;
+    }
+    delete [] m_shadow;
+}
+
+/**
+ * @brief Add a line to the segment.
+ *
+ * @return The slot, -1 if we're full or not open.
+ */
+int GPIOStatePublisher::add_line(const string &chip, unsigned int offset, const string &name)
+{
+    int retVal = -1;
+    lock_guard<mutex> lock(m_lock);
+
+    if (m_header == nullptr)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOStatePublisher", GPIO_ERR_NOT_REQUESTED, 0, "Segment isn't open");
+    }
+    else if (m_header->num_lines.load(std::memory_order_relaxed) >= m_header->capacity)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOStatePublisher", GPIO_ERR_NO_SPACE, 0, "No room for <%s>", name.c_str());
+    }
+    else
+    {
+        retVal = m_header->num_lines.load(std::memory_order_relaxed);
+        copy_name(m_slots[retVal].chip, chip);
+        copy_name(m_slots[retVal].name, name);
+        m_slots[retVal].offset = offset;
+        m_header->num_lines.store(retVal + 1, std::memory_order_release);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Publish a line's state.
+ *
+ * Called from the line's own event thread.  Bad slots are ignored.
+ */
+void GPIOStatePublisher::publish(int slot, bool value, uint64_t timestamp_ns, uint64_t edges, uint64_t lost)
+{
+    if ((m_header != nullptr) && (slot >= 0) && ((uint32_t) slot < m_header->num_lines.load(std::memory_order_acquire)))
+    {
+        gpio_line_state_t &state = m_shadow[slot];
+
+        state.value = value;
+        state.timestamp_ns = timestamp_ns;
+        state.edges += edges;
+        state.lost += lost;
+        m_slots[slot].state.store(state);
+    }
+}
+
+/**
+ * Constructor for GPIOStateReader.  Maps the publisher's segment read-only.
+ * On failure (no such segment, or it isn't one of ours) the reader is left
+ * closed with no lines.
+ *
+ * @param name The shm_open() name the publisher used.
+ */
+GPIOStateReader::GPIOStateReader(const string &name) :
+    m_size(0), m_capacity(0), m_header(nullptr), m_slots(nullptr)
+{
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "GPIOStateReader", GPIO_ERR_IO, errno, "Failed to open segment <%s>", name.c_str());
+    }
+    else
+    {
+        struct stat st;
+        void *base = MAP_FAILED;
+
+        if ((fstat(fd, &st) < 0) || ((size_t) st.st_size < sizeof(gpio_state_header_t)))
+        {
+            GPIO_DIAG(GPIO_LOG_ERROR, "GPIOStateReader", GPIO_ERR_INVALID, errno, "Segment <%s> is too small", name.c_str());
+        }
+        else if ((base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+        {
+            GPIO_DIAG(GPIO_LOG_ERROR, "GPIOStateReader", GPIO_ERR_IO, errno, "Failed to map segment <%s>", name.c_str());
+        }
+        else
+        {
+            const gpio_state_header_t *header = static_cast<const gpio_state_header_t *>(base);
+
+            if ((header->magic.load(std::memory_order_acquire) != GPIO_STATE_MAGIC) || (header->version != GPIO_STATE_VERSION) ||
+                (((size_t) st.st_size) < (sizeof(gpio_state_header_t) + (header->capacity * sizeof(gpio_state_slot_t)))))
+            {
+                GPIO_DIAG(GPIO_LOG_ERROR, "GPIOStateReader", GPIO_ERR_INVALID, 0, "Segment <%s> isn't a GPIO state segment", name.c_str());
+                munmap(base, st.st_size);
+            }
+            else
+            {
+                m_size = st.st_size;
+                m_capacity = header->capacity;
+                m_header = header;
+                m_slots = reinterpret_cast<const gpio_state_slot_t *>(static_cast<const char *>(base) + sizeof(gpio_state_header_t));
+            }
+        }
+        close(fd);
+    }
+}
+
+/**
+ * Destructor for GPIOStateReader.  Unmaps the segment.
+ */
+GPIOStateReader::~GPIOStateReader()
+{
+    if (m_header != nullptr)
+    {
+        munmap(const_cast<gpio_state_header_t *>(m_header), m_size);
+        m_header = nullptr;
+    }
+}
+
+/**
+ * @brief Find a slot by line name.
+ *
+ * @return The slot, -1 if there isn't one by that name.
+ */
+int GPIOStateReader::find(const string &name)
+{
+    int retVal = -1;
+    size_t count = get_num_lines();
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (strncmp(m_slots[i].name, name.c_str(), GPIO_STATE_NAME_SIZE) == 0)
+        {
+            retVal = i;
+            break;
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Get a slot's description.
+ *
+ * @return false for a bad slot.
+ */
+bool GPIOStateReader::get_line(int slot, string &chip, unsigned int &offset, string &name)
+{
+    bool retVal = false;
+
+    if (valid(slot))
+    {
+        chip = m_slots[slot].chip;
+        offset = m_slots[slot].offset;
+        name = m_slots[slot].name;
+        retVal = true;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Get a consistent snapshot of a slot's state.
+ *
+ * @return false for a bad slot.
+ */
+bool GPIOStateReader::read(int slot, gpio_line_state_t &state)
+{
+    bool retVal = false;
+
+    if (valid(slot))
+    {
+        state = m_slots[slot].state.load();
+        retVal = true;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Get a slot's sequence, for cheap "anything new?" checks.
+ */
+uint32_t GPIOStateReader::sequence(int slot)
+{
+    return valid(slot) ? m_slots[slot].state.sequence() : 0;
+}
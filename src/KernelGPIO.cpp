@@ -2,15 +2,12 @@
 #include <string>
 using std::string;
 
-#include <iostream>
-using std::cout;
-using std::endl;
-using std::flush;
-
 #include <mutex>
 using std::mutex;
 using std::lock_guard;
 
+#include <thread>
+
 // We're using the simpler (albeit only SLIGHTLY so..) C API for libgpiod
 // as the C++ wrapper, especially in the 2.x api where they radically cnaged
 // the API to make it, "more generic" and simply made it more painful to use.
@@ -22,27 +19,69 @@ using std::lock_guard;
 #include <gpiod.h>
 
 #include "KernelGPIO.hpp"
+#include "GPIODiag.hpp"
 
 #include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+// How many edge events we pull out of the kernel per read in run().
+static const size_t EVENT_BATCH_SIZE = 16;
+
+KernelGPIO::KernelGPIO(const string &chipname, size_t line) : 
+    LoopThread("KernelGPIO"),
+    chipname(chipname), m_value(false), m_direction(INPUT), m_edge(NONE), m_active_low(false), m_callback(nullptr), 
+    m_summary_callback(nullptr), m_max_notifications(0), m_window_ns(0),
+    m_publisher(nullptr), m_publish_slot(-1), m_publish_generation(0), m_publish_seen(0), m_publish_running(false),
+    m_line_num(line), m_chip(nullptr), m_request(nullptr)
+{
+    open_line(line);
+}
 
-KernelGPIO::KernelGPIO(string chipname, size_t line) : 
-    m_value(false), m_direction(INPUT), m_active_low(false), m_callback(nullptr), 
-    m_chip(nullptr), m_line(nullptr), m_request(nullptr)
+/**
+ * Constructor for a line by name.  The chip and offset are resolved out of
+ * GPIOChip's line name index, so this doesn't cost a scan of every chip's
+ * lines per object.  If the name isn't found, the object is left closed and
+ * every other call will fail accordingly.
+ *
+ * @param linename The name of the line as the kernel knows it.
+ */
+KernelGPIO::KernelGPIO(const string &linename) : 
+    LoopThread("KernelGPIO"),
+    m_value(false), m_direction(INPUT), m_edge(NONE), m_active_low(false), m_callback(nullptr), 
+    m_summary_callback(nullptr), m_max_notifications(0), m_window_ns(0),
+    m_publisher(nullptr), m_publish_slot(-1), m_publish_generation(0), m_publish_seen(0), m_publish_running(false),
+    m_line_num(0), m_chip(nullptr), m_request(nullptr)
 {
-    // Do a small amount of sanity checking.  Range needs to be 0->chip's capacity
-    if (line < 0)
+    unsigned int offset = 0;
+
+    if (!GPIOChip::find_line(linename, chipname, offset))
     {
-        cout << "Invalid line number specified.  Must be >= 0" << endl;
+        GPIO_DIAG(GPIO_LOG_ERROR, "KernelGPIO", GPIO_ERR_NO_LINE, 0, "Unable to find GPIO line named <%s>", linename.c_str());
     }
     else
     {
-        // Open the chip...
-        m_chip = gpiod_chip_open(chipname.c_str());
-        if (m_chip == nullptr)
-        {
-            cout << "Failed to open GPIO chip <" << chipname << ">" << endl;
-        }
+        m_line_num = offset;
+        open_line(offset);
+    }
+}
+
+/**
+ * Factory for a line by name.
+ *
+ * @param linename The name of the line as the kernel knows it.
+ * @return The opened line or nullptr if it couldn't be found or opened.
+ */
+unique_ptr<KernelGPIO> KernelGPIO::from_name(const string &linename)
+{
+    unique_ptr<KernelGPIO> retVal(new KernelGPIO(linename));
+
+    if (!retVal->is_open())
+    {
+        retVal.reset();
     }
+
+    return retVal;
 }
 
 /**
@@ -53,11 +92,7 @@ KernelGPIO::KernelGPIO(string chipname, size_t line) :
 KernelGPIO::~KernelGPIO() 
 {
     // Close down the thread, wait for it to finish.
-    if (isRunning())
-    {
-        stop();
-        join();
-    }
+    stop_events();
 
     // Clean up the allocations we've made...
     close_chip();
@@ -69,7 +104,13 @@ KernelGPIO::~KernelGPIO()
  * provided settings.  If the line is an output line, the value parameter
  * will be set.  If the line is an input line, the edge detection parameter
  * will be set.  If the edge detection parameter is set to NONE, the thread
- * for this GPIO line will not be started.
+ * for this GPIO line will not be started (and will be stopped if it was).
+ *
+ * If we already hold the line, the new settings are applied to the existing
+ * request in place.  The line is never released to other consumers in that
+ * case, and an output being switched around doesn't glitch.  Only if the
+ * kernel won't take the change in place do we drop the line and request it
+ * all over again.
  *
  * @param direction The direction to configure the GPIO line as (INPUT or
  * OUTPUT).
@@ -85,129 +126,65 @@ KernelGPIO::~KernelGPIO()
 bool KernelGPIO::configure(gpio_direction_t direction, bool active_low, gpio_edge_t edge, bool value) 
 {
     bool retVal = false;        // Assume failure.
-    int ret = 0;
-    unsigned int offset = m_line_num;
-
-    // Drop the current request...
-    release_request();
-
-    // Start a new one...
-    struct gpiod_line_config *cfg;
-    struct gpiod_line_settings *settings = gpiod_line_settings_new();
+    gpio_line_settings_t settings;
 
-    if (!settings)
+    if (m_request == nullptr)
     {
-        cout << " KernelGPIO : Failed to allocate line settings" << endl << flush;
+        GPIO_DIAG(GPIO_LOG_ERROR, "KernelGPIO", GPIO_ERR_NO_CHIP, 0, "No chip open");
     }
     else
     {
-        ret = gpiod_line_settings_set_direction(settings, (gpiod_line_direction) direction);
-        if (ret < 0)
+        settings.direction = (gpiod_line_direction) direction;
+        settings.edge = (direction == INPUT) ? (gpiod_line_edge) edge : GPIOD_LINE_EDGE_NONE;
+        settings.active_low = active_low;
+        settings.value = value;
+        m_request->set_settings(m_line_num, settings);
+
+        // Fast path- change the settings on the request we already have.
+        if (m_request->is_requested())
+        {
+            retVal = m_request->reconfigure();
+        }
+
+        if (!retVal)
+        {
+            // Slow path- a fresh request.  The event thread can't be sitting
+            // on the old request while we swap it out from under it.
+            stop_events();
+            m_request->release();
+            retVal = m_request->request();
+        }
+
+        if (!retVal)
         {
-            cout << " KernelGPIO : Failed to set direction" << endl << flush;
+            GPIO_DIAG(GPIO_LOG_ERROR, "KernelGPIO", GPIO_ERR_IO, 0, "Failed to configure GPIO line");
         }
         else
         {
-            // If we're an output line set here, do that and preserve our
-            // value for readback.
+            // Store our cached info for the config...
+            m_direction = direction;
+            m_edge = (gpio_edge_t) settings.edge;
+            m_active_low = active_low;
             if (direction == OUTPUT)
             {
-                ret = gpiod_line_settings_set_output_value(settings, (value ?  GPIOD_LINE_VALUE_ACTIVE : GPIOD_LINE_VALUE_INACTIVE));
-                if (ret < 0)
-                {
-                    cout << " KernelGPIO : Failed to set output value" << endl << flush;
-                }
-                else
-                {   
-                    // Preserve the value...we can't read it back from the line.
-                    m_value = value;
-                }
+                // Preserve the value...we can't read it back from the line.
+                m_value = value;
             }
 
-            // Set the edge detection.
-            ret = gpiod_line_settings_set_edge_detection(settings, (gpiod_line_edge) edge);
-            if (ret < 0)
+            // Check to see if we were told to set edge detection and start
+            // or stop the thread accordingly.
+            if (m_edge != NONE)
             {
-                cout << " KernelGPIO : Failed to set edge detection" << endl << flush;
+                if (!isRunning())
+                {
+                    start();
+                }
             }
             else
             {
-                // Set active low
-                gpiod_line_settings_set_active_low(settings, active_low);
-
-                // All done.  Start processing the line config out of this now.
-                cfg = gpiod_line_config_new();
-                if (!cfg)
-                {
-                    cout << " KernelGPIO : Failed to allocate line config" << endl << flush;
-                }
-                else
-                {
-                    ret = gpiod_line_config_add_line_settings(cfg, &offset, 1, settings);
-                    if (ret < 0)
-                    {
-                        cout << " KernelGPIO : Failed to add line settings" << endl << flush;
-                    }
-                    else
-                    {
-                        // Start configuring the request/line...
-                        cfg = gpiod_line_config_new();
-                        if (!cfg)
-                        {
-                            cout << " KernelGPIO : Failed to allocate line config" << endl << flush;
-                        }
-                        else
-                        {
-                            ret = gpiod_line_config_add_line_settings(cfg, &offset, 1, settings);
-                            if (ret < 0)
-                            {
-                                cout << " KernelGPIO : Failed to add line settings" << endl << flush;
-                            }
-                            else
-                            {
-                                struct gpiod_request_config *req_cfg = gpiod_request_config_new();
-                                if (!req_cfg)
-                                {
-                                    cout << " KernelGPIO : Failed to allocate request config" << endl << flush;
-                                }
-                                else
-                                {
-                                    gpiod_request_config_set_consumer(req_cfg, "KerneoGPIO");
-                                    m_request = gpiod_chip_request_lines(m_chip, req_cfg, cfg);
-                                    if (!m_request)
-                                    {
-                                        cout << " KernelGPIO : Failed to request GPIO line" << endl << flush;
-                                    }
-                                    else
-                                    {
-                                        // We're a go.
-                                        retVal = true;
-
-                                        // Check to see if we were told to set edge detection.
-                                        if (edge != NONE)
-                                        {
-                                            // Yep.  Store our cached info for the config and start the thread.
-                                            m_direction = direction;
-                                            m_edge = edge;
-                                            start();
-                                        }
-                                    }
-                                }
-
-                                // Clean up after yourself
-                                gpiod_request_config_free(req_cfg);
-                            }
-                        }
-                    }
-
-                    // Clean up after yourself
-                    gpiod_line_config_free(cfg);
-                }
+                stop_events();
             }
         }
-
-        // Clean up after yourself
-        gpiod_line_settings_free(settings);            
     }
 
     return retVal;
@@ -216,49 +193,66 @@ bool KernelGPIO::configure(gpio_direction_t direction, bool active_low, gpio_edg
 /**
  * @brief Set the value of a GPIO line.
  *
+ * This is a hot path, so it doesn't log anything- what went wrong, if
+ * anything, comes back in the status.
+ *
  * @param value The value to set, true for high, false for low.
- * @return true on success, false on failure.  If the line is not configured for output,
- *         then the function is a no-op and returns false.
+ * @return GPIO_OK on success.  If the line is not configured for output,
+ *         then the function is a no-op and returns GPIO_ERR_DIRECTION.
  */
-bool KernelGPIO::set_value(bool value)
+GPIOStatus KernelGPIO::set_value(bool value)
 {
-    bool retVal = false;
-    int ret = 0;
+    GPIOStatus retVal;
+    uint64_t start = GPIOMetrics::start_timer();
 
     if (m_direction != OUTPUT)
     {
-        cout << " KernelGPIO : Line is not configured for output" << endl << flush;
+        retVal = GPIOStatus(GPIO_ERR_DIRECTION);
+    }
+    else if ((m_request == nullptr) || !m_request->is_requested())
+    {
+        retVal = GPIOStatus(GPIO_ERR_NOT_REQUESTED);
     }
     else
     {
-        // Check to see if we have a request.
-        if (m_request == nullptr)
-        {
-            cout << " KernelGPIO : Request is null??" << endl << flush;
-        }
-        else
+        retVal = m_request->set_value(m_line_num, value);
+        if (retVal)
         {
-            // We do, presume since the preserved mode is OUTPUT that this will work now.
-            ret = gpiod_line_request_set_value(m_request, m_line_num, (value ?  GPIOD_LINE_VALUE_ACTIVE : GPIOD_LINE_VALUE_INACTIVE));
-            if (ret < 0)
-            {
-                cout << " KernelGPIO : Failed to set value - errno = " << errno << endl << flush;
-            }
-            else
-            {
-                // Success.  Preserve the value for readback.
-                m_value = value;
-                retVal = true;
-            }
+            // Success.  Preserve the value for readback.
+            m_value = value;
         }
     }
 
+    m_metrics.record_set(start, retVal);
     return retVal;
 }
 
 /**
  * @brief Get the "value" of the GPIO line.
  *
+ * Same as read_value(), for code that just wants a bool.  Failures are
+ * reported (rate limited) through GPIODiag and read as false.
+ *
+ * @return The value of the GPIO line, actual, or approximated as described
+ *         for read_value().  Also, this will return false on a failure.
+ */
+bool KernelGPIO::get_value()
+{
+    bool retVal = false;
+    GPIOStatus status = read_value(retVal);
+
+    if (!status)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "KernelGPIO", status.get_code(), status.get_errno(), "Unable to read line %u", m_line_num);
+        retVal = false;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Read the "value" of the GPIO line.
+ *
  * This function pulls the value of the GPIO line.  If in output mode, the
  * previously set value is returned.  If in input mode, without edge detection, 
  * the value is read directly from the line and returned.  If edge detection 
@@ -274,206 +268,403 @@ bool KernelGPIO::set_value(bool value)
  *    internal store as is.  It will latch to the last read event in a 
  *    current processing run for events.
  *
- * @return The value of the GPIO line, actual, or approximated as described.
- *         Also, this will return false on a failure.
+ * @param value Filled in with the value on success.
+ * @return GPIO_OK, or what went wrong.  Nothing is logged.
  */
-bool KernelGPIO::get_value()
+GPIOStatus KernelGPIO::read_value(bool &value)
 {
-    bool retVal = false;
-    int ret = 0;
+    GPIOStatus retVal;
+    uint64_t start = GPIOMetrics::start_timer();
 
     // This is somewhat complex, depending on what our settings have, we pull from
     // the internal store value or from the actual line setting.
-    if (m_chip != nullptr)    
+    if (m_request == nullptr)    
     {
-        if (m_request == nullptr)
+        retVal = GPIOStatus(GPIO_ERR_NO_CHIP);
+    }
+    else if (!m_request->is_requested())
+    {
+        retVal = GPIOStatus(GPIO_ERR_NOT_REQUESTED);
+    }
+    else if (m_direction == gpio_direction_t::OUTPUT)
+    {
+        // Can't read the value from the line so we report what was previously set.
+        value = m_value;
+    }
+    else
+    {
+        // Input mode.  Now we need to see what settings we have.  Edge detection modes
+        // set on eventing will dictate some of our behaviors.
+        switch (m_edge)
         {
-            if (m_direction == gpio_direction_t::OUTPUT)
-            {
-                // Can't read the value from the line so we report what was previously set.
-                retVal = m_value;
-            }
-            else
-            {
-                // Input mode.  Now we need to see what settings we have.  Edge detection modes
-                // set on eventing will dictate some of our behaviors.
-                if (m_edge == gpio_edge_t::NONE)
-                {
-                    // No edge detection.  Just read the value.
-                    if (m_request == nullptr)
-                    {
-                        cout << " KernelGPIO : Request is null??" << endl << flush;
-                    }
-                    else 
-                    {
-                        ret = gpiod_line_request_get_value(m_request, m_line_num);
-                        if (ret < 0)
-                        {
-                            cout << " KernelGPIO : Failed to get value - errno = " << errno << endl << flush;
-                        }
-                        {
-                            retVal = ret;
-                        }
-                    }
-                    
-                }
+            case gpio_edge_t::NONE:
+                // No edge detection.  Just read the value.
+                retVal = m_request->read_value(m_line_num, value);
+                break;
+
+            case gpio_edge_t::BOTH:
+                // Just return the internal store.  Last event in a string up to this point is the value
+                value = m_value;
+                break;
+
+            case gpio_edge_t::RISING:
+                // Latching behavior- you will see rising edges meaning line goes active
+                // but we won't see returns to inactive on the line. Return our internal
+                // store's value and force it to false.  If you need to know each rising
+                // value, set a callback.
+                value = m_value.exchange(false);
+                break;
+
+            case gpio_edge_t::FALLING:
+                // Latching behavior- you will see falling edges meaning line goes inactive
+                // but we won't see returns to active on the line. Return our internal
+                // store's value and force it to true.  If you need to know each falling
+                // value, set a callback.
+                value = m_value.exchange(true);
+                break;
+        }                    
+    }
 
-                switch (m_edge)
-                {
-                    case gpio_edge_t::NONE:
-                        // No edge detection.  Just read the value.
-                        if (m_request == nullptr)
-                        {
-                            cout << " KernelGPIO : Request is null??" << endl << flush;
-                        }
-                        else 
-                        {
-                            ret = gpiod_line_request_get_value(m_request, m_line_num);
-                            if (ret < 0)
-                            {
-                                cout << " KernelGPIO : Failed to get value - errno = " << errno << endl << flush;
-                            }
-                            {
-                                retVal = ret;
-                            }
-                        }
-                        break;
-
-                    case gpio_edge_t::BOTH:
-                        // Just return the internal store.  Last event in a string up to this point is the value
-                        retVal = m_value;
-                        break;
-
-                    case gpio_edge_t::RISING:
-                        // Latching behavior- you will see rising edges meaning line goes active
-                        // but we won't see returns to inactive on the line. Return our internal
-                        // store's value and force it to false.  If you need to know each rising
-                        // value, set a callback.
-                        retVal = m_value;
-                        m_value = false;
-                        break;
-
-                    case gpio_edge_t::FALLING:
-                        // Latching behavior- you will see falling edges meaning line goes inactive
-                        // but we won't see returns to active on the line. Return our internal
-                        // store's value and force it to true.  If you need to know each falling
-                        // value, set a callback.
-                        retVal = m_value;
-                        m_value = true;
-                        break;
-                }                    
-            }
-        }
-        else
-        {
-            cout << "KernelGPIO : No request open" << endl << flush;
-        }
+    m_metrics.record_get(start, retVal);
+    return retVal;
+}
+
+/**
+ * @brief Set the notification rate limit.
+ *
+ * @param max_notifications Most notifications per window, 0 for no limit.
+ * @param window_ns Length of the window.
+ */
+void KernelGPIO::set_rate_limit(unsigned int max_notifications, uint64_t window_ns)
+{
+    m_window_ns = window_ns;
+    m_max_notifications = (window_ns > 0) ? max_notifications : 0;
+
+    // The event loop may be sitting on held edges waiting for a window that
+    // just changed.
+    m_wake.signal();
+}
+
+/**
+ * @brief Publish the line's state to a shared memory segment.
+ *
+ * The slot is added here, but all the publishing is done by the event thread,
+ * which picks the change up when we wake it- that keeps it the slot's one
+ * and only writer.  We don't return until it has, so the old publisher can
+ * be freed as soon as we do.
+ *
+ * @param publisher The segment to publish to, nullptr to stop.
+ * @param name The name readers will find the line by, chip:line if empty.
+ * @return false if the segment has no room (or isn't open).
+ */
+bool KernelGPIO::set_publisher(GPIOStatePublisher *publisher, const string &name)
+{
+    bool retVal = true;
+    int slot = -1;
+
+    if (publisher != nullptr)
+    {
+        slot = publisher->add_line(chipname, m_line_num, name.empty() ? (chipname + ":" + std::to_string(m_line_num)) : name);
+        retVal = (slot >= 0);
     }
-    else
+
+    if (retVal)
     {
-        cout << "KernelGPIO : No chip open" << endl << flush;
+        unique_lock<mutex> lock(m_publish_lock);
+        uint64_t generation = ++m_publish_generation;
+
+        m_publisher = publisher;
+        m_publish_slot = slot;
+        m_wake.signal();
+
+        // The event thread may still be publishing to the old one- wait for it
+        // to let go.  From one of our callbacks it can't until we return, but
+        // it checks again before it publishes anything.
+        if (m_publish_running && (std::this_thread::get_id() != _thread->get_id()))
+        {
+            m_publish_cond.wait(lock, [this, generation] { return (m_publish_seen >= generation) || !m_publish_running; });
+        }
     }
 
     return retVal;
 }
 
+/**
+ * @brief Edge event processing loop.
+ *
+ * Waits on the line's request and a wakeup fd so configure() and the
+ * destructor can get our attention.  Events are pulled out of the kernel in
+ * batches, but each one is processed in order, so the latching behavior in
+ * get_value() sees exactly what it did one at a time.
+ *
+ * With no rate limit, every edge is a notification.  With one, every edge
+ * still updates the value, but edges are folded into a pending summary and
+ * only handed out while the window has notifications left.  Whatever's
+ * pending when the window runs out waits for the next one, so the handlers
+ * see at most max_notifications calls per window no matter what the line
+ * does.
+ */
 void KernelGPIO::run()
 {
+    ThreadPolicy::Binding policy(*this);
     int ret = 0;
-    bool value = false;
+    unsigned long last_seqno = 0;       // Starts over with every request
+    gpio_edge_event_t events[EVENT_BATCH_SIZE];
+    gpio_edge_summary_t pending = { 0, 0, 0, false };
+    uint64_t window_start = 0;
+    unsigned int notified = 0;
+    GPIOStatePublisher *publisher = nullptr;
+    int slot = -1;
+    bool refresh = true;        // Always pick up the publisher on the way in
 
-    // Allocate out a buffer for events- ONE event per each pass.
-    struct gpiod_edge_event_buffer *buf = gpiod_edge_event_buffer_new(1);
-    if (buf == nullptr)
     {
-        cout << " KernelGPIO : Failed to allocate event buffer" << endl << flush;        
+        lock_guard<mutex> lock(m_publish_lock);
+        m_publish_running = true;
     }
-    else
+    struct pollfd fds[2];
+
+    fds[0].fd = m_request->get_fd();
+    fds[0].events = POLLIN;
+    fds[1].fd = m_wake.get_fd();
+    fds[1].events = POLLIN;
+
+    // This loop only runs in the right modes...
+    while (_run && m_direction == gpio_direction_t::INPUT && m_edge != gpio_edge_t::NONE) 
     {
-        // This loop only runs in the right modes...
-        while (_run && m_direction == gpio_direction_t::INPUT && m_edge != gpio_edge_t::NONE) 
+        unsigned int max_notifications = m_max_notifications;
+        uint64_t window_ns = m_window_ns;
+        struct timespec timeout;
+        struct timespec *wait = NULL;
+        uint64_t lost = 0;
+
+        // Pick up a change of publisher, and give a new one our current level.
+        if (refresh || (m_publish_generation.load(std::memory_order_acquire) != m_publish_seen))
         {
-            // Wait for an event to happen...indefinitely...
-            ret = gpiod_line_request_wait_edge_events(m_request, -1);
-            if (ret < 0)
+            refresh_publisher(publisher, slot);
+            if (publisher != nullptr)
             {
-                cout << " KernelGPIO : Failed to wait for event - errno = " << errno << endl << flush;
+                publisher->publish(slot, m_value, 0);
             }
-            ret = 0;
-            while (ret == 0)
+            refresh = false;
+        }
+
+        // Anything still held when the limit's been taken off goes out now,
+        // not with whatever edge happens to come along next.
+        if ((pending.edges > 0) && (max_notifications == 0))
+        {
+            notify(pending);
+            pending.edges = 0;
+        }
+
+        // Held edges need us back when the window rolls over.
+        if ((pending.edges > 0) && (max_notifications > 0))
+        {
+            uint64_t now = GPIOMetrics::now_ns();
+            uint64_t left = ((window_start + window_ns) > now) ? (window_start + window_ns - now) : 0;
+            timeout.tv_sec = left / 1000000000ULL;
+            timeout.tv_nsec = left % 1000000000ULL;
+            wait = &timeout;
+        }
+
+        // Wait for an event to happen...or for someone to need our attention...
+        ret = ppoll(fds, 2, wait, NULL);
+        if (ret < 0)
+        {
+            if (errno != EINTR)
             {
-                // Read events...ONE AT A TIME for a reason.
-                ret = gpiod_line_request_read_edge_events(m_request, buf, 1);
-                if (ret < 0)
+                GPIO_DIAG(GPIO_LOG_ERROR, "KernelGPIO", GPIO_ERR_IO, errno, "Failed to wait for event");
+            }
+        }
+        else
+        {
+            if (fds[1].revents & POLLIN)
+            {
+                m_wake.clear();
+            }
+
+            if (fds[0].revents & POLLIN)
+            {
+                ret = m_request->read_edge_events(events, EVENT_BATCH_SIZE);
+                if (ret > 0)
                 {
-                    // We're done either way.  Last set of events have been read...
-                    // We're just checking to see if this needs an error logged or not
-                    if (errno != EAGAIN)
-                    {
-                        cout << " KernelGPIO : Failed to read event - errno = " << errno << endl << flush;
-                    }
+                    m_metrics.record_wakeup(ret);
                 }
-                else if (ret == 0)
+                for (int i = 0; i < ret; i++)
                 {
-                    struct gpiod_edge_event *ev = gpiod_edge_event_buffer_get_event(buf, 0);
+                    // Gaps in the line's sequence numbers are events the kernel dropped on us.
+                    if ((last_seqno != 0) && (events[i].line_seqno > (last_seqno + 1)))
+                    {
+                        m_metrics.record_lost(events[i].line_seqno - last_seqno - 1);
+                        lost += events[i].line_seqno - last_seqno - 1;
+                    }
+                    last_seqno = events[i].line_seqno;
 
                     // We got the event.  Process it.
-                    switch (gpiod_edge_event_get_event_type(ev))
+                    m_value = events[i].rising;
+
+                    if (pending.edges == 0)
                     {
-                        case GPIOD_LINE_EDGE_RISING:
-                            m_value = true;
-                            break;
-                        case GPIOD_LINE_EDGE_FALLING:
-                            m_value = false;
-                            break;
-                        default:
-                            cout << " KernelGPIO : Unknown event type - " << gpiod_edge_event_get_event_type(ev) << endl << flush;
-                            break;
+                        pending.first_ns = events[i].timestamp_ns;
                     }
+                    pending.edges++;
+                    pending.last_ns = events[i].timestamp_ns;
+                    pending.value = events[i].rising;
+
+                    if (max_notifications == 0)
+                    {
+                        notify(pending);
+                        pending.edges = 0;
+                    }
+                }
+
+                // One publish per batch- readers want the latest, not every step.
+                // A callback may have just swapped the publisher out from under us.
+                if (m_publish_generation.load(std::memory_order_acquire) != m_publish_seen)
+                {
+                    refresh_publisher(publisher, slot);
+                }
+                if ((ret > 0) && (publisher != nullptr))
+                {
+                    publisher->publish(slot, m_value, events[ret - 1].timestamp_ns, ret, lost);
+                }
+            }
+
+            // Hand out whatever's been held if the window allows it.
+            if ((pending.edges > 0) && (max_notifications > 0))
+            {
+                uint64_t now = GPIOMetrics::now_ns();
+                if ((now - window_start) >= window_ns)
+                {
+                    window_start = now;
+                    notified = 0;
+                }
+
+                if (notified < max_notifications)
+                {
+                    notify(pending);
+                    pending.edges = 0;
+                    notified++;
                 }
             }
         }
+    }
 
-        // Clean up after yourself...
-        gpiod_edge_event_buffer_free(buf);
+    // Nobody's waiting on us to pick up a publisher now.
+    {
+        lock_guard<mutex> lock(m_publish_lock);
+        m_publish_running = false;
+        m_publish_seen = m_publish_generation;
     }
+    m_publish_cond.notify_all();
 }
 
+/**
+ * @brief Pick up the current publisher on the event thread.
+ *
+ * Lets set_publisher() know we're done with the one before it.
+ */
+void KernelGPIO::refresh_publisher(GPIOStatePublisher *&publisher, int &slot)
+{
+    {
+        lock_guard<mutex> lock(m_publish_lock);
+        publisher = m_publisher;
+        slot = m_publish_slot;
+        m_publish_seen = m_publish_generation;
+    }
+    m_publish_cond.notify_all();
+}
 
 /**
- * @brief Release the line_request and free all associated resources.
+ * @brief Hand a notification to whichever callbacks are set.
+ */
+void KernelGPIO::notify(const gpio_edge_summary_t &summary)
+{
+    gpio_callback_t callback = m_callback;
+    gpio_summary_callback_t summary_callback = m_summary_callback;
+
+    if ((callback != nullptr) || (summary_callback != nullptr))
+    {
+        uint64_t start = GPIOMetrics::now_ns();
+        if (callback != nullptr)
+        {
+            callback(summary.value);
+        }
+        if (summary_callback != nullptr)
+        {
+            summary_callback(summary);
+        }
+        m_metrics.record_callback(GPIOMetrics::now_ns() - start);
+    }
+}
+
+
+/**
+ * @brief Get our share of the chip and sanity check the line against it.
  *
- * If the class is not currently using a request, this call is a no-op.
- * Otherwise, this will free up the resources associated with the current
- * chip for immediate reuse.
+ * Common tail end of the constructors.  A failure leaves the chip closed.
+ *
+ * @param line The offset of the line on the chip named in chipname.
+ */
+void KernelGPIO::open_line(size_t line)
+{
+    // Open the chip...or rather, get our share of it from the registry.
+    m_chip = GPIOChip::open(chipname);
+    if (m_chip == nullptr)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "KernelGPIO", GPIO_ERR_NO_CHIP, 0, "Failed to open GPIO chip <%s>", chipname.c_str());
+    }
+    else if (line >= m_chip->get_num_lines())
+    {
+        // Do a small amount of sanity checking.  Range needs to be 0->chip's capacity
+        GPIO_DIAG(GPIO_LOG_ERROR, "KernelGPIO", GPIO_ERR_NO_LINE, 0, "Invalid line number specified.  Must be < %zu", m_chip->get_num_lines());
+        close_chip();
+    }
+    else
+    {
+        // Set up the request we'll be (re)configuring for the life of the object.
+        m_request.reset(new GPIOLineRequest(m_chip, { (unsigned int) line }, "KernelGPIO"));
+        m_metrics.set_name(m_chip->get_name() + ":" + std::to_string(line));
+    }
+}
+
+/**
+ * @brief Stop the edge event thread if it's running.
+ *
+ * Kicks the thread out of its wait so it notices, and waits for it to be
+ * done so it can be started again later.
+ */
+void KernelGPIO::stop_events()
+{
+    stop_loop();
+}
+
+/**
+ * @brief Release the line_request.
+ *
+ * If the class is not currently holding the line, this call is a no-op.
+ * Otherwise, this will free the line up for immediate reuse.  The cached
+ * settings and config are kept for the next configure().
  */
 void KernelGPIO::release_request()
 {
-    // Double free is not possible with the C API, but we don't need to 
-    // do things if it was already closed...       
+    stop_events();
     if (m_request != nullptr)
     {
-        gpiod_line_request_release(m_request);
-        // Not strictly needed, but we use nullptr as a barrier for not opened/closed...
-        m_request = nullptr;
+        m_request->release();
     }
 }
 
 /**
- * @brief Close the current chip and release all associated resources.
+ * @brief Let go of our share of the current chip.
  *
  * If the class is not currently using a chip, this call is a no-op.
- * Otherwise, this will free up the resources associated with the current
- * chip for immediate reuse.
+ * Otherwise, this drops our reference on the shared chip handle.  The
+ * chip is actually closed when the last user of it lets go.
  */
 void KernelGPIO::close_chip()
 {
-    // Double close is not possible with the C API, but we don't need to 
-    // do things if it was already closed...       
-    if (m_chip != nullptr)
-    {
-        gpiod_chip_close(m_chip);
-        // Not strictly needed, but we use nullptr as a barrier for not opened/closed...
-        m_chip = nullptr;
-    }
-}   
\ No newline at end of file
+    // Make sure nothing's still hanging off of the chip before we drop it.
+    release_request();
+    m_request.reset();
+    m_chip.reset();
+}
\ No newline at end of file
@@ -0,0 +1,477 @@
+
+#include <string>
+using std::string;
+
+#include <errno.h>
+
+#include "LibgpiodBackend.hpp"
+#include "GPIODiag.hpp"
+
+// The kernel caps a request at this many lines.
+static const size_t MAX_LINES = 64;
+
+// Size of the buffer we pull edge events through, per read.
+static const size_t EVENT_BATCH_SIZE = 64;
+
+/**
+ * @brief Open a chip through libgpiod.
+ *
+ * @param path Path to the chip's character device.
+ * @return The chip, or nullptr if it couldn't be opened.
+ */
+shared_ptr<LibgpiodChip> LibgpiodChip::open(const string &path)
+{
+    shared_ptr<LibgpiodChip> retVal;
+
+    struct gpiod_chip *chip = gpiod_chip_open(path.c_str());
+    if (chip != nullptr)
+    {
+        retVal = shared_ptr<LibgpiodChip>(new LibgpiodChip(chip));
+    }
+
+    return retVal;
+}
+
+/**
+ * Constructor for LibgpiodChip.  Pulls the chip info once and keeps it.
+ */
+LibgpiodChip::LibgpiodChip(struct gpiod_chip *chip) :
+    m_chip(chip), m_num_lines(0)
+{
+    struct gpiod_chip_info *info = gpiod_chip_get_info(m_chip);
+    if (info == nullptr)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "LibgpiodChip", GPIO_ERR_IO, errno, "Failed to get chip info");
+    }
+    else
+    {
+        m_name = gpiod_chip_info_get_name(info);
+        m_label = gpiod_chip_info_get_label(info);
+        m_num_lines = gpiod_chip_info_get_num_lines(info);
+
+        // Clean up after yourself
+        gpiod_chip_info_free(info);
+    }
+}
+
+/**
+ * Destructor for LibgpiodChip.  Closes the chip.
+ */
+LibgpiodChip::~LibgpiodChip()
+{
+    gpiod_chip_close(m_chip);
+}
+
+/**
+ * @brief Get a line's name.  One ioctl, so don't do this in a loop you care about.
+ */
+string LibgpiodChip::get_line_name(unsigned int offset)
+{
+    string retVal;
+
+    struct gpiod_line_info *info = gpiod_chip_get_line_info(m_chip, offset);
+    if (info != nullptr)
+    {
+        const char *name = gpiod_line_info_get_name(info);
+        if (name != nullptr)
+        {
+            retVal = name;
+        }
+
+        // Clean up after yourself
+        gpiod_line_info_free(info);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Get a line's info from the kernel.  One ioctl.
+ */
+bool LibgpiodChip::get_line_info(unsigned int offset, gpio_line_info_t &info)
+{
+    return take_line_info(gpiod_chip_get_line_info(m_chip, offset), info, true);
+}
+
+/**
+ * @brief Start watching a line's info for changes.
+ *
+ * @param info Filled in with the line's info as of now.
+ */
+bool LibgpiodChip::watch_line_info(unsigned int offset, gpio_line_info_t &info)
+{
+    return take_line_info(gpiod_chip_watch_line_info(m_chip, offset), info, true);
+}
+
+/**
+ * @brief Stop watching a line's info.
+ */
+bool LibgpiodChip::unwatch_line_info(unsigned int offset)
+{
+    return gpiod_chip_unwatch_line_info(m_chip, offset) == 0;
+}
+
+/**
+ * @brief The chip's fd- it's where info events show up.
+ */
+int LibgpiodChip::get_info_fd()
+{
+    return gpiod_chip_get_fd(m_chip);
+}
+
+/**
+ * @brief Read one info event, blocking if there isn't one pending.
+ */
+bool LibgpiodChip::read_info_event(gpio_info_event_t &event)
+{
+    bool retVal = false;
+
+    struct gpiod_info_event *raw = gpiod_chip_read_info_event(m_chip);
+    if (raw != nullptr)
+    {
+        event.type = gpiod_info_event_get_event_type(raw);
+        event.timestamp_ns = gpiod_info_event_get_timestamp_ns(raw);
+
+        // The event owns its line info, so that one isn't ours to free.
+        retVal = take_line_info(gpiod_info_event_get_line_info(raw), event.info, false);
+
+        // Clean up after yourself
+        gpiod_info_event_free(raw);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Copy libgpiod's line info into ours.
+ *
+ * @param raw The info, nullptr is a failure.
+ * @param free_it Free raw once it's copied.
+ */
+bool LibgpiodChip::take_line_info(struct gpiod_line_info *raw, gpio_line_info_t &info, bool free_it)
+{
+    bool retVal = false;
+
+    if (raw != nullptr)
+    {
+        const char *name = gpiod_line_info_get_name(raw);
+        const char *consumer = gpiod_line_info_get_consumer(raw);
+
+        info.offset = gpiod_line_info_get_offset(raw);
+        info.name = (name != nullptr) ? name : "";
+        info.consumer = (consumer != nullptr) ? consumer : "";
+        info.used = gpiod_line_info_is_used(raw);
+        info.direction = gpiod_line_info_get_direction(raw);
+        info.edge = gpiod_line_info_get_edge_detection(raw);
+        info.bias = gpiod_line_info_get_bias(raw);
+        info.active_low = gpiod_line_info_is_active_low(raw);
+
+        if (free_it)
+        {
+            gpiod_line_info_free(raw);
+        }
+        retVal = true;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Request lines from the chip.
+ *
+ * @return The request, or nullptr (errno set) on failure.
+ */
+unique_ptr<GPIORequestBackend> LibgpiodChip::request_lines(const vector<unsigned int> &offsets,
+                                                           const vector<gpio_line_settings_t> &settings,
+                                                           const string &consumer, size_t event_buffer_size)
+{
+    unique_ptr<LibgpiodRequest> request(new LibgpiodRequest(offsets));
+
+    if (!request->request(m_chip, settings, consumer, event_buffer_size))
+    {
+        request.reset();
+    }
+
+    return unique_ptr<GPIORequestBackend>(request.release());
+}
+
+/**
+ * Constructor for LibgpiodRequest.  Sets up the libgpiod objects we'll be
+ * reusing for the life of the request.
+ */
+LibgpiodRequest::LibgpiodRequest(const vector<unsigned int> &offsets) :
+    m_offsets(offsets), m_request(nullptr), m_line_settings(nullptr),
+    m_line_config(nullptr), m_event_buffer(nullptr)
+{
+    m_line_settings = gpiod_line_settings_new();
+    m_line_config = gpiod_line_config_new();
+}
+
+/**
+ * Destructor for LibgpiodRequest.  Releases the lines and frees everything
+ * we were caching.
+ */
+LibgpiodRequest::~LibgpiodRequest()
+{
+    // Clean up after yourself
+    if (m_request != nullptr)
+    {
+        gpiod_line_request_release(m_request);
+    }
+    if (m_event_buffer != nullptr)
+    {
+        gpiod_edge_event_buffer_free(m_event_buffer);
+    }
+    if (m_line_config != nullptr)
+    {
+        gpiod_line_config_free(m_line_config);
+    }
+    if (m_line_settings != nullptr)
+    {
+        gpiod_line_settings_free(m_line_settings);
+    }
+}
+
+/**
+ * @brief Request the lines from the kernel.
+ *
+ * @return true on success, false (errno set) on failure.
+ */
+bool LibgpiodRequest::request(struct gpiod_chip *chip, const vector<gpio_line_settings_t> &settings,
+                              const string &consumer, size_t event_buffer_size)
+{
+    bool retVal = false;
+
+    if (build_config(settings))
+    {
+        struct gpiod_request_config *req_cfg = gpiod_request_config_new();
+        if (req_cfg == nullptr)
+        {
+            errno = ENOMEM;
+        }
+        else
+        {
+            gpiod_request_config_set_consumer(req_cfg, consumer.c_str());
+            if (event_buffer_size > 0)
+            {
+                gpiod_request_config_set_event_buffer_size(req_cfg, event_buffer_size);
+            }
+
+            m_request = gpiod_chip_request_lines(chip, req_cfg, m_line_config);
+            retVal = (m_request != nullptr);
+
+            // Clean up after yourself- without losing the errno we care about.
+            int saved = errno;
+            gpiod_request_config_free(req_cfg);
+            errno = saved;
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Change the settings on the lines we hold, in place.
+ */
+bool LibgpiodRequest::reconfigure(const vector<gpio_line_settings_t> &settings)
+{
+    return build_config(settings) && (gpiod_line_request_reconfigure_lines(m_request, m_line_config) == 0);
+}
+
+/**
+ * @brief Get the logical value of one line.
+ */
+GPIOStatus LibgpiodRequest::read_value(unsigned int offset, bool &value)
+{
+    GPIOStatus retVal;
+
+    int ret = gpiod_line_request_get_value(m_request, offset);
+    if (ret < 0)
+    {
+        retVal = GPIOStatus(GPIO_ERR_IO, errno);
+    }
+    else
+    {
+        value = (ret == GPIOD_LINE_VALUE_ACTIVE);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Set the logical value of one line.
+ */
+GPIOStatus LibgpiodRequest::set_value(unsigned int offset, bool value)
+{
+    GPIOStatus retVal;
+
+    if (gpiod_line_request_set_value(m_request, offset, (value ? GPIOD_LINE_VALUE_ACTIVE : GPIOD_LINE_VALUE_INACTIVE)) < 0)
+    {
+        retVal = GPIOStatus(GPIO_ERR_IO, errno);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Read every line in the request with one call.
+ */
+GPIOStatus LibgpiodRequest::get_values(uint64_t &values)
+{
+    GPIOStatus retVal;
+    enum gpiod_line_value raw[MAX_LINES];
+
+    if (gpiod_line_request_get_values(m_request, raw) < 0)
+    {
+        retVal = GPIOStatus(GPIO_ERR_IO, errno);
+    }
+    else
+    {
+        values = 0;
+        for (size_t i = 0; i < m_offsets.size(); i++)
+        {
+            if (raw[i] == GPIOD_LINE_VALUE_ACTIVE)
+            {
+                values |= (1ULL << i);
+            }
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Set any subset of the lines in the request with one call.
+ */
+GPIOStatus LibgpiodRequest::set_values(uint64_t mask, uint64_t values)
+{
+    GPIOStatus retVal;
+    unsigned int offsets[MAX_LINES];
+    enum gpiod_line_value raw[MAX_LINES];
+    size_t count = 0;
+
+    for (size_t i = 0; i < m_offsets.size(); i++)
+    {
+        if (mask & (1ULL << i))
+        {
+            offsets[count] = m_offsets[i];
+            raw[count] = (values & (1ULL << i)) ? GPIOD_LINE_VALUE_ACTIVE : GPIOD_LINE_VALUE_INACTIVE;
+            count++;
+        }
+    }
+
+    // Nothing asked for is nothing to do- and no syscall.
+    if ((count > 0) && (gpiod_line_request_set_values_subset(m_request, count, offsets, raw) < 0))
+    {
+        retVal = GPIOStatus(GPIO_ERR_IO, errno);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief The request's fd for use with poll()/epoll.
+ */
+int LibgpiodRequest::get_fd()
+{
+    return gpiod_line_request_get_fd(m_request);
+}
+
+/**
+ * @brief Wait for edge events.
+ *
+ * @return 1 if events are pending, 0 on timeout, -1 on error.
+ */
+int LibgpiodRequest::wait_edge_events(int64_t timeout_ns)
+{
+    return gpiod_line_request_wait_edge_events(m_request, timeout_ns);
+}
+
+/**
+ * @brief Read a batch of pending edge events.
+ *
+ * @return The number of events read, -1 on error.
+ */
+int LibgpiodRequest::read_edge_events(gpio_edge_event_t *events, size_t max_events)
+{
+    int retVal = -1;
+
+    if (m_event_buffer == nullptr)
+    {
+        m_event_buffer = gpiod_edge_event_buffer_new(EVENT_BATCH_SIZE);
+    }
+
+    if (m_event_buffer != nullptr)
+    {
+        if (max_events > EVENT_BATCH_SIZE)
+        {
+            max_events = EVENT_BATCH_SIZE;
+        }
+
+        retVal = gpiod_line_request_read_edge_events(m_request, m_event_buffer, max_events);
+        for (int i = 0; i < retVal; i++)
+        {
+            struct gpiod_edge_event *ev = gpiod_edge_event_buffer_get_event(m_event_buffer, i);
+            events[i].timestamp_ns = gpiod_edge_event_get_timestamp_ns(ev);
+            events[i].offset = gpiod_edge_event_get_line_offset(ev);
+            events[i].rising = (gpiod_edge_event_get_event_type(ev) == GPIOD_EDGE_EVENT_RISING_EDGE);
+            events[i].global_seqno = gpiod_edge_event_get_global_seqno(ev);
+            events[i].line_seqno = gpiod_edge_event_get_line_seqno(ev);
+        }
+    }
+    else
+    {
+        errno = ENOMEM;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Rebuild the cached line config from the settings.
+ *
+ * Reuses the same settings and config objects every time instead of
+ * allocating new ones.
+ *
+ * @return true on success, false on failure.
+ */
+bool LibgpiodRequest::build_config(const vector<gpio_line_settings_t> &settings)
+{
+    bool retVal = false;
+
+    if ((m_line_settings == nullptr) || (m_line_config == nullptr))
+    {
+        errno = ENOMEM;
+    }
+    else
+    {
+        retVal = true;
+        gpiod_line_config_reset(m_line_config);
+        for (size_t i = 0; (i < m_offsets.size()) && retVal; i++)
+        {
+            const gpio_line_settings_t &line = settings[i];
+
+            gpiod_line_settings_reset(m_line_settings);
+            gpiod_line_settings_set_direction(m_line_settings, line.direction);
+            gpiod_line_settings_set_bias(m_line_settings, line.bias);
+            gpiod_line_settings_set_active_low(m_line_settings, line.active_low);
+            if (line.direction == GPIOD_LINE_DIRECTION_OUTPUT)
+            {
+                gpiod_line_settings_set_drive(m_line_settings, line.drive);
+                gpiod_line_settings_set_output_value(m_line_settings, (line.value ? GPIOD_LINE_VALUE_ACTIVE : GPIOD_LINE_VALUE_INACTIVE));
+            }
+            else
+            {
+                gpiod_line_settings_set_edge_detection(m_line_settings, line.edge);
+                gpiod_line_settings_set_debounce_period_us(m_line_settings, line.debounce_us);
+            }
+
+            if (gpiod_line_config_add_line_settings(m_line_config, &m_offsets[i], 1, m_line_settings) < 0)
+            {
+                retVal = false;
+            }
+        }
+    }
+
+    return retVal;
+}
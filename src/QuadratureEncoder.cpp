@@ -0,0 +1,226 @@
+
+#include <string>
+using std::string;
+
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+#include "QuadratureEncoder.hpp"
+#include "GPIODiag.hpp"
+#include "GPIOMetrics.hpp"
+
+// The kernel's ceiling on a request's event buffer, and our read batch size.
+static const size_t KERNEL_EVENT_BUFFER = 1024;
+static const size_t EVENT_BATCH_SIZE = 64;
+
+// Default velocity window, and the shortest we'll wake up for.
+static const uint64_t DEFAULT_WINDOW_NS = 100000000;
+static const uint64_t MIN_WINDOW_NS = 1000000;
+
+// Marks a transition where both lines changed at once.
+static const int8_t ILLEGAL = 2;
+
+// Position change for each (previous state << 2 | new state), states being
+// (A << 1) | B.  Forward is 00 -> 01 -> 11 -> 10 -> 00.
+static const int8_t QUADRATURE_TABLE[16] =
+{
+    //  to:  00       01       10       11
+            0,      +1,      -1,      ILLEGAL,      // from 00
+           -1,       0,      ILLEGAL, +1,           // from 01
+           +1,      ILLEGAL,  0,      -1,           // from 10
+            ILLEGAL, -1,     +1,       0            // from 11
+};
+
+/**
+ * Constructor for QuadratureEncoder.  Requests A, B and (optionally) the
+ * index line together with both edges detected, picks up where the lines
+ * currently stand, and starts decoding.
+ *
+ * @param chipname The chip the lines are on.
+ * @param line_a, line_b The quadrature lines.
+ * @param line_index The index line, or NO_INDEX.
+ * @param debounce_us Kernel debounce period for the lines, 0 for none.
+ * @param bias Pull-up/down to apply to the lines.
+ */
+QuadratureEncoder::QuadratureEncoder(const string &chipname, unsigned int line_a, unsigned int line_b,
+                                     unsigned int line_index, unsigned long debounce_us,
+                                     enum gpiod_line_bias bias) :
+    LoopThread("QuadEncoder"),
+    m_a_mask(0), m_b_mask(0), m_index_mask(0), m_state(0), m_last_seqno(0),
+    m_position(0), m_velocity(0.0), m_window_ns(DEFAULT_WINDOW_NS), m_index_reset(false),
+    m_index_count(0), m_illegal(0), m_lost(0)
+{
+    shared_ptr<GPIOChip> chip = GPIOChip::open(chipname);
+    if (chip == nullptr)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "QuadratureEncoder", GPIO_ERR_NO_CHIP, 0, "Failed to open GPIO chip <%s>", chipname.c_str());
+    }
+    else
+    {
+        vector<unsigned int> offsets = { line_a, line_b };
+        if (line_index != NO_INDEX)
+        {
+            offsets.push_back(line_index);
+        }
+
+        gpio_line_settings_t settings;
+        settings.edge = GPIOD_LINE_EDGE_BOTH;
+        settings.bias = bias;
+        settings.debounce_us = debounce_us;
+
+        m_request.reset(new GPIOLineRequest(chip, offsets, "QuadratureEncoder"));
+        m_request->set_settings(settings);
+        m_request->set_event_buffer_size(KERNEL_EVENT_BUFFER);
+        m_a_mask = m_request->get_mask(line_a);
+        m_b_mask = m_request->get_mask(line_b);
+        if (line_index != NO_INDEX)
+        {
+            m_index_mask = m_request->get_mask(line_index);
+        }
+
+        uint64_t values = 0;
+        if (!m_request->request())
+        {
+            GPIO_DIAG(GPIO_LOG_ERROR, "QuadratureEncoder", GPIO_ERR_IO, 0, "Failed to request lines");
+        }
+        else if (!m_request->get_values(values))
+        {
+            GPIO_DIAG(GPIO_LOG_ERROR, "QuadratureEncoder", GPIO_ERR_IO, 0, "Failed to read initial state");
+        }
+        else
+        {
+            m_state = ((values & m_a_mask) ? 0x02 : 0x00) | ((values & m_b_mask) ? 0x01 : 0x00);
+            start();
+        }
+    }
+}
+
+/**
+ * Destructor for QuadratureEncoder.  Stops decoding and releases the lines.
+ */
+QuadratureEncoder::~QuadratureEncoder()
+{
+    stop_loop();
+}
+
+/**
+ * @brief Set the window velocity is measured over.
+ *
+ * The loop wakes up at least once a window, so a zero (or tiny) window
+ * would have it spinning.  Anything under MIN_WINDOW_NS gets MIN_WINDOW_NS.
+ *
+ * @param window_ns The window, in ns.
+ */
+void QuadratureEncoder::set_velocity_window_ns(uint64_t window_ns)
+{
+    m_window_ns = (window_ns < MIN_WINDOW_NS) ? MIN_WINDOW_NS : window_ns;
+}
+
+/**
+ * @brief The decoding loop.
+ *
+ * Each batch of events is decoded into a local count and folded into the
+ * position with one atomic add.  We also wake at least once per velocity
+ * window so velocity falls to zero when the encoder stops.
+ */
+void QuadratureEncoder::run()
+{
+    ThreadPolicy::Binding policy(*this);
+    gpio_edge_event_t events[EVENT_BATCH_SIZE];
+    struct pollfd fds[2];
+    uint64_t window_start = GPIOMetrics::now_ns();
+    int64_t window_counts = 0;
+
+    fds[0].fd = m_request->get_fd();
+    fds[0].events = POLLIN;
+    fds[1].fd = m_wake.get_fd();
+    fds[1].events = POLLIN;
+
+    while (_run)
+    {
+        uint64_t window = m_window_ns;
+        uint64_t now = GPIOMetrics::now_ns();
+        uint64_t wait = ((window_start + window) > now) ? (window_start + window - now) : 0;
+        struct timespec timeout;
+
+        timeout.tv_sec = wait / 1000000000ULL;
+        timeout.tv_nsec = wait % 1000000000ULL;
+        if (ppoll(fds, 2, &timeout, NULL) < 0)
+        {
+            if (errno != EINTR)
+            {
+                GPIO_DIAG(GPIO_LOG_ERROR, "QuadratureEncoder", GPIO_ERR_IO, errno, "Failed to wait for events");
+            }
+            continue;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            m_wake.clear();
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            int count = m_request->read_edge_events(events, EVENT_BATCH_SIZE);
+            int64_t delta = 0;
+
+            for (int i = 0; i < count; i++)
+            {
+                const gpio_edge_event_t &event = events[i];
+                uint64_t mask = 1ULL << event.index;
+
+                if ((m_last_seqno != 0) && (event.global_seqno > (m_last_seqno + 1)))
+                {
+                    m_lost += event.global_seqno - m_last_seqno - 1;
+                }
+                m_last_seqno = event.global_seqno;
+
+                if (mask == m_index_mask)
+                {
+                    if (event.rising)
+                    {
+                        m_index_count++;
+                        if (m_index_reset)
+                        {
+                            // Everything before the index is history.
+                            m_position.store(0, std::memory_order_relaxed);
+                            delta = 0;
+                        }
+                    }
+                    continue;
+                }
+
+                unsigned int bit = (mask == m_a_mask) ? 0x02 : 0x01;
+                unsigned int next = event.rising ? (m_state | bit) : (m_state & ~bit);
+                int8_t step = QUADRATURE_TABLE[(m_state << 2) | next];
+
+                if ((step == ILLEGAL) || (next == m_state))
+                {
+                    // Either both lines moved or a line "moved" to where it
+                    // already was.  We missed something- don't guess.
+                    m_illegal++;
+                }
+                else
+                {
+                    delta += step;
+                }
+                m_state = next;
+            }
+
+            if (delta != 0)
+            {
+                m_position.fetch_add(delta, std::memory_order_relaxed);
+                window_counts += delta;
+            }
+        }
+
+        now = GPIOMetrics::now_ns();
+        if ((now - window_start) >= window)
+        {
+            m_velocity.store((double) window_counts * 1000000000.0 / (now - window_start), std::memory_order_relaxed);
+            window_counts = 0;
+            window_start = now;
+        }
+    }
+}
@@ -0,0 +1,343 @@
+
+#include <string>
+using std::string;
+
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+#include "ReflexEngine.hpp"
+#include "GPIODiag.hpp"
+#include "GPIOMetrics.hpp"
+
+// How many events we pull per read.
+static const size_t EVENT_BATCH_SIZE = 64;
+
+/**
+ * Constructor for ReflexEngine.  Requests the inputs with both edges
+ * detected and starts the event thread.  No rules, no reflexes- add some.
+ *
+ * @param chipname The chip the inputs are on.
+ * @param inputs The lines the rules trigger on.
+ * @param outputs The (caller owned) request holding the lines the rules drive.
+ */
+ReflexEngine::ReflexEngine(const string &chipname, const vector<unsigned int> &inputs, GPIOLineRequest *outputs) :
+    LoopThread("ReflexEngine"),
+    m_outputs(outputs), m_next_id(0)
+{
+    reset_stats();
+
+    shared_ptr<GPIOChip> chip = GPIOChip::open(chipname);
+    if (chip == nullptr)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "ReflexEngine", GPIO_ERR_NO_CHIP, 0, "Failed to open GPIO chip <%s>", chipname.c_str());
+    }
+    else if ((m_outputs == nullptr) || !m_outputs->is_requested())
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "ReflexEngine", GPIO_ERR_NOT_REQUESTED, 0, "No output request to drive");
+    }
+    else
+    {
+        gpio_line_settings_t settings;
+        settings.edge = GPIOD_LINE_EDGE_BOTH;
+
+        m_request.reset(new GPIOLineRequest(chip, inputs, "ReflexEngine"));
+        m_request->set_settings(settings);
+        if (!m_request->request())
+        {
+            GPIO_DIAG(GPIO_LOG_ERROR, "ReflexEngine", GPIO_ERR_IO, 0, "Failed to request lines");
+        }
+        else
+        {
+            start();
+        }
+    }
+}
+
+/**
+ * Destructor for ReflexEngine.  Stops the event thread and releases the
+ * inputs.  The outputs are left where the rules last put them.
+ */
+ReflexEngine::~ReflexEngine()
+{
+    stop_loop();
+}
+
+/**
+ * @brief Add a rule.
+ *
+ * @return The rule's id, or -1 if the input isn't one of ours or the rule
+ *         doesn't drive anything.
+ */
+int ReflexEngine::add_rule(const reflex_rule_t &rule)
+{
+    int retVal = -1;
+    int index = (m_request != nullptr) ? m_request->get_index(rule.input) : -1;
+
+    if (index < 0)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "ReflexEngine", GPIO_ERR_NO_LINE, 0, "Line %u is not one of our inputs", rule.input);
+    }
+    else if (rule.mask == 0)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "ReflexEngine", GPIO_ERR_INVALID, 0, "Rule doesn't drive any outputs");
+    }
+    else
+    {
+        lock_guard<mutex> lock(m_lock);
+
+        retVal = m_next_id++;
+        m_rules.push_back({ retVal, rule, index, 0 });
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Remove a rule.  Delayed actions it already queued still happen.
+ *
+ * @return false if there's no such rule.
+ */
+bool ReflexEngine::remove_rule(int id)
+{
+    bool retVal = false;
+    lock_guard<mutex> lock(m_lock);
+
+    for (auto it = m_rules.begin(); it != m_rules.end(); it++)
+    {
+        if (it->id == id)
+        {
+            m_rules.erase(it);
+            retVal = true;
+            break;
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Drop every delayed action that hasn't happened yet.
+ */
+void ReflexEngine::cancel_pending()
+{
+    lock_guard<mutex> lock(m_lock);
+    m_delayed = priority_queue<delayed_t, vector<delayed_t>, delayed_later_t>();
+}
+
+/**
+ * @brief Get the counters and latency histograms.
+ */
+reflex_stats_t ReflexEngine::get_stats()
+{
+    reflex_stats_t retVal;
+
+    {
+        lock_guard<mutex> lock(m_lock);
+        retVal.triggers = m_triggers;
+        retVal.held_off = m_held_off;
+        retVal.writes = m_writes;
+        retVal.write_errors = m_write_errors;
+        retVal.lost = m_lost;
+    }
+    m_latency.snapshot(retVal.latency_ns);
+    m_late.snapshot(retVal.late_ns);
+
+    return retVal;
+}
+
+/**
+ * @brief Zero the counters and latency histograms.
+ */
+void ReflexEngine::reset_stats()
+{
+    {
+        lock_guard<mutex> lock(m_lock);
+        m_triggers = 0;
+        m_held_off = 0;
+        m_writes = 0;
+        m_write_errors = 0;
+        m_lost = 0;
+    }
+    m_latency.reset();
+    m_late.reset();
+}
+
+/**
+ * @brief The event loop.
+ *
+ * Each pass reads a batch of input events, runs them past the rules and
+ * collects every undelayed action plus any delayed ones that have come due
+ * into one set of output values, then writes them with one bulk set.  The
+ * outputs' state is shadowed here so toggles don't cost a read.
+ */
+void ReflexEngine::run()
+{
+    ThreadPolicy::Binding policy(*this);
+    gpio_edge_event_t events[EVENT_BATCH_SIZE];
+    vector<unsigned long> last_seqno(m_request->get_num_lines(), 0);
+    vector<uint64_t> fired;             // Edge timestamps of this pass's undelayed firings
+    vector<uint64_t> due;               // Due times of this pass's delayed actions
+    uint64_t current = 0;
+    struct pollfd fds[2];
+
+    fired.reserve(EVENT_BATCH_SIZE);
+    due.reserve(EVENT_BATCH_SIZE);
+
+    if (!m_outputs->get_values(current))
+    {
+        GPIO_DIAG(GPIO_LOG_WARNING, "ReflexEngine", GPIO_ERR_IO, errno, "Couldn't read the outputs, assuming all inactive");
+    }
+
+    fds[0].fd = m_request->get_fd();
+    fds[0].events = POLLIN;
+    fds[1].fd = m_wake.get_fd();
+    fds[1].events = POLLIN;
+
+    while (_run)
+    {
+        struct timespec timeout;
+        struct timespec *wait = NULL;
+        int count = 0;
+
+        // Sleep until the next delayed action, if there is one.
+        {
+            lock_guard<mutex> lock(m_lock);
+            if (!m_delayed.empty())
+            {
+                uint64_t now = GPIOMetrics::now_ns();
+                uint64_t left = (m_delayed.top().due_ns > now) ? (m_delayed.top().due_ns - now) : 0;
+                timeout.tv_sec = left / 1000000000ULL;
+                timeout.tv_nsec = left % 1000000000ULL;
+                wait = &timeout;
+            }
+        }
+
+        if (ppoll(fds, 2, wait, NULL) < 0)
+        {
+            if (errno != EINTR)
+            {
+                GPIO_DIAG(GPIO_LOG_ERROR, "ReflexEngine", GPIO_ERR_IO, errno, "Failed to wait for events");
+            }
+            continue;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            m_wake.clear();
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            count = m_request->read_edge_events(events, EVENT_BATCH_SIZE);
+        }
+
+        lock_guard<mutex> lock(m_lock);
+        uint64_t next = current;
+        uint64_t touched = 0;
+
+        fired.clear();
+        due.clear();
+
+        // Run the events past the rules...
+        for (int i = 0; i < count; i++)
+        {
+            const gpio_edge_event_t &event = events[i];
+
+            if ((last_seqno[event.index] != 0) && (event.line_seqno > (last_seqno[event.index] + 1)))
+            {
+                m_lost += event.line_seqno - last_seqno[event.index] - 1;
+            }
+            last_seqno[event.index] = event.line_seqno;
+
+            for (auto &entry : m_rules)
+            {
+                const reflex_rule_t &rule = entry.rule;
+
+                if ((entry.input_index != (int) event.index) ||
+                    ((rule.edge == GPIOD_LINE_EDGE_RISING) && !event.rising) ||
+                    ((rule.edge == GPIOD_LINE_EDGE_FALLING) && event.rising) ||
+                    (rule.edge == GPIOD_LINE_EDGE_NONE))
+                {
+                    continue;
+                }
+
+                if (event.timestamp_ns < entry.holdoff_until)
+                {
+                    m_held_off++;
+                    continue;
+                }
+
+                m_triggers++;
+                entry.holdoff_until = event.timestamp_ns + rule.holdoff_ns;
+                if (rule.delay_ns == 0)
+                {
+                    apply(rule.action, rule.mask, next);
+                    touched |= rule.mask;
+                    fired.push_back(event.timestamp_ns);
+                }
+                else
+                {
+                    m_delayed.push({ event.timestamp_ns + rule.delay_ns, rule.action, rule.mask });
+                }
+            }
+        }
+
+        // ...pick up whatever delayed actions are due...
+        uint64_t now = GPIOMetrics::now_ns();
+        while (!m_delayed.empty() && (m_delayed.top().due_ns <= now))
+        {
+            const delayed_t &action = m_delayed.top();
+
+            apply(action.action, action.mask, next);
+            touched |= action.mask;
+            due.push_back(action.due_ns);
+            m_delayed.pop();
+        }
+
+        // ...and do it all with one write.
+        if (touched != 0)
+        {
+            if (!m_outputs->set_values(touched, next))
+            {
+                m_write_errors++;
+            }
+            else
+            {
+                uint64_t done = GPIOMetrics::now_ns();
+
+                m_writes++;
+                current = (current & ~touched) | (next & touched);
+                for (auto timestamp : fired)
+                {
+                    m_latency.record(done - timestamp);
+                }
+                for (auto due_ns : due)
+                {
+                    m_late.record(done - due_ns);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Apply one action to a set of output values.
+ */
+void ReflexEngine::apply(reflex_action_t action, uint64_t mask, uint64_t &values)
+{
+    switch (action)
+    {
+        case REFLEX_SET:
+            values |= mask;
+            break;
+
+        case REFLEX_CLEAR:
+            values &= ~mask;
+            break;
+
+        case REFLEX_TOGGLE:
+            values ^= mask;
+            break;
+    }
+}
@@ -0,0 +1,677 @@
+
+#include <string>
+using std::string;
+
+#include <algorithm>
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+
+#include "SimGPIOChip.hpp"
+#include "GPIOChip.hpp"
+#include "GPIODiag.hpp"
+#include "GPIOMetrics.hpp"
+
+const char *SimGPIOChip::PREFIX = "sim:";
+
+mutex SimGPIOChip::s_lock;
+map<string, shared_ptr<SimGPIOChip>> SimGPIOChip::s_chips;
+
+// The kernel's default event buffer is this many events per line.
+static const size_t DEFAULT_EVENTS_PER_LINE = 16;
+
+// The kernel's info event buffer, per chip.  Events past this are dropped.
+static const size_t INFO_EVENT_BUFFER = 32;
+
+/**
+ * @brief Make a simulated chip.
+ *
+ * The first call also registers the "sim:" backend with GPIOChip, so the
+ * chip can be opened by path from then on.
+ *
+ * @param path Where the chip lives- has to start with PREFIX.
+ * @param num_lines How many lines the chip has.
+ * @param label The chip's label.
+ * @return The chip, nullptr if the path's bad.
+ */
+shared_ptr<SimGPIOChip> SimGPIOChip::create(const string &path, size_t num_lines, const string &label)
+{
+    static std::once_flag registered;
+    shared_ptr<SimGPIOChip> retVal;
+
+    // Registered outside of s_lock- GPIOChip::open() holds its own lock
+    // while it calls find(), so we can't be holding ours while we take its.
+    std::call_once(registered, []()
+    {
+        GPIOChip::register_backend(PREFIX, [](const string &chip_path) -> shared_ptr<GPIOChipBackend>
+        {
+            return SimGPIOChip::find(chip_path);
+        });
+    });
+
+    if (path.compare(0, strlen(PREFIX), PREFIX) != 0)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "SimGPIOChip", GPIO_ERR_INVALID, 0, "Chip path <%s> doesn't start with %s", path.c_str(), PREFIX);
+    }
+    else
+    {
+        lock_guard<mutex> lock(s_lock);
+
+        auto it = s_chips.find(path);
+        if (it != s_chips.end())
+        {
+            retVal = it->second;
+        }
+        else
+        {
+            retVal = shared_ptr<SimGPIOChip>(new SimGPIOChip(path, num_lines, label));
+            s_chips[path] = retVal;
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Find a simulated chip by path.  nullptr (errno ENOENT) if there isn't one.
+ */
+shared_ptr<SimGPIOChip> SimGPIOChip::find(const string &path)
+{
+    shared_ptr<SimGPIOChip> retVal;
+    lock_guard<mutex> lock(s_lock);
+
+    auto it = s_chips.find(path);
+    if (it != s_chips.end())
+    {
+        retVal = it->second;
+    }
+    else
+    {
+        errno = ENOENT;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Forget a simulated chip.  Anybody who already has it open keeps it.
+ */
+void SimGPIOChip::remove(const string &path)
+{
+    lock_guard<mutex> lock(s_lock);
+    s_chips.erase(path);
+}
+
+/**
+ * Constructor for SimGPIOChip.  Only reachable through create().  The name
+ * is the path without the prefix.
+ */
+SimGPIOChip::SimGPIOChip(const string &path, size_t num_lines, const string &label) :
+    m_name(path.substr(strlen(PREFIX))), m_label(label), m_lines(num_lines)
+{
+}
+
+/**
+ * @brief Get a line's name, empty if it doesn't have one.
+ */
+string SimGPIOChip::get_line_name(unsigned int offset)
+{
+    string retVal;
+    lock_guard<mutex> lock(m_lock);
+
+    if (offset < m_lines.size())
+    {
+        retVal = m_lines[offset].name;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Name a line.
+ */
+void SimGPIOChip::set_line_name(unsigned int offset, const string &name)
+{
+    lock_guard<mutex> lock(m_lock);
+
+    if (offset < m_lines.size())
+    {
+        m_lines[offset].name = name;
+    }
+}
+
+/**
+ * @brief Take lines on the chip.
+ *
+ * @return The request, nullptr with errno EINVAL for a bad line or EBUSY if
+ *         somebody else already holds one of them.
+ */
+unique_ptr<GPIORequestBackend> SimGPIOChip::request_lines(const vector<unsigned int> &offsets,
+                                                          const vector<gpio_line_settings_t> &settings,
+                                                          const string &consumer, size_t event_buffer_size)
+{
+    unique_ptr<GPIORequestBackend> retVal;
+    lock_guard<mutex> lock(m_lock);
+
+    int error = 0;
+    for (size_t i = 0; (i < offsets.size()) && (error == 0); i++)
+    {
+        if (offsets[i] >= m_lines.size())
+        {
+            error = EINVAL;
+        }
+        else if (m_lines[offsets[i]].owner != nullptr)
+        {
+            error = EBUSY;
+        }
+    }
+
+    if (error != 0)
+    {
+        errno = error;
+    }
+    else
+    {
+        SimGPIORequest *request = new SimGPIORequest(shared_from_this(), offsets, settings, event_buffer_size);
+        for (size_t i = 0; i < offsets.size(); i++)
+        {
+            m_lines[offsets[i]].owner = request;
+            m_lines[offsets[i]].index = i;
+            m_lines[offsets[i]].consumer = consumer;
+        }
+        request->apply_settings(settings);
+        retVal.reset(request);
+
+        for (auto offset : offsets)
+        {
+            info_event(offset, GPIOD_INFO_EVENT_LINE_REQUESTED);
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Get a line's info.
+ */
+bool SimGPIOChip::get_line_info(unsigned int offset, gpio_line_info_t &info)
+{
+    bool retVal = false;
+    lock_guard<mutex> lock(m_lock);
+
+    if (offset < m_lines.size())
+    {
+        fill_line_info(offset, info);
+        retVal = true;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Start watching a line's info for changes.
+ *
+ * @param info Filled in with the line's info as of now.
+ */
+bool SimGPIOChip::watch_line_info(unsigned int offset, gpio_line_info_t &info)
+{
+    bool retVal = false;
+    lock_guard<mutex> lock(m_lock);
+
+    if (offset >= m_lines.size())
+    {
+        errno = EINVAL;
+    }
+    else if (m_lines[offset].watched)
+    {
+        // Same as the kernel- one watch per line per chip fd.
+        errno = EBUSY;
+    }
+    else
+    {
+        m_lines[offset].watched = true;
+        fill_line_info(offset, info);
+        retVal = true;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Stop watching a line's info.
+ */
+bool SimGPIOChip::unwatch_line_info(unsigned int offset)
+{
+    bool retVal = false;
+    lock_guard<mutex> lock(m_lock);
+
+    if ((offset < m_lines.size()) && m_lines[offset].watched)
+    {
+        m_lines[offset].watched = false;
+        retVal = true;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Read one info event, blocking if there isn't one pending.
+ */
+bool SimGPIOChip::read_info_event(gpio_info_event_t &event)
+{
+    bool retVal = false;
+    bool done = false;
+
+    while (!done)
+    {
+        {
+            lock_guard<mutex> lock(m_lock);
+
+            if (!m_info_events.empty())
+            {
+                event = m_info_events.front();
+                m_info_events.pop_front();
+                if (m_info_events.empty())
+                {
+                    m_info_pending.clear();
+                }
+
+                retVal = true;
+                done = true;
+            }
+        }
+
+        if (!done)
+        {
+            struct pollfd fd = { m_info_pending.get_fd(), POLLIN, 0 };
+            if ((poll(&fd, 1, -1) < 0) && (errno != EINTR))
+            {
+                done = true;
+            }
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Drive an input line.
+ *
+ * @param level The physical level.
+ * @return false if the line's bad or is an output somebody holds.
+ */
+bool SimGPIOChip::set_input(unsigned int offset, bool level)
+{
+    bool retVal = false;
+    lock_guard<mutex> lock(m_lock);
+
+    if (offset < m_lines.size())
+    {
+        sim_line_t &line = m_lines[offset];
+        if ((line.owner == nullptr) || (line.owner->m_settings[line.index].direction != GPIOD_LINE_DIRECTION_OUTPUT))
+        {
+            if (line.level != level)
+            {
+                line.level = level;
+                deliver_edge(offset, GPIOMetrics::now_ns());
+            }
+            retVal = true;
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Toggle an input line as fast as possible.
+ *
+ * The toggles all happen right now, but their event timestamps are spaced
+ * period_ns apart as if they'd come in over time.  This is the way to push
+ * a consumer harder than any real line would.
+ *
+ * @return The number of edges injected, 0 if the line's bad or an output.
+ */
+size_t SimGPIOChip::inject_burst(unsigned int offset, size_t edges, uint64_t period_ns)
+{
+    size_t retVal = 0;
+    lock_guard<mutex> lock(m_lock);
+
+    if (offset < m_lines.size())
+    {
+        sim_line_t &line = m_lines[offset];
+        if ((line.owner == nullptr) || (line.owner->m_settings[line.index].direction != GPIOD_LINE_DIRECTION_OUTPUT))
+        {
+            uint64_t start = GPIOMetrics::now_ns();
+            for (retVal = 0; retVal < edges; retVal++)
+            {
+                line.level = !line.level;
+                deliver_edge(offset, start + (retVal * period_ns));
+            }
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief The physical level of a line.
+ *
+ * @return 1 or 0, -1 if the line's bad.
+ */
+int SimGPIOChip::get_output(unsigned int offset)
+{
+    int retVal = -1;
+    lock_guard<mutex> lock(m_lock);
+
+    if (offset < m_lines.size())
+    {
+        retVal = m_lines[offset].level ? 1 : 0;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Hand an edge to whoever holds the line.  Caller holds m_lock.
+ */
+void SimGPIOChip::deliver_edge(unsigned int offset, uint64_t timestamp_ns)
+{
+    sim_line_t &line = m_lines[offset];
+
+    if (line.owner != nullptr)
+    {
+        line.owner->edge_event(line.index, line.level, timestamp_ns);
+    }
+}
+
+/**
+ * @brief Fill in a line's info as of now.  Caller holds m_lock.
+ */
+void SimGPIOChip::fill_line_info(unsigned int offset, gpio_line_info_t &info)
+{
+    const sim_line_t &line = m_lines[offset];
+
+    info = gpio_line_info_t();
+    info.offset = offset;
+    info.name = line.name;
+    info.consumer = line.consumer;
+    info.used = (line.owner != nullptr);
+    if (line.owner != nullptr)
+    {
+        const gpio_line_settings_t &settings = line.owner->m_settings[line.index];
+        info.direction = settings.direction;
+        info.edge = settings.edge;
+        info.bias = settings.bias;
+        info.active_low = settings.active_low;
+    }
+}
+
+/**
+ * @brief Queue an info event if the line's watched.  Caller holds m_lock.
+ */
+void SimGPIOChip::info_event(unsigned int offset, enum gpiod_info_event_type type)
+{
+    if (m_lines[offset].watched && (m_info_events.size() < INFO_EVENT_BUFFER))
+    {
+        gpio_info_event_t event;
+        event.type = type;
+        event.timestamp_ns = GPIOMetrics::now_ns();
+        fill_line_info(offset, event.info);
+
+        m_info_events.push_back(event);
+        m_info_pending.signal();
+    }
+}
+
+/**
+ * Constructor for SimGPIORequest.  Only reachable through
+ * SimGPIOChip::request_lines(), which holds the chip lock.
+ */
+SimGPIORequest::SimGPIORequest(shared_ptr<SimGPIOChip> chip, const vector<unsigned int> &offsets,
+                               const vector<gpio_line_settings_t> &settings, size_t event_buffer_size) :
+    m_chip(chip), m_offsets(offsets), m_settings(settings),
+    m_capacity((event_buffer_size > 0) ? event_buffer_size : (DEFAULT_EVENTS_PER_LINE * offsets.size())),
+    m_global_seqno(0), m_line_seqno(offsets.size(), 0)
+{
+}
+
+/**
+ * Destructor for SimGPIORequest.  Hands the lines back to the chip.
+ */
+SimGPIORequest::~SimGPIORequest()
+{
+    lock_guard<mutex> lock(m_chip->m_lock);
+
+    for (auto offset : m_offsets)
+    {
+        m_chip->m_lines[offset].owner = nullptr;
+        m_chip->m_lines[offset].consumer.clear();
+        m_chip->info_event(offset, GPIOD_INFO_EVENT_LINE_RELEASED);
+    }
+}
+
+/**
+ * @brief Change the settings on the held lines.  Can't fail on a sim.
+ */
+bool SimGPIORequest::reconfigure(const vector<gpio_line_settings_t> &settings)
+{
+    lock_guard<mutex> lock(m_chip->m_lock);
+
+    apply_settings(settings);
+    for (auto offset : m_offsets)
+    {
+        m_chip->info_event(offset, GPIOD_INFO_EVENT_LINE_CONFIG_CHANGED);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Get the logical value of one line.
+ */
+GPIOStatus SimGPIORequest::read_value(unsigned int offset, bool &value)
+{
+    GPIOStatus retVal;
+    lock_guard<mutex> lock(m_chip->m_lock);
+
+    if ((offset >= m_chip->m_lines.size()) || (m_chip->m_lines[offset].owner != this))
+    {
+        retVal = GPIOStatus(GPIO_ERR_NO_LINE, EINVAL);
+    }
+    else
+    {
+        const SimGPIOChip::sim_line_t &line = m_chip->m_lines[offset];
+        value = line.level ^ m_settings[line.index].active_low;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Set the logical value of one line.  Inputs can't be set.
+ */
+GPIOStatus SimGPIORequest::set_value(unsigned int offset, bool value)
+{
+    GPIOStatus retVal;
+    lock_guard<mutex> lock(m_chip->m_lock);
+
+    if ((offset >= m_chip->m_lines.size()) || (m_chip->m_lines[offset].owner != this))
+    {
+        retVal = GPIOStatus(GPIO_ERR_NO_LINE, EINVAL);
+    }
+    else
+    {
+        SimGPIOChip::sim_line_t &line = m_chip->m_lines[offset];
+        if (m_settings[line.index].direction != GPIOD_LINE_DIRECTION_OUTPUT)
+        {
+            retVal = GPIOStatus(GPIO_ERR_DIRECTION, EPERM);
+        }
+        else
+        {
+            line.level = value ^ m_settings[line.index].active_low;
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Read every line in the request.
+ */
+GPIOStatus SimGPIORequest::get_values(uint64_t &values)
+{
+    lock_guard<mutex> lock(m_chip->m_lock);
+
+    values = 0;
+    for (size_t i = 0; i < m_offsets.size(); i++)
+    {
+        if (m_chip->m_lines[m_offsets[i]].level ^ m_settings[i].active_low)
+        {
+            values |= (1ULL << i);
+        }
+    }
+
+    return GPIOStatus();
+}
+
+/**
+ * @brief Set any subset of the lines in the request.  All or nothing, like
+ *        the kernel- if any of them is an input, none of them are set.
+ */
+GPIOStatus SimGPIORequest::set_values(uint64_t mask, uint64_t values)
+{
+    GPIOStatus retVal;
+    lock_guard<mutex> lock(m_chip->m_lock);
+
+    for (size_t i = 0; (i < m_offsets.size()) && retVal; i++)
+    {
+        if ((mask & (1ULL << i)) && (m_settings[i].direction != GPIOD_LINE_DIRECTION_OUTPUT))
+        {
+            retVal = GPIOStatus(GPIO_ERR_DIRECTION, EPERM);
+        }
+    }
+
+    for (size_t i = 0; (i < m_offsets.size()) && retVal; i++)
+    {
+        if (mask & (1ULL << i))
+        {
+            m_chip->m_lines[m_offsets[i]].level = ((values >> i) & 1) ^ m_settings[i].active_low;
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Wait for edge events.
+ *
+ * @param timeout_ns How long to wait, negative waits forever.
+ * @return 1 if events are pending, 0 on timeout, -1 on error.
+ */
+int SimGPIORequest::wait_edge_events(int64_t timeout_ns)
+{
+    struct pollfd fd = { m_pending.get_fd(), POLLIN, 0 };
+    struct timespec timeout;
+
+    timeout.tv_sec = timeout_ns / 1000000000LL;
+    timeout.tv_nsec = timeout_ns % 1000000000LL;
+
+    int retVal = ppoll(&fd, 1, (timeout_ns < 0) ? NULL : &timeout, NULL);
+
+    return (retVal > 0) ? 1 : retVal;
+}
+
+/**
+ * @brief Read a batch of pending edge events, blocking if there aren't any.
+ *
+ * @return The number of events read, -1 on error.
+ */
+int SimGPIORequest::read_edge_events(gpio_edge_event_t *events, size_t max_events)
+{
+    int retVal = -1;
+    bool done = false;
+
+    while (!done)
+    {
+        {
+            lock_guard<mutex> lock(m_chip->m_lock);
+
+            if (!m_events.empty())
+            {
+                size_t count = std::min(max_events, m_events.size());
+                std::copy(m_events.begin(), m_events.begin() + count, events);
+                m_events.erase(m_events.begin(), m_events.begin() + count);
+
+                // Only quiet the fd once everything's been read.
+                if (m_events.empty())
+                {
+                    m_pending.clear();
+                }
+
+                retVal = count;
+                done = true;
+            }
+        }
+
+        if (!done && (wait_edge_events(-1) < 0) && (errno != EINTR))
+        {
+            done = true;
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Take on new settings.  Outputs are driven to their value right
+ *        away, as the kernel does.  Caller holds the chip lock.
+ */
+void SimGPIORequest::apply_settings(const vector<gpio_line_settings_t> &settings)
+{
+    m_settings = settings;
+    m_settings.resize(m_offsets.size());
+
+    for (size_t i = 0; i < m_offsets.size(); i++)
+    {
+        if (m_settings[i].direction == GPIOD_LINE_DIRECTION_OUTPUT)
+        {
+            m_chip->m_lines[m_offsets[i]].level = m_settings[i].value ^ m_settings[i].active_low;
+        }
+    }
+}
+
+/**
+ * @brief Queue an edge event if the line's watching for it.
+ *
+ * A full buffer drops the oldest event.  The seqnos count every edge, so the
+ * reader sees the drop as a gap.  Caller holds the chip lock.
+ */
+void SimGPIORequest::edge_event(unsigned int index, bool level, uint64_t timestamp_ns)
+{
+    const gpio_line_settings_t &settings = m_settings[index];
+    bool rising = level ^ settings.active_low;
+
+    if ((settings.direction == GPIOD_LINE_DIRECTION_INPUT) &&
+        ((settings.edge == GPIOD_LINE_EDGE_BOTH) ||
+         ((settings.edge == GPIOD_LINE_EDGE_RISING) && rising) ||
+         ((settings.edge == GPIOD_LINE_EDGE_FALLING) && !rising)))
+    {
+        gpio_edge_event_t event;
+        event.timestamp_ns = timestamp_ns;
+        event.offset = m_offsets[index];
+        event.index = index;
+        event.rising = rising;
+        event.global_seqno = ++m_global_seqno;
+        event.line_seqno = ++m_line_seqno[index];
+
+        if (m_events.size() >= m_capacity)
+        {
+            m_events.pop_front();
+        }
+        m_events.push_back(event);
+
+        m_pending.signal();
+    }
+}
@@ -40,6 +40,8 @@
  */
 
 #include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
 #include <string.h>
 #include <sys/fcntl.h>
 #include <sys/poll.h>
@@ -49,17 +51,426 @@
 #include <iostream>
 #include <fstream>
 #include <stdexcept>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
 #include <string>
 using std::string;
 
+#include <Runable.hpp>
 #include <SysFSGPIO.hpp>
+#include <WakeupFD.hpp>
 
 
 const std::string SysFSGPIO::_sysfsPath("/sys/class/gpio/");
 
 const ssize_t MAX_BUF = 2;
 
+// What gets written to (and read back from) a value file.
+static const char LEVEL_CHARS[] = { '0', '1' };
+
+// Room for "/sys/class/gpio/gpioNNNNN/active_low" and then some.
+static const size_t PATH_BUF = 64;
+
+
+/**
+ * Format the path to a GPIO's sysfs directory into @a path.  The attributes
+ * are then just a strcpy() onto the end of it.
+ *
+ * @return The length of the directory path- where the attribute goes.
+ */
+static size_t formatGPIOPath(char *path, const string &sysfsPath, uint16_t id)
+{
+	return snprintf(path, PATH_BUF, "%sgpio%u", sysfsPath.c_str(), (unsigned int) id);
+}
+
+/**
+ * Write @a value to a sysfs attribute, unless that's what it already reads.
+ * Sysfs hands the value back with a trailing newline, which we ignore.
+ *
+ * @return false if the attribute couldn't be opened or written.
+ */
+static bool writeAttribute(const char *path, const char *value, SysFSBringUpTiming &timing)
+{
+	bool retVal = false;
+	int fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd >= 0)
+	{
+		char current[16];
+		size_t len = strlen(value);
+		ssize_t nbytes = pread(fd, current, sizeof(current), 0);
+		if ((nbytes > (ssize_t) len) && (current[len] == '\n') && (memcmp(current, value, len) == 0))
+		{
+			timing.skipped++;
+			retVal = true;
+		}
+		else if (pwrite(fd, value, len, 0) == (ssize_t) len)
+		{
+			timing.writes++;
+			retVal = true;
+		}
+		close(fd);
+	}
+
+	return retVal;
+}
+
+
+/*
+    The one thread that polls every callback-enabled SysFSGPIO's value file.
+    Pins add themselves when they're set up and take themselves out when
+    they're torn down- the thread comes up with the first of them and goes
+    away with the last.  The wakeup fd gets the thread's attention when the
+    set of pins changes or it's time to stop.
+
+    Callbacks are free to tear pins down, their own included.  A pin taken
+    out mid-round is skipped for the rest of it.  If it was the last one, the
+    thread can't be joined from inside one of its own callbacks- it's stopped
+    and set aside, and the next add() or remove() (or exit) joins it once
+    it's finished the round.
+*/
+class SysFSDispatcher : public Runable, public ThreadPolicy
+{
+public:
+	static void add(SysFSGPIO *gpio)
+	{
+		reap();
+
+		std::lock_guard<std::mutex> lock(_lock);
+		if (_instance == NULL)
+		{
+			_instance = new SysFSDispatcher();
+			if (_hasPolicy)
+			{
+				_instance->set_thread_policy(_policy);
+			}
+			_instance->start();
+		}
+		_instance->_pins.push_back(gpio);
+		_instance->_dirty = true;
+		_instance->_wake.signal();
+	}
+
+	// Once this returns, the pin's callback isn't running and won't be called again.
+	static void remove(SysFSGPIO *gpio)
+	{
+		SysFSDispatcher *retired = NULL;
+		std::unique_lock<std::mutex> lock(_lock);
+		SysFSDispatcher *dispatcher = _instance;
+		if (dispatcher != NULL)
+		{
+			bool onThread = (std::this_thread::get_id() == dispatcher->_threadId);
+
+			for (auto it = dispatcher->_pins.begin(); it != dispatcher->_pins.end(); it++)
+			{
+				if (*it == gpio)
+				{
+					dispatcher->_pins.erase(it);
+					break;
+				}
+			}
+			for (auto &pin : dispatcher->_ready)
+			{
+				if (pin == gpio)
+				{
+					pin = NULL;
+				}
+			}
+			if (onThread && (gpio == dispatcher->_current))
+			{
+				dispatcher->_currentRemoved = true;
+			}
+			dispatcher->_dirty = true;
+			dispatcher->_wake.signal();
+
+			// Callbacks run outside the lock, so wait out any that are going-
+			// unless it's the dispatcher itself tearing a pin down from one.
+			if (!onThread)
+			{
+				dispatcher->_waiting++;
+				dispatcher->_idle.wait(lock, [dispatcher] { return !dispatcher->_dispatching; });
+				dispatcher->_waiting--;
+			}
+
+			// Last one out (with nobody else still waiting on this round) shuts it down...
+			if ((dispatcher == _instance) && dispatcher->_pins.empty() && (dispatcher->_waiting == 0))
+			{
+				_instance = NULL;
+				dispatcher->stop();
+				dispatcher->_wake.signal();
+				if (onThread)
+				{
+					// ...which, from one of its own callbacks, means somebody else joins it later.
+					_retired.push_back(dispatcher);
+				}
+				else
+				{
+					retired = dispatcher;
+				}
+			}
+		}
+		lock.unlock();
+
+		if (retired != NULL)
+		{
+			retired->join();
+			delete retired;
+		}
+		reap();
+	}
+
+	// Join and free the dispatchers that were shut down from their own
+	// callbacks and have since run out.  Ones still finishing their last
+	// round are left for next time.
+	static void reap(void)
+	{
+		std::vector<SysFSDispatcher *> finished;
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			for (auto it = _retired.begin(); it != _retired.end(); )
+			{
+				if ((*it)->_finished)
+				{
+					finished.push_back(*it);
+					it = _retired.erase(it);
+				}
+				else
+				{
+					it++;
+				}
+			}
+		}
+
+		for (auto dispatcher : finished)
+		{
+			dispatcher->join();
+			delete dispatcher;
+		}
+	}
+
+	// The policy for the dispatcher thread, whether or not it's running right now.
+	static void setPolicy(const thread_policy_t *policy)
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		_hasPolicy = (policy != NULL);
+		if (_hasPolicy)
+		{
+			_policy = *policy;
+		}
+		if (_instance != NULL)
+		{
+			if (_hasPolicy)
+			{
+				_instance->set_thread_policy(_policy);
+			}
+			else
+			{
+				_instance->clear_thread_policy();
+			}
+		}
+	}
+
+	static thread_policy_status_t getPolicyStatus(void)
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		thread_policy_status_t retVal;
+		if (_instance != NULL)
+		{
+			retVal = _instance->get_thread_policy_status();
+		}
+		return retVal;
+	}
+
+protected:
+	void run(void)
+	{
+		{
+			ThreadPolicy::Binding policy(*this);
+			dispatchLoop();
+		}
+
+		// Nothing left but returning, so whoever reaps us won't be kept waiting.
+		std::lock_guard<std::mutex> lock(_lock);
+		_finished = true;
+	}
+
+private:
+	static std::mutex					_lock;			// Guards the instance and everything in it
+	static SysFSDispatcher *			_instance;
+	static bool							_hasPolicy;		// Has one been set for the thread?
+	static thread_policy_t				_policy;
+	static std::vector<SysFSDispatcher *>	_retired;		// Shut down from their own callbacks, not joined yet
+
+	std::condition_variable				_idle;			// Signalled when a round of callbacks is done
+	std::vector<SysFSGPIO *>			_pins;
+	std::vector<SysFSGPIO *>			_ready;			// This round's pins, NULLed out as they're removed
+	SysFSGPIO *							_current;		// Whose callback is running
+	bool								_currentRemoved;	// ...and whether it was torn down from it
+	bool								_dirty;			// The pins changed since the poll set was built
+	bool								_dispatching;	// Callbacks are running outside the lock
+	bool								_finished;		// run() is done
+	int									_waiting;		// Removers waiting on this round
+	std::thread::id						_threadId;
+	WakeupFD							_wake;
+
+	SysFSDispatcher() :
+		ThreadPolicy("SysFSDispatch"),
+		_current(NULL),
+		_currentRemoved(false),
+		_dirty(true),
+		_dispatching(false),
+		_finished(false),
+		_waiting(0)
+	{
+	}
+
+	~SysFSDispatcher()
+	{
+		if (NULL != _thread)
+		{
+			delete _thread;
+			_thread = NULL;
+		}
+	}
+
+	void dispatchLoop(void)
+	{
+		std::vector<struct pollfd> fdset;
+		std::vector<SysFSGPIO *> pins;
+
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			_threadId = std::this_thread::get_id();
+		}
+
+		while (_run)
+		{
+			// Pick up any change in who we're watching...
+			{
+				std::lock_guard<std::mutex> lock(_lock);
+				if (_dirty)
+				{
+					pins = _pins;
+					fdset.resize(pins.size() + 1);
+					fdset[0].fd = _wake.get_fd();
+					fdset[0].events = POLLIN;
+					for (size_t i = 0; i < pins.size(); i++)
+					{
+						fdset[i + 1].fd = pins[i]->_fd;
+						fdset[i + 1].events = POLLPRI;
+					}
+					_dirty = false;
+				}
+			}
+
+			int pollRet = poll(fdset.data(), fdset.size(), -1);
+			uint64_t timestamp = GPIOMetrics::now_ns();
+			if (pollRet <= 0)
+			{
+				continue;
+			}
+
+			if (fdset[0].revents & POLLIN)
+			{
+				_wake.clear();
+			}
+
+			// Anybody that's been taken out since we polled is skipped- their
+			// edge (if any) goes with them.
+			{
+				std::lock_guard<std::mutex> lock(_lock);
+				if (!_dirty)
+				{
+					for (size_t i = 0; i < pins.size(); i++)
+					{
+						if (fdset[i + 1].revents & (POLLPRI | POLLERR))
+						{
+							_ready.push_back(pins[i]);
+						}
+					}
+				}
+				_dispatching = !_ready.empty();
+			}
+
+			// The list is re-checked for each pin, since a callback can take
+			// out the ones after it.
+			for (size_t i = 0; ; i++)
+			{
+				SysFSGPIO *gpio;
+				{
+					std::lock_guard<std::mutex> lock(_lock);
+					if (i >= _ready.size())
+					{
+						break;
+					}
+					gpio = _ready[i];
+					_current = gpio;
+					_currentRemoved = false;
+				}
+
+				if (gpio != NULL)
+				{
+					gpio->dispatch(timestamp, _currentRemoved);
+				}
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(_lock);
+				_ready.clear();
+				_current = NULL;
+				if (_dispatching)
+				{
+					_dispatching = false;
+					_idle.notify_all();
+				}
+			}
+		}
+	}
+};
+
+std::mutex SysFSDispatcher::_lock;
+SysFSDispatcher *SysFSDispatcher::_instance = NULL;
+bool SysFSDispatcher::_hasPolicy = false;
+thread_policy_t SysFSDispatcher::_policy;
+std::vector<SysFSDispatcher *> SysFSDispatcher::_retired;
+
+// Whatever's still waiting on a join when we're going away.
+static struct SysFSDispatcherReaper
+{
+	~SysFSDispatcherReaper() { SysFSDispatcher::reap(); }
+} _dispatcherReaper;
+
+
+/**
+ * Set the scheduling policy of the thread every edge callback runs on.  It's
+ * applied to the thread now if it's running, and whenever it's started again.
+ *
+ * @param policy The policy to use.
+ */
+void SysFSGPIO::setDispatcherPolicy(const thread_policy_t &policy)
+{
+	SysFSDispatcher::setPolicy(&policy);
+}
+
+/**
+ * Put the callback thread back on the ThreadPolicy global default.
+ */
+void SysFSGPIO::clearDispatcherPolicy(void)
+{
+	SysFSDispatcher::setPolicy(NULL);
+}
+
+/**
+ * What took when the policy was applied to the callback thread.  Reads as
+ * unbound if there are no callback pins (and so no thread) right now.
+ */
+thread_policy_status_t SysFSGPIO::getDispatcherPolicyStatus(void)
+{
+	return SysFSDispatcher::getPolicyStatus();
+}
+
 
 /**
  * Default constructor for the SysFSGPIO class.
@@ -80,10 +491,13 @@ SysFSGPIO::SysFSGPIO() :
 		_id_str(""),
 		_direction(Direction::NO_DIR),
 		_edge(Edge::NONE),
+		_dispatched(false),
 		_fd(-1),
+		_valueFd(-1),
 		_data(NULL),
 		_activeLow(false),
-		_doTeardown(true)
+		_doTeardown(true),
+		_metrics("sysfs")
 {
 }
 
@@ -105,21 +519,50 @@ SysFSGPIO::SysFSGPIO(uint16_t id, Direction direction, bool useActiveLow) :
 		_id_str(std::to_string(id)),
 		_direction(direction),
 		_edge(Edge::NONE),
+		_dispatched(false),
 		_fd(-1),
+		_valueFd(-1),
 		_data(NULL),
 		_activeLow(useActiveLow),
-		_doTeardown(true)
+		_doTeardown(true),
+		_metrics("sysfs:" + std::to_string(id))
 {
 	// Simple.  Export out the GPIO with the specified direction...  There's few cleanups to be done...
 	exportGPIO();
 }
 
+/**
+ * Constructor for exportAll(), which has already exported the GPIO and
+ * configures it itself afterwards.
+ *
+ * @param id The GPIO ID to use.
+ * @param direction The direction of the GPIO.  May be either IN or OUT.
+ * @param useActiveLow Set to true if the pin should be treated as an active-low
+ *                     logic level.
+ * @param doTeardown Set to true if we exported it, and so unexport it when we go.
+ */
+SysFSGPIO::SysFSGPIO(uint16_t id, Direction direction, bool useActiveLow, bool doTeardown) :
+		_id(id),
+		_id_str(std::to_string(id)),
+		_direction(direction),
+		_edge(Edge::NONE),
+		_dispatched(false),
+		_fd(-1),
+		_valueFd(-1),
+		_data(NULL),
+		_activeLow(useActiveLow),
+		_doTeardown(doTeardown),
+		_metrics("sysfs:" + std::to_string(id))
+{
+}
+
 /**
  * Constructor that sets up a SysFSGPIO object with a specific ID, edge detection,
  * and a callback function. This constructor initializes a SysFSGPIO object with
  * the specified @a id, @a edge, @a callback, and @a data. The GPIO is configured
  * for input with the specified edge detection behavior and optionally set to
- * active-low logic level. It also starts a thread to handle edge-triggered events.
+ * active-low logic level. Edges are picked up by the poll loop shared by every
+ * callback-enabled SysFSGPIO, rather than a thread of our own.
  *
  * @param id The GPIO ID to use.
  * @param edge The edge type for triggering callbacks. Must not be Edge::NONE.
@@ -136,11 +579,58 @@ SysFSGPIO::SysFSGPIO(uint16_t id, Edge edge, CallbackFunction callback, void *da
 		_id_str(std::to_string(id)),
 		_direction(Direction::IN),
 		_edge(edge),
-		_fd(-1),
 		_callback(callback),
+		_dispatched(false),
+		_fd(-1),
+		_valueFd(-1),
+		_data(data),
+		_activeLow(useActiveLow),
+		_doTeardown(true),
+		_metrics("sysfs:" + std::to_string(id))
+{
+	setupCallback();
+}
+
+/**
+ * Constructor that sets up a SysFSGPIO object with a specific ID, edge detection,
+ * and a callback function that's also handed the time the edge was picked up
+ * (CLOCK_MONOTONIC, ns).  Otherwise the same as the plain callback version.
+ *
+ * @param id The GPIO ID to use.
+ * @param edge The edge type for triggering callbacks. Must not be Edge::NONE.
+ * @param callback The function to call when an edge is detected.
+ * @param data User-defined data to be passed to the callback function.
+ * @param useActiveLow Set to true if the pin should be treated as an active-low
+ *                     logic level.
+ * @throws std::runtime_error If no edge is specified, if setting the edge behavior
+ *         fails, or if the GPIO value file cannot be opened.
+ */
+SysFSGPIO::SysFSGPIO(uint16_t id, Edge edge, TimestampedCallbackFunction callback, void *data, bool useActiveLow) :
+		_id(id),
+		_id_str(std::to_string(id)),
+		_direction(Direction::IN),
+		_edge(edge),
+		_timestampedCallback(callback),
+		_dispatched(false),
+		_fd(-1),
+		_valueFd(-1),
 		_data(data),
 		_activeLow(useActiveLow),
-		_doTeardown(true)
+		_doTeardown(true),
+		_metrics("sysfs:" + std::to_string(id))
+{
+	setupCallback();
+}
+
+/**
+ * @brief Set up edge detection and the poll FD, then register with the dispatcher
+ *
+ * Common tail end of the callback constructors.
+ *
+ * @throws std::runtime_error If no edge is specified, if setting the edge behavior
+ *         fails, or if the GPIO value file cannot be opened.
+ */
+void SysFSGPIO::setupCallback(void)
 {
 	char buf[MAX_BUF];
 
@@ -203,8 +693,9 @@ SysFSGPIO::SysFSGPIO(uint16_t id, Edge edge, CallbackFunction callback, void *da
 		}
 	}
 
-	// Now that we have GPIO-age...start the thread!
-	start();
+	// Now that we have GPIO-age...hand ourselves to the shared poll loop!
+	_dispatched = true;
+	SysFSDispatcher::add(this);
 }
 
 /*************  ✨ Codeium Command ⭐  *************/
@@ -219,12 +710,11 @@ SysFSGPIO::SysFSGPIO(uint16_t id, Edge edge, CallbackFunction callback, void *da
 /******  26733cba-4843-4557-86c7-8994b2c3f179  *******/
 SysFSGPIO::~SysFSGPIO()
 {
-	if (isRunning())
+	if (_dispatched)
 	{
-		// If we're running stop, join, clear our thread...
-		stop();
-		join();
-		if (NULL != _thread) delete _thread;
+		// Out of the poll loop before the FD it's watching goes away...
+		SysFSDispatcher::remove(this);
+		_dispatched = false;
 	}
 
 	if (_fd > -1)
@@ -233,6 +723,11 @@ SysFSGPIO::~SysFSGPIO()
 		close(_fd);
 	}
 
+	if (_valueFd > -1)
+	{
+		close(_valueFd);
+	}
+
 	// Have a GPIO we've exported...unexport...
 	unexportGPIO();
 }
@@ -249,8 +744,11 @@ SysFSGPIO::~SysFSGPIO()
  */
 void SysFSGPIO::exportGPIO(void)
 {
+	struct stat st;
+	char path[PATH_BUF];
+
 	// We're going to check for the presence of /sys/class/gpio...
-    if( !PathExists(_sysfsPath) )
+    if( stat(_sysfsPath.c_str(), &st) != 0 )
     {
        throw std::runtime_error(_sysfsPath + " does not exist.");
     }
@@ -259,7 +757,8 @@ void SysFSGPIO::exportGPIO(void)
     // set it the specified way, but if it was lit...leave it be.
     // (This may be "wrong" but it lets us do things like LEDs, etc.
     // with multiple "controllers" and do them "right" all the same...)
-	if (PathExists(_sysfsPath + "gpio" + _id_str))
+	formatGPIOPath(path, _sysfsPath, _id);
+	if (stat(path, &st) == 0)
 	{
 	    // It exists before any other steps, so skip the start-up steps
 	    // and move to the config and declare it not needing to be torn down.
@@ -271,70 +770,234 @@ void SysFSGPIO::exportGPIO(void)
         // indicating that we couldn't get the GPIO generated- and we CAN ask that question
         // quicker than trying to guess whether we have a valid GPIO ID in hand....
         // attempt to export
-		std::ofstream sysfs_export(_sysfsPath + "export", std::ofstream::app);
-		if( !sysfs_export.is_open() )
+		int fd = open((_sysfsPath + "export").c_str(), O_WRONLY | O_CLOEXEC);
+		if( fd < 0 )
 		{
 			throw std::runtime_error("Unable to export GPIO " + _id_str);
 		}
-		sysfs_export << _id_str;
-		sysfs_export.close();
+		ssize_t nbytes = write(fd, _id_str.c_str(), _id_str.size());
+		close(fd);
 
 		// Now, double-check it got MADE...
-		if (!PathExists(_sysfsPath + "gpio" + _id_str))
+		if ((nbytes != (ssize_t) _id_str.size()) || (stat(path, &st) != 0))
 		{
 			throw std::runtime_error("Unable to export GPIO(2) " + _id_str);
 		}
 	}
 
+    // Initially set the value to low on the line to start inbound or to clear the value on
+    // outbound...set it "off"...
+	SysFSBringUpTiming timing;
+	memset(&timing, 0, sizeof(timing));
+	configure(Value::LOW, timing);
+}
+
+/**
+    * @brief Set the GPIO's direction, active_low and initial value
+    *
+    * Each attribute is read first and only written if it's not already what
+    * we want- rewriting "out" to an output's direction drops it low, for
+    * one, and every write is a trip through the GPIO driver.  The value file
+    * is opened for good along the way.  Inputs don't take a value, so theirs
+    * is left alone.
+    *
+    * @param initial The value for an output, INVALID to leave it be
+    * @param timing Tallies of the writes made and skipped
+    *
+    * @throw std::runtime_error if an attribute can't be set
+    */
+void SysFSGPIO::configure(Value initial, SysFSBringUpTiming &timing)
+{
+	char path[PATH_BUF];
+	size_t base = formatGPIOPath(path, _sysfsPath, _id);
+
     //attempt to set direction
-    {
-		std::ofstream sysfs_direction(_sysfsPath + "gpio" + _id_str + "/direction", std::ofstream::app);
-		if( !sysfs_direction.is_open() )
+	if (_direction != Direction::NO_DIR)
+	{
+		strcpy(path + base, "/direction");
+		if (!writeAttribute(path, (_direction == Direction::OUT) ? "out" : "in", timing))
 		{
 			throw std::runtime_error("Unable to set direction for GPIO " + _id_str);
 		}
-		switch(_direction)
+	}
+
+    // Attempt to set active low - Some things we want signal high to be "off" (Like LEDs)
+	strcpy(path + base, "/active_low");
+	if (!writeAttribute(path, _activeLow ? "1" : "0", timing))
+	{
+		throw std::runtime_error("Unable to set active_low for GPIO " + _id_str);
+	}
+
+	// (This is also where the value file gets opened for good...)
+	strcpy(path + base, "/value");
+	openValue(path);
+	if ((_direction == Direction::OUT) && ((initial == Value::LOW) || (initial == Value::HIGH)))
+	{
+		char current;
+		if ((pread(_valueFd, &current, 1, 0) == 1) && (current == LEVEL_CHARS[initial]))
 		{
-		case Direction::IN :
-			sysfs_direction << "in";
-			break;
+			timing.skipped++;
+		}
+		else if (pwrite(_valueFd, &LEVEL_CHARS[initial], 1, 0) == 1)
+		{
+			timing.writes++;
+		}
+		else
+		{
+			throw std::runtime_error("Unable to initialize value for GPIO " + _id_str);
+		}
+	}
+}
 
-		case Direction::OUT :
-			sysfs_direction << "out";
-			break;
+/**
+    * @brief Open the GPIO's value file for get/set
+    *
+    * Opened once here and kept, so a get or set is a single pread()/pwrite()
+    * against it instead of an open/read-or-write/close (and the string
+    * building for the path) every time.  Falls back to read-only if the
+    * kernel won't let us write it (an input, typically).
+    *
+    * @param path The value file's path
+    *
+    * @throw std::runtime_error if the value file can't be opened at all
+    */
+void SysFSGPIO::openValue(const char *path)
+{
+	if (_valueFd < 0)
+	{
+		_valueFd = open(path, O_RDWR | O_CLOEXEC);
+		if (_valueFd < 0)
+		{
+			_valueFd = open(path, O_RDONLY | O_CLOEXEC);
 		}
-		sysfs_direction.close();
-    }
+		if (_valueFd < 0)
+		{
+			throw std::runtime_error("Unable to open value for GPIO " + _id_str);
+		}
+	}
+}
 
-    // Attempt to set active low - Some things we want signal high to be "off" (Like LEDs)
-    {
-       std::ofstream sysfs_activelow(_sysfsPath + "gpio" + _id_str + "/active_low", std::ofstream::app);
-       if( !sysfs_activelow.is_open() )
-       {
-          throw std::runtime_error("Unable to set active_low for GPIO " + _id_str);
-       }
-       if (_activeLow)
-       {
-    	   sysfs_activelow << "1";
-       }
-       else
-       {
-    	   sysfs_activelow << "0";
-       }
-       sysfs_activelow.close();
-    }
+/**
+    * @brief Export and configure a set of GPIOs
+    *
+    * The batch version of the direction constructor, for bringing up a board's
+    * worth of pins at once.  Everything's exported first, through the one
+    * export FD, then configured- with the paths formatted into a buffer
+    * rather than built up as strings, and only the attributes that aren't
+    * already right written.  Pins that were exported before we got here
+    * are left exported when their objects go, same as the constructor.
+    *
+    * @param pins The pins and their settings
+    * @param timing If not NULL, how long each phase took and what it wrote
+    *
+    * @return The pins, in the order given
+    *
+    * @throw std::runtime_error if a pin can't be exported or configured.  The
+    *        pins brought up before it are torn back down.
+    */
+vector<unique_ptr<SysFSGPIO>> SysFSGPIO::exportAll(const vector<SysFSPinConfig> &pins, SysFSBringUpTiming *timing)
+{
+	vector<unique_ptr<SysFSGPIO>> retVal;
+	SysFSBringUpTiming stats;
+	struct stat st;
+	char path[PATH_BUF];
+	int exportFd = -1;
+	int unowned = -1;
+	uint64_t start = GPIOMetrics::now_ns();
 
-    // Initially set the value to low on the line to start inbound or to clear the value on
-    // outbound...set it "off"...
+	memset(&stats, 0, sizeof(stats));
+	stats.pins = pins.size();
+	retVal.reserve(pins.size());
+
+	if (stat(_sysfsPath.c_str(), &st) != 0)
+	{
+		throw std::runtime_error(_sysfsPath + " does not exist.");
+	}
+
+	// Export whatever isn't already...
+	try
 	{
-		std::ofstream sysfs_value(_sysfsPath + "gpio" + _id_str + "/value", std::ofstream::app);
-		if( !sysfs_value.is_open() )
+		for (auto &pin : pins)
 		{
-			throw std::runtime_error("Unable to initialize value for GPIO " + _id_str);
+			bool exported = false;
+
+			formatGPIOPath(path, _sysfsPath, pin.id);
+			if (stat(path, &st) != 0)
+			{
+				if (exportFd < 0)
+				{
+					exportFd = open((_sysfsPath + "export").c_str(), O_WRONLY | O_CLOEXEC);
+				}
+
+				char id[8];
+				int len = snprintf(id, sizeof(id), "%u", (unsigned int) pin.id);
+				if ((exportFd < 0) || (write(exportFd, id, len) != len))
+				{
+					throw std::runtime_error("Unable to export GPIO " + std::to_string(pin.id));
+				}
+
+				// Ours to take back down until a SysFSGPIO owns it.
+				unowned = pin.id;
+				if (stat(path, &st) != 0)
+				{
+					throw std::runtime_error("Unable to export GPIO " + std::to_string(pin.id));
+				}
+				exported = true;
+				stats.exported++;
+			}
+
+			retVal.emplace_back(new SysFSGPIO(pin.id, pin.direction, pin.activeLow, exported));
+			unowned = -1;
+		}
+	}
+	catch (...)
+	{
+		if (exportFd >= 0)
+		{
+			close(exportFd);
 		}
-		sysfs_value << "0";
-		sysfs_value.close();
+
+		// Everything in retVal unexports itself on the way out- the pin we
+		// were in the middle of doesn't have anyone to do that for it.
+		if (unowned >= 0)
+		{
+			int unexportFd = open((_sysfsPath + "unexport").c_str(), O_WRONLY | O_CLOEXEC);
+			if (unexportFd >= 0)
+			{
+				char id[8];
+				int len = snprintf(id, sizeof(id), "%d", unowned);
+				if (write(unexportFd, id, len) != len)
+				{
+					perror("SysFSGPIO::exportAll()");
+				}
+				close(unexportFd);
+			}
+		}
+		throw;
+	}
+
+	if (exportFd >= 0)
+	{
+		close(exportFd);
+	}
+
+	// ...and then set them all up.
+	uint64_t configStart = GPIOMetrics::now_ns();
+	stats.exportNs = configStart - start;
+	for (size_t i = 0; i < pins.size(); i++)
+	{
+		retVal[i]->configure(pins[i].value, stats);
+	}
+
+	uint64_t end = GPIOMetrics::now_ns();
+	stats.configNs = end - configStart;
+	stats.totalNs = end - start;
+	if (timing != NULL)
+	{
+		*timing = stats;
 	}
+
+	return retVal;
 }
 
 
@@ -377,18 +1040,14 @@ Value SysFSGPIO::getValue(void)
 	// to READ and for Callbacks.  If so, you're not supposed to read the GPIO line via
 	// getValue() (It's handed to you in the callback...)
 	Value retVal = Value::INVALID;
+	uint64_t start = GPIOMetrics::start_timer();
 	if ((_edge == Edge::NONE) && (_direction != Direction::NO_DIR))
 	{
 		// Edge has to be NONE if it's a valid mode for us...
-		std::ifstream sysfs_value(_sysfsPath + "gpio" + _id_str + "/value");
-		if( !sysfs_value.is_open() )
-		{
-			throw std::runtime_error("Unable to get value for GPIO " + _id_str);
-		}
-
-		char value = sysfs_value.get();
-		if( !sysfs_value.good() )
+		char value;
+		if (pread(_valueFd, &value, 1, 0) != 1)
 		{
+			_metrics.record_get(start, false);
 			throw std::runtime_error("Unable to get value for GPIO " + _id_str);
 		}
 
@@ -408,6 +1067,7 @@ Value SysFSGPIO::getValue(void)
 		}
 	}
 
+	_metrics.record_get(start, (retVal != Value::INVALID));
 	return retVal;
 }
 
@@ -431,6 +1091,7 @@ Value SysFSGPIO::setValue(Value value)
 	// getValue() (It's handed to you in the callback...) or set the value...  We return
 	// what we attempted to set if it's good...
 	Value retVal = Value::INVALID;
+	uint64_t start = GPIOMetrics::start_timer();
 
 	if ((_edge == Edge::NONE) && (_direction != Direction::NO_DIR))
 	{
@@ -440,91 +1101,89 @@ Value SysFSGPIO::setValue(Value value)
 		// While setting an Input doesn't make any sense, NORMALLY, we want to
 		// allow the user to clear state and have it set itself again, so, we
 		// allow this for anything other than the ABOVE condition...
-		std::ofstream sysfs_value(_sysfsPath + "gpio" + _id_str + "/value", std::ofstream::app);
-		if( !sysfs_value.is_open() )
+		if ((value == Value::LOW) || (value == Value::HIGH))
 		{
-		  throw std::runtime_error("Unable to set value for GPIO " + _id_str);
+			// (The kernel refuses it for an input- EPERM, or EBADF if we could only
+			// open the value file read-only- which is that "doesn't make sense" case,
+			// so it's let go quietly, as it always was...)
+			if ((pwrite(_valueFd, &LEVEL_CHARS[value], 1, 0) != 1) &&
+				!((_direction == Direction::IN) && ((errno == EPERM) || (errno == EBADF))))
+			{
+				_metrics.record_set(start, false);
+				throw std::runtime_error("Unable to set value for GPIO " + _id_str);
+			}
 		}
-		switch(value)
+		else
 		{
-		case Value::LOW :
-			sysfs_value << "0";
-			break;
-
-		case Value::HIGH :
-			sysfs_value << "1";
-			break;
+			retVal = Value::INVALID;
 		}
-		sysfs_value.close();
 	}
 
+	_metrics.record_set(start, (retVal != Value::INVALID));
 	return retVal;
 }
 
 
 /**
-    * @brief Start the run loop for GPIO monitoring
+    * @brief Handle an edge on our GPIO line
     *
-    * This member function will start a loop that will monitor the GPIO line for
-    * changes.  When a change is detected, it will call the callback function
-    * registered with the GPIO line.
+    * Called on the dispatcher's thread when poll() says our value file has
+    * something new.  Reads the value and hands it to whichever callback we
+    * were set up with.
     *
-    * @note If using callbacks, you MUST call stop() to stop the loop.  If you
-    *       don't, the loop will continue to run and your program will not exit
-    *       properly.
+    * @param timestamp When the dispatcher picked the edge up (CLOCK_MONOTONIC, ns)
+    * @param removed Set by the dispatcher if the callback tears us down, in
+    *                which case we're gone by the time it returns
     */
-void SysFSGPIO::run(void)
+void SysFSGPIO::dispatch(uint64_t timestamp, const bool &removed)
 {
 	char buf[MAX_BUF];
-	struct pollfd fdset[1];
 
-	memset((void*)fdset, 0, sizeof(fdset));
-
-	fdset[0].fd     = _fd;
-	fdset[0].events = POLLPRI;
-
-	// Presume it's all properly set up and we're going to go live with callbacks...
-	while (_run)
+	// Got a new value to absorb...
+	ssize_t nbytes = pread(_fd, buf, MAX_BUF, 0);
+	if( nbytes != MAX_BUF )
 	{
-		// Set up a poll() call...
-		int pollRet = poll(fdset, 1, -1);
-		if( 1 == pollRet )
+		// Can't throw from here- it's everybody's thread, not just ours...
+		if( nbytes < 0 )
 		{
-			if(fdset[0].revents & POLLPRI)
-			{
-				// Got a new value to absorb...
-				lseek(fdset[0].fd, 0, SEEK_SET);
-				ssize_t nbytes = read(fdset[0].fd, buf, MAX_BUF);
-				if( nbytes != MAX_BUF ) // See comment above
-				{
-					if( nbytes < 0 )
-					{
-						perror("SysFSGPIO::run()");
-					}
-					throw std::runtime_error("GPIO " + _id_str + " SysFSGPIO::run() badness...");
-				}
+			perror("SysFSGPIO::dispatch()");
+		}
+		return;
+	}
 
-				// Figure out what it is...
-				Value val;
-				switch (buf[0])
-				{
-				case '0' :
-					val = Value::LOW;
-					break;
+	// Figure out what it is...
+	Value val;
+	switch (buf[0])
+	{
+	case '0' :
+		val = Value::LOW;
+		break;
 
-				case '1' :
-					val = Value::HIGH;
-					break;
+	case '1' :
+		val = Value::HIGH;
+		break;
 
-				default :
-					val = Value::INVALID;
-					break;
-				}
+	default :
+		val = Value::INVALID;
+		break;
+	}
 
-				// Call our callback function with the value and possible pointer to data/object.  Call-ee MUST return.
-				_callback(val, _data);
-			}
-		}
+	// SysFS only ever hands us the current level, so each wakeup is one "event".
+	_metrics.record_wakeup(1);
+
+	// Call our callback function with the value and possible pointer to data/object.  Call-ee MUST return.
+	uint64_t start = GPIOMetrics::now_ns();
+	if (_timestampedCallback)
+	{
+		_timestampedCallback(val, timestamp, _data);
+	}
+	else
+	{
+		_callback(val, _data);
+	}
+	if (!removed)
+	{
+		_metrics.record_callback(GPIOMetrics::now_ns() - start);
 	}
 }
 // Dogsbody for the callback engine...
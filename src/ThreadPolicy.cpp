@@ -0,0 +1,249 @@
+
+#include <string>
+using std::string;
+
+#include <errno.h>
+#include <string.h>
+#include <alloca.h>
+#include <sys/mman.h>
+
+#include "ThreadPolicy.hpp"
+#include "GPIODiag.hpp"
+
+// Linux won't take a thread name longer than this (plus the NUL).
+static const size_t MAX_THREAD_NAME = 15;
+
+mutex ThreadPolicy::s_lock;
+thread_policy_t ThreadPolicy::s_default;
+bool ThreadPolicy::s_memory_locked = false;
+
+/**
+ * @brief Touch size bytes of stack below us so the pages are mapped (and,
+ * with mlockall, locked) before the loop needs them.
+ */
+static void __attribute__((noinline)) prefault_stack(size_t size)
+{
+    volatile char *stack = (volatile char *) alloca(size);
+    for (size_t i = 0; i < size; i += 4096)
+    {
+        stack[i] = 0;
+    }
+    stack[size - 1] = 0;
+}
+
+/**
+ * Constructor for ThreadPolicy.
+ *
+ * @param thread_name What to name the loop thread if the policy doesn't.
+ */
+ThreadPolicy::ThreadPolicy(const string &thread_name) :
+    m_thread_name(thread_name), m_has_policy(false), m_thread(0)
+{
+}
+
+/**
+ * @brief Set the default policy for loops that haven't been given their own.
+ */
+void ThreadPolicy::set_default_thread_policy(const thread_policy_t &policy)
+{
+    lock_guard<mutex> lock(s_lock);
+    s_default = policy;
+}
+
+/**
+ * @brief Get the default policy.
+ */
+thread_policy_t ThreadPolicy::get_default_thread_policy()
+{
+    lock_guard<mutex> lock(s_lock);
+    return s_default;
+}
+
+/**
+ * @brief Give this object's loop its own policy.  Applied right away if the
+ * loop is running, otherwise when it's next started.
+ */
+void ThreadPolicy::set_thread_policy(const thread_policy_t &policy)
+{
+    lock_guard<mutex> lock(m_lock);
+    m_policy = policy;
+    m_has_policy = true;
+    if (m_status.bound)
+    {
+        apply(m_policy, false);
+    }
+}
+
+/**
+ * @brief Go back to following the global default (from the next start on).
+ */
+void ThreadPolicy::clear_thread_policy()
+{
+    lock_guard<mutex> lock(m_lock);
+    m_has_policy = false;
+}
+
+/**
+ * @brief The policy this object's loop will run (or is running) under.
+ */
+thread_policy_t ThreadPolicy::get_thread_policy()
+{
+    lock_guard<mutex> lock(m_lock);
+    return effective_policy();
+}
+
+/**
+ * @brief What took the last time the policy was applied.
+ */
+thread_policy_status_t ThreadPolicy::get_thread_policy_status()
+{
+    lock_guard<mutex> lock(m_lock);
+    return m_status;
+}
+
+/**
+ * @brief Our policy, or the default if we don't have one.  Caller holds m_lock.
+ */
+thread_policy_t ThreadPolicy::effective_policy()
+{
+    thread_policy_t retVal;
+
+    if (m_has_policy)
+    {
+        retVal = m_policy;
+    }
+    else
+    {
+        retVal = get_default_thread_policy();
+    }
+
+    if (retVal.name.empty())
+    {
+        retVal.name = m_thread_name;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Apply a policy to the loop thread and record what took.  Caller
+ * holds m_lock.
+ *
+ * @param policy What to apply.
+ * @param self True if we're being called on the loop thread itself.
+ */
+void ThreadPolicy::apply(const thread_policy_t &policy, bool self)
+{
+    thread_policy_status_t status;
+    struct sched_param param;
+    int ret;
+
+    status.bound = true;
+
+    // Scheduling...
+    param.sched_priority = policy.priority;
+    ret = pthread_setschedparam(m_thread, policy.policy, &param);
+    if (ret != 0)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "ThreadPolicy", GPIO_ERR_IO, ret, "Unable to set scheduling for <%s>", policy.name.c_str());
+        status.error = ret;
+    }
+    else
+    {
+        status.scheduling = true;
+    }
+
+    // CPU affinity...
+    if (policy.cpu_mask != 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (unsigned int cpu = 0; (cpu < 64) && (cpu < CPU_SETSIZE); cpu++)
+        {
+            if (policy.cpu_mask & (1ULL << cpu))
+            {
+                CPU_SET(cpu, &cpus);
+            }
+        }
+        ret = pthread_setaffinity_np(m_thread, sizeof(cpus), &cpus);
+        if (ret != 0)
+        {
+            GPIO_DIAG(GPIO_LOG_ERROR, "ThreadPolicy", GPIO_ERR_IO, ret, "Unable to set CPU affinity for <%s>", policy.name.c_str());
+            status.error = (status.error == 0) ? ret : status.error;
+        }
+        else
+        {
+            status.affinity = true;
+        }
+    }
+
+    // Memory locking is for the whole process, so we only ever do it once.
+    if (policy.lock_memory)
+    {
+        lock_guard<mutex> lock(s_lock);
+        if (!s_memory_locked)
+        {
+            if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+            {
+                // The diag can step on errno, so hang on to it first.
+                int error = errno;
+                GPIO_DIAG(GPIO_LOG_ERROR, "ThreadPolicy", GPIO_ERR_IO, error, "Unable to lock memory");
+                status.error = (status.error == 0) ? error : status.error;
+            }
+            else
+            {
+                s_memory_locked = true;
+            }
+        }
+        status.memory_locked = s_memory_locked;
+    }
+
+    // Only the thread can touch its own stack.
+    if ((policy.prefault_stack > 0) && self)
+    {
+        prefault_stack(policy.prefault_stack);
+        status.stack_prefaulted = true;
+    }
+    else
+    {
+        status.stack_prefaulted = m_status.stack_prefaulted;
+    }
+
+    // And a name, so it can be picked out in top/ps/perf.
+    if (!policy.name.empty())
+    {
+        ret = pthread_setname_np(m_thread, policy.name.substr(0, MAX_THREAD_NAME).c_str());
+        if (ret != 0)
+        {
+            status.error = (status.error == 0) ? ret : status.error;
+        }
+        else
+        {
+            status.named = true;
+        }
+    }
+
+    m_status = status;
+}
+
+/**
+ * Constructor for ThreadPolicy::Binding.  Applies the owner's policy to the
+ * calling (loop) thread.
+ */
+ThreadPolicy::Binding::Binding(ThreadPolicy &owner) :
+    m_owner(owner)
+{
+    lock_guard<mutex> lock(m_owner.m_lock);
+    m_owner.m_thread = pthread_self();
+    m_owner.apply(m_owner.effective_policy(), true);
+}
+
+/**
+ * Destructor for ThreadPolicy::Binding.  The loop's on its way out, so stop
+ * pointing at its thread.
+ */
+ThreadPolicy::Binding::~Binding()
+{
+    lock_guard<mutex> lock(m_owner.m_lock);
+    m_owner.m_status.bound = false;
+}
@@ -0,0 +1,624 @@
+
+#include <string>
+using std::string;
+
+#include <cmath>
+
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/timerfd.h>
+
+#include "WaveformEngine.hpp"
+#include "GPIODiag.hpp"
+#include "GPIOMetrics.hpp"
+
+/**
+ * Constructor for WaveformEngine.  The timing thread isn't started until
+ * the first channel is added.
+ */
+WaveformEngine::WaveformEngine() :
+    LoopThread("WaveformEngine"),
+    m_next_schedule_id(1), m_next_id(0)
+{
+    m_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timer_fd < 0)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "WaveformEngine", GPIO_ERR_IO, errno, "Failed to create timer");
+    }
+
+    // We gather up at most one write per request per pass, so this is
+    // plenty to keep the timing thread from allocating in the common case.
+    m_writes.reserve(16);
+    m_due.reserve(64);
+    reset_stats();
+}
+
+/**
+ * Destructor for WaveformEngine.  Stops the timing thread.  Lines are left
+ * wherever the waveforms last put them.
+ */
+WaveformEngine::~WaveformEngine()
+{
+    stop_loop();
+
+    if (m_timer_fd >= 0)
+    {
+        close(m_timer_fd);
+    }
+}
+
+/**
+ * @brief Start PWM on a single line.
+ *
+ * @param request The request holding the line, already configured as output.
+ * @param offset The line's offset on the chip.
+ * @param period_ns The PWM period.
+ * @param duty The duty cycle, 0.0 - 1.0.
+ * @return The channel id, or -1 on failure.
+ */
+int WaveformEngine::add_pwm(GPIOLineRequest *request, unsigned int offset, uint64_t period_ns, double duty)
+{
+    int retVal = -1;
+    uint64_t mask = (request != nullptr) ? request->get_mask(offset) : 0;
+
+    if (mask == 0)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "WaveformEngine", GPIO_ERR_NO_LINE, 0, "Line %u is not part of the request", offset);
+    }
+    else
+    {
+        retVal = add_waveform(request, mask, pwm_steps(mask, period_ns, duty));
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Start PWM on a KernelGPIO line.  It needs to be configured as an output.
+ */
+int WaveformEngine::add_pwm(KernelGPIO &gpio, uint64_t period_ns, double duty)
+{
+    return add_pwm(gpio.get_line_request(), gpio.get_line(), period_ns, duty);
+}
+
+/**
+ * @brief Start playing an arbitrary sequence of steps.
+ *
+ * @param request The request holding the lines, already configured as outputs.
+ * @param mask Bitmask by request index of the lines this channel drives.
+ * @param steps The values to drive and how long to hold each.
+ * @param repeat How many times to play the sequence.  0 is forever.
+ * @return The channel id, or -1 on failure.
+ */
+int WaveformEngine::add_waveform(GPIOLineRequest *request, uint64_t mask, const vector<waveform_step_t> &steps, size_t repeat)
+{
+    int retVal = -1;
+    uint64_t total_ns = 0;
+
+    for (auto &step : steps)
+    {
+        total_ns += step.duration_ns;
+    }
+
+    if ((request == nullptr) || (mask == 0))
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "WaveformEngine", GPIO_ERR_INVALID, 0, "No lines to drive");
+    }
+    else if (total_ns == 0)
+    {
+        // A sequence that takes no time at all would have us spinning forever.
+        GPIO_DIAG(GPIO_LOG_ERROR, "WaveformEngine", GPIO_ERR_INVALID, 0, "Waveform has no duration");
+    }
+    else
+    {
+        channel_t channel;
+        channel.request = request;
+        channel.mask = mask;
+        channel.steps = steps;
+        channel.has_pending = false;
+        channel.step = 0;
+        channel.repeat = repeat;
+        channel.active = true;
+        retVal = add_channel(channel);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Change the period and duty cycle of a PWM channel.
+ *
+ * The change is picked up at the end of the current period.
+ *
+ * @return false if there's no such channel.
+ */
+bool WaveformEngine::set_pwm(int channel, uint64_t period_ns, double duty)
+{
+    bool retVal = false;
+
+    if (period_ns == 0)
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "WaveformEngine", GPIO_ERR_INVALID, 0, "PWM period can't be zero");
+    }
+    else
+    {
+        lock_guard<mutex> lock(m_lock);
+        channel_t *ch = find_channel(channel);
+        if (ch != nullptr)
+        {
+            ch->pending = pwm_steps(ch->mask, period_ns, duty);
+            ch->has_pending = true;
+            retVal = true;
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Stop playing a channel.
+ *
+ * @return false if there's no such channel.
+ */
+bool WaveformEngine::remove_channel(int channel)
+{
+    bool retVal = false;
+
+    lock_guard<mutex> lock(m_lock);
+    for (auto it = m_channels.begin(); it != m_channels.end(); ++it)
+    {
+        if (it->id == channel)
+        {
+            m_channels.erase(it);
+            retVal = true;
+            break;
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Check whether a channel is still playing.
+ */
+bool WaveformEngine::is_active(int channel)
+{
+    lock_guard<mutex> lock(m_lock);
+    channel_t *ch = find_channel(channel);
+    return (ch != nullptr) && ch->active;
+}
+
+/**
+ * @brief Get the timing statistics gathered so far.
+ */
+waveform_stats_t WaveformEngine::get_stats()
+{
+    lock_guard<mutex> lock(m_lock);
+    waveform_stats_t retVal = m_stats;
+
+    if (retVal.wakeups > 0)
+    {
+        double mean = m_late_sum / retVal.wakeups;
+        double variance = (m_late_sum_sq / retVal.wakeups) - (mean * mean);
+        retVal.mean_late_ns = mean;
+        retVal.stddev_late_ns = (variance > 0.0) ? sqrt(variance) : 0.0;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Clear the timing statistics.
+ */
+void WaveformEngine::reset_stats()
+{
+    lock_guard<mutex> lock(m_lock);
+    m_stats = waveform_stats_t();
+    m_late_sum = 0.0;
+    m_late_sum_sq = 0.0;
+}
+
+/**
+ * @brief Run the timing thread SCHED_FIFO at this priority, or back at
+ * normal priority for 0.  Applied right away if the thread's running.
+ */
+void WaveformEngine::set_realtime(int priority)
+{
+    thread_policy_t policy = get_thread_policy();
+
+    policy.policy = (priority > 0) ? SCHED_FIFO : SCHED_OTHER;
+    policy.priority = (priority > 0) ? priority : 0;
+    set_thread_policy(policy);
+}
+
+/**
+ * @brief Is the timing thread running SCHED_FIFO/RR right now?
+ */
+bool WaveformEngine::is_realtime()
+{
+    thread_policy_t policy = get_thread_policy();
+    thread_policy_status_t status = get_thread_policy_status();
+
+    return status.bound && status.scheduling && (policy.policy != SCHED_OTHER);
+}
+
+/**
+ * @brief The timing loop.
+ *
+ * Each pass arms the timerfd for the earliest channel deadline (absolute,
+ * so time spent in the pass doesn't accumulate as drift), waits for it or
+ * for a wakeup, then plays one step of every channel that's due.  All the
+ * steps due on the same request go out in one bulk write.
+ */
+void WaveformEngine::run()
+{
+    ThreadPolicy::Binding policy(*this);
+    struct pollfd fds[2];
+
+    fds[0].fd = m_timer_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = m_wake.get_fd();
+    fds[1].events = POLLIN;
+
+    while (_run)
+    {
+        bool have_deadline = false;
+        uint64_t deadline = 0;
+        struct itimerspec its = {};
+
+        // When's the next thing due?
+        {
+            lock_guard<mutex> lock(m_lock);
+            for (auto &ch : m_channels)
+            {
+                if (ch.active && (!have_deadline || (ch.deadline_ns < deadline)))
+                {
+                    deadline = ch.deadline_ns;
+                    have_deadline = true;
+                }
+            }
+            if (!m_schedule.empty() && (!have_deadline || (m_schedule.top().when_ns < deadline)))
+            {
+                deadline = m_schedule.top().when_ns;
+                have_deadline = true;
+            }
+        }
+
+        // Arm (or disarm, with a zero value) the timer and wait on it.
+        if (have_deadline)
+        {
+            // A zero it_value disarms- make sure "right now" isn't taken that way.
+            its.it_value.tv_sec = deadline / 1000000000ULL;
+            its.it_value.tv_nsec = deadline % 1000000000ULL;
+            if ((its.it_value.tv_sec == 0) && (its.it_value.tv_nsec == 0))
+            {
+                its.it_value.tv_nsec = 1;
+            }
+        }
+        timerfd_settime(m_timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno != EINTR)
+            {
+                GPIO_DIAG(GPIO_LOG_ERROR, "WaveformEngine", GPIO_ERR_IO, errno, "Failed to wait on timer");
+            }
+            continue;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            m_wake.clear();
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            uint64_t expirations;
+            if (read(m_timer_fd, &expirations, sizeof(expirations)) < 0)
+            {
+                // EAGAIN- raced with a re-arm, nothing to soak up.
+            }
+        }
+
+        uint64_t now = GPIOMetrics::now_ns();
+
+        lock_guard<mutex> lock(m_lock);
+
+        if (have_deadline && (now >= deadline))
+        {
+            record_lateness(now - deadline);
+        }
+
+        // Play one step of everything that's due...
+        m_writes.clear();
+        for (auto &ch : m_channels)
+        {
+            if (ch.active && (ch.deadline_ns <= now))
+            {
+                const waveform_step_t &step = ch.steps[ch.step];
+
+                // Merge into the write for this request, or start one.
+                write_t *write = find_write(ch.request);
+                if (write == nullptr)
+                {
+                    m_writes.push_back({ ch.request, 0, 0, false, 0 });
+                    write = &m_writes.back();
+                }
+                write->mask |= ch.mask;
+                write->values = (write->values & ~ch.mask) | (step.values & ch.mask);
+
+                // Next deadline is relative to the last one, not to now.
+                ch.deadline_ns += step.duration_ns;
+
+                // On to the next step, wrapping/finishing at the end of the sequence.
+                ch.step++;
+                if (ch.step >= ch.steps.size())
+                {
+                    ch.step = 0;
+                    if (ch.has_pending)
+                    {
+                        ch.steps.swap(ch.pending);
+                        ch.has_pending = false;
+                    }
+                    if ((ch.repeat > 0) && (--ch.repeat == 0))
+                    {
+                        ch.active = false;
+                    }
+                }
+
+                // If we've fallen a whole step behind, don't try to catch up
+                // with a burst of back to back writes- just pick it up from here.
+                if (ch.active && (ch.deadline_ns < now))
+                {
+                    ch.deadline_ns = now;
+                    m_stats.overruns++;
+                }
+            }
+        }
+
+        // ...and every scheduled change that's due, in time order, so a
+        // later change to a line wins over an earlier one in the same pass...
+        m_due.clear();
+        while (!m_schedule.empty() && (m_schedule.top().when_ns <= now))
+        {
+            const scheduled_t &entry = m_schedule.top();
+
+            write_t *write = find_write(entry.request);
+            if (write == nullptr)
+            {
+                m_writes.push_back({ entry.request, 0, 0, false, 0 });
+                write = &m_writes.back();
+            }
+            write->mask |= entry.mask;
+            write->values = (write->values & ~entry.mask) | (entry.values & entry.mask);
+
+            m_due.push_back(entry);
+            m_schedule.pop();
+        }
+
+        // ...and push it all out, one bulk write per request.
+        for (auto &w : m_writes)
+        {
+            w.ok = w.request->set_values(w.mask, w.values);
+            w.done_ns = GPIOMetrics::now_ns();
+            if (w.ok)
+            {
+                m_stats.writes++;
+            }
+        }
+
+        // How close did the scheduled changes come?
+        for (auto &entry : m_due)
+        {
+            const write_t *write = find_write(entry.request);
+            schedule_result_t result;
+
+            result.id = entry.id;
+            result.requested_ns = entry.when_ns;
+            result.actual_ns = write->done_ns;
+            result.error_ns = (int64_t) (write->done_ns - entry.when_ns);
+            result.ok = write->ok;
+
+            if (m_results.size() >= MAX_SCHEDULE_RESULTS)
+            {
+                m_results.pop_front();
+            }
+            m_results.push_back(result);
+        }
+    }
+}
+
+/**
+ * @brief Schedule a change to some of a request's lines.
+ *
+ * @param request The request holding the lines, already configured as outputs.
+ * @param when_ns When to make the change, CLOCK_MONOTONIC.  Times already
+ *        past are applied right away (and show up late in the results).
+ * @param mask Bitmask by request index of the lines to change.
+ * @param values Bitmask by request index of what to drive them to.
+ * @return The change's id, 0 on failure.
+ */
+uint64_t WaveformEngine::schedule(GPIOLineRequest *request, uint64_t when_ns, uint64_t mask, uint64_t values)
+{
+    uint64_t retVal = 0;
+
+    if ((request == nullptr) || (mask == 0))
+    {
+        GPIO_DIAG(GPIO_LOG_ERROR, "WaveformEngine", GPIO_ERR_INVALID, 0, "Nothing to schedule");
+    }
+    else
+    {
+        lock_guard<mutex> lock(m_lock);
+
+        retVal = m_next_schedule_id++;
+        m_schedule.push({ retVal, when_ns, request, mask, values });
+
+        // Only bother the timing thread if this is the new soonest thing.
+        if (!isRunning())
+        {
+            start();
+        }
+        else if (m_schedule.top().id == retVal)
+        {
+            m_wake.signal();
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Schedule a change to a KernelGPIO line.  It needs to be configured as an output.
+ */
+uint64_t WaveformEngine::schedule(KernelGPIO &gpio, uint64_t when_ns, bool value)
+{
+    GPIOLineRequest *request = gpio.get_line_request();
+    uint64_t mask = (request != nullptr) ? request->get_mask(gpio.get_line()) : 0;
+
+    return schedule(request, when_ns, mask, value ? mask : 0);
+}
+
+/**
+ * @brief How many scheduled changes are still waiting.
+ */
+size_t WaveformEngine::scheduled_count()
+{
+    lock_guard<mutex> lock(m_lock);
+    return m_schedule.size();
+}
+
+/**
+ * @brief Drop every scheduled change that hasn't happened yet.
+ */
+void WaveformEngine::clear_schedule()
+{
+    lock_guard<mutex> lock(m_lock);
+    m_schedule = priority_queue<scheduled_t, vector<scheduled_t>, scheduled_later_t>();
+    m_wake.signal();
+}
+
+/**
+ * @brief Hand over the results of the changes applied since the last call.
+ *
+ * @param results Appended to.
+ * @return How many results were added.
+ */
+size_t WaveformEngine::take_schedule_results(vector<schedule_result_t> &results)
+{
+    lock_guard<mutex> lock(m_lock);
+    size_t retVal = m_results.size();
+
+    results.insert(results.end(), m_results.begin(), m_results.end());
+    m_results.clear();
+
+    return retVal;
+}
+
+/**
+ * @brief Add a fully set up channel and make sure the timing thread is going.
+ */
+int WaveformEngine::add_channel(channel_t &channel)
+{
+    lock_guard<mutex> lock(m_lock);
+
+    channel.id = m_next_id++;
+    channel.deadline_ns = GPIOMetrics::now_ns();
+    m_channels.push_back(channel);
+
+    if (!isRunning())
+    {
+        start();
+    }
+    else
+    {
+        m_wake.signal();
+    }
+
+    return channel.id;
+}
+
+/**
+ * @brief Find this pass's write for a request.  Caller holds m_lock.
+ */
+WaveformEngine::write_t *WaveformEngine::find_write(GPIOLineRequest *request)
+{
+    write_t *retVal = nullptr;
+
+    for (auto &w : m_writes)
+    {
+        if (w.request == request)
+        {
+            retVal = &w;
+            break;
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Find a channel by id.  Caller holds m_lock.
+ */
+WaveformEngine::channel_t *WaveformEngine::find_channel(int id)
+{
+    channel_t *retVal = nullptr;
+
+    for (auto &ch : m_channels)
+    {
+        if (ch.id == id)
+        {
+            retVal = &ch;
+            break;
+        }
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Fold one wakeup's lateness into the statistics.  Caller holds m_lock.
+ */
+void WaveformEngine::record_lateness(int64_t late_ns)
+{
+    if ((m_stats.wakeups == 0) || (late_ns < m_stats.min_late_ns))
+    {
+        m_stats.min_late_ns = late_ns;
+    }
+    if ((m_stats.wakeups == 0) || (late_ns > m_stats.max_late_ns))
+    {
+        m_stats.max_late_ns = late_ns;
+    }
+    m_stats.wakeups++;
+    m_late_sum += late_ns;
+    m_late_sum_sq += (double) late_ns * late_ns;
+}
+
+/**
+ * @brief Build the steps for one period of PWM.
+ *
+ * 0% and 100% duty are a single steady step so we don't emit zero width
+ * pulses.
+ */
+vector<waveform_step_t> WaveformEngine::pwm_steps(uint64_t mask, uint64_t period_ns, double duty)
+{
+    vector<waveform_step_t> retVal;
+
+    if (duty <= 0.0)
+    {
+        retVal.push_back({ 0, period_ns });
+    }
+    else if (duty >= 1.0)
+    {
+        retVal.push_back({ mask, period_ns });
+    }
+    else
+    {
+        uint64_t high_ns = (uint64_t) (period_ns * duty);
+        retVal.push_back({ mask, high_ns });
+        retVal.push_back({ 0, period_ns - high_ns });
+    }
+
+    return retVal;
+}
@@ -0,0 +1,22 @@
+/*
+    Convert an EdgeCapture log into a VCD for viewing in GTKWave and friends.
+
+    Usage: cap2vcd <capture file> <vcd file>
+*/
+
+#include <iostream>
+using std::cout;
+using std::endl;
+
+#include "EdgeCapture.hpp"
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        cout << "Usage: " << argv[0] << " <capture file> <vcd file>" << endl;
+        return 1;
+    }
+
+    return EdgeCapture::convert_to_vcd(argv[1], argv[2]) ? 0 : 1;
+}